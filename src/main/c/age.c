@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <windows.h>
+#include "age.h"
+#include "format.h"
+#include "output.h"
+
+#define FILE_TIME_UNITS_PER_DAY (10000000ULL * 60 * 60 * 24)
+#define DAYS_PER_WEEK 7
+#define DAYS_PER_YEAR 365
+#define AGE_LABEL_CAPACITY 32
+
+static const unsigned long *boundaries;
+static size_t bucketBoundaryCount = 0;
+/* A file written at or after cutoffs[i] is younger than boundaries[i]. */
+static uint64_t cutoffs[MAX_AGE_BOUNDARIES];
+
+static const wchar_t *formatDays(unsigned long days, wchar_t *buffer, size_t capacity);
+static const wchar_t *formatBucketLabel(size_t bucket, wchar_t *buffer, size_t capacity);
+
+/* Ages are measured from the time this is called, so that a scan that
+   takes hours still puts every file in the same buckets. */
+void initAgeBuckets(const unsigned long *boundaryDays, size_t boundaryCount)
+{
+    FILETIME now;
+    uint64_t nowValue;
+    uint64_t age;
+    size_t i;
+
+    GetSystemTimeAsFileTime(&now);
+    nowValue = ((uint64_t) now.dwHighDateTime << 32) | now.dwLowDateTime;
+    boundaries = boundaryDays;
+    bucketBoundaryCount = boundaryCount;
+    for (i = 0; i < boundaryCount; i++) {
+        age = boundaryDays[i] * FILE_TIME_UNITS_PER_DAY;
+        cutoffs[i] = age < nowValue ? nowValue - age : 0;
+    }
+}
+
+size_t getAgeBucket(uint64_t lastWriteTime)
+{
+    size_t bucket = 0;
+
+    while (bucket < bucketBoundaryCount && lastWriteTime < cutoffs[bucket]) {
+        bucket++;
+    }
+    return bucket;
+}
+
+/* Local time, to the minute, like GNU du --time. */
+const wchar_t *formatFileTime(uint64_t time, wchar_t *buffer, size_t capacity)
+{
+    FILETIME fileTime;
+    FILETIME localTime;
+    SYSTEMTIME systemTime;
+
+    fileTime.dwLowDateTime = (DWORD) time;
+    fileTime.dwHighDateTime = (DWORD) (time >> 32);
+    if (time == 0 || !FileTimeToLocalFileTime(&fileTime, &localTime)
+            || !FileTimeToSystemTime(&localTime, &systemTime)) {
+        _snwprintf(buffer, capacity, L"-");
+    } else {
+        _snwprintf(buffer, capacity, L"%04u-%02u-%02u %02u:%02u",
+                systemTime.wYear, systemTime.wMonth, systemTime.wDay,
+                systemTime.wHour, systemTime.wMinute);
+    }
+    buffer[capacity - 1] = L'\0';
+    return buffer;
+}
+
+static const wchar_t *formatDays(unsigned long days, wchar_t *buffer, size_t capacity)
+{
+    if (days % DAYS_PER_YEAR == 0) {
+        _snwprintf(buffer, capacity, L"%luy", days / DAYS_PER_YEAR);
+    } else if (days % DAYS_PER_WEEK == 0) {
+        _snwprintf(buffer, capacity, L"%luw", days / DAYS_PER_WEEK);
+    } else {
+        _snwprintf(buffer, capacity, L"%lud", days);
+    }
+    buffer[capacity - 1] = L'\0';
+    return buffer;
+}
+
+static const wchar_t *formatBucketLabel(size_t bucket, wchar_t *buffer, size_t capacity)
+{
+    wchar_t low[AGE_LABEL_CAPACITY];
+    wchar_t high[AGE_LABEL_CAPACITY];
+
+    if (bucket == 0) {
+        _snwprintf(buffer, capacity, L"< %ls", formatDays(boundaries[0], high, AGE_LABEL_CAPACITY));
+    } else if (bucket == bucketBoundaryCount) {
+        _snwprintf(buffer, capacity, L">= %ls", formatDays(boundaries[bucket - 1], low, AGE_LABEL_CAPACITY));
+    } else {
+        _snwprintf(buffer, capacity, L"%ls to < %ls",
+                formatDays(boundaries[bucket - 1], low, AGE_LABEL_CAPACITY),
+                formatDays(boundaries[bucket], high, AGE_LABEL_CAPACITY));
+    }
+    buffer[capacity - 1] = L'\0';
+    return buffer;
+}
+
+void printAgeTable(const int64_t *ageBytes, const wchar_t *path)
+{
+    wchar_t label[AGE_LABEL_CAPACITY];
+    wchar_t sizeText[SIZE_TEXT_CAPACITY];
+    int64_t totalBytes = 0;
+    size_t i;
+
+    for (i = 0; i <= bucketBoundaryCount; i++) {
+        totalBytes += ageBytes[i];
+    }
+    writeOutput(L"Last modified in %ls:\n", path);
+    writeOutput(L"  %-17ls %12ls %6ls\n", L"Age", L"Total", L"%");
+    for (i = 0; i <= bucketBoundaryCount; i++) {
+        formatFileSize(ageBytes[i], sizeText, SIZE_TEXT_CAPACITY);
+        writeOutput(L"  %-17ls %12ls %5.1f%%\n", formatBucketLabel(i, label, AGE_LABEL_CAPACITY),
+                sizeText, totalBytes > 0 ? 100.0 * ageBytes[i] / totalBytes : 0.0);
+    }
+    fflush(stdout);
+}
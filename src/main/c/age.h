@@ -0,0 +1,21 @@
+#ifndef AGE_H_EDCRFV
+#define AGE_H_EDCRFV
+
+#include <stdint.h>
+#include <stddef.h>     /* size_t */
+#include <wchar.h>
+
+/* Ages are given as up to this many boundaries, in days, each larger than
+   the one before. Bucket 0 holds files younger than the first boundary and
+   the last bucket holds files older than the last one. */
+#define MAX_AGE_BOUNDARIES 8
+#define AGE_BUCKET_COUNT (MAX_AGE_BOUNDARIES + 1)
+#define DEFAULT_AGE_BOUNDARIES "1y,3y,5y"
+#define FILE_TIME_TEXT_CAPACITY 32
+
+extern void initAgeBuckets(const unsigned long *boundaryDays, size_t boundaryCount);
+extern size_t getAgeBucket(uint64_t lastWriteTime);
+extern const wchar_t *formatFileTime(uint64_t time, wchar_t *buffer, size_t capacity);
+extern void printAgeTable(const int64_t *ageBytes, const wchar_t *path);
+
+#endif
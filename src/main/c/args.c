@@ -2,11 +2,18 @@
 #include <stdlib.h>
 #include <stddef.h>
 #include <stdbool.h>
+#include <ctype.h>      /* isdigit */
 #include <wchar.h>
 #include <windows.h>
 #include "args.h"
 #include "string.h"
 #include "help.h"
+#include "estimate.h"
+#include "serve.h"
+#include "pool.h"
+#include "prefetch.h"
+#include "checkpoint.h"
+#include "shard.h"
 
 /* If Microsoft's C compiler is being used, then include the local getopt.h
    because Microsoft does not provide one. Otherwise include the system
@@ -21,8 +28,82 @@ bool displayRegularFilesAlso = false;
 bool displayBytes = false;
 bool summarize = false;
 bool humanReadable = false;
+bool dereference = false;
+bool oneFileSystem = false;
+unsigned long maxErrors = 0;    /* 0 means no limit */
+bool quietErrors = false;
+bool showProgress = false;
+bool showHistogram = false;
+bool byExtension = false;
+unsigned long ageBoundaries[MAX_AGE_BOUNDARIES];    /* In days */
+size_t ageBoundaryCount = 0;    /* 0 means no --by-age */
+bool showTime = false;
+bool byOwner = false;
+bool serveMode = false;
+const wchar_t *queryKind = NULL;      /* NULL unless --query */
+unsigned long queryCount = DEFAULT_TOP_COUNT;
+const wchar_t *pipeName = NULL;       /* NULL means DEFAULT_PIPE_NAME */
+const wchar_t *filesFrom = NULL;      /* NULL unless --files-from or --files0-from */
+char filesFromDelimiter = '\n';
+unsigned long threadCount = 0;        /* 0 means one per processor */
+bool physicalOrder = false;           /* --order=physical */
+unsigned long prefetchDepth = 0;      /* 0 means no directories are read ahead */
+bool showStats = false;
+bool countInodes = false;            /* --inodes */
+unsigned long estimateSeconds = 0;    /* 0 means an exact scan */
+unsigned long deadlineSeconds = 0;    /* 0 means no deadline */
+const wchar_t *checkpointPath = NULL; /* NULL unless --checkpoint or --resume */
+bool resumeFromCheckpoint = false;
+unsigned long checkpointSeconds = DEFAULT_CHECKPOINT_SECONDS;
+unsigned long shardIndex = 0;         /* From 1 */
+unsigned long shardCount = 0;         /* 0 unless --shard */
+unsigned long splitDepth = DEFAULT_SPLIT_DEPTH;
+const wchar_t *partialPath = NULL;    /* NULL unless --partial */
+bool mergeMode = false;
+PatternSet *excludePatterns;
+PatternSet *includePatterns;
 
-static const wchar_t *programName;
+/* Options that only have a long form get codes beyond any character. */
+enum LongOnlyOption {
+    OPTION_MAX_ERRORS = 256,
+    OPTION_QUIET_ERRORS,
+    OPTION_EXCLUDE,
+    OPTION_EXCLUDE_FROM,
+    OPTION_INCLUDE,
+    OPTION_ESTIMATE,
+    OPTION_DEADLINE,
+    OPTION_PROGRESS,
+    OPTION_HISTOGRAM,
+    OPTION_BY_EXTENSION,
+    OPTION_BY_AGE,
+    OPTION_TIME,
+    OPTION_BY_OWNER,
+    OPTION_SERVE,
+    OPTION_QUERY,
+    OPTION_PIPE,
+    OPTION_FILES_FROM,
+    OPTION_FILES0_FROM,
+    OPTION_THREADS,
+    OPTION_ORDER,
+    OPTION_PREFETCH,
+    OPTION_STATS,
+    OPTION_INODES,
+    OPTION_CHECKPOINT,
+    OPTION_CHECKPOINT_INTERVAL,
+    OPTION_RESUME,
+    OPTION_SHARD,
+    OPTION_SPLIT_DEPTH,
+    OPTION_PARTIAL,
+    OPTION_MERGE
+};
+
+static unsigned long parseCount(const char *optionName, const char *value);
+static unsigned long parseDuration(const char *optionName, const char *value);
+static void parseAgeBoundaries(const char *optionName, const char *value);
+static void parseQuery(const char *optionName, const char *value);
+static void parseOrder(const char *optionName, const char *value);
+static void parseShard(const char *optionName, const char *value);
+static void invalidArgument(const char *optionName, const char *value);
 
 List *setSwitches(int argc, const wchar_t *argv[])
 {
@@ -35,17 +116,53 @@ List *setSwitches(int argc, const wchar_t *argv[])
         {"bytes",          no_argument, NULL, 'b'},
         {"summarize",      no_argument, NULL, 's'},
         {"human-readable", no_argument, NULL, 'h'},
+        {"dereference",    no_argument, NULL, 'L'},
+        {"one-file-system", no_argument, NULL, 'x'},
+        {"max-errors",     required_argument, NULL, OPTION_MAX_ERRORS},
+        {"quiet-errors",   no_argument, NULL, OPTION_QUIET_ERRORS},
+        {"exclude",        required_argument, NULL, OPTION_EXCLUDE},
+        {"exclude-from",   required_argument, NULL, OPTION_EXCLUDE_FROM},
+        {"include",        required_argument, NULL, OPTION_INCLUDE},
+        {"estimate",       optional_argument, NULL, OPTION_ESTIMATE},
+        {"deadline",       required_argument, NULL, OPTION_DEADLINE},
+        {"progress",       no_argument, NULL, OPTION_PROGRESS},
+        {"histogram",      no_argument, NULL, OPTION_HISTOGRAM},
+        {"by-extension",   no_argument, NULL, OPTION_BY_EXTENSION},
+        {"by-age",         optional_argument, NULL, OPTION_BY_AGE},
+        {"time",           no_argument, NULL, OPTION_TIME},
+        {"by-owner",       no_argument, NULL, OPTION_BY_OWNER},
+        {"serve",          no_argument, NULL, OPTION_SERVE},
+        {"query",          required_argument, NULL, OPTION_QUERY},
+        {"pipe",           required_argument, NULL, OPTION_PIPE},
+        {"files-from",     required_argument, NULL, OPTION_FILES_FROM},
+        {"files0-from",    required_argument, NULL, OPTION_FILES0_FROM},
+        {"threads",        required_argument, NULL, OPTION_THREADS},
+        {"order",          required_argument, NULL, OPTION_ORDER},
+        {"prefetch",       optional_argument, NULL, OPTION_PREFETCH},
+        {"stats",          no_argument, NULL, OPTION_STATS},
+        {"inodes",         no_argument, NULL, OPTION_INODES},
+        {"checkpoint",     required_argument, NULL, OPTION_CHECKPOINT},
+        {"checkpoint-interval", required_argument, NULL, OPTION_CHECKPOINT_INTERVAL},
+        {"resume",         required_argument, NULL, OPTION_RESUME},
+        {"shard",          required_argument, NULL, OPTION_SHARD},
+        {"split-depth",    required_argument, NULL, OPTION_SPLIT_DEPTH},
+        {"partial",        required_argument, NULL, OPTION_PARTIAL},
+        {"merge",          no_argument, NULL, OPTION_MERGE},
         {0,                0,           0,     0 }
     };
     int optionIndex = 0;
     const int END_OF_OPTIONS = -1;
     char **arguments;
+    const wchar_t *resumePath = NULL;
+    int optionCount = 0;
     /* optind - system sets to index of next argument in argv. */
 
-    programName = argv[0];
     arguments = convertAllToUtf8(argc, argv);
+    excludePatterns = initPatternSet();
+    includePatterns = initPatternSet();
 
-    while ((optionChar = getopt_long(argc, arguments, "?vabsh", longOptions, &optionIndex)) != END_OF_OPTIONS) {
+    while ((optionChar = getopt_long(argc, arguments, "?vabshLx", longOptions, &optionIndex)) != END_OF_OPTIONS) {
+        optionCount++;
         switch (optionChar) {
         case '?':
             usage();
@@ -67,6 +184,114 @@ List *setSwitches(int argc, const wchar_t *argv[])
         case 'h':
             humanReadable = true;
             break;
+        case 'L':
+            dereference = true;
+            break;
+        case 'x':
+            oneFileSystem = true;
+            break;
+        case OPTION_MAX_ERRORS:
+            maxErrors = parseCount("max-errors", optarg);
+            break;
+        case OPTION_QUIET_ERRORS:
+            quietErrors = true;
+            break;
+        case OPTION_EXCLUDE:
+            addPattern(excludePatterns, convertFromUtf8(optarg));
+            break;
+        case OPTION_EXCLUDE_FROM:
+            addPatternsFromFile(excludePatterns, convertFromUtf8(optarg));
+            break;
+        case OPTION_INCLUDE:
+            addPattern(includePatterns, convertFromUtf8(optarg));
+            break;
+        case OPTION_ESTIMATE:
+            estimateSeconds = optarg == NULL ? DEFAULT_ESTIMATE_SECONDS : parseCount("estimate", optarg);
+            if (estimateSeconds == 0) {
+                fwprintf(stderr, L"%ls: ERROR with arguments: --estimate needs at least 1 second\n", programName);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPTION_DEADLINE:
+            deadlineSeconds = parseDuration("deadline", optarg);
+            break;
+        case OPTION_PROGRESS:
+            showProgress = true;
+            break;
+        case OPTION_HISTOGRAM:
+            showHistogram = true;
+            break;
+        case OPTION_BY_EXTENSION:
+            byExtension = true;
+            break;
+        case OPTION_BY_AGE:
+            parseAgeBoundaries("by-age", optarg == NULL ? DEFAULT_AGE_BOUNDARIES : optarg);
+            break;
+        case OPTION_TIME:
+            showTime = true;
+            break;
+        case OPTION_BY_OWNER:
+            byOwner = true;
+            break;
+        case OPTION_SERVE:
+            serveMode = true;
+            break;
+        case OPTION_QUERY:
+            parseQuery("query", optarg);
+            break;
+        case OPTION_PIPE:
+            pipeName = convertFromUtf8(optarg);
+            break;
+        case OPTION_FILES_FROM:
+            filesFrom = convertFromUtf8(optarg);
+            filesFromDelimiter = '\n';
+            break;
+        case OPTION_FILES0_FROM:
+            filesFrom = convertFromUtf8(optarg);
+            filesFromDelimiter = '\0';
+            break;
+        case OPTION_THREADS:
+            threadCount = parseCount("threads", optarg);
+            if (threadCount == 0) {
+                invalidArgument("threads", optarg);
+            }
+            break;
+        case OPTION_ORDER:
+            parseOrder("order", optarg);
+            break;
+        case OPTION_PREFETCH:
+            prefetchDepth = optarg == NULL ? DEFAULT_PREFETCH_DEPTH : parseCount("prefetch", optarg);
+            break;
+        case OPTION_STATS:
+            showStats = true;
+            break;
+        case OPTION_INODES:
+            countInodes = true;
+            break;
+        case OPTION_CHECKPOINT:
+            checkpointPath = convertFromUtf8(optarg);
+            break;
+        case OPTION_CHECKPOINT_INTERVAL:
+            checkpointSeconds = parseDuration("checkpoint-interval", optarg);
+            break;
+        case OPTION_RESUME:
+            resumePath = convertFromUtf8(optarg);
+            break;
+        case OPTION_SHARD:
+            parseShard("shard", optarg);
+            break;
+        case OPTION_SPLIT_DEPTH:
+            splitDepth = parseCount("split-depth", optarg);
+            if (splitDepth == 0) {
+                invalidArgument("split-depth", optarg);
+            }
+            break;
+        case OPTION_PARTIAL:
+            partialPath = convertFromUtf8(optarg);
+            break;
+        case OPTION_MERGE:
+            mergeMode = true;
+            break;
         default:
             fwprintf(stderr, L"%ls: getopt_long returned unrecognized option: %c\n", programName, optionChar);
             exit(EXIT_FAILURE);
@@ -78,9 +303,258 @@ List *setSwitches(int argc, const wchar_t *argv[])
         exit(EXIT_FAILURE);
     }
 
+    if ((showHistogram || byExtension || ageBoundaryCount > 0 || showTime || byOwner) && estimateSeconds > 0) {
+        fwprintf(stderr, L"%ls: ERROR with arguments: --estimate cannot be combined with --histogram, --by-extension, --by-age, --by-owner or --time\n", programName);
+        exit(EXIT_FAILURE);
+    }
+
+    if (countInodes && (showHistogram || byExtension || ageBoundaryCount > 0 || byOwner || estimateSeconds > 0 || serveMode)) {
+        fwprintf(stderr, L"%ls: ERROR with arguments: --inodes cannot be combined with --histogram, --by-extension, --by-age, --by-owner, --estimate or --serve\n", programName);
+        exit(EXIT_FAILURE);
+    }
+
+    if (serveMode && queryKind != NULL) {
+        fwprintf(stderr, L"%ls: ERROR with arguments: cannot both --serve and --query\n", programName);
+        exit(EXIT_FAILURE);
+    }
+
+    if (filesFrom != NULL && (serveMode || queryKind != NULL)) {
+        fwprintf(stderr, L"%ls: ERROR with arguments: --files-from and --files0-from cannot be combined with --serve or --query\n", programName);
+        exit(EXIT_FAILURE);
+    }
+
+    if (filesFrom != NULL && optind < argc) {
+        fwprintf(stderr, L"%ls: ERROR with arguments: FILE arguments cannot be combined with --files-from or --files0-from\n", programName);
+        exit(EXIT_FAILURE);
+    }
+
+    if (checkpointPath != NULL && resumePath != NULL) {
+        fwprintf(stderr, L"%ls: ERROR with arguments: --resume goes on saving checkpoints to its FILE, so it cannot be combined with --checkpoint\n", programName);
+        exit(EXIT_FAILURE);
+    }
+    if (resumePath != NULL) {
+        checkpointPath = resumePath;
+        resumeFromCheckpoint = true;
+    }
+
+    /* The tables of --histogram, --by-extension and --by-owner, and the
+       directories -L has visited, are not saved in a checkpoint. */
+    if (checkpointPath != NULL && (showHistogram || byExtension || byOwner || estimateSeconds > 0 || serveMode
+            || queryKind != NULL || filesFrom != NULL || deadlineSeconds > 0 || dereference)) {
+        fwprintf(stderr, L"%ls: ERROR with arguments: --checkpoint and --resume cannot be combined with --histogram, --by-extension, --by-owner, --estimate, --serve, --query, --files-from, --files0-from, --deadline or -L\n", programName);
+        exit(EXIT_FAILURE);
+    }
+
+    if ((shardCount > 0) != (partialPath != NULL)) {
+        fwprintf(stderr, L"%ls: ERROR with arguments: --shard needs --partial for the file to write its result to, and --partial needs --shard\n", programName);
+        exit(EXIT_FAILURE);
+    }
+
+    /* A shard has to report its entries in the order a single scan would. */
+    if (shardCount > 0 && (showHistogram || byExtension || byOwner || estimateSeconds > 0 || serveMode
+            || queryKind != NULL || filesFrom != NULL || deadlineSeconds > 0 || dereference || checkpointPath != NULL)) {
+        fwprintf(stderr, L"%ls: ERROR with arguments: --shard cannot be combined with --histogram, --by-extension, --by-owner, --estimate, --serve, --query, --files-from, --files0-from, --deadline, -L, --checkpoint or --resume\n", programName);
+        exit(EXIT_FAILURE);
+    }
+
+    if (mergeMode && optionCount > 1) {
+        fwprintf(stderr, L"%ls: ERROR with arguments: --merge takes its options from the partial result files, so it cannot be combined with others\n", programName);
+        exit(EXIT_FAILURE);
+    }
+    if (mergeMode && optind == argc) {
+        fwprintf(stderr, L"%ls: ERROR with arguments: --merge needs the partial result file of each shard\n", programName);
+        exit(EXIT_FAILURE);
+    }
+
+    if (checkpointPath != NULL || shardCount > 0) {
+        /* A checkpoint or a partial result is of one scan at a time. */
+        threadCount = 1;
+    } else if (threadCount == 0) {
+        threadCount = getDefaultThreadCount();
+    }
+
+    /* Compile once here so that each directory entry is only tested once. */
+    compilePatternSet(excludePatterns);
+    compilePatternSet(includePatterns);
+
     remainingArguments = initList();
     while (optind < argc) {
         appendListItem(&remainingArguments, wcsdup(argv[optind++]));
     }
     return remainingArguments;
 }
+
+/* The size that -b and --inodes ask for. */
+enum TallySize chooseTallySize()
+{
+    enum TallySize size;
+
+    if (countInodes) {
+        size = TALLY_COUNT_ONLY;
+    } else if (displayBytes) {
+        size = TALLY_LISTED_SIZE;
+    } else {
+        size = TALLY_ALLOCATED_SIZE;
+    }
+    return size;
+}
+
+/* How --estimate and --serve list directories. Without a deadline, which
+   is the caller's to set. */
+void chooseListingOptions(struct ListingOptions *options)
+{
+    options->isPhysicalOrder = physicalOrder;
+    options->needsAllocatedSizes = chooseTallySize() == TALLY_ALLOCATED_SIZE;
+    options->dereference = dereference;
+    options->excludes = excludePatterns;
+    options->includes = includePatterns;
+    options->deadline = NULL;
+}
+
+static unsigned long parseCount(const char *optionName, const char *value)
+{
+    char *end;
+    unsigned long count;
+
+    count = strtoul(value, &end, 10);
+    if (*value == '\0' || *end != '\0') {
+        invalidArgument(optionName, value);
+    }
+    return count;
+}
+
+/* Accepts seconds, or a sequence such as 1h30m using the units s, m, h and d. */
+static unsigned long parseDuration(const char *optionName, const char *value)
+{
+    const char *p;
+    char *end;
+    unsigned long amount;
+    unsigned long multiplier;
+    unsigned long seconds = 0;
+
+    p = value;
+    do {
+        if (!isdigit((unsigned char) *p)) {
+            invalidArgument(optionName, value);
+        }
+        amount = strtoul(p, &end, 10);
+        switch (*end) {
+        case '\0':
+        case 's':
+            multiplier = 1;
+            break;
+        case 'm':
+            multiplier = 60;
+            break;
+        case 'h':
+            multiplier = 60 * 60;
+            break;
+        case 'd':
+            multiplier = 24 * 60 * 60;
+            break;
+        default:
+            invalidArgument(optionName, value);
+            multiplier = 0;
+        }
+        seconds += amount * multiplier;
+        p = *end == '\0' ? end : end + 1;
+    } while (*p != '\0');
+    if (seconds == 0) {
+        invalidArgument(optionName, value);
+    }
+    return seconds;
+}
+
+/* A comma separated list of ages such as 90d,1y,3y. The units are d for
+   days, w for weeks and y for years, which is also the default. */
+static void parseAgeBoundaries(const char *optionName, const char *value)
+{
+    const char *p;
+    char *end;
+    unsigned long amount;
+    unsigned long days;
+
+    ageBoundaryCount = 0;
+    p = value;
+    do {
+        if (!isdigit((unsigned char) *p) || ageBoundaryCount == MAX_AGE_BOUNDARIES) {
+            invalidArgument(optionName, value);
+        }
+        amount = strtoul(p, &end, 10);
+        switch (*end) {
+        case 'd':
+            days = amount;
+            end++;
+            break;
+        case 'w':
+            days = amount * 7;
+            end++;
+            break;
+        case 'y':
+            end++;
+            /* Falls through */
+        default:
+            days = amount * 365;
+            break;
+        }
+        if (days == 0 || (ageBoundaryCount > 0 && days <= ageBoundaries[ageBoundaryCount - 1])
+                || (*end != ',' && *end != '\0')) {
+            invalidArgument(optionName, value);
+        }
+        ageBoundaries[ageBoundaryCount++] = days;
+        p = *end == ',' ? end + 1 : end;
+    } while (*end != '\0');
+}
+
+/* total, children, or top with an optional count as in top:20 */
+static void parseQuery(const char *optionName, const char *value)
+{
+    if (strcmp(value, "total") == 0) {
+        queryKind = L"total";
+    } else if (strcmp(value, "children") == 0) {
+        queryKind = L"children";
+    } else if (strcmp(value, "top") == 0) {
+        queryKind = L"top";
+    } else if (strncmp(value, "top:", 4) == 0) {
+        queryKind = L"top";
+        queryCount = parseCount(optionName, value + 4);
+    } else {
+        invalidArgument(optionName, value);
+    }
+}
+
+/* listing, the order the file system lists entries in, or physical */
+static void parseOrder(const char *optionName, const char *value)
+{
+    if (strcmp(value, "listing") == 0) {
+        physicalOrder = false;
+    } else if (strcmp(value, "physical") == 0) {
+        physicalOrder = true;
+    } else {
+        invalidArgument(optionName, value);
+    }
+}
+
+/* I/N, where shard I counts from 1 */
+static void parseShard(const char *optionName, const char *value)
+{
+    char *end;
+
+    if (!isdigit((unsigned char) *value)) {
+        invalidArgument(optionName, value);
+    }
+    shardIndex = strtoul(value, &end, 10);
+    if (*end != '/' || !isdigit((unsigned char) end[1])) {
+        invalidArgument(optionName, value);
+    }
+    shardCount = strtoul(end + 1, &end, 10);
+    if (*end != '\0' || shardIndex == 0 || shardIndex > shardCount) {
+        invalidArgument(optionName, value);
+    }
+}
+
+static void invalidArgument(const char *optionName, const char *value)
+{
+    fwprintf(stderr, L"%ls: ERROR with arguments: invalid value for --%hs: %hs\n", programName, optionName, value);
+    exit(EXIT_FAILURE);
+}
@@ -2,11 +2,50 @@
 
 #include <wchar.h>
 #include "list.h"
+#include "pattern.h"
+#include "age.h"
+#include "tally.h"
 
 extern bool displayRegularFilesAlso;
 extern bool displayBytes;
 extern bool summarize;
 extern bool humanReadable;
+extern bool dereference;
+extern bool oneFileSystem;
+extern unsigned long maxErrors;
+extern bool quietErrors;
+extern bool showProgress;
+extern bool showHistogram;
+extern bool byExtension;
+extern unsigned long ageBoundaries[MAX_AGE_BOUNDARIES];
+extern size_t ageBoundaryCount;
+extern bool showTime;
+extern bool byOwner;
+extern bool serveMode;
+extern const wchar_t *queryKind;
+extern unsigned long queryCount;
+extern const wchar_t *pipeName;
+extern const wchar_t *filesFrom;
+extern char filesFromDelimiter;
+extern unsigned long threadCount;
+extern bool physicalOrder;
+extern unsigned long prefetchDepth;
+extern bool showStats;
+extern bool countInodes;
+extern unsigned long estimateSeconds;
+extern unsigned long deadlineSeconds;
+extern const wchar_t *checkpointPath;
+extern bool resumeFromCheckpoint;
+extern unsigned long checkpointSeconds;
+extern unsigned long shardIndex;
+extern unsigned long shardCount;
+extern unsigned long splitDepth;
+extern const wchar_t *partialPath;
+extern bool mergeMode;
+extern PatternSet *excludePatterns;
+extern PatternSet *includePatterns;
 
 extern List *setSwitches(int argc, const wchar_t *argv[]);
+extern enum TallySize chooseTallySize();
+extern void chooseListingOptions(struct ListingOptions *options);
 
@@ -0,0 +1,286 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <io.h>         /* _chsize_s */
+#include <windows.h>
+#include <gc.h>
+#include "checkpoint.h"
+#include "record.h"
+#include "output.h"
+#include "error.h"
+#include "string.h"
+#include "filename.h"
+#include "du.h"
+
+#define CHECKPOINT_MAGIC "du checkpoint 1\n"
+#define OUTPUT_SUFFIX L".out"
+#define TEMPORARY_SUFFIX L".tmp"
+#define REPLAY_CAPACITY 4096
+
+/* A checkpoint holds CHECKPOINT_MAGIC, the fingerprint, how many arguments
+   were done, how much of FILE.out was written for them, how many errors
+   there were, and the argument being scanned, which is empty between
+   arguments. The state of its scan follows. */
+static const wchar_t *checkpointPath = NULL;
+static wchar_t *outputPath;
+static FILE *outputLog;
+static wchar_t *fingerprint;
+static uint64_t argumentsDone = 0;
+static unsigned long resumedErrorCount = 0;
+static FILE *savedScan = NULL;          /* At the scan state to be resumed, NULL if none */
+static wchar_t *savedScanPath;
+static const wchar_t *currentPath = L"";
+static ULONGLONG interval;
+static ULONGLONG lastWriteTime;
+
+static wchar_t *makeFingerprint(int argc, const wchar_t *argv[]);
+static bool isCheckpointOption(const wchar_t *argument);
+static void readCheckpoint();
+static void replayOutput(uint64_t length);
+static void writeCheckpoint(const ScanContext *scan);
+static void checkpointDamaged();
+
+void startCheckpoints(const wchar_t *path, bool isResuming, unsigned long seconds,
+        int argc, const wchar_t *argv[])
+{
+    checkpointPath = path;
+    outputPath = concat(path, OUTPUT_SUFFIX);
+    interval = (ULONGLONG) seconds * 1000;
+    fingerprint = makeFingerprint(argc, argv);
+    if (isResuming) {
+        readCheckpoint();
+    } else if ((outputLog = _wfopen(outputPath, L"wb")) == NULL) {
+        writeError(errno, L"Failed to create", outputPath);
+        exit(EXIT_FAILURE);
+    }
+    setOutputCopy(outputLog);
+    if (!isResuming) {
+        /* So that a run stopped before the first interval can be resumed. */
+        writeCheckpoint(NULL);
+    }
+    lastWriteTime = GetTickCount64();
+}
+
+/* What the output depends on: the current directory and the arguments,
+   apart from those about checkpoints, which can differ between the run
+   that is stopped and the one that resumes it. */
+static wchar_t *makeFingerprint(int argc, const wchar_t *argv[])
+{
+    wchar_t *text;
+    int i;
+
+    if ((text = getAbsolutePath(L".")) == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    for (i = 1; i < argc; i++) {
+        if (!isCheckpointOption(argv[i])) {
+            text = concat3(text, L"\n", argv[i]);
+        } else if (wcschr(argv[i], L'=') == NULL) {
+            /* Its value is the next argument. */
+            i++;
+        }
+    }
+    return text;
+}
+
+static bool isCheckpointOption(const wchar_t *argument)
+{
+    return startsWith(argument, L"--checkpoint") || startsWith(argument, L"--resume");
+}
+
+static void readCheckpoint()
+{
+    FILE *file;
+    char magic[sizeof(CHECKPOINT_MAGIC) - 1];
+    wchar_t *savedFingerprint;
+    uint64_t outputLength;
+    uint64_t errorCount;
+
+    if ((file = _wfopen(checkpointPath, L"rb")) == NULL) {
+        writeError(errno, L"Failed to open checkpoint", checkpointPath);
+        exit(EXIT_FAILURE);
+    }
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic)
+            || memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0
+            || (savedFingerprint = readRecordText(file)) == NULL
+            || !readRecordNumber(file, &argumentsDone)
+            || !readRecordNumber(file, &outputLength)
+            || !readRecordNumber(file, &errorCount)
+            || (savedScanPath = readRecordText(file)) == NULL) {
+        checkpointDamaged();
+    }
+    if (wcscmp(savedFingerprint, fingerprint) != 0) {
+        fwprintf(stderr, L"%ls: ERROR with arguments: %ls was saved by a run with other arguments or in another directory\n",
+                programName, checkpointPath);
+        exit(EXIT_FAILURE);
+    }
+    resumedErrorCount = (unsigned long) errorCount;
+    if (*savedScanPath == L'\0') {
+        fclose(file);
+    } else {
+        savedScan = file;
+    }
+    replayOutput(outputLength);
+}
+
+/* Throws away whatever was printed after the checkpoint, which will be
+   printed again, and prints what was printed up to it. It is thrown away
+   first, so that a run stopped while printing does not leave it behind. A
+   surrogate pair is not split between two writes. */
+static void replayOutput(uint64_t length)
+{
+    wchar_t chunk[REPLAY_CAPACITY + 1];
+    uint64_t left;
+    size_t wanted;
+    size_t count;
+    size_t kept = 0;
+    wchar_t last;
+
+    if ((outputLog = _wfopen(outputPath, L"r+b")) == NULL) {
+        writeError(errno, L"Failed to open", outputPath);
+        exit(EXIT_FAILURE);
+    }
+    if (_chsize_s(_fileno(outputLog), (__int64) length) != 0) {
+        writeError(errno, L"Failed to truncate", outputPath);
+        exit(EXIT_FAILURE);
+    }
+    left = length / sizeof(wchar_t);
+    while (left > 0) {
+        wanted = left < REPLAY_CAPACITY - kept ? (size_t) left : REPLAY_CAPACITY - kept;
+        if (fread(chunk + kept, sizeof(wchar_t), wanted, outputLog) != wanted) {
+            checkpointDamaged();
+        }
+        left -= wanted;
+        count = kept + wanted;
+        last = chunk[count - 1];
+        kept = left > 0 && IS_HIGH_SURROGATE(last) ? 1 : 0;
+        chunk[count - kept] = L'\0';
+        fputws(chunk, stdout);
+        chunk[0] = last;
+    }
+    fflush(stdout);
+    /* What is printed next is written after it. */
+    if (_fseeki64(outputLog, (__int64) length, SEEK_SET) != 0) {
+        writeError(errno, L"Failed to seek in", outputPath);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* An argument that was done before the checkpoint is not scanned again. */
+bool isArgumentDone(size_t position)
+{
+    return position < argumentsDone;
+}
+
+/* Called as each argument is about to be scanned. Returns true if its
+   scan was saved by the checkpoint, and has been loaded to be resumed. */
+bool loadArgumentScan(const wchar_t *path, ScanContext *scan)
+{
+    currentPath = path;
+    if (savedScan == NULL) {
+        return false;
+    }
+    if (wcscmp(savedScanPath, path) != 0) {
+        fwprintf(stderr, L"%ls: ERROR with arguments: %ls was saved while scanning %ls, not %ls\n",
+                programName, checkpointPath, savedScanPath, path);
+        exit(EXIT_FAILURE);
+    }
+    if (!loadScanState(scan, savedScan)) {
+        checkpointDamaged();
+    }
+    fclose(savedScan);
+    savedScan = NULL;
+    return true;
+}
+
+/* The callback of the scan of each argument. */
+void writeScanCheckpoint(void *context, ScanContext *scan)
+{
+    writeCheckpoint(scan);
+}
+
+/* Between arguments the checkpoint is small, and is written whenever one
+   is due. */
+void finishArgumentCheckpoint()
+{
+    argumentsDone++;
+    currentPath = L"";
+    if (GetTickCount64() - lastWriteTime >= interval) {
+        writeCheckpoint(NULL);
+    }
+}
+
+/* The run is over, so there is nothing left to resume. */
+void finishCheckpoints()
+{
+    setOutputCopy(NULL);
+    fclose(outputLog);
+    if (!DeleteFile(checkpointPath)) {
+        writeLastError(GetLastError(), L"Failed to delete checkpoint", checkpointPath);
+    }
+    if (!DeleteFile(outputPath)) {
+        writeLastError(GetLastError(), L"Failed to delete", outputPath);
+    }
+}
+
+unsigned long getResumedErrorCount()
+{
+    return resumedErrorCount;
+}
+
+/* The output that the checkpoint counts as printed is on the disk before
+   the checkpoint is, and the checkpoint is written in full to a file of
+   its own before it takes the place of the last one. A checkpoint that
+   cannot be written is an error, but the run carries on. */
+static void writeCheckpoint(const ScanContext *scan)
+{
+    OutputBuffer *output;
+    wchar_t *temporaryPath;
+    FILE *file;
+    __int64 outputLength;
+    bool isWritten;
+
+    /* With one thread, the argument being scanned is the first that is
+       not written yet, so its output can go straight to standard output. */
+    if ((output = getThreadOutput()) != NULL) {
+        writeOutputBuffer(output);
+    }
+    if (!flushRecordFile(outputLog) || (outputLength = _ftelli64(outputLog)) < 0) {
+        writeError(errno, L"Failed to write", outputPath);
+        return;
+    }
+    temporaryPath = concat(checkpointPath, TEMPORARY_SUFFIX);
+    if ((file = _wfopen(temporaryPath, L"wb")) == NULL) {
+        writeError(errno, L"Failed to create checkpoint", temporaryPath);
+        return;
+    }
+    fwrite(CHECKPOINT_MAGIC, 1, strlen(CHECKPOINT_MAGIC), file);
+    writeRecordText(file, fingerprint);
+    writeRecordNumber(file, argumentsDone);
+    writeRecordNumber(file, (uint64_t) outputLength);
+    writeRecordNumber(file, resumedErrorCount + getErrorCount());
+    writeRecordText(file, scan != NULL ? currentPath : L"");
+    if (scan != NULL) {
+        saveScanState(scan, file);
+    }
+    isWritten = flushRecordFile(file) && !ferror(file);
+    if (fclose(file) != 0) {
+        isWritten = false;
+    }
+    if (!isWritten) {
+        writeError(errno, L"Failed to write checkpoint", temporaryPath);
+        DeleteFile(temporaryPath);
+    } else if (!MoveFileEx(temporaryPath, checkpointPath, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        writeLastError(GetLastError(), L"Failed to replace checkpoint", checkpointPath);
+        DeleteFile(temporaryPath);
+    }
+    lastWriteTime = GetTickCount64();
+}
+
+static void checkpointDamaged()
+{
+    writeLastError(ERROR_INVALID_DATA, L"Checkpoint is damaged or was saved by another version of du", checkpointPath);
+    exit(EXIT_FAILURE);
+}
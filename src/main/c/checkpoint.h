@@ -0,0 +1,27 @@
+#ifndef CHECKPOINT_H_RFVBGT
+#define CHECKPOINT_H_RFVBGT
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <wchar.h>
+#include "scan.h"
+
+#define DEFAULT_CHECKPOINT_SECONDS 60
+
+/* --checkpoint saves how far a run has got to FILE, and what it has
+   printed to FILE.out, so that --resume can carry on after the run is
+   stopped. The arguments that were done are skipped and their output is
+   printed again, and the argument being scanned picks up where its scan
+   was, so the output is the same as that of a run that was not stopped.
+   Each checkpoint replaces the last one in a single step, and both files
+   are removed when the run finishes. */
+extern void startCheckpoints(const wchar_t *path, bool isResuming, unsigned long seconds,
+        int argc, const wchar_t *argv[]);
+extern bool isArgumentDone(size_t position);
+extern bool loadArgumentScan(const wchar_t *path, ScanContext *scan);
+extern void writeScanCheckpoint(void *context, ScanContext *scan);
+extern void finishArgumentCheckpoint();
+extern void finishCheckpoints();
+extern unsigned long getResumedErrorCount();
+
+#endif
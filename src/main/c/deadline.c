@@ -0,0 +1,52 @@
+#include <stdlib.h>
+#include <errno.h>
+#include <windows.h>
+#include <gc.h>
+#include "deadline.h"
+#include "error.h"
+
+struct Deadline {
+    ULONGLONG time;
+    volatile bool isReached;
+    volatile LONG unscannedDirectoryCount;
+};
+
+/* From now. */
+Deadline *initDeadline(unsigned long seconds)
+{
+    Deadline *deadline;
+
+    if ((deadline = (Deadline *) GC_MALLOC(sizeof(Deadline))) == NULL) {
+        writeError(errno, L"Failed to allocate memory for", L"deadline");
+        exit(EXIT_FAILURE);
+    }
+    deadline->time = GetTickCount64() + (ULONGLONG) seconds * 1000;
+    deadline->isReached = false;
+    deadline->unscannedDirectoryCount = 0;
+    return deadline;
+}
+
+/* Cheap enough to call for every directory entry. Once the deadline has
+   passed the clock is not read again. */
+bool isPastDeadline(Deadline *deadline)
+{
+    if (deadline == NULL) {
+        return false;
+    }
+    if (!deadline->isReached && GetTickCount64() >= deadline->time) {
+        deadline->isReached = true;
+    }
+    return deadline->isReached;
+}
+
+void countUnscannedDirectory(Deadline *deadline)
+{
+    if (deadline != NULL) {
+        InterlockedIncrement(&deadline->unscannedDirectoryCount);
+    }
+}
+
+unsigned long getUnscannedDirectoryCount(const Deadline *deadline)
+{
+    return deadline != NULL ? (unsigned long) deadline->unscannedDirectoryCount : 0;
+}
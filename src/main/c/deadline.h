@@ -0,0 +1,19 @@
+#ifndef DEADLINE_H_ZXCVBN
+#define DEADLINE_H_ZXCVBN
+
+#include <stdbool.h>
+
+/* A time after which nothing more is read, and a count of the
+   directories that were left unread because of it. It may be shared by
+   scans on different threads. Where a deadline is asked for, NULL stands
+   for none, which never passes. */
+typedef
+    struct Deadline /* as */
+    Deadline;
+
+extern Deadline *initDeadline(unsigned long seconds);
+extern bool isPastDeadline(Deadline *deadline);
+extern void countUnscannedDirectory(Deadline *deadline);
+extern unsigned long getUnscannedDirectoryCount(const Deadline *deadline);
+
+#endif
@@ -45,6 +45,27 @@
 #include "args.h"
 #include "help.h"
 #include "registry.h"
+#include "visited.h"
+#include "glob.h"
+#include "format.h"
+#include "estimate.h"
+#include "deadline.h"
+#include "usage.h"
+#include "progress.h"
+#include "histogram.h"
+#include "extension.h"
+#include "age.h"
+#include "owner.h"
+#include "serve.h"
+#include "output.h"
+#include "pool.h"
+#include "filelist.h"
+#include "roots.h"
+#include "prefetch.h"
+#include "tally.h"
+#include "scan.h"
+#include "checkpoint.h"
+#include "shard.h"
 
 /* Visual C++ 4.0 does not define this. */
 #ifndef INVALID_FILE_ATTRIBUTES
@@ -53,29 +74,101 @@
 
 #define DEFAULT_PATH _T(".")
 #define FIND_ALL_PATTERN _T("\\*")
+#define LOWER_BOUND_MARK L">="
 
-#define KIBIBYTE 0x400
-#define MEBIBYTE 0x100000
-#define GIBIBYTE 0x40000000
+#define COLUMNS_TEXT_CAPACITY 512
 
-static void printFileSize(wchar_t *path, unsigned long size);
-static unsigned long calcDiskUsage(wchar_t *path, bool isTopLevel);
+/* An argument inside the one being scanned. Its lines and tables are
+   collected on the way, so that its subtree is not read a second time. */
+struct Capture {
+    struct Root *root;
+    OutputBuffer *output;
+    bool isReached;
+    struct Histogram histogram;
+    ExtensionTable *extensions;
+    OwnerTable *owners;
+    struct Histogram *outerHistogram;   /* The tables of the scan around it */
+    ExtensionTable *outerExtensions;
+    OwnerTable *outerOwners;
+    struct Capture *outer;
+};
+
+/* What is gathered while one argument is scanned, besides its total. */
+struct ArgumentScan {
+    struct Breakdowns breakdowns;   /* Each table NULL unless its option was given */
+    struct Capture **captures;      /* Arguments inside this one */
+    size_t captureCount;
+    struct Capture *innermost;      /* The capture the scan is in, NULL if none */
+};
+
+/* Arguments that overlap. Whichever of them comes first in argument order
+   scans the outermost one, and the others wait for it to finish. */
+struct Overlap {
+    struct Root *outermost;
+    OutputBuffer *output;           /* Of the outermost */
+    struct Capture **captures;
+    size_t captureCount;
+    size_t captureCapacity;
+    size_t firstPosition;
+    HANDLE doneEvent;
+};
+
+/* The matches of a pattern given to the worker pool so far. */
+struct MatchStream {
+    WorkerPool *pool;
+    size_t count;
+};
+
+/* What the worker pool is given for each argument. */
+struct Argument {
+    struct Root *root;
+    struct Overlap *overlap;        /* NULL if it overlaps no other argument */
+    struct Capture *capture;        /* NULL unless it is inside another argument */
+};
+
+static void printFileSize(const wchar_t *path, const struct Usage *usage, OutputBuffer *output);
+static void printEntry(struct ArgumentScan *scan, struct Capture *startedHere, const wchar_t *path,
+        const struct Usage *usage, bool isShown, bool isShownAsTop);
+static const wchar_t *formatColumns(const struct Usage *usage, wchar_t *buffer, size_t capacity);
 static void setup();
-static void du(int argc, const wchar_t *argv[]);
+static int du(int argc, const wchar_t *argv[]);
+static int mergeShards(List *partialPaths);
+static void collectMatch(const wchar_t *path, void *context);
+static void summarizeMatches(const wchar_t *pattern);
+static void submitMatch(const wchar_t *path, void *context);
+static void submitListedFile(wchar_t *path, void *context);
+static void summarizeListedFile(void *item);
+static void summarizeArguments(List *paths);
+static struct Argument **initArguments(struct Root **roots, size_t count);
+static void addCapture(struct Overlap *overlap, struct Argument *argument);
+static void summarizePoolArgument(void *item);
+static void scanOverlap(struct Overlap *overlap);
+static void summarizeArgument(const wchar_t *path, struct Capture **captures, size_t captureCount);
+static void initArgumentScan(struct ArgumentScan *scan, struct Capture **captures, size_t captureCount,
+        struct ScanCallbacks *callbacks);
+static void printScanTables(const struct ArgumentScan *scan, const struct Usage *usage, const wchar_t *path);
+static void *startCapture(void *context, const struct FileEntry *fileEntry, bool isTopLevel);
+static void finishCapture(struct ArgumentScan *scan, struct Capture *capture, const struct Usage *usage, bool isRead);
+static void finishArgumentEntry(void *context, const struct ScanEntry *entry);
+static void finishArgumentDirectory(void *context, const struct ScanEntry *entry);
 static const wchar_t *getEnvironmentVariable(const wchar_t *name);
+static wchar_t *getDefaultPath();
 
-const wchar_t *programName;
+static VisitedSet *visitedDirectories;
+static Deadline *deadline;          /* NULL without --deadline */
 
 int wmain(int argc, const wchar_t *argv[])
 {
+    int exitCode = EXIT_SUCCESS;
+
     GC_INIT();
     programName = argv[0];
     if (startsWith(getSimpleName(programName), L"du-setup")) {
         setup();
     } else {
-        du(argc, argv);
+        exitCode = du(argc, argv);
     }
-    return EXIT_SUCCESS;
+    return exitCode;
 }
 
 static const wchar_t *getEnvironmentVariable(const wchar_t *name)
@@ -140,71 +233,605 @@ static void setup()
     addElementToRegistryUserPath(binDir);
 }
 
-static void du(int argc, const wchar_t *argv[])
+static int du(int argc, const wchar_t *argv[])
 {
     List *fileArgs;
+    List *paths;
     List *node;
     wchar_t *argument;
+    WorkerPool *pool;
+    bool isShardWritten = true;
 
     fileArgs = setSwitches(argc, argv);
-    if (getListSize(fileArgs) > 0) {
+    if (mergeMode) {
+        return mergeShards(fileArgs);
+    }
+    chooseSizeFormat();
+    if (queryKind != NULL) {
+        return queryUsage(fileArgs);
+    }
+    if (serveMode) {
+        if (isListEmpty(fileArgs)) {
+            appendListItem(&fileArgs, getDefaultPath());
+        }
+        return serveUsage(fileArgs);
+    }
+    if (deadlineSeconds > 0) {
+        deadline = initDeadline(deadlineSeconds);
+    }
+    if (ageBoundaryCount > 0) {
+        initAgeBuckets(ageBoundaries, ageBoundaryCount);
+    }
+    if (byOwner) {
+        initOwnerCache();
+    }
+    if (showProgress) {
+        startProgress();
+    }
+    if (prefetchDepth > 0) {
+        startPrefetch(prefetchDepth, deadline);
+    }
+    if (dereference) {
+        visitedDirectories = initVisitedSet();
+    }
+    initOutput();
+    if (checkpointPath != NULL) {
+        startCheckpoints(checkpointPath, resumeFromCheckpoint, checkpointSeconds, argc, argv);
+    }
+    if (shardCount > 0) {
+        startShard(partialPath, shardIndex - 1, shardCount, splitDepth, argc, argv);
+    }
+    if (filesFrom != NULL) {
+        pool = startWorkerPool(summarizeListedFile, threadCount);
+        readFileNames(filesFrom, filesFromDelimiter, submitListedFile, pool);
+        finishWorkerPool(pool);
+    } else if (getListSize(fileArgs) == 1 && isGlob((const wchar_t *) getListItem(fileArgs))
+            && !canMatchNested((const wchar_t *) getListItem(fileArgs))) {
+        summarizeMatches((const wchar_t *) getListItem(fileArgs));
+    } else {
+        /* Matches are put in with the other arguments first, because one
+           may be inside another. */
+        paths = initList();
         for (node = fileArgs; !isListEmpty(node); node = skipListItem(node)) {
-            argument = removeListItem(&fileArgs);
-            calcDiskUsage(argument, true);
+            argument = (wchar_t *) getListItem(node);
+            /* cmd.exe leaves wildcards for the program to expand. */
+            if (isGlob(argument)) {
+                if (!expandGlob(argument, collectMatch, &paths)) {
+                    writeLastError(ERROR_FILE_NOT_FOUND, L"No match for pattern", argument);
+                }
+            } else {
+                appendListItem(&paths, argument);
+            }
         }
+        if (isListEmpty(fileArgs)) {
+            appendListItem(&paths, getDefaultPath());
+        }
+        if (!isListEmpty(paths)) {
+            summarizeArguments(paths);
+        }
+    }
+    if (checkpointPath != NULL) {
+        finishCheckpoints();
+    }
+    if (shardCount > 0) {
+        isShardWritten = finishShard();
+    }
+    stopPrefetch();
+    stopProgress();
+    if (showStats) {
+        writeScanStats();
+    }
+    writeErrorSummary();
+    if (getUnscannedDirectoryCount(deadline) > 0) {
+        fwprintf(stderr, L"%ls: deadline reached: %lu directories were not scanned completely, totals marked %ls are lower bounds\n",
+                programName, getUnscannedDirectoryCount(deadline), LOWER_BOUND_MARK);
+        return EXIT_FAILURE;
+    }
+    /* As with GNU du, an entry that could not be read makes the run a
+       partial failure, though everything else was counted. That includes
+       the errors before the checkpoint a run was resumed from. A shard
+       whose partial result was not written has failed outright. */
+    return getErrorCount() + getResumedErrorCount() > 0 || !isShardWritten ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* Prints the lines of the partial results in the order a single run
+   would have, through the same callbacks as a scan. */
+static int mergeShards(List *partialPaths)
+{
+    ShardMerge *merge;
+    struct ArgumentScan argumentScan;
+    struct ScanCallbacks callbacks;
+    const wchar_t *path;
+    struct Usage usage;
+    enum ScanResult result;
+
+    merge = openShardMerge(partialPaths);
+    chooseSizeFormat();
+    if (ageBoundaryCount > 0) {
+        initAgeBuckets(ageBoundaries, ageBoundaryCount);
+    }
+    initOutput();
+    initArgumentScan(&argumentScan, NULL, 0, &callbacks);
+    while (mergeNextArgument(merge, &callbacks, &path, &usage, &result)) {
+        if (result == SCAN_COMPLETE) {
+            printScanTables(&argumentScan, &usage, path);
+        }
+    }
+    if (getFailedShardCount(merge) > 0) {
+        /* Errors in the directories every shard reads were reported by each. */
+        fwprintf(stderr, L"%ls: %lu of the shards reported errors\n", programName, getFailedShardCount(merge));
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+static wchar_t *getDefaultPath()
+{
+    wchar_t *path;
+
+    if ((path = getAbsolutePath(DEFAULT_PATH)) == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    return path;
+}
+
+/* Each match of a wildcard argument is treated like an argument of its own. */
+static void collectMatch(const wchar_t *path, void *context)
+{
+    appendListItem((List **) context, (void *) path);
+}
+
+/* The matches of a lone pattern cannot be inside one another, so each is
+   given to the worker pool as soon as it is found. */
+static void summarizeMatches(const wchar_t *pattern)
+{
+    struct MatchStream stream;
+
+    stream.pool = startWorkerPool(summarizePoolArgument, threadCount);
+    stream.count = 0;
+    if (!expandGlob(pattern, submitMatch, &stream)) {
+        writeLastError(ERROR_FILE_NOT_FOUND, L"No match for pattern", pattern);
+    }
+    finishWorkerPool(stream.pool);
+}
+
+static void submitMatch(const wchar_t *path, void *context)
+{
+    struct MatchStream *stream = (struct MatchStream *) context;
+    struct Root *root;
+    struct Argument *argument;
+
+    if ((root = (struct Root *) GC_MALLOC(sizeof(struct Root))) == NULL
+            || (argument = (struct Argument *) GC_MALLOC(sizeof(struct Argument))) == NULL) {
+        writeError(errno, L"Failed to allocate memory for", path);
+        exit(EXIT_FAILURE);
+    }
+    root->path = path;
+    root->fullPath = path;
+    root->position = stream->count++;
+    root->enclosing = NULL;
+    root->scanPath = path;
+    argument->root = root;
+    argument->overlap = NULL;
+    argument->capture = NULL;
+    submitToWorkerPool(stream->pool, argument);
+}
+
+/* Names read by --files-from are taken literally, without wildcards. */
+static void submitListedFile(wchar_t *path, void *context)
+{
+    submitToWorkerPool((WorkerPool *) context, path);
+}
+
+static void summarizeListedFile(void *item)
+{
+    summarizeArgument((const wchar_t *) item, NULL, 0);
+}
+
+/* The arguments are scanned at the same time, up to --threads of them,
+   and printed in argument order. */
+static void summarizeArguments(List *paths)
+{
+    struct Root **roots;
+    struct Argument **arguments;
+    WorkerPool *pool;
+    size_t count;
+    size_t i;
+
+    roots = initRoots(paths, &count);
+    arguments = initArguments(roots, count);
+    pool = startWorkerPool(summarizePoolArgument, count < threadCount ? (unsigned long) count : threadCount);
+    for (i = 0; i < count; i++) {
+        submitToWorkerPool(pool, arguments[i]);
+    }
+    finishWorkerPool(pool);
+}
+
+static struct Argument **initArguments(struct Root **roots, size_t count)
+{
+    struct Argument **arguments;
+    struct Argument *enclosing;
+    size_t i;
+
+    if ((arguments = (struct Argument **) GC_MALLOC(count * sizeof(struct Argument *))) == NULL) {
+        writeError(errno, L"Failed to allocate memory for", L"arguments");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < count; i++) {
+        if ((arguments[i] = (struct Argument *) GC_MALLOC(sizeof(struct Argument))) == NULL) {
+            writeError(errno, L"Failed to allocate memory for", L"arguments");
+            exit(EXIT_FAILURE);
+        }
+        arguments[i]->root = roots[i];
+        arguments[i]->overlap = NULL;
+        arguments[i]->capture = NULL;
+    }
+    for (i = 0; i < count; i++) {
+        if (roots[i]->enclosing == NULL) {
+            continue;
+        }
+        if (checkpointPath != NULL || shardCount > 0) {
+            /* A checkpoint or a partial result is of one argument at a time. */
+            fwprintf(stderr, L"%ls: ERROR with arguments: --checkpoint, --resume and --shard cannot be combined with a FILE inside another: %ls\n",
+                    programName, roots[i]->path);
+            exit(EXIT_FAILURE);
+        }
+        enclosing = arguments[roots[i]->enclosing->position];
+        if (enclosing->overlap == NULL) {
+            enclosing->overlap = (struct Overlap *) GC_MALLOC(sizeof(struct Overlap));
+            if (enclosing->overlap == NULL) {
+                writeError(errno, L"Failed to allocate memory for", L"arguments");
+                exit(EXIT_FAILURE);
+            }
+            enclosing->overlap->outermost = enclosing->root;
+            enclosing->overlap->output = initOutputBuffer();
+            enclosing->overlap->captures = NULL;
+            enclosing->overlap->captureCount = 0;
+            enclosing->overlap->captureCapacity = 0;
+            enclosing->overlap->firstPosition = enclosing->root->position;
+            if ((enclosing->overlap->doneEvent = CreateEvent(NULL, TRUE, FALSE, NULL)) == NULL) {
+                writeLastError(GetLastError(), L"Failed to create event for", enclosing->root->path);
+                exit(EXIT_FAILURE);
+            }
+        }
+        addCapture(enclosing->overlap, arguments[i]);
+    }
+    return arguments;
+}
+
+static void addCapture(struct Overlap *overlap, struct Argument *argument)
+{
+    struct Capture *capture;
+
+    if (overlap->captureCount == overlap->captureCapacity) {
+        overlap->captureCapacity = overlap->captureCapacity == 0 ? 4 : overlap->captureCapacity * 2;
+        overlap->captures = (struct Capture **) GC_REALLOC(overlap->captures, overlap->captureCapacity * sizeof(struct Capture *));
+    }
+    if (overlap->captures == NULL || (capture = (struct Capture *) GC_MALLOC(sizeof(struct Capture))) == NULL) {
+        writeError(errno, L"Failed to allocate memory for", argument->root->path);
+        exit(EXIT_FAILURE);
+    }
+    capture->root = argument->root;
+    capture->output = initOutputBuffer();
+    capture->isReached = false;
+    capture->extensions = NULL;
+    capture->owners = NULL;
+    capture->outer = NULL;
+    overlap->captures[overlap->captureCount++] = capture;
+    if (argument->root->position < overlap->firstPosition) {
+        overlap->firstPosition = argument->root->position;
+    }
+    argument->overlap = overlap;
+    argument->capture = capture;
+}
+
+static void summarizePoolArgument(void *item)
+{
+    struct Argument *argument = (struct Argument *) item;
+    struct Overlap *overlap;
+
+    if (isArgumentDone(argument->root->position)) {
+        /* Its output was printed again from the checkpoint. */
+        return;
+    }
+    if ((overlap = argument->overlap) == NULL) {
+        summarizeArgument(argument->root->path, NULL, 0);
+        if (checkpointPath != NULL) {
+            finishArgumentCheckpoint();
+        }
+        return;
+    }
+    /* The first of them was taken from the pool before any of the others,
+       so waiting for it cannot hold it up. */
+    if (argument->root->position == overlap->firstPosition) {
+        scanOverlap(overlap);
+        SetEvent(overlap->doneEvent);
     } else {
-        argument = getAbsolutePath(DEFAULT_PATH);
-        calcDiskUsage(argument, true);
+        WaitForSingleObject(overlap->doneEvent, INFINITE);
     }
+    writeOutput(L"%ls", getOutputText(argument->capture != NULL ? argument->capture->output : overlap->output));
 }
 
-void printFileSize(wchar_t *path, unsigned long size) {
-    double hrSize;
-    if (humanReadable) {
-        if (size >= GIBIBYTE) {
-            hrSize = ((double) size) / ((double) GIBIBYTE);
-            _tprintf(_T("%2.1fG\t%ls\n"), hrSize, path);
-        } else if (size >= MEBIBYTE) {
-            hrSize = ((double) size) / ((double) MEBIBYTE);
-            _tprintf(_T("%2.1fM\t%ls\n"), hrSize, path);
-        } else if (size >= KIBIBYTE) {
-            hrSize = ((double) size) / ((double) KIBIBYTE);
-            _tprintf(_T("%2.1fK\t%ls\n"), hrSize, path);
-        } else {
-            _tprintf(_T("%-2lu\t%ls\n"), size, path);
+/* A nested argument that the scan did not reach, because it was excluded,
+   is behind a link, or is on another volume with -x, is scanned on its own. */
+static void scanOverlap(struct Overlap *overlap)
+{
+    OutputBuffer *output;
+    struct Capture *capture;
+    size_t i;
+
+    output = getThreadOutput();
+    setThreadOutput(overlap->output);
+    summarizeArgument(overlap->outermost->path, overlap->captures, overlap->captureCount);
+    for (i = 0; i < overlap->captureCount; i++) {
+        capture = overlap->captures[i];
+        if (!capture->isReached) {
+            setThreadOutput(capture->output);
+            summarizeArgument(capture->root->path, NULL, 0);
         }
+    }
+    setThreadOutput(output);
+}
+
+static void summarizeArgument(const wchar_t *path, struct Capture **captures, size_t captureCount)
+{
+    struct ArgumentScan argumentScan;
+    struct Histogram histogram;
+    struct ScanOptions options;
+    struct ScanCallbacks callbacks;
+    ScanContext *scan;
+    struct Usage usage;
+    enum ScanResult result;
+
+    if (estimateSeconds > 0) {
+        estimateDiskUsage(path, estimateSeconds, deadline);
+        return;
+    }
+    initArgumentScan(&argumentScan, captures, captureCount, &callbacks);
+    if (showHistogram) {
+        initHistogram(&histogram);
+        argumentScan.breakdowns.histogram = &histogram;
+    }
+    if (byExtension) {
+        argumentScan.breakdowns.extensions = initExtensionTable();
+    }
+    if (byOwner) {
+        argumentScan.breakdowns.owners = initOwnerTable();
+    }
+    options.size = chooseTallySize();
+    options.byAge = ageBoundaryCount > 0;
+    options.dereference = dereference;
+    options.oneFileSystem = oneFileSystem;
+    options.isPhysicalOrder = physicalOrder;
+    options.excludes = excludePatterns;
+    options.includes = includePatterns;
+    options.deadline = deadline;
+    /* Files inside a nested argument are printed to it with -a. */
+    options.visitsFiles = displayRegularFilesAlso || captureCount > 0;
+    options.visited = visitedDirectories;
+    options.breakdowns = showHistogram || byExtension || byOwner ? &argumentScan.breakdowns : NULL;
+    options.checkpointSeconds = checkpointSeconds;
+    options.selectDepth = 0;
+    options.programName = NULL;
+    if (shardCount > 0) {
+        /* What the shard finds goes to its partial result, not to the output. */
+        scanShard(path, &options);
+        return;
+    }
+    callbacks.checkpoint = checkpointPath != NULL ? writeScanCheckpoint : NULL;
+    if ((scan = initScanContext(&options, &callbacks)) == NULL) {
+        writeError(errno, L"Failed to allocate memory for scan of", path);
+        exit(EXIT_FAILURE);
+    }
+    if (checkpointPath != NULL && loadArgumentScan(path, scan)) {
+        result = resumeScan(scan, &usage);
     } else {
-        if (!displayBytes) {
-            if (size > 0) {
-                size = size / ((unsigned long) (1024.0 + 0.5)); /* Convert to KB and round */
-                if (size == 0) {
-                    size = 1; /* Don't allow zero to display if there are bytes in the file */
-                }
+        result = scanTree(scan, path, &usage);
+    }
+    if (result == SCAN_COMPLETE) {
+        clearProgressLine();
+        printScanTables(&argumentScan, &usage, path);
+    }
+}
+
+/* Without tables to fill in. The callbacks print the lines, and are
+   those of a merge too. */
+static void initArgumentScan(struct ArgumentScan *scan, struct Capture **captures, size_t captureCount,
+        struct ScanCallbacks *callbacks)
+{
+    scan->breakdowns.histogram = NULL;
+    scan->breakdowns.extensions = NULL;
+    scan->breakdowns.owners = NULL;
+    scan->captures = captures;
+    scan->captureCount = captureCount;
+    scan->innermost = NULL;
+    callbacks->startEntry = captureCount > 0 ? startCapture : NULL;
+    callbacks->entryDone = finishArgumentEntry;
+    callbacks->directoryDone = finishArgumentDirectory;
+    callbacks->error = NULL;
+    callbacks->context = scan;
+    callbacks->checkpoint = NULL;
+    callbacks->select = NULL;
+}
+
+static void printScanTables(const struct ArgumentScan *scan, const struct Usage *usage, const wchar_t *path)
+{
+    if (showHistogram) {
+        printHistogram(scan->breakdowns.histogram, path);
+    }
+    if (byExtension) {
+        printExtensionTable(scan->breakdowns.extensions, path);
+    }
+    if (ageBoundaryCount > 0) {
+        printAgeTable(usage->ageBytes, path);
+    }
+    if (byOwner) {
+        printOwnerTable(scan->breakdowns.owners, path);
+    }
+}
+
+/* Called for every entry of a scan that has nested arguments. If this is
+   one of them, the scan starts collecting its lines and tables too. A link
+   is not read below the top, though it would be as an argument, so that
+   argument is left to be scanned on its own. */
+static void *startCapture(void *context, const struct FileEntry *fileEntry, bool isTopLevel)
+{
+    struct ArgumentScan *scan = (struct ArgumentScan *) context;
+    struct Breakdowns *breakdowns = &scan->breakdowns;
+    struct Capture *capture;
+    size_t i;
+
+    if (fileEntry->type == FILETYPE_LINK && !isTopLevel && !dereference) {
+        return NULL;
+    }
+    for (i = 0; i < scan->captureCount; i++) {
+        capture = scan->captures[i];
+        if (!capture->isReached && _wcsicmp(capture->root->scanPath, fileEntry->path) == 0) {
+            capture->isReached = true;
+            capture->outer = scan->innermost;
+            scan->innermost = capture;
+            capture->outerHistogram = breakdowns->histogram;
+            capture->outerExtensions = breakdowns->extensions;
+            capture->outerOwners = breakdowns->owners;
+            if (breakdowns->histogram != NULL) {
+                initHistogram(&capture->histogram);
+                breakdowns->histogram = &capture->histogram;
+            }
+            if (breakdowns->extensions != NULL) {
+                breakdowns->extensions = capture->extensions = initExtensionTable();
+            }
+            if (breakdowns->owners != NULL) {
+                breakdowns->owners = capture->owners = initOwnerTable();
             }
+            return capture;
         }
-        wprintf(L"%-7lu %ls\n", size, path);
     }
-    fflush(stdout);
+    return NULL;
 }
 
-unsigned long calcDiskUsage(wchar_t *path, bool isTopLevel) {
-    unsigned long size = 0;
-    List *entries;
-    List *entry;
+/* Prints the tables of the nested argument to its own output and adds them
+   to those of the scan around it. */
+static void finishCapture(struct ArgumentScan *scan, struct Capture *capture, const struct Usage *usage, bool isRead)
+{
+    OutputBuffer *output;
 
-    if (isFile(path)) {
-        size = getFileSize(path);
-        if (displayRegularFilesAlso || isTopLevel) {
-            printFileSize(path, size);
-        }
+    if (isRead) {
+        output = getThreadOutput();
+        setThreadOutput(capture->output);
+        printScanTables(scan, usage, capture->root->path);
+        setThreadOutput(output);
+    } else {
+        capture->isReached = false;
+        capture->output = initOutputBuffer();
+    }
+    if (capture->outerHistogram != NULL) {
+        mergeHistogram(capture->outerHistogram, &capture->histogram);
+    }
+    if (capture->outerExtensions != NULL) {
+        mergeExtensionTable(capture->outerExtensions, capture->extensions);
+    }
+    if (capture->outerOwners != NULL) {
+        mergeOwnerTable(capture->outerOwners, capture->owners);
+    }
+    scan->breakdowns.histogram = capture->outerHistogram;
+    scan->breakdowns.extensions = capture->outerExtensions;
+    scan->breakdowns.owners = capture->outerOwners;
+    scan->innermost = capture->outer;
+}
+
+/* Files are printed with -a, and so are links that are not followed. The
+   argument itself is always printed. */
+static void finishArgumentEntry(void *context, const struct ScanEntry *entry)
+{
+    struct ArgumentScan *scan = (struct ArgumentScan *) context;
+    struct Capture *capture = (struct Capture *) entry->cookie;
+    bool isShown;
+
+    if (entry->type == FILETYPE_FILE) {
+        isShown = displayRegularFilesAlso || entry->isTopLevel;
     } else {
-        entries = listFiles(path);
-        for (entry = entries; !isListEmpty(entry); entry = skipListItem(entry)) {
-            size += calcDiskUsage((wchar_t*) getListItem(entry), false);
+        isShown = displayRegularFilesAlso && entry->type == FILETYPE_LINK;
+    }
+    printEntry(scan, capture, entry->path, &entry->usage, isShown, true);
+    if (capture != NULL) {
+        finishCapture(scan, capture, &entry->usage, entry->isRead);
+    }
+}
+
+/* With -s only the argument itself is printed. */
+static void finishArgumentDirectory(void *context, const struct ScanEntry *entry)
+{
+    struct ArgumentScan *scan = (struct ArgumentScan *) context;
+    struct Capture *capture = (struct Capture *) entry->cookie;
+
+    printEntry(scan, capture, entry->path, &entry->usage, !summarize || entry->isTopLevel, true);
+    if (capture != NULL) {
+        finishCapture(scan, capture, &entry->usage, true);
+    }
+}
+
+/* With --by-age the bytes in each age bucket and with --time the newest
+   modification time come between the size and the path. */
+static const wchar_t *formatColumns(const struct Usage *usage, wchar_t *buffer, size_t capacity)
+{
+    wchar_t sizeText[SIZE_TEXT_CAPACITY];
+    wchar_t timeText[FILE_TIME_TEXT_CAPACITY];
+    const wchar_t *mark;
+    size_t length;
+    size_t i;
+
+    formatFileSize(usage->size, sizeText, SIZE_TEXT_CAPACITY);
+    mark = usage->isLowerBound ? LOWER_BOUND_MARK : L"";
+    if (humanReadable) {
+        _snwprintf(buffer, capacity, L"%ls%ls\t", mark, sizeText);
+    } else {
+        _snwprintf(buffer, capacity, L"%ls%-7ls ", mark, sizeText);
+    }
+    buffer[capacity - 1] = L'\0';
+    if (ageBoundaryCount > 0) {
+        for (i = 0; i <= ageBoundaryCount; i++) {
+            length = wcslen(buffer);
+            _snwprintf(buffer + length, capacity - length, L"%ls\t",
+                    formatFileSize(usage->ageBytes[i], sizeText, SIZE_TEXT_CAPACITY));
         }
-        if (!summarize || isTopLevel) {
-            printFileSize(path, size);
+    }
+    if (showTime) {
+        length = wcslen(buffer);
+        _snwprintf(buffer + length, capacity - length, L"%ls\t",
+                formatFileTime(usage->newestTime, timeText, FILE_TIME_TEXT_CAPACITY));
+    }
+    buffer[capacity - 1] = L'\0';
+    return buffer;
+}
+
+/* NULL output means the thread's own. */
+static void printFileSize(const wchar_t *path, const struct Usage *usage, OutputBuffer *output) {
+    wchar_t columns[COLUMNS_TEXT_CAPACITY];
+
+    formatColumns(usage, columns, COLUMNS_TEXT_CAPACITY);
+    if (output == NULL) {
+        clearProgressLine();
+        writeOutput(L"%ls%ls\n", columns, path);
+        fflush(stdout);
+    } else {
+        writeOutputTo(output, L"%ls%ls\n", columns, path);
+    }
+}
+
+/* isShown says whether the scan prints the entry, and isShownAsTop whether
+   it would if it were the argument, which is what the nested argument that
+   starts here needs. Each nested argument gets the path as it was given. */
+static void printEntry(struct ArgumentScan *scan, struct Capture *startedHere, const wchar_t *path,
+        const struct Usage *usage, bool isShown, bool isShownAsTop)
+{
+    struct Capture *capture;
+
+    if (isShown) {
+        printFileSize(path, usage, NULL);
+    }
+    for (capture = scan->innermost; capture != NULL; capture = capture->outer) {
+        if (capture == startedHere ? isShownAsTop : isShown) {
+            printFileSize(concat(capture->root->path, path + wcslen(capture->root->scanPath)), usage, capture->output);
         }
     }
-    return size;
 }
@@ -7,7 +7,6 @@
 extern bool		displayRegularFilesAlso;
 extern bool		displayBytes;
 extern bool		summarize;
-extern _TCHAR	*programName;
 
 #endif
 
@@ -1,28 +1,138 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
 #include <lmerr.h>
 #include "du.h"
+#include "args.h"
 #include "error.h"
+#include "progress.h"
 
 #define ERROR_TEXT_CAPACITY 128
+#define ERROR_LINE_CAPACITY 1024
 
-static void displayErrorText(DWORD errorCode);
+/* Must be a power of 2 so that the hash can be masked. There are only
+   a handful of distinct error codes in any real run. */
+#define ERROR_CACHE_CAPACITY 128
+
+struct ErrorCacheEntry {
+    bool used;
+    DWORD code;
+    const _TCHAR *text;     /* Message text with trailing line breaks removed */
+    unsigned long count;
+};
+
+const _TCHAR *programName = _T("du");
+
+static struct ErrorCacheEntry errorCache[ERROR_CACHE_CAPACITY];
+static CRITICAL_SECTION errorLock;
+static HMODULE netmsgModule = NULL;
+static bool netmsgLoadAttempted = false;
+static unsigned long errorCount = 0;
+static unsigned long displayedErrorCount = 0;
+static unsigned long suppressedErrorCount = 0;
+static DWORD handlerSlot = TLS_OUT_OF_INDEXES;
+static INIT_ONCE setupOnce = INIT_ONCE_STATIC_INIT;
+
+static const _TCHAR *getErrorText(DWORD errorCode);
+static const _TCHAR *formatErrorText(DWORD errorCode);
+static struct ErrorCacheEntry *findErrorCacheEntry(DWORD errorCode);
+static void writeErrorLine(const _TCHAR *format, ...);
+static void reportError(DWORD errorCode, const _TCHAR *line);
+static bool passToHandler(DWORD errorCode, const _TCHAR *message, const _TCHAR *object);
+static const _TCHAR *getProgramName();
+static void setUpErrorReporting();
+static BOOL CALLBACK createErrorLock(PINIT_ONCE once, PVOID parameter, PVOID *context);
+
+/* The lock and the handler slot are made by whichever thread first sets
+   a handler or reports something, so nothing has to be called before. */
+static void setUpErrorReporting()
+{
+    InitOnceExecuteOnce(&setupOnce, createErrorLock, NULL, NULL);
+}
+
+static BOOL CALLBACK createErrorLock(PINIT_ONCE once, PVOID parameter, PVOID *context)
+{
+    InitializeCriticalSection(&errorLock);
+    handlerSlot = TlsAlloc();
+    return TRUE;
+}
+
+/* NULL puts the thread back to printing its errors. The handler is not
+   copied, so it must outlive its use. */
+void setThreadErrorHandler(const struct ErrorHandler *handler)
+{
+    setUpErrorReporting();
+    if (handlerSlot != TLS_OUT_OF_INDEXES) {
+        TlsSetValue(handlerSlot, (LPVOID) handler);
+    }
+}
+
+const struct ErrorHandler *getThreadErrorHandler()
+{
+    const struct ErrorHandler *handler = NULL;
+
+    setUpErrorReporting();
+    if (handlerSlot != TLS_OUT_OF_INDEXES) {
+        handler = (const struct ErrorHandler *) TlsGetValue(handlerSlot);
+    }
+    return handler;
+}
+
+/* Returns false if the thread has no handler. */
+static bool passToHandler(DWORD errorCode, const _TCHAR *message, const _TCHAR *object)
+{
+    const struct ErrorHandler *handler;
+
+    if ((handler = getThreadErrorHandler()) == NULL || handler->callback == NULL) {
+        return false;
+    }
+    handler->callback(handler->context, errorCode, message, object);
+    return true;
+}
+
+/* The name that the errors of this thread are printed with. */
+static const _TCHAR *getProgramName()
+{
+    const struct ErrorHandler *handler;
+
+    if ((handler = getThreadErrorHandler()) != NULL && handler->programName != NULL) {
+        return handler->programName;
+    }
+    return programName;
+}
 
 /* This function was taken from Microsoft's Knowledge Base Article 149409
-   and modified to fix the formatting. */
-void displayErrorText(DWORD errorCode)
+   and modified to fix the formatting. It is only called once per distinct
+   error code because the result is cached by getErrorText. Must be called
+   with errorLock held. */
+static const _TCHAR *formatErrorText(DWORD errorCode)
 {
-    HMODULE moduleHandle = NULL; /* default to system source */
     _TCHAR* message;
+    _TCHAR* text;
     DWORD bufferLength;
+    HMODULE moduleHandle = NULL; /* default to system source */
 
-    /* If errorCode is in the network range, load the message source */
+    if ((errorCode & ERRNO_ERROR_FLAG) != 0) {
+        text = (_TCHAR *) malloc(ERROR_TEXT_CAPACITY * sizeof(_TCHAR));
+        if (text != NULL) {
+            _tcserror_s(text, ERROR_TEXT_CAPACITY, (int) (errorCode & ~ERRNO_ERROR_FLAG));
+        }
+        return text;
+    }
+
+    /* If errorCode is in the network range, load the message source. It
+       is kept loaded for the rest of the run. */
     if (errorCode >= NERR_BASE && errorCode <= MAX_NERR) {
-        moduleHandle = LoadLibraryEx(_T("netmsg.dll"), NULL, LOAD_LIBRARY_AS_DATAFILE);
-        if (moduleHandle == NULL) {
-            /* Can't call writeLastError because that could cause an infinite recursive failure loop. */
-            _ftprintf(stderr, _T("failed to load library netmsg.dll: error number %lu\n"), GetLastError());
+        if (!netmsgLoadAttempted) {
+            netmsgLoadAttempted = true;
+            netmsgModule = LoadLibraryEx(_T("netmsg.dll"), NULL, LOAD_LIBRARY_AS_DATAFILE);
+            if (netmsgModule == NULL) {
+                /* Can't call writeLastError because that could cause an infinite recursive failure loop. */
+                writeErrorLine(_T("%ls: failed to load library netmsg.dll: error number %lu\n"), getProgramName(), GetLastError());
+            }
         }
+        moduleHandle = netmsgModule;
     }
 
     /* Call FormatMessage() to allow for message text to be acquired
@@ -40,52 +150,212 @@ void displayErrorText(DWORD errorCode)
                        NULL);
 
     if (bufferLength) {
-        /* Output message string on stderr */
-        _ftprintf(stderr, message);
-        /* WriteFile(GetStdHandle(STD_ERROR_HANDLE), message, bufferLength, &numberOfBytesWritten, NULL); */
+        /* Strip the line break so the text can be embedded in a line. */
+        while (bufferLength > 0 && (message[bufferLength - 1] == _T('\n') || message[bufferLength - 1] == _T('\r'))) {
+            message[--bufferLength] = _T('\0');
+        }
+        text = _tcsdup(message);
         /* Free the buffer allocated by the system */
         LocalFree(message);
+    } else {
+        text = (_TCHAR *) malloc(ERROR_TEXT_CAPACITY * sizeof(_TCHAR));
+        if (text != NULL) {
+            _sntprintf(text, ERROR_TEXT_CAPACITY, _T("error number %lu"), errorCode);
+            text[ERROR_TEXT_CAPACITY - 1] = _T('\0');
+        }
+    }
+    return text;
+}
+
+/* Must be called with errorLock held. Returns NULL only if the cache is full. */
+static struct ErrorCacheEntry *findErrorCacheEntry(DWORD errorCode)
+{
+    unsigned i;
+    unsigned probes;
+    struct ErrorCacheEntry *entry = NULL;
+
+    i = (unsigned) (errorCode * 2654435761UL) & (ERROR_CACHE_CAPACITY - 1);
+    for (probes = 0; probes < ERROR_CACHE_CAPACITY && entry == NULL; probes++) {
+        if (!errorCache[i].used) {
+            errorCache[i].used = true;
+            errorCache[i].code = errorCode;
+            errorCache[i].text = formatErrorText(errorCode);
+            errorCache[i].count = 0;
+            entry = &errorCache[i];
+        } else if (errorCache[i].code == errorCode) {
+            entry = &errorCache[i];
+        }
+        i = (i + 1) & (ERROR_CACHE_CAPACITY - 1);
+    }
+    return entry;
+}
+
+/* Must be called with errorLock held. */
+static const _TCHAR *getErrorText(DWORD errorCode)
+{
+    struct ErrorCacheEntry *entry;
+    const _TCHAR *text = NULL;
+
+    if ((entry = findErrorCacheEntry(errorCode)) != NULL) {
+        text = entry->text;
     }
-    /* If you loaded a message source, unload it */
-    if (moduleHandle != NULL) {
-        FreeLibrary(moduleHandle);
+    if (text == NULL) {
+        text = _T("unknown error");
     }
+    return text;
 }
 
+/* Formats the whole line first and writes it with one call so that lines
+   from different threads never interleave. A status line from --progress
+   is cleared first, and drawn again by the reporter at its next turn. */
+static void writeErrorLine(const _TCHAR *format, ...)
+{
+    _TCHAR line[ERROR_LINE_CAPACITY];
+    va_list args;
+
+    va_start(args, format);
+    _vsntprintf(line, ERROR_LINE_CAPACITY, format, args);
+    va_end(args);
+    line[ERROR_LINE_CAPACITY - 1] = _T('\0');
+    writeOverProgressLine(line);
+}
+
+/* The errno value is counted and limited like a system error code, with
+   ERRNO_ERROR_FLAG set so that the two kinds of code are kept apart. */
 void writeError(errno_t errorCode, const _TCHAR* message, const _TCHAR* object)
 {
-    _TCHAR errorText[ERROR_TEXT_CAPACITY];
+    _TCHAR line[ERROR_LINE_CAPACITY];
 
-    _tcserror_s(errorText, ERROR_TEXT_CAPACITY, errorCode);
-    _ftprintf(stderr, _TEXT("%ls: %ls: \"%ls\": %ls\n"), programName, message, object, errorText);
+    if (passToHandler(ERRNO_ERROR_FLAG | (DWORD) errorCode, message, object)) {
+        return;
+    }
+    _sntprintf(line, ERROR_LINE_CAPACITY, _TEXT("%ls: %ls: \"%ls\": "), getProgramName(), message, object);
+    line[ERROR_LINE_CAPACITY - 1] = _T('\0');
+    reportError(ERRNO_ERROR_FLAG | (DWORD) errorCode, line);
 }
 
 void writeError2(errno_t errorCode, const _TCHAR* message, const _TCHAR* object1, const _TCHAR* object2)
 {
-    _TCHAR errorText[ERROR_TEXT_CAPACITY];
+    _TCHAR line[ERROR_LINE_CAPACITY];
 
-    _tcserror_s(errorText, ERROR_TEXT_CAPACITY, errorCode);
-    _ftprintf(stderr, _TEXT("%ls: %ls: \"%ls\" and \"%ls\": %ls\n"), programName, message, object1, object2, errorText);
+    _sntprintf(line, ERROR_LINE_CAPACITY, _TEXT("\"%ls\" and \"%ls\""), object1, object2);
+    line[ERROR_LINE_CAPACITY - 1] = _T('\0');
+    if (passToHandler(ERRNO_ERROR_FLAG | (DWORD) errorCode, message, line)) {
+        return;
+    }
+    _sntprintf(line, ERROR_LINE_CAPACITY, _TEXT("%ls: %ls: \"%ls\" and \"%ls\": "), getProgramName(), message, object1, object2);
+    line[ERROR_LINE_CAPACITY - 1] = _T('\0');
+    reportError(ERRNO_ERROR_FLAG | (DWORD) errorCode, line);
 }
 
 void writeError3(errno_t errorCode, const _TCHAR* message, const _TCHAR* object1, const _TCHAR* object2, const _TCHAR* object3)
 {
-    _TCHAR errorText[ERROR_TEXT_CAPACITY];
+    _TCHAR line[ERROR_LINE_CAPACITY];
 
-    _tcserror_s(errorText, ERROR_TEXT_CAPACITY, errorCode);
-    _ftprintf(stderr, _TEXT("%ls: %ls: \"%ls\", \"%ls\" and \"%ls\": %ls\n"), programName, message, object1, object2, object3, errorText);
+    _sntprintf(line, ERROR_LINE_CAPACITY, _TEXT("\"%ls\", \"%ls\" and \"%ls\""), object1, object2, object3);
+    line[ERROR_LINE_CAPACITY - 1] = _T('\0');
+    if (passToHandler(ERRNO_ERROR_FLAG | (DWORD) errorCode, message, line)) {
+        return;
+    }
+    _sntprintf(line, ERROR_LINE_CAPACITY, _TEXT("%ls: %ls: \"%ls\", \"%ls\" and \"%ls\": "),
+            getProgramName(), message, object1, object2, object3);
+    line[ERROR_LINE_CAPACITY - 1] = _T('\0');
+    reportError(ERRNO_ERROR_FLAG | (DWORD) errorCode, line);
+}
+
+/* For conditions that are worth mentioning but are not errors. */
+void writeWarning(const _TCHAR* message, const _TCHAR* object)
+{
+    if (passToHandler(0, message, object)) {
+        return;
+    }
+    setUpErrorReporting();
+    EnterCriticalSection(&errorLock);
+    if (!quietErrors) {
+        writeErrorLine(_TEXT("%ls: WARNING: %ls: %ls\n"), getProgramName(), message, object);
+    }
+    LeaveCriticalSection(&errorLock);
+}
+
+/* Counts the error against its code and decides whether it gets displayed,
+   according to --quiet-errors and --max-errors. The line argument holds
+   everything that goes before the error text. */
+static void reportError(DWORD errorCode, const _TCHAR *line)
+{
+    struct ErrorCacheEntry *entry;
+
+    setUpErrorReporting();
+    EnterCriticalSection(&errorLock);
+    errorCount++;
+    if ((entry = findErrorCacheEntry(errorCode)) != NULL) {
+        entry->count++;
+    }
+    if (quietErrors || (maxErrors > 0 && displayedErrorCount >= maxErrors)) {
+        if (!quietErrors && suppressedErrorCount == 0) {
+            writeErrorLine(_T("%ls: more than %lu errors, further errors are only counted\n"), getProgramName(), maxErrors);
+        }
+        suppressedErrorCount++;
+    } else {
+        displayedErrorCount++;
+        writeErrorLine(_T("%ls%ls\n"), line, getErrorText(errorCode));
+    }
+    LeaveCriticalSection(&errorLock);
 }
 
 void writeLastError(DWORD lastError, const _TCHAR* message, const _TCHAR* object)
 {
-    _ftprintf(stderr, _TEXT("%ls: %ls: %ls: "), programName, message, object);
-    displayErrorText(lastError);
-    /* _ftprintf(stderr, _TEXT("\n")); */
-    fflush(stderr);
+    _TCHAR line[ERROR_LINE_CAPACITY];
+
+    if (passToHandler(lastError, message, object)) {
+        return;
+    }
+    _sntprintf(line, ERROR_LINE_CAPACITY, _TEXT("%ls: %ls: %ls: "), getProgramName(), message, object);
+    line[ERROR_LINE_CAPACITY - 1] = _T('\0');
+    reportError(lastError, line);
 }
 
 void writeLastError2(DWORD lastError, const TCHAR* message, const TCHAR* object1, const TCHAR *object2)
 {
-    _ftprintf(stderr, _TEXT("%ls: %ls: %ls and %ls: "), programName, message, object1, object2);
-    displayErrorText(lastError);
+    _TCHAR line[ERROR_LINE_CAPACITY];
+
+    _sntprintf(line, ERROR_LINE_CAPACITY, _TEXT("%ls and %ls"), object1, object2);
+    line[ERROR_LINE_CAPACITY - 1] = _T('\0');
+    if (passToHandler(lastError, message, line)) {
+        return;
+    }
+    _sntprintf(line, ERROR_LINE_CAPACITY, _TEXT("%ls: %ls: %ls and %ls: "), getProgramName(), message, object1, object2);
+    line[ERROR_LINE_CAPACITY - 1] = _T('\0');
+    reportError(lastError, line);
+}
+
+unsigned long getErrorCount()
+{
+    unsigned long count;
+
+    setUpErrorReporting();
+    EnterCriticalSection(&errorLock);
+    count = errorCount;
+    LeaveCriticalSection(&errorLock);
+    return count;
+}
+
+/* Prints how many times each error occurred. Only needed when some errors
+   were not displayed or when there were enough of them to be worth adding up. */
+void writeErrorSummary()
+{
+    unsigned i;
+
+    setUpErrorReporting();
+    EnterCriticalSection(&errorLock);
+    if (suppressedErrorCount > 0 || errorCount > 1) {
+        writeErrorLine(_T("%ls: %lu errors (%lu not displayed):\n"), getProgramName(), errorCount, suppressedErrorCount);
+        for (i = 0; i < ERROR_CACHE_CAPACITY; i++) {
+            if (errorCache[i].used && errorCache[i].count > 0) {
+                writeErrorLine(_T("%ls: %10lu  %ls\n"), getProgramName(), errorCache[i].count,
+                        errorCache[i].text != NULL ? errorCache[i].text : _T("unknown error"));
+            }
+        }
+    }
+    fflush(stderr);
+    LeaveCriticalSection(&errorLock);
 }
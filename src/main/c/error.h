@@ -6,11 +6,36 @@
 #include <errno.h>
 #include <windows.h>
 
+/* Error codes with this bit set are errno values rather than system
+   error codes. Windows leaves the bit to applications. */
+#define ERRNO_ERROR_FLAG 0x20000000UL
+
+/* Takes the errors and warnings of one thread instead of their being
+   printed and counted. errorCode is 0 for a warning, and has
+   ERRNO_ERROR_FLAG set for an errno value. */
+typedef void (*ErrorCallback)(void *context, unsigned long errorCode, const _TCHAR *message, const _TCHAR *object);
+
+/* Without a callback, errors are printed and counted with programName
+   in front, or the handler's own name if it has one. */
+struct ErrorHandler {
+    ErrorCallback callback;
+    void *context;
+    const _TCHAR *programName;      /* NULL for programName */
+};
+
+/* What printed errors start with. "du" until the program sets it. */
+extern const _TCHAR *programName;
+
 extern void writeError(errno_t errorCode, const _TCHAR* message, const _TCHAR* object);
 extern void writeError2(errno_t errorCode, const _TCHAR* message, const _TCHAR* object1, const _TCHAR* object2);
 extern void writeError3(errno_t errorCode, const _TCHAR* message, const _TCHAR* object1, const _TCHAR* object2, const _TCHAR* object3);
 extern void writeLastError(DWORD lastError, const _TCHAR* message, const _TCHAR* object);
 extern void writeLastError2(DWORD lastError, const TCHAR *message, const TCHAR *object1, const TCHAR *object2);
+extern void writeWarning(const _TCHAR* message, const _TCHAR* object);
+extern void setThreadErrorHandler(const struct ErrorHandler *handler);
+extern const struct ErrorHandler *getThreadErrorHandler();
+extern unsigned long getErrorCount();
+extern void writeErrorSummary();
 
 #endif
 
@@ -0,0 +1,311 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>       /* sqrt */
+#include <errno.h>
+#include <windows.h>
+#include <gc.h>
+#include "estimate.h"
+#include "filename.h"
+#include "format.h"
+#include "string.h"
+#include "error.h"
+#include "args.h"
+#include "deadline.h"
+#include "output.h"
+
+/* Probing stops early once the 95% margin of error is this small. */
+#define TARGET_RELATIVE_MARGIN 0.01
+#define MIN_PROBES_FOR_EARLY_STOP 30
+#define Z_95_PERCENT 1.96
+
+/* A directory seen by at least one probe. Directory listings are kept so
+   that later probes only pay for the levels nobody has visited yet. Once
+   every directory below a node has been listed the node is complete and
+   its totals are exact. */
+struct ProbeNode {
+    const wchar_t *path;
+    struct ProbeNode *parent;
+    size_t indexInParent;
+    bool isListed;
+    bool isComplete;
+    int64_t fileBytes;          /* Files directly in this directory */
+    uint64_t fileCount;
+    struct ProbeNode **children;
+    size_t childCount;
+    size_t completeChildren;    /* The first completeChildren children are complete */
+    int64_t completeBytes;      /* Subtree totals of the complete children */
+    uint64_t completeFiles;
+    uint64_t completeDirectories;
+};
+
+/* Running sums for the mean and variance of the probe results. */
+struct Samples {
+    unsigned long count;
+    double sum;
+    double sumOfSquares;
+};
+
+static uint64_t nextRandom(uint64_t *state);
+static struct ProbeNode *newProbeNode(const wchar_t *path, struct ProbeNode *parent, size_t indexInParent);
+static void listProbeNode(struct ProbeNode *node, const struct ListingOptions *listing);
+static void markChildComplete(struct ProbeNode *parent, struct ProbeNode *child);
+static void setComplete(struct ProbeNode *node);
+static struct ProbeNode *probe(struct ProbeNode *root, const struct ListingOptions *listing, uint64_t *randomState,
+        double *bytes, double *files);
+static void addSample(struct Samples *samples, double value);
+static double getMean(const struct Samples *samples);
+static double getMargin(const struct Samples *samples);
+static double getRelativeMargin(const struct Samples *samples);
+static void printEstimate(const wchar_t *path, double bytes, double bytesMargin, double files, double filesMargin);
+
+/* xorshift64*, which is plenty for choosing directories. Each estimate
+   has its own state so that estimates can run on several threads. */
+static uint64_t nextRandom(uint64_t *state)
+{
+    LARGE_INTEGER counter;
+
+    if (*state == 0) {
+        QueryPerformanceCounter(&counter);
+        *state = ((uint64_t) counter.QuadPart ^ GetTickCount64() ^ (uintptr_t) state) | 1;
+    }
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static struct ProbeNode *newProbeNode(const wchar_t *path, struct ProbeNode *parent, size_t indexInParent)
+{
+    struct ProbeNode *node;
+
+    if ((node = (struct ProbeNode *) GC_MALLOC(sizeof(struct ProbeNode))) == NULL) {
+        writeError(errno, L"Failed to allocate memory for estimate of", path);
+        exit(EXIT_FAILURE);
+    }
+    node->path = path;
+    node->parent = parent;
+    node->indexInParent = indexInParent;
+    node->isListed = false;
+    node->isComplete = false;
+    node->fileBytes = 0;
+    node->fileCount = 0;
+    node->children = NULL;
+    node->childCount = 0;
+    node->completeChildren = 0;
+    node->completeBytes = 0;
+    node->completeFiles = 0;
+    node->completeDirectories = 0;
+    return node;
+}
+
+/* Uses the same enumeration as the exact scan, so exclusions apply. Links
+   to directories are never followed here because a probe has no way to
+   notice that it is going around a loop. */
+static void listProbeNode(struct ProbeNode *node, const struct ListingOptions *listing)
+{
+    DirectoryReader *reader;
+    struct FileEntry *batch;
+    size_t batchSize;
+    size_t capacity = 0;
+    size_t i;
+
+    if ((reader = openDirectory(node->path, listing)) != NULL) {
+        while ((batch = readDirectory(reader, &batchSize)) != NULL) {
+            for (i = 0; i < batchSize; i++) {
+                switch (batch[i].type) {
+                case FILETYPE_FILE:
+                    node->fileBytes += getEntrySize(&batch[i], chooseTallySize(), listing->dereference);
+                    node->fileCount++;
+                    break;
+                case FILETYPE_DIRECTORY:
+                    if (node->childCount == capacity) {
+                        capacity = capacity == 0 ? 8 : capacity * 2;
+                        node->children = (struct ProbeNode **) GC_REALLOC(node->children, capacity * sizeof(struct ProbeNode *));
+                        if (node->children == NULL) {
+                            writeError(errno, L"Failed to allocate memory for estimate of", node->path);
+                            exit(EXIT_FAILURE);
+                        }
+                    }
+                    node->children[node->childCount] = newProbeNode(createStringCopy(batch[i].path), node, node->childCount);
+                    node->childCount++;
+                    break;
+                default:
+                    break;
+                }
+            }
+        }
+        closeDirectory(reader);
+    }
+    node->isListed = true;
+    if (node->childCount == 0) {
+        setComplete(node);
+    }
+}
+
+static void setComplete(struct ProbeNode *node)
+{
+    node->isComplete = true;
+    node->completeBytes += node->fileBytes;
+    node->completeFiles += node->fileCount;
+    node->completeDirectories += 1;
+}
+
+/* Moves the child into the complete part of its parent's child array. */
+static void markChildComplete(struct ProbeNode *parent, struct ProbeNode *child)
+{
+    struct ProbeNode *swapped;
+    size_t target;
+
+    target = parent->completeChildren;
+    swapped = parent->children[target];
+    parent->children[target] = child;
+    parent->children[child->indexInParent] = swapped;
+    swapped->indexInParent = child->indexInParent;
+    child->indexInParent = target;
+    parent->completeChildren++;
+    parent->completeBytes += child->completeBytes;
+    parent->completeFiles += child->completeFiles;
+    parent->completeDirectories += child->completeDirectories;
+    if (parent->completeChildren == parent->childCount) {
+        setComplete(parent);
+    }
+}
+
+/* One random walk from the root to a leaf or a complete subtree. At each
+   level the complete children are added exactly and one of the others is
+   chosen at random to stand for all of them, in the manner of Knuth's
+   estimate of the size of a backtrack tree. Each probe is an unbiased
+   estimate of the totals. Returns the node where the walk ended. */
+static struct ProbeNode *probe(struct ProbeNode *root, const struct ListingOptions *listing, uint64_t *randomState,
+        double *bytes, double *files)
+{
+    struct ProbeNode *node;
+    double weight = 1.0;
+    size_t incompleteChildren;
+
+    *bytes = 0.0;
+    *files = 0.0;
+    node = root;
+    for (;;) {
+        if (!node->isListed) {
+            listProbeNode(node, listing);
+        }
+        if (node->isComplete) {
+            *bytes += weight * node->completeBytes;
+            *files += weight * node->completeFiles;
+            break;
+        }
+        *bytes += weight * (node->fileBytes + node->completeBytes);
+        *files += weight * (node->fileCount + node->completeFiles);
+        incompleteChildren = node->childCount - node->completeChildren;
+        weight *= incompleteChildren;
+        node = node->children[node->completeChildren + nextRandom(randomState) % incompleteChildren];
+    }
+    return node;
+}
+
+static void addSample(struct Samples *samples, double value)
+{
+    samples->count++;
+    samples->sum += value;
+    samples->sumOfSquares += value * value;
+}
+
+static double getMean(const struct Samples *samples)
+{
+    return samples->count == 0 ? 0.0 : samples->sum / samples->count;
+}
+
+/* Half width of the 95% confidence interval of the mean. */
+static double getMargin(const struct Samples *samples)
+{
+    double mean;
+    double variance;
+
+    if (samples->count < 2) {
+        return 0.0;
+    }
+    mean = getMean(samples);
+    variance = (samples->sumOfSquares - samples->count * mean * mean) / (samples->count - 1);
+    if (variance < 0.0) {
+        variance = 0.0;     /* Rounding */
+    }
+    return Z_95_PERCENT * sqrt(variance / samples->count);
+}
+
+static double getRelativeMargin(const struct Samples *samples)
+{
+    double mean;
+
+    mean = getMean(samples);
+    return mean > 0.0 ? getMargin(samples) / mean : 0.0;
+}
+
+static void printEstimate(const wchar_t *path, double bytes, double bytesMargin, double files, double filesMargin)
+{
+    wchar_t sizeText[SIZE_TEXT_CAPACITY];
+    double bytesPercent;
+    double filesPercent;
+
+    bytesPercent = bytes > 0.0 ? 100.0 * bytesMargin / bytes : 0.0;
+    filesPercent = files > 0.0 ? 100.0 * filesMargin / files : 0.0;
+    formatFileSize((int64_t) (bytes + 0.5), sizeText, SIZE_TEXT_CAPACITY);
+    if (humanReadable) {
+        writeOutput(L"%ls\t+/-%.1f%%\t%.0f files +/-%.1f%%\t%ls\n", sizeText, bytesPercent, files, filesPercent, path);
+    } else {
+        writeOutput(L"%-7ls +/-%.1f%%\t%.0f files +/-%.1f%%\t%ls\n", sizeText, bytesPercent, files, filesPercent, path);
+    }
+    fflush(stdout);
+}
+
+/* Probes the tree below path until the time limit is reached, the margin
+   of error is small enough, or the whole tree has been listed, in which
+   case the result is exact. The deadline, which may be NULL, stops it
+   too. */
+void estimateDiskUsage(const wchar_t *path, unsigned long seconds, Deadline *deadline)
+{
+    struct ProbeNode *root;
+    struct ProbeNode *node;
+    struct FileEntry entry;
+    struct Samples byteSamples = { 0, 0.0, 0.0 };
+    struct Samples fileSamples = { 0, 0.0, 0.0 };
+    struct ListingOptions listing;
+    ULONGLONG endTime;
+    uint64_t randomState = 0;
+    double bytes;
+    double files;
+
+    chooseListingOptions(&listing);
+    listing.deadline = deadline;
+    if (!getFileEntry(path, &entry)) {
+        return;
+    }
+    if (entry.type == FILETYPE_FILE) {
+        printEstimate(path, (double) getEntrySize(&entry, chooseTallySize(), listing.dereference), 0.0, 1.0, 0.0);
+        return;
+    }
+    endTime = GetTickCount64() + (ULONGLONG) seconds * 1000;
+    root = newProbeNode(path, NULL, 0);
+    do {
+        node = probe(root, &listing, &randomState, &bytes, &files);
+        addSample(&byteSamples, bytes);
+        addSample(&fileSamples, files);
+        /* Pass completion up as far as it goes. */
+        while (node->isComplete && node->parent != NULL && node->indexInParent >= node->parent->completeChildren) {
+            markChildComplete(node->parent, node);
+            node = node->parent;
+        }
+    } while (!root->isComplete
+             && GetTickCount64() < endTime
+             && !isPastDeadline(deadline)
+             && (byteSamples.count < MIN_PROBES_FOR_EARLY_STOP
+                 || getRelativeMargin(&byteSamples) > TARGET_RELATIVE_MARGIN));
+
+    if (root->isComplete) {
+        printEstimate(path, (double) root->completeBytes, 0.0, (double) root->completeFiles, 0.0);
+    } else {
+        printEstimate(path, getMean(&byteSamples), getMargin(&byteSamples),
+                      getMean(&fileSamples), getMargin(&fileSamples));
+    }
+}
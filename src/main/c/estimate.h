@@ -0,0 +1,11 @@
+#ifndef ESTIMATE_H_LKJHGF
+#define ESTIMATE_H_LKJHGF
+
+#include <wchar.h>
+#include "deadline.h"
+
+#define DEFAULT_ESTIMATE_SECONDS 10
+
+extern void estimateDiskUsage(const wchar_t *path, unsigned long seconds, Deadline *deadline);
+
+#endif
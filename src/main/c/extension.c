@@ -0,0 +1,250 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <wctype.h>     /* towlower */
+#include <errno.h>
+#include <gc.h>
+#include "extension.h"
+#include "format.h"
+#include "error.h"
+#include "output.h"
+
+#define INITIAL_EXTENSION_CAPACITY 256
+#define TOP_EXTENSION_COUNT 10
+#define NO_EXTENSION L"(none)"
+
+struct ExtensionEntry {
+    const wchar_t *extension;   /* Lower case, NULL for an empty slot */
+    unsigned long hash;
+    uint64_t fileCount;
+    int64_t byteTotal;
+};
+
+struct ExtensionTable {
+    struct ExtensionEntry *entries;     /* Open addressing */
+    size_t capacity;
+    size_t count;
+};
+
+static const wchar_t *findExtension(const wchar_t *path);
+static unsigned long hashExtension(const wchar_t *extension);
+static bool isSameExtension(const wchar_t *interned, const wchar_t *extension);
+static struct ExtensionEntry *findEntry(ExtensionTable *table, const wchar_t *extension, unsigned long hash);
+static void growExtensionTable(ExtensionTable *table);
+static void addEntry(ExtensionTable *table, const wchar_t *extension, unsigned long hash, uint64_t fileCount, int64_t byteTotal);
+static struct ExtensionEntry **sortEntries(const ExtensionTable *table, int (*compare)(const void *, const void *));
+static int compareByBytes(const void *left, const void *right);
+static int compareByCount(const void *left, const void *right);
+static void printTop(struct ExtensionEntry **sorted, size_t count, const wchar_t *title);
+
+ExtensionTable *initExtensionTable()
+{
+    ExtensionTable *table;
+
+    if ((table = (ExtensionTable *) GC_MALLOC(sizeof(ExtensionTable))) == NULL) {
+        writeError(errno, L"Failed to allocate memory for", L"extension table");
+        exit(EXIT_FAILURE);
+    }
+    table->capacity = INITIAL_EXTENSION_CAPACITY;
+    table->count = 0;
+    table->entries = (struct ExtensionEntry *) GC_MALLOC(table->capacity * sizeof(struct ExtensionEntry));
+    if (table->entries == NULL) {
+        writeError(errno, L"Failed to allocate memory for", L"extension table");
+        exit(EXIT_FAILURE);
+    }
+    return table;
+}
+
+/* Points into path, after the last dot of the file name. A name that only
+   starts with a dot, like .gitignore, has no extension. */
+static const wchar_t *findExtension(const wchar_t *path)
+{
+    const wchar_t *name = path;
+    const wchar_t *dot = NULL;
+    const wchar_t *p;
+
+    for (p = path; *p != L'\0'; p++) {
+        if (*p == L'\\' || *p == L'/') {
+            name = p + 1;
+            dot = NULL;
+        } else if (*p == L'.') {
+            dot = p;
+        }
+    }
+    return dot == NULL || dot == name ? L"" : dot + 1;
+}
+
+/* FNV-1a over the lower case form, like the pattern table. */
+static unsigned long hashExtension(const wchar_t *extension)
+{
+    unsigned long hash = 2166136261UL;
+    const wchar_t *p;
+
+    for (p = extension; *p != L'\0'; p++) {
+        hash ^= (unsigned long) towlower(*p);
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+static bool isSameExtension(const wchar_t *interned, const wchar_t *extension)
+{
+    while (*interned != L'\0' && *interned == (wchar_t) towlower(*extension)) {
+        interned++;
+        extension++;
+    }
+    return *interned == L'\0' && *extension == L'\0';
+}
+
+/* Returns the entry for the extension or the empty slot where it belongs. */
+static struct ExtensionEntry *findEntry(ExtensionTable *table, const wchar_t *extension, unsigned long hash)
+{
+    struct ExtensionEntry *entry;
+    size_t index;
+
+    index = hash & (table->capacity - 1);
+    for (;;) {
+        entry = &table->entries[index];
+        if (entry->extension == NULL
+                || (entry->hash == hash && isSameExtension(entry->extension, extension))) {
+            return entry;
+        }
+        index = (index + 1) & (table->capacity - 1);
+    }
+}
+
+static void growExtensionTable(ExtensionTable *table)
+{
+    struct ExtensionEntry *oldEntries;
+    size_t oldCapacity;
+    size_t i;
+
+    oldEntries = table->entries;
+    oldCapacity = table->capacity;
+    table->capacity *= 2;
+    table->count = 0;
+    table->entries = (struct ExtensionEntry *) GC_MALLOC(table->capacity * sizeof(struct ExtensionEntry));
+    if (table->entries == NULL) {
+        writeError(errno, L"Failed to allocate memory for", L"extension table");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < oldCapacity; i++) {
+        if (oldEntries[i].extension != NULL) {
+            addEntry(table, oldEntries[i].extension, oldEntries[i].hash,
+                     oldEntries[i].fileCount, oldEntries[i].byteTotal);
+        }
+    }
+}
+
+static void addEntry(ExtensionTable *table, const wchar_t *extension, unsigned long hash, uint64_t fileCount, int64_t byteTotal)
+{
+    struct ExtensionEntry *entry;
+    wchar_t *interned;
+    size_t length;
+    size_t i;
+
+    entry = findEntry(table, extension, hash);
+    if (entry->extension == NULL) {
+        if ((table->count + 1) * 4 > table->capacity * 3) {
+            growExtensionTable(table);
+            entry = findEntry(table, extension, hash);
+        }
+        length = wcslen(extension);
+        if ((interned = (wchar_t *) GC_MALLOC_ATOMIC((length + 1) * sizeof(wchar_t))) == NULL) {
+            writeError(errno, L"Failed to allocate memory for extension", extension);
+            exit(EXIT_FAILURE);
+        }
+        for (i = 0; i <= length; i++) {
+            interned[i] = (wchar_t) towlower(extension[i]);
+        }
+        entry->extension = interned;
+        entry->hash = hash;
+        table->count++;
+    }
+    entry->fileCount += fileCount;
+    entry->byteTotal += byteTotal;
+}
+
+void addToExtensionTable(ExtensionTable *table, const wchar_t *path, int64_t size)
+{
+    const wchar_t *extension;
+
+    extension = findExtension(path);
+    addEntry(table, extension, hashExtension(extension), 1, size);
+}
+
+void mergeExtensionTable(ExtensionTable *total, const ExtensionTable *part)
+{
+    size_t i;
+
+    for (i = 0; i < part->capacity; i++) {
+        if (part->entries[i].extension != NULL) {
+            addEntry(total, part->entries[i].extension, part->entries[i].hash,
+                     part->entries[i].fileCount, part->entries[i].byteTotal);
+        }
+    }
+}
+
+static struct ExtensionEntry **sortEntries(const ExtensionTable *table, int (*compare)(const void *, const void *))
+{
+    struct ExtensionEntry **sorted;
+    size_t count = 0;
+    size_t i;
+
+    if ((sorted = (struct ExtensionEntry **) GC_MALLOC((table->count + 1) * sizeof(struct ExtensionEntry *))) == NULL) {
+        writeError(errno, L"Failed to allocate memory for", L"extension table");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < table->capacity; i++) {
+        if (table->entries[i].extension != NULL) {
+            sorted[count++] = &table->entries[i];
+        }
+    }
+    qsort(sorted, count, sizeof(struct ExtensionEntry *), compare);
+    return sorted;
+}
+
+static int compareByBytes(const void *left, const void *right)
+{
+    const struct ExtensionEntry *a = *(const struct ExtensionEntry **) left;
+    const struct ExtensionEntry *b = *(const struct ExtensionEntry **) right;
+
+    if (a->byteTotal != b->byteTotal) {
+        return a->byteTotal > b->byteTotal ? -1 : 1;
+    }
+    return wcscmp(a->extension, b->extension);
+}
+
+static int compareByCount(const void *left, const void *right)
+{
+    const struct ExtensionEntry *a = *(const struct ExtensionEntry **) left;
+    const struct ExtensionEntry *b = *(const struct ExtensionEntry **) right;
+
+    if (a->fileCount != b->fileCount) {
+        return a->fileCount > b->fileCount ? -1 : 1;
+    }
+    return wcscmp(a->extension, b->extension);
+}
+
+static void printTop(struct ExtensionEntry **sorted, size_t count, const wchar_t *title)
+{
+    wchar_t sizeText[SIZE_TEXT_CAPACITY];
+    size_t i;
+
+    writeOutput(L"  %ls\n", title);
+    writeOutput(L"  %-16ls %12ls %12ls\n", L"Extension", L"Files", L"Total");
+    for (i = 0; i < count && i < TOP_EXTENSION_COUNT; i++) {
+        formatFileSize(sorted[i]->byteTotal, sizeText, SIZE_TEXT_CAPACITY);
+        writeOutput(L"  %-16ls %12llu %12ls\n",
+                *sorted[i]->extension == L'\0' ? NO_EXTENSION : sorted[i]->extension,
+                (unsigned long long) sorted[i]->fileCount, sizeText);
+    }
+}
+
+void printExtensionTable(const ExtensionTable *table, const wchar_t *path)
+{
+    writeOutput(L"Extensions in %ls (%lu distinct):\n", path, (unsigned long) table->count);
+    printTop(sortEntries(table, compareByBytes), table->count, L"Largest by size");
+    printTop(sortEntries(table, compareByCount), table->count, L"Largest by number of files");
+    fflush(stdout);
+}
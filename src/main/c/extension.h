@@ -0,0 +1,18 @@
+#ifndef EXTENSION_H_TGBYHN
+#define EXTENSION_H_TGBYHN
+
+#include <stdint.h>
+#include <wchar.h>
+
+/* Number of files and bytes per file name extension. Each distinct
+   extension is copied once, when it is first seen. */
+typedef
+    struct ExtensionTable /* as */
+    ExtensionTable;
+
+extern ExtensionTable *initExtensionTable();
+extern void addToExtensionTable(ExtensionTable *table, const wchar_t *path, int64_t size);
+extern void mergeExtensionTable(ExtensionTable *total, const ExtensionTable *part);
+extern void printExtensionTable(const ExtensionTable *table, const wchar_t *path);
+
+#endif
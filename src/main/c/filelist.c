@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <io.h>         /* _setmode */
+#include <fcntl.h>      /* _O_BINARY */
+#include <windows.h>
+#include <gc.h>
+#include "filelist.h"
+#include "string.h"
+#include "error.h"
+
+#define INITIAL_NAME_CAPACITY 260
+#define UTF8_BOM "\xEF\xBB\xBF"
+#define STDIN_NAME L"-"
+
+static void handleName(char *name, size_t length, bool isFirst, char delimiter, FileNameHandler handler, void *context);
+
+/* Reads UTF-8 file names separated by delimiter, which is NUL or a line
+   feed, from listName or from standard input if listName is -. Each name
+   is handed over as soon as it has been read, so that work on it can
+   start before the rest of the list arrives. Empty names are skipped. */
+void readFileNames(const wchar_t *listName, char delimiter, FileNameHandler handler, void *context)
+{
+    FILE *listFile;
+    char *name;
+    size_t length = 0;
+    size_t capacity = INITIAL_NAME_CAPACITY;
+    bool isFirst = true;
+    int c;
+
+    if (wcscmp(listName, STDIN_NAME) == 0) {
+        listFile = stdin;
+        _setmode(_fileno(stdin), _O_BINARY);
+    } else if ((listFile = _wfopen(listName, L"rb")) == NULL) {
+        writeError(errno, L"Failed to open file list", listName);
+        exit(EXIT_FAILURE);
+    }
+    if ((name = (char *) GC_MALLOC_ATOMIC(capacity)) == NULL) {
+        writeError(errno, L"Failed to allocate memory for file list", listName);
+        exit(EXIT_FAILURE);
+    }
+    while ((c = getc(listFile)) != EOF) {
+        if ((char) c == delimiter) {
+            handleName(name, length, isFirst, delimiter, handler, context);
+            isFirst = false;
+            length = 0;
+            continue;
+        }
+        if (length + 1 >= capacity) {
+            capacity *= 2;
+            if ((name = (char *) GC_REALLOC(name, capacity)) == NULL) {
+                writeError(errno, L"Failed to allocate memory for file list", listName);
+                exit(EXIT_FAILURE);
+            }
+        }
+        name[length++] = (char) c;
+    }
+    if (ferror(listFile)) {
+        writeError(errno, L"Failed to read file list", listName);
+        exit(EXIT_FAILURE);
+    }
+    /* The last name need not be followed by a delimiter. */
+    handleName(name, length, isFirst, delimiter, handler, context);
+    if (listFile != stdin) {
+        fclose(listFile);
+    }
+}
+
+static void handleName(char *name, size_t length, bool isFirst, char delimiter, FileNameHandler handler, void *context)
+{
+    char *start = name;
+
+    name[length] = '\0';
+    if (delimiter == '\n' && length > 0 && name[length - 1] == '\r') {
+        name[--length] = '\0';
+    }
+    if (isFirst && strncmp(start, UTF8_BOM, strlen(UTF8_BOM)) == 0) {
+        start += strlen(UTF8_BOM);
+    }
+    if (*start != '\0') {
+        handler(convertFromUtf8(start), context);
+    }
+}
@@ -0,0 +1,10 @@
+#ifndef FILELIST_H_EDCRFV
+#define FILELIST_H_EDCRFV
+
+#include <wchar.h>
+
+typedef void (*FileNameHandler)(wchar_t *fileName, void *context);
+
+extern void readFileNames(const wchar_t *listName, char delimiter, FileNameHandler handler, void *context);
+
+#endif
@@ -7,15 +7,63 @@
 #include "string.h"
 #include "error.h"
 #include "trace.h"
-#include "args.h"
 
-enum FileType {
-    FILETYPE_DIRECTORY, FILETYPE_FILE, FILETYPE_GLOB, FILETYPE_UNKNOWN
+/* Entries handed out by one call to readDirectory */
+#define DIRECTORY_BATCH_SIZE 128
+/* Room for the records of a directory read by file ID, well over a batch */
+#define ID_INFO_BUFFER_SIZE 65536
+/* A file ID on NTFS is the number of its record in the master file table
+   in the low 48 bits, and a sequence number above them. */
+#define RECORD_NUMBER_MASK 0xFFFFFFFFFFFFULL
+
+/* An entry as either way of reading a directory reports it. */
+struct FoundEntry {
+    wchar_t name[MAX_PATH];
+    DWORD attributes;
+    DWORD reparseTag;               /* Only for a reparse point */
+    int64_t size;
+    uint64_t lastWriteTime;
+    uint64_t fileIndex;             /* 0 unless read by file ID */
 };
 
-static HANDLE open(const wchar_t *path);
+struct DirectoryReader {
+    const wchar_t *path;
+    size_t pathLength;
+    const wchar_t *search;
+    struct ListingOptions options;
+    HANDLE findHandle;              /* INVALID_HANDLE_VALUE when read by file ID */
+    WIN32_FIND_DATA findData;
+    HANDLE directoryHandle;         /* With --order=physical, INVALID_HANDLE_VALUE otherwise */
+    unsigned long volumeSerialNumber;
+    LONGLONG *infoBuffer;           /* FILE_ID_BOTH_DIR_INFO records, which must be aligned */
+    const FILE_ID_BOTH_DIR_INFO *nextInfo;  /* NULL once the buffer has been used up */
+    struct FoundEntry found;        /* The next entry, already found */
+    bool hasNext;
+    bool isComplete;                /* False if the deadline cut the listing short */
+    bool isFailed;                  /* True if an error did */
+    struct FileEntry entries[DIRECTORY_BATCH_SIZE];
+    wchar_t *paths[DIRECTORY_BATCH_SIZE];   /* Reused from batch to batch */
+    size_t pathCapacities[DIRECTORY_BATCH_SIZE];
+    struct FileEntry *sorted[DIRECTORY_BATCH_SIZE];
+};
+
+static HANDLE open(const wchar_t *path, bool dereference);
 static void close(HANDLE h);
-static int64_t getAllocatedFileSize(const wchar_t *path);
+static int64_t getAllocatedFileSize(const wchar_t *path, bool dereference);
+static bool isExcluded(const wchar_t *name, DWORD attributes, const struct ListingOptions *options);
+static bool lookUpFileEntry(const wchar_t *path, struct FileEntry *entry, bool isMissingAnError);
+static enum FileType getFileTypeFromAttributes(DWORD fileAttributes, DWORD reparseTag);
+static enum FileType getFileTypeOfPath(const wchar_t *path, DWORD fileAttributes);
+static DWORD getReparseTag(const wchar_t *path);
+static bool openById(DirectoryReader *reader);
+static bool openByName(DirectoryReader *reader);
+static bool findNext(DirectoryReader *reader);
+static bool findNextById(DirectoryReader *reader);
+static bool setBatchEntry(DirectoryReader *reader, size_t slot);
+static void fetchSizesInRecordOrder(DirectoryReader *reader, size_t count);
+static void sortByRecordNumber(struct FileEntry **entries, size_t count);
+static int compareRecordNumbers(const void *left, const void *right);
+static uint64_t getFileTimeValue(const FILETIME *time);
 
 /* Result should be freed. */
 extern wchar_t* slashToBackslash(const wchar_t *path) {
@@ -23,7 +71,8 @@ extern wchar_t* slashToBackslash(const wchar_t *path) {
     return replaceAll(_tcsdup(path), _TEXT('/'), _TEXT('\\'));
 }
 
-/* Result must be freed. */
+/* Returns NULL, having reported why, if the path cannot be made absolute.
+   It is up to the caller whether that ends the program. */
 wchar_t* getAbsolutePath(const wchar_t *path) {
     wchar_t *absolutePath = NULL;
     DWORD reqSize;
@@ -34,21 +83,19 @@ wchar_t* getAbsolutePath(const wchar_t *path) {
     if (reqSize == 0) {
         writeLastError(GetLastError(), L"failed to get required buf size",
                 path);
-        exit(EXIT_FAILURE);
     } else {
         absolutePath = (wchar_t*) GC_MALLOC(reqSize * sizeof(wchar_t));
         if (absolutePath == NULL) {
-            writeError(errno, _T("memory alloc failed for abs path of"), path);
-            exit(EXIT_FAILURE);
+            writeLastError(ERROR_NOT_ENOUGH_MEMORY, _T("memory alloc failed for abs path of"), path);
         } else {
             returnedLen = GetFullPathName(path, reqSize, absolutePath, NULL);
             if (returnedLen == 0) {
                 writeLastError(GetLastError(), L"failed to get full path",
                         path);
-                exit(EXIT_FAILURE);
+                absolutePath = NULL;
             } else if (returnedLen >= reqSize) {
                 writeLastError(GetLastError(), L"buffer not big enough", path);
-                exit(EXIT_FAILURE);
+                absolutePath = NULL;
             }
         }
     }
@@ -67,6 +114,9 @@ wchar_t* getParentPath(const wchar_t *path) {
     } else {
         absPath = getAbsolutePath(path);
     }
+    if (absPath == NULL) {
+        return NULL;
+    }
     lastBackslashPointer = wcsrchr(absPath, L'\\');
     parentSize = lastBackslashPointer - absPath + 1;
     parent = (wchar_t*) GC_MALLOC(parentSize * sizeof(wchar_t));
@@ -104,92 +154,454 @@ extern const wchar_t* skipPrefix(wchar_t *path) {
     return result;
 }
 
-int64_t getFileSize(wchar_t *path) {
-    HANDLE findHandle;
-    WIN32_FIND_DATA fileFindData;
-    int64_t size = 0;
-    int64_t multiplier;
-    int64_t maxDWORD;
+/* Works for every path, including the root of a drive, which
+   FindFirstFile cannot look up. */
+bool getFileEntry(const wchar_t *path, struct FileEntry *entry) {
+    return lookUpFileEntry(path, entry, true);
+}
 
-    findHandle = FindFirstFile(path, &fileFindData);
-    if (findHandle == INVALID_HANDLE_VALUE) {
-        writeLastError(GetLastError(), L"Failed to get handle for file", path);
+/* Like getFileEntry, but a path that does not exist is not an error. */
+bool getFileEntryIfExists(const wchar_t *path, struct FileEntry *entry) {
+    return lookUpFileEntry(path, entry, false);
+}
+
+static bool lookUpFileEntry(const wchar_t *path, struct FileEntry *entry, bool isMissingAnError) {
+    WIN32_FILE_ATTRIBUTE_DATA attributeData;
+    DWORD lastError;
+    bool gotEntry = false;
+
+    if (!GetFileAttributesEx(path, GetFileExInfoStandard, &attributeData)) {
+        lastError = GetLastError();
+        if (isMissingAnError || (lastError != ERROR_FILE_NOT_FOUND && lastError != ERROR_PATH_NOT_FOUND)) {
+            writeLastError(lastError, L"Failed to get file attributes", path);
+        }
     } else {
-        if (!displayBytes) {
-            size = getAllocatedFileSize(path);
-        } else {
-            maxDWORD = (int64_t) MAXDWORD; /* Avoid Visual C++ 4.0 warning */
-            multiplier = maxDWORD + 1UL;
-            size = fileFindData.nFileSizeHigh * multiplier
-                    + fileFindData.nFileSizeLow;
+        entry->path = (wchar_t *) path;
+        entry->type = getFileTypeOfPath(path, attributeData.dwFileAttributes);
+        entry->size = ((int64_t) attributeData.nFileSizeHigh << 32) + attributeData.nFileSizeLow;
+        entry->allocatedSize = SIZE_NOT_ASKED;
+        entry->lastWriteTime = getFileTimeValue(&attributeData.ftLastWriteTime);
+        entry->id.volumeSerialNumber = 0;
+        entry->id.fileIndex = 0;
+        gotEntry = true;
+    }
+    return gotEntry;
+}
+
+/* UNKNOWN_SIZE if the file could not be opened. */
+int64_t getAllocatedEntrySize(const struct FileEntry *entry, bool dereference) {
+    return entry->allocatedSize != SIZE_NOT_ASKED ? entry->allocatedSize : getAllocatedFileSize(entry->path, dereference);
+}
+
+static uint64_t getFileTimeValue(const FILETIME *time) {
+    return ((uint64_t) time->dwHighDateTime << 32) | time->dwLowDateTime;
+}
+
+/* Opens a directory for readDirectory. Returns NULL, having reported the
+   error, if it cannot be read. In physical order the directory is read
+   by file ID where the file system allows it, and then, if the allocated
+   sizes are needed, those of its files are fetched as the batches are
+   read. The options are copied. */
+DirectoryReader *openDirectory(const wchar_t *path, const struct ListingOptions *options) {
+    DirectoryReader *reader;
+
+    if ((reader = (DirectoryReader *) GC_MALLOC(sizeof(DirectoryReader))) == NULL
+            || (reader->search = joinText(path, DIR_SEPARATOR L"*")) == NULL) {
+        writeLastError(ERROR_NOT_ENOUGH_MEMORY, L"Failed to allocate memory for directory reader", path);
+        return NULL;
+    }
+    reader->path = path;
+    reader->pathLength = wcslen(path);
+    reader->options = *options;
+    reader->findHandle = INVALID_HANDLE_VALUE;
+    reader->directoryHandle = INVALID_HANDLE_VALUE;
+    reader->isComplete = true;
+    reader->isFailed = false;
+    if (!(options->isPhysicalOrder && openById(reader)) && !openByName(reader)) {
+        return NULL;
+    }
+    return reader;
+}
+
+/* Returns false, without reporting anything, if the directory cannot be
+   read this way, not even for want of memory, so that FindFirstFile can
+   be tried instead. */
+static bool openById(DirectoryReader *reader) {
+    BY_HANDLE_FILE_INFORMATION info;
+
+    /* FILE_FLAG_BACKUP_SEMANTICS is required to open a directory. */
+    reader->directoryHandle = CreateFile(reader->path, FILE_LIST_DIRECTORY,
+                    FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                    NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+    if (reader->directoryHandle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    reader->infoBuffer = (LONGLONG *) GC_MALLOC_ATOMIC(ID_INFO_BUFFER_SIZE);
+    reader->nextInfo = NULL;
+    if (reader->infoBuffer != NULL && GetFileInformationByHandle(reader->directoryHandle, &info)) {
+        reader->volumeSerialNumber = info.dwVolumeSerialNumber;
+        reader->hasNext = findNextById(reader);
+        if (reader->hasNext || GetLastError() == ERROR_NO_MORE_FILES) {
+            return true;
         }
-        FindClose(findHandle);
     }
-    return size;
+    close(reader->directoryHandle);
+    reader->directoryHandle = INVALID_HANDLE_VALUE;
+    return false;
 }
 
-List* listFiles(const wchar_t *path) {
-    HANDLE findHandle;
-    WIN32_FIND_DATA fileProperties;
-    const wchar_t *search;
-    bool moreDirectoryEntries;
-    wchar_t *entry;
-    List *files;
-    DWORD lastError;
-    wchar_t *entryPath;
+static bool openByName(DirectoryReader *reader) {
+    /* The basic information level leaves out the short name, and a large
+       fetch asks for more entries at a time. Both are new in Windows 7. */
+    reader->findHandle = FindFirstFileEx(reader->search, FindExInfoBasic, &reader->findData,
+                                         FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+    if (reader->findHandle == INVALID_HANDLE_VALUE && GetLastError() == ERROR_INVALID_PARAMETER) {
+        reader->findHandle = FindFirstFile(reader->search, &reader->findData);
+    }
+    if (reader->findHandle == INVALID_HANDLE_VALUE) {
+        writeLastError(GetLastError(), L"Failed to get handle for pattern", reader->search);
+        return false;
+    }
+    wcscpy(reader->found.name, reader->findData.cFileName);
+    reader->found.attributes = reader->findData.dwFileAttributes;
+    reader->found.reparseTag = reader->findData.dwReserved0;
+    reader->found.size = ((int64_t) reader->findData.nFileSizeHigh << 32) + reader->findData.nFileSizeLow;
+    reader->found.lastWriteTime = getFileTimeValue(&reader->findData.ftLastWriteTime);
+    reader->found.fileIndex = 0;
+    reader->hasNext = true;
+    return true;
+}
 
-    files = initList();
-    if (isGlob(path)) {
-        search = path;
-    } else {
-        search = buildPath(path, L"*");
+/* Moves on to the next entry. Returns false at the end, or on an error,
+   which GetLastError tells apart. */
+static bool findNext(DirectoryReader *reader) {
+    if (reader->directoryHandle != INVALID_HANDLE_VALUE) {
+        return findNextById(reader);
     }
-    findHandle = FindFirstFile(search, &fileProperties);
-    if (findHandle == INVALID_HANDLE_VALUE) {
-        writeLastError(GetLastError(), L"Failed to get handle for pattern",
-                search);
+    if (!FindNextFile(reader->findHandle, &reader->findData)) {
+        return false;
+    }
+    wcscpy(reader->found.name, reader->findData.cFileName);
+    reader->found.attributes = reader->findData.dwFileAttributes;
+    reader->found.reparseTag = reader->findData.dwReserved0;
+    reader->found.size = ((int64_t) reader->findData.nFileSizeHigh << 32) + reader->findData.nFileSizeLow;
+    reader->found.lastWriteTime = getFileTimeValue(&reader->findData.ftLastWriteTime);
+    return true;
+}
+
+/* The records come a buffer at a time, and the names in them are not
+   terminated. */
+static bool findNextById(DirectoryReader *reader) {
+    const FILE_ID_BOTH_DIR_INFO *info;
+    size_t nameLength;
+
+    if (reader->nextInfo == NULL) {
+        if (!GetFileInformationByHandleEx(reader->directoryHandle, FileIdBothDirectoryInfo,
+                                          reader->infoBuffer, ID_INFO_BUFFER_SIZE)) {
+            return false;
+        }
+        reader->nextInfo = (const FILE_ID_BOTH_DIR_INFO *) reader->infoBuffer;
+    }
+    info = reader->nextInfo;
+    if (info->NextEntryOffset == 0) {
+        reader->nextInfo = NULL;
     } else {
-        moreDirectoryEntries = true;
-        while (moreDirectoryEntries) {
-            entry = fileProperties.cFileName;
-            if (wcscmp(entry, L".") != 0 && wcscmp(entry, L"..") != 0) {
-                entryPath = buildPath(path, entry);
-                appendListItem(&files, entryPath);
+        reader->nextInfo = (const FILE_ID_BOTH_DIR_INFO *) ((const char *) info + info->NextEntryOffset);
+    }
+    nameLength = info->FileNameLength / sizeof(wchar_t);
+    if (nameLength >= MAX_PATH) {
+        nameLength = MAX_PATH - 1;
+    }
+    wmemcpy(reader->found.name, info->FileName, nameLength);
+    reader->found.name[nameLength] = L'\0';
+    reader->found.attributes = info->FileAttributes;
+    /* For a reparse point the tag is where the size of the extended
+       attributes would be. */
+    reader->found.reparseTag = info->EaSize;
+    reader->found.size = info->EndOfFile.QuadPart;
+    reader->found.lastWriteTime = (uint64_t) info->LastWriteTime.QuadPart;
+    reader->found.fileIndex = (uint64_t) info->FileId.QuadPart;
+    return true;
+}
+
+/* Returns the next batch of entries and sets count to how many there
+   are, or returns NULL when there are no more. The entries, paths
+   included, are only good until the next call. Stops early when the
+   deadline passes, and on an error, which it reports. */
+struct FileEntry *readDirectory(DirectoryReader *reader, size_t *count) {
+    const wchar_t *name;
+    DWORD lastError;
+    size_t n = 0;
+
+    while (reader->hasNext && n < DIRECTORY_BATCH_SIZE) {
+        name = reader->found.name;
+        if (wcscmp(name, L".") != 0 && wcscmp(name, L"..") != 0
+                && !isExcluded(name, reader->found.attributes, &reader->options)) {
+            if (!setBatchEntry(reader, n)) {
+                reader->isFailed = true;
+                reader->hasNext = false;
+                break;
             }
-            if (!FindNextFile(findHandle, &fileProperties)) {
-                if ((lastError = GetLastError()) == ERROR_NO_MORE_FILES) {
-                    moreDirectoryEntries = false;
-                } else {
-                    writeLastError(lastError, L"Failed to get next results",
-                            search);
-                }
+            n++;
+        }
+        if (!findNext(reader)) {
+            if ((lastError = GetLastError()) != ERROR_NO_MORE_FILES) {
+                writeLastError(lastError, L"Failed to get next results", reader->search);
+                reader->isFailed = true;
             }
+            reader->hasNext = false;
+        } else if (isPastDeadline(reader->options.deadline)) {
+            reader->hasNext = false;
+            reader->isComplete = false;
+        }
+    }
+    if (reader->directoryHandle != INVALID_HANDLE_VALUE && reader->options.needsAllocatedSizes) {
+        fetchSizesInRecordOrder(reader, n);
+    }
+    *count = n;
+    return n > 0 ? reader->entries : NULL;
+}
+
+/* Tells whether every entry was read, which is not so if the deadline
+   passed first. */
+bool isDirectoryComplete(const DirectoryReader *reader) {
+    return reader->isComplete;
+}
+
+/* Tells whether the listing ended on an error, which has been reported. */
+bool hasDirectoryFailed(const DirectoryReader *reader) {
+    return reader->isFailed;
+}
+
+void closeDirectory(DirectoryReader *reader) {
+    if (reader->directoryHandle != INVALID_HANDLE_VALUE) {
+        close(reader->directoryHandle);
+    } else {
+        FindClose(reader->findHandle);
+    }
+}
+
+/* Fills in a slot of the batch from the entry just found. The path is
+   built in a buffer that belongs to the slot, so reading a directory
+   allocates nothing once its longest names have been seen. Returns false,
+   having reported it, if there is not enough memory for the path. */
+static bool setBatchEntry(DirectoryReader *reader, size_t slot) {
+    struct FileEntry *entry;
+    const struct FoundEntry *found;
+    size_t nameLength;
+    size_t capacity;
+
+    entry = &reader->entries[slot];
+    found = &reader->found;
+    nameLength = wcslen(found->name);
+    capacity = reader->pathLength + nameLength + 2;
+    if (capacity > reader->pathCapacities[slot]) {
+        capacity += capacity / 2;
+        if ((reader->paths[slot] = (wchar_t *) GC_MALLOC_ATOMIC(capacity * sizeof(wchar_t))) == NULL) {
+            writeLastError(ERROR_NOT_ENOUGH_MEMORY, L"Failed to allocate memory for directory entry", found->name);
+            reader->pathCapacities[slot] = 0;
+            return false;
+        }
+        reader->pathCapacities[slot] = capacity;
+    }
+    wmemcpy(reader->paths[slot], reader->path, reader->pathLength);
+    reader->paths[slot][reader->pathLength] = L'\\';
+    wmemcpy(reader->paths[slot] + reader->pathLength + 1, found->name, nameLength + 1);
+    entry->path = reader->paths[slot];
+    entry->type = getFileTypeFromAttributes(found->attributes, found->reparseTag);
+    entry->size = found->size;
+    entry->allocatedSize = SIZE_NOT_ASKED;
+    entry->lastWriteTime = found->lastWriteTime;
+    entry->id.volumeSerialNumber = found->fileIndex == 0 ? 0 : reader->volumeSerialNumber;
+    entry->id.fileIndex = found->fileIndex;
+    return true;
+}
+
+/* The allocated size of a file needs the file to be opened, which reads
+   its record in the master file table. Opening the files of a batch in
+   the order of their records lets a disk that has to seek sweep across
+   the table once instead of going back and forth. */
+static void fetchSizesInRecordOrder(DirectoryReader *reader, size_t count) {
+    size_t fileCount = 0;
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        if (reader->entries[i].type == FILETYPE_FILE) {
+            reader->sorted[fileCount++] = &reader->entries[i];
+        }
+    }
+    sortByRecordNumber(reader->sorted, fileCount);
+    for (i = 0; i < fileCount && !isPastDeadline(reader->options.deadline); i++) {
+        reader->sorted[i]->allocatedSize = getAllocatedFileSize(reader->sorted[i]->path, reader->options.dereference);
+    }
+}
+
+/* Opens the directories among the entries in the order of their records
+   in the master file table, so that the records are read in one sweep
+   and are already in the cache when the directories are visited in
+   listing order. Entries read without file IDs are left alone. The path
+   of each entry is what follows directoryPath, as the scan keeps it.
+   Being only a way to go faster, it gives up quietly for want of memory. */
+void prefetchDirectories(const wchar_t *directoryPath, const struct FileEntry *entries, size_t count,
+        Deadline *deadline) {
+    struct FileEntry **sorted;
+    size_t directoryCount = 0;
+    size_t i;
+    HANDLE handle;
+    wchar_t *path;
+
+    if ((sorted = (struct FileEntry **) GC_MALLOC(count * sizeof(struct FileEntry *))) == NULL) {
+        return;
+    }
+    for (i = 0; i < count; i++) {
+        if (entries[i].type == FILETYPE_DIRECTORY && entries[i].id.fileIndex != 0) {
+            sorted[directoryCount++] = (struct FileEntry *) &entries[i];
+        }
+    }
+    sortByRecordNumber(sorted, directoryCount);
+    for (i = 0; i < directoryCount && !isPastDeadline(deadline); i++) {
+        if ((path = joinText(directoryPath, sorted[i]->path)) == NULL) {
+            return;
+        }
+        handle = CreateFile(path, FILE_READ_ATTRIBUTES,
+                        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                        NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+        /* A failure is reported when the directory is visited. */
+        if (handle != INVALID_HANDLE_VALUE) {
+            close(handle);
         }
-        FindClose(findHandle); /* Only close it if it got opened successfully */
     }
-    return files;
+}
+
+static void sortByRecordNumber(struct FileEntry **entries, size_t count) {
+    qsort(entries, count, sizeof(struct FileEntry *), compareRecordNumbers);
+}
+
+static int compareRecordNumbers(const void *left, const void *right) {
+    uint64_t leftRecord;
+    uint64_t rightRecord;
+
+    leftRecord = (*(struct FileEntry * const *) left)->id.fileIndex & RECORD_NUMBER_MASK;
+    rightRecord = (*(struct FileEntry * const *) right)->id.fileIndex & RECORD_NUMBER_MASK;
+    return leftRecord < rightRecord ? -1 : leftRecord > rightRecord;
+}
+
+/* Excluded directories are dropped here, so they are never opened. The
+   include patterns only restrict which files are counted. */
+static bool isExcluded(const wchar_t *name, DWORD attributes, const struct ListingOptions *options) {
+    bool excluded;
+
+    if (options->excludes != NULL && !isPatternSetEmpty(options->excludes)
+            && matchesPatternSet(options->excludes, name)) {
+        excluded = true;
+    } else if (!(attributes & FILE_ATTRIBUTE_DIRECTORY)
+            && options->includes != NULL && !isPatternSetEmpty(options->includes)) {
+        excluded = !matchesPatternSet(options->includes, name);
+    } else {
+        excluded = false;
+    }
+    return excluded;
+}
+
+/* Applies the exclude and include patterns to an entry found some other
+   way than by readDirectory, such as a change notification. */
+bool isExcludedEntry(const struct FileEntry *entry, const struct ListingOptions *options) {
+    return isExcluded(getSimpleName(entry->path), entry->type == FILETYPE_FILE ? 0 : FILE_ATTRIBUTE_DIRECTORY, options);
 }
 
 enum FileType getFileType(const wchar_t *path) {
     DWORD fileAttributes;
     enum FileType type;
 
-    if (isGlob(path)) {
-        type = FILETYPE_GLOB;
+    fileAttributes = GetFileAttributes(path);
+    if (fileAttributes == INVALID_FILE_ATTRIBUTES) {
+        type = FILETYPE_UNKNOWN;
+        writeLastError(GetLastError(), L"Failed to get file attributes", path);
     } else {
-        fileAttributes = GetFileAttributes(path);
-        if (fileAttributes == INVALID_FILE_ATTRIBUTES) {
-            type = FILETYPE_UNKNOWN;
-            writeLastError(GetLastError(), L"Failed to get file attributes", path);
-        } else if (fileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
-            type = FILETYPE_DIRECTORY;
+        type = getFileTypeOfPath(path, fileAttributes);
+    }
+    return type;
+}
+
+static enum FileType getFileTypeFromAttributes(DWORD fileAttributes, DWORD reparseTag) {
+    enum FileType type;
+
+    if (fileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+        if (isDirectoryLink(fileAttributes, reparseTag)) {
+            type = FILETYPE_LINK;
         } else {
-            type = FILETYPE_FILE;
+            type = FILETYPE_DIRECTORY;
         }
+    } else {
+        type = FILETYPE_FILE;
     }
     return type;
 }
 
+/* Only junctions, mount points and directory symbolic links lead somewhere
+   else. Other reparse points, such as the placeholders of files kept in
+   the cloud and deduplicated directories, are directories like any other. */
+bool isDirectoryLink(unsigned long fileAttributes, unsigned long reparseTag) {
+    return (fileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0
+            && (reparseTag == IO_REPARSE_TAG_MOUNT_POINT || reparseTag == IO_REPARSE_TAG_SYMLINK);
+}
+
+/* Attributes looked up by path come without the reparse tag, so for a
+   directory that is a reparse point the tag is asked for separately. */
+static enum FileType getFileTypeOfPath(const wchar_t *path, DWORD fileAttributes) {
+    DWORD reparseTag = 0;
+
+    if ((fileAttributes & FILE_ATTRIBUTE_DIRECTORY) && (fileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)) {
+        reparseTag = getReparseTag(path);
+    }
+    return getFileTypeFromAttributes(fileAttributes, reparseTag);
+}
+
+/* Returns IO_REPARSE_TAG_MOUNT_POINT, which makes it a link and keeps it
+   from being followed, if the tag cannot be read. */
+static DWORD getReparseTag(const wchar_t *path) {
+    HANDLE handle;
+    FILE_ATTRIBUTE_TAG_INFO info;
+    DWORD reparseTag = IO_REPARSE_TAG_MOUNT_POINT;
+
+    /* FILE_FLAG_BACKUP_SEMANTICS is required to open a directory. */
+    handle = CreateFile(path, FILE_READ_ATTRIBUTES,
+                    FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                    NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OPEN_REPARSE_POINT, NULL);
+    if (handle != INVALID_HANDLE_VALUE) {
+        if (GetFileInformationByHandleEx(handle, FileAttributeTagInfo, &info, sizeof(info))) {
+            reparseTag = info.ReparseTag;
+        }
+        close(handle);
+    }
+    return reparseTag;
+}
+
+/* Follows reparse points, so the result identifies the target. */
+bool getFileId(const wchar_t *path, struct FileId *id) {
+    HANDLE handle;
+    BY_HANDLE_FILE_INFORMATION info;
+    bool gotId = false;
+
+    /* FILE_FLAG_BACKUP_SEMANTICS is required to open a directory. */
+    handle = CreateFile(path, FILE_READ_ATTRIBUTES,
+                    FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                    NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+    if (handle == INVALID_HANDLE_VALUE) {
+        writeLastError(GetLastError(), L"Failed to open for file ID", path);
+    } else {
+        if (GetFileInformationByHandle(handle, &info)) {
+            id->volumeSerialNumber = info.dwVolumeSerialNumber;
+            id->fileIndex = ((uint64_t) info.nFileIndexHigh << 32) | info.nFileIndexLow;
+            gotId = true;
+        } else {
+            writeLastError(GetLastError(), L"Failed to get file ID", path);
+        }
+        close(handle);
+    }
+    return gotId;
+}
+
 bool isFile(const wchar_t *path) {
     return getFileType(path) == FILETYPE_FILE;
 }
@@ -198,10 +610,6 @@ bool isDirectory(const wchar_t *path) {
     return getFileType(path) == FILETYPE_DIRECTORY;
 }
 
-bool isGlobPattern(const wchar_t *path) {
-    return getFileType(path) == FILETYPE_GLOB;
-}
-
 bool isAbsolutePath(const wchar_t *path) {
     bool isAbsolutePath;
     size_t len;
@@ -249,27 +657,36 @@ extern bool isExtendedLengthPath(const wchar_t *path) {
     return startsWith(path, EXTENDED_LENGTH_PATH_PREFIX);
 }
 
-static HANDLE open(const wchar_t *path) {
+/* Returns INVALID_HANDLE_VALUE, having reported why, if the file cannot
+   be opened. Only its attributes are asked for, which needs neither the
+   right to read it nor that others share it, so a file held open by
+   another process, or being deleted, can still be looked at. */
+static HANDLE open(const wchar_t *path, bool dereference) {
     HANDLE fileHandle;
+    wchar_t *absolutePath;
     wchar_t *extendedPath;
 
     if (isAbsolutePath(path)) {
-        extendedPath =  makeExtendedLengthPath(path);
-    } else {
-        extendedPath = makeExtendedLengthPath(getAbsolutePath(path));
+        absolutePath = (wchar_t *) path;
+    } else if ((absolutePath = getAbsolutePath(path)) == NULL) {
+        return INVALID_HANDLE_VALUE;
+    }
+    if ((extendedPath = joinText(EXTENDED_LENGTH_PATH_PREFIX, absolutePath)) == NULL) {
+        writeLastError(ERROR_NOT_ENOUGH_MEMORY, L"Failed to allocate memory for", path);
+        return INVALID_HANDLE_VALUE;
     }
     fileHandle = CreateFile(
                     extendedPath,                       /* file name */
-                    GENERIC_READ,                       /* desired access */
-                    FILE_SHARE_READ | FILE_SHARE_WRITE, /* share mode */
+                    FILE_READ_ATTRIBUTES,               /* desired access */
+                    FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, /* share mode */
                     NULL,                               /* security attributes */
                     OPEN_EXISTING,                      /* disposition */
-                    FILE_FLAG_SEQUENTIAL_SCAN,          /* flags */
+                    FILE_FLAG_SEQUENTIAL_SCAN           /* flags */
+                        | (dereference ? 0 : FILE_FLAG_OPEN_REPARSE_POINT),
                     NULL                                /* template file handle */
                  );
     if (fileHandle == INVALID_HANDLE_VALUE) {
         writeLastError(GetLastError(), L"Failed to open file", path);
-        exit(EXIT_FAILURE);
     }
     return fileHandle;
 }
@@ -280,15 +697,22 @@ static void close(HANDLE fileHandle) {
     }
 }
 
-static int64_t getAllocatedFileSize(const wchar_t *path) {
+/* Returns UNKNOWN_SIZE, having reported why, for a file that cannot be
+   looked at, such as one that is locked or that the ACL denies, so that
+   the scan can go on past it. */
+static int64_t getAllocatedFileSize(const wchar_t *path, bool dereference) {
     HANDLE fileHandle;
     FILE_STANDARD_INFO fileStandardInfo;
+    int64_t size = UNKNOWN_SIZE;
 
-    fileHandle = open(path);
-    if (! GetFileInformationByHandleEx(fileHandle, FileStandardInfo, &fileStandardInfo, sizeof(FILE_STANDARD_INFO))) {
+    if ((fileHandle = open(path, dereference)) == INVALID_HANDLE_VALUE) {
+        return UNKNOWN_SIZE;
+    }
+    if (GetFileInformationByHandleEx(fileHandle, FileStandardInfo, &fileStandardInfo, sizeof(FILE_STANDARD_INFO))) {
+        size = fileStandardInfo.AllocationSize.QuadPart;
+    } else {
         writeLastError(GetLastError(), L"Failed to get standard file info", path);
-        exit(EXIT_FAILURE);
     }
     close(fileHandle);
-    return fileStandardInfo.AllocationSize.QuadPart;
+    return size;
 }
@@ -13,18 +13,69 @@
 #include <wchar.h>
 #include "list.h"
 #include "string.h"
+#include "pattern.h"
+#include "deadline.h"
 
 #define DIR_SEPARATOR L"\\"
 #define EXTENDED_LENGTH_PATH_PREFIX L"\\\\?\\"
 
+enum FileType {
+    FILETYPE_DIRECTORY, FILETYPE_FILE, FILETYPE_LINK, FILETYPE_UNKNOWN
+};
+
+/* Identifies a file or directory independently of the path used to reach it. */
+struct FileId {
+    unsigned long volumeSerialNumber;
+    uint64_t fileIndex;
+};
+
+#define SIZE_NOT_ASKED (-1)
+#define UNKNOWN_SIZE (-2)           /* The file could not be looked at */
+
+/* What a directory listing says about one of its entries. */
+struct FileEntry {
+    wchar_t *path;
+    enum FileType type;
+    int64_t size;               /* Length of the data, not the allocated size */
+    int64_t allocatedSize;      /* SIZE_NOT_ASKED until it has been asked for */
+    uint64_t lastWriteTime;     /* FILETIME as a number */
+    struct FileId id;           /* From the listing with --order=physical, zero otherwise */
+};
+
+/* How directories are listed and their files looked at. A scan takes
+   these from its options; --estimate and --serve from the arguments. */
+struct ListingOptions {
+    bool isPhysicalOrder;           /* Read by file ID where the file system allows it (--order=physical) */
+    bool needsAllocatedSizes;       /* Fetched with each batch when read by file ID */
+    bool dereference;               /* A link to a file is opened for the size of the file (-L) */
+    const PatternSet *excludes;     /* Names not listed (--exclude), NULL for none */
+    const PatternSet *includes;     /* The only file names listed (--include), NULL for all */
+    Deadline *deadline;             /* After which nothing more is listed, NULL for none */
+};
+
+/* Reads a directory a batch of entries at a time, so that a directory
+   with millions of entries never has to be held in memory at once. */
+typedef struct DirectoryReader DirectoryReader;
+
 extern wchar_t *getAbsolutePath(const wchar_t *path);
 extern const wchar_t *getSimpleName(const wchar_t *path);
 extern wchar_t *getParentPath(const wchar_t *path);
-extern int64_t getFileSize(wchar_t *path);
-extern List *listFiles(const wchar_t *path);
+extern bool getFileEntry(const wchar_t *path, struct FileEntry *entry);
+extern bool getFileEntryIfExists(const wchar_t *path, struct FileEntry *entry);
+extern int64_t getAllocatedEntrySize(const struct FileEntry *entry, bool dereference);
+extern bool isExcludedEntry(const struct FileEntry *entry, const struct ListingOptions *options);
+extern DirectoryReader *openDirectory(const wchar_t *path, const struct ListingOptions *options);
+extern struct FileEntry *readDirectory(DirectoryReader *reader, size_t *count);
+extern bool isDirectoryComplete(const DirectoryReader *reader);
+extern bool hasDirectoryFailed(const DirectoryReader *reader);
+extern void closeDirectory(DirectoryReader *reader);
+extern void prefetchDirectories(const wchar_t *directoryPath, const struct FileEntry *entries, size_t count,
+        Deadline *deadline);
+extern enum FileType getFileType(const wchar_t *path);
+extern bool isDirectoryLink(unsigned long fileAttributes, unsigned long reparseTag);
+extern bool getFileId(const wchar_t *path, struct FileId *id);
 extern bool isFile(const wchar_t *path);
 extern bool isDirectory(const wchar_t *path);
-extern bool isGlob(const wchar_t *path);
 extern bool isAbsolutePath(const wchar_t *path);
 extern wchar_t *buildPath(const wchar_t *dir, const wchar_t *file);
 extern bool fileExists(wchar_t *path);
@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <tchar.h>
+#include "format.h"
+#include "args.h"
+
+#define KIBIBYTE 0x400
+#define MEBIBYTE 0x100000
+#define GIBIBYTE 0x40000000
+
+typedef const wchar_t *(*SizeFormat)(int64_t size, wchar_t *buffer, size_t capacity);
+
+static const wchar_t *formatAnySize(int64_t size, wchar_t *buffer, size_t capacity);
+static const wchar_t *formatHumanReadable(int64_t size, wchar_t *buffer, size_t capacity);
+static const wchar_t *formatKilobytes(int64_t size, wchar_t *buffer, size_t capacity);
+static const wchar_t *formatBytes(int64_t size, wchar_t *buffer, size_t capacity);
+
+/* Looks at -h and -b for every size until chooseSizeFormat is called. */
+static SizeFormat sizeFormat = formatAnySize;
+
+/* Formats a size the way it is displayed in the first column of the
+   output, according to -h and -b. A count from --inodes is shown as it
+   is, or like a size with -h. Returns buffer. */
+const wchar_t *formatFileSize(int64_t size, wchar_t *buffer, size_t capacity)
+{
+    return sizeFormat(size, buffer, capacity);
+}
+
+/* Settles on the format for -h and -b once the options are known, so
+   that printing a line does not test them again. */
+void chooseSizeFormat()
+{
+    if (humanReadable) {
+        sizeFormat = formatHumanReadable;
+    } else if (displayBytes || countInodes) {
+        sizeFormat = formatBytes;
+    } else {
+        sizeFormat = formatKilobytes;
+    }
+}
+
+static const wchar_t *formatAnySize(int64_t size, wchar_t *buffer, size_t capacity)
+{
+    if (humanReadable) {
+        return formatHumanReadable(size, buffer, capacity);
+    } else if (displayBytes || countInodes) {
+        return formatBytes(size, buffer, capacity);
+    }
+    return formatKilobytes(size, buffer, capacity);
+}
+
+static const wchar_t *formatHumanReadable(int64_t size, wchar_t *buffer, size_t capacity)
+{
+    double hrSize;
+
+    if (size >= GIBIBYTE) {
+        hrSize = ((double) size) / ((double) GIBIBYTE);
+        _sntprintf(buffer, capacity, _T("%2.1fG"), hrSize);
+    } else if (size >= MEBIBYTE) {
+        hrSize = ((double) size) / ((double) MEBIBYTE);
+        _sntprintf(buffer, capacity, _T("%2.1fM"), hrSize);
+    } else if (size >= KIBIBYTE) {
+        hrSize = ((double) size) / ((double) KIBIBYTE);
+        _sntprintf(buffer, capacity, _T("%2.1fK"), hrSize);
+    } else {
+        _sntprintf(buffer, capacity, _T("%-2lld"), (long long) size);
+    }
+    buffer[capacity - 1] = _T('\0');
+    return buffer;
+}
+
+static const wchar_t *formatKilobytes(int64_t size, wchar_t *buffer, size_t capacity)
+{
+    if (size > 0) {
+        size = size / ((int64_t) (1024.0 + 0.5)); /* Convert to KB and round */
+        if (size == 0) {
+            size = 1; /* Don't allow zero to display if there are bytes in the file */
+        }
+    }
+    return formatBytes(size, buffer, capacity);
+}
+
+static const wchar_t *formatBytes(int64_t size, wchar_t *buffer, size_t capacity)
+{
+    _sntprintf(buffer, capacity, _T("%lld"), (long long) size);
+    buffer[capacity - 1] = _T('\0');
+    return buffer;
+}
@@ -0,0 +1,13 @@
+#ifndef FORMAT_H_MNBVCX
+#define FORMAT_H_MNBVCX
+
+#include <stdint.h>     /* int64_t */
+#include <stddef.h>     /* size_t */
+#include <wchar.h>
+
+#define SIZE_TEXT_CAPACITY 32
+
+extern const wchar_t *formatFileSize(int64_t size, wchar_t *buffer, size_t capacity);
+extern void chooseSizeFormat();
+
+#endif
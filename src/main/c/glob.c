@@ -0,0 +1,271 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <wctype.h>     /* iswalpha */
+#include <windows.h>
+#include <gc.h>
+#include "glob.h"
+#include "pattern.h"
+#include "filename.h"
+#include "string.h"
+#include "error.h"
+
+#define RECURSIVE_WILDCARD L"**"
+#define PARENT_DIRECTORY L".."
+
+/* One piece of the pattern between backslashes. */
+struct GlobComponent {
+    const wchar_t *text;
+    PatternSet *pattern;        /* NULL for a plain name */
+    bool isRecursive;           /* ** matches any number of directories */
+};
+
+struct Glob {
+    struct GlobComponent *components;
+    size_t count;
+    GlobMatchHandler handler;
+    void *context;
+    bool matched;
+};
+
+static size_t getRootLength(const wchar_t *path);
+static bool isComponent(const wchar_t *start, const wchar_t *end, const wchar_t *name);
+static void parseComponents(struct Glob *glob, wchar_t *relativePart);
+static wchar_t *joinPath(const wchar_t *base, const wchar_t *name);
+static void emitMatch(struct Glob *glob, const wchar_t *path);
+static void expandFrom(struct Glob *glob, const wchar_t *base, size_t index);
+static void expandDirectory(struct Glob *glob, const wchar_t *base, size_t index);
+
+/* Square brackets are legal in file names, so they only make an argument
+   a pattern when there is no file by that exact name. */
+bool isGlob(const wchar_t *path)
+{
+    const wchar_t *openBracket;
+
+    return wcschr(path, L'*') != NULL || wcschr(path, L'?') != NULL
+        || ((openBracket = wcschr(path, L'[')) != NULL && wcschr(openBracket, L']') != NULL
+                && !fileExists((wchar_t *) path));
+}
+
+/* Every match of a pattern without a ** or .. component is the same
+   number of directories down, so that no match can be inside another. */
+bool canMatchNested(const wchar_t *pattern)
+{
+    const wchar_t *start;
+    const wchar_t *p;
+
+    start = pattern;
+    for (p = pattern; ; p++) {
+        if (*p == L'\\' || *p == L'/' || *p == L'\0') {
+            if (isComponent(start, p, RECURSIVE_WILDCARD) || isComponent(start, p, PARENT_DIRECTORY)) {
+                return true;
+            }
+            if (*p == L'\0') {
+                break;
+            }
+            start = p + 1;
+        }
+    }
+    return false;
+}
+
+static bool isComponent(const wchar_t *start, const wchar_t *end, const wchar_t *name)
+{
+    return (size_t) (end - start) == wcslen(name) && wcsncmp(start, name, end - start) == 0;
+}
+
+/* Expands the pattern one directory level at a time, calling handler for
+   each match as soon as it is found instead of collecting the matches
+   first. Returns false if nothing matched. */
+bool expandGlob(const wchar_t *pattern, GlobMatchHandler handler, void *context)
+{
+    struct Glob glob;
+    wchar_t *normalized;
+    wchar_t *root;
+    size_t rootLength;
+
+    normalized = slashToBackslash(pattern);
+    rootLength = getRootLength(normalized);
+    if ((root = (wchar_t *) GC_MALLOC((rootLength + 1) * sizeof(wchar_t))) == NULL) {
+        writeError(errno, L"Failed to allocate memory for pattern", pattern);
+        exit(EXIT_FAILURE);
+    }
+    wcsncpy(root, normalized, rootLength);
+    root[rootLength] = L'\0';
+
+    glob.handler = handler;
+    glob.context = context;
+    glob.matched = false;
+    parseComponents(&glob, normalized + rootLength);
+    expandFrom(&glob, root, 0);
+    free(normalized);
+    return glob.matched;
+}
+
+/* The part that is never expanded: C:\, \\server\share\ or \\?\C:\ */
+static size_t getRootLength(const wchar_t *path)
+{
+    size_t length = 0;
+    int separators = 0;
+
+    if (path[0] == L'\\' && path[1] == L'\\') {
+        length = 2;
+        while (path[length] != L'\0' && separators < 2) {
+            if (path[length] == L'\\') {
+                separators++;
+            }
+            length++;
+        }
+    } else if (iswalpha(path[0]) && path[1] == L':') {
+        length = path[2] == L'\\' ? 3 : 2;
+    } else if (path[0] == L'\\') {
+        length = 1;
+    }
+    return length;
+}
+
+/* Splits the relative part in place. Empty components are dropped. */
+static void parseComponents(struct Glob *glob, wchar_t *relativePart)
+{
+    wchar_t *p;
+    wchar_t *start;
+    size_t capacity = 1;
+    struct GlobComponent *component;
+
+    for (p = relativePart; *p != L'\0'; p++) {
+        if (*p == L'\\') {
+            capacity++;
+        }
+    }
+    glob->components = (struct GlobComponent *) GC_MALLOC(capacity * sizeof(struct GlobComponent));
+    if (glob->components == NULL) {
+        writeError(errno, L"Failed to allocate memory for pattern", relativePart);
+        exit(EXIT_FAILURE);
+    }
+    glob->count = 0;
+    start = relativePart;
+    for (p = relativePart; ; p++) {
+        if (*p == L'\\' || *p == L'\0') {
+            if (p > start) {
+                component = &glob->components[glob->count++];
+                component->text = createStringCopy(start);
+                ((wchar_t *) component->text)[p - start] = L'\0';
+                component->isRecursive = wcscmp(component->text, RECURSIVE_WILDCARD) == 0;
+                component->pattern = NULL;
+                if (!component->isRecursive && wcspbrk(component->text, L"*?[") != NULL) {
+                    component->pattern = initPatternSet();
+                    addPattern(component->pattern, component->text);
+                    compilePatternSet(component->pattern);
+                }
+            }
+            if (*p == L'\0') {
+                break;
+            }
+            start = p + 1;
+        }
+    }
+}
+
+static wchar_t *joinPath(const wchar_t *base, const wchar_t *name)
+{
+    wchar_t *path;
+
+    if (*base == L'\0') {
+        path = createStringCopy(name);
+    } else if (endsWithChar(base, L'\\') || endsWithChar(base, L':')) {
+        path = concat(base, name);
+    } else {
+        path = buildPath(base, name);
+    }
+    return path;
+}
+
+static void emitMatch(struct Glob *glob, const wchar_t *path)
+{
+    glob->matched = true;
+    glob->handler(path, glob->context);
+}
+
+static void expandFrom(struct Glob *glob, const wchar_t *base, size_t index)
+{
+    const struct GlobComponent *component;
+    wchar_t *path;
+
+    if (index == glob->count) {
+        /* A trailing ** can leave an empty base, which is not a match. */
+        if (*base != L'\0') {
+            emitMatch(glob, base);
+        }
+    } else {
+        component = &glob->components[index];
+        if (component->isRecursive) {
+            expandFrom(glob, base, index + 1);  /* ** can match no directories at all */
+            expandDirectory(glob, base, index);
+        } else if (component->pattern == NULL) {
+            path = joinPath(base, component->text);
+            if (index + 1 < glob->count || fileExists(path)) {
+                expandFrom(glob, path, index + 1);
+            }
+        } else {
+            expandDirectory(glob, base, index);
+        }
+    }
+}
+
+/* Reads one directory and continues with each entry that matches the
+   component at index. Junctions and directory symbolic links are not
+   descended by **, so that a link loop cannot make the expansion endless. */
+static void expandDirectory(struct Glob *glob, const wchar_t *base, size_t index)
+{
+    const struct GlobComponent *component;
+    HANDLE findHandle;
+    WIN32_FIND_DATA entry;
+    const wchar_t *search;
+    const wchar_t *name;
+    wchar_t *path;
+    DWORD lastError;
+    bool isLast;
+    bool isDirectory;
+    bool isLink;
+
+    component = &glob->components[index];
+    isLast = index + 1 == glob->count;
+    search = joinPath(base, L"*");
+    findHandle = FindFirstFile(search, &entry);
+    if (findHandle == INVALID_HANDLE_VALUE) {
+        lastError = GetLastError();
+        /* A directory that does not exist just means no match. */
+        if (lastError != ERROR_FILE_NOT_FOUND && lastError != ERROR_PATH_NOT_FOUND) {
+            writeLastError(lastError, L"Failed to get handle for pattern", search);
+        }
+        return;
+    }
+    do {
+        name = entry.cFileName;
+        if (wcscmp(name, L".") == 0 || wcscmp(name, L"..") == 0) {
+            continue;
+        }
+        isDirectory = (entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+        isLink = isDirectoryLink(entry.dwFileAttributes, entry.dwReserved0);
+        if (component->isRecursive) {
+            path = joinPath(base, name);
+            if (isDirectory && !isLink) {
+                expandFrom(glob, path, index);
+            } else if (isLast) {
+                /* A trailing ** matches every file at any depth. */
+                emitMatch(glob, path);
+            }
+        } else if (matchesPatternSet(component->pattern, name)) {
+            path = joinPath(base, name);
+            if (isLast) {
+                emitMatch(glob, path);
+            } else if (isDirectory) {
+                expandFrom(glob, path, index + 1);
+            }
+        }
+    } while (FindNextFile(findHandle, &entry));
+    if ((lastError = GetLastError()) != ERROR_NO_MORE_FILES) {
+        writeLastError(lastError, L"Failed to get next results", search);
+    }
+    FindClose(findHandle);
+}
@@ -0,0 +1,14 @@
+#ifndef GLOB_H_PLOKIJ
+#define GLOB_H_PLOKIJ
+
+#include <stdbool.h>
+#include <wchar.h>
+
+/* Called for each path that matches, as soon as it is found. */
+typedef void (*GlobMatchHandler)(const wchar_t *path, void *context);
+
+extern bool isGlob(const wchar_t *path);
+extern bool canMatchNested(const wchar_t *pattern);
+extern bool expandGlob(const wchar_t *pattern, GlobMatchHandler handler, void *context);
+
+#endif
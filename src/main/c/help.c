@@ -14,10 +14,90 @@ void usage()
     _putts(_T("  /a, -a, --all            write counts for all files, not just directories"));
     _putts(_T("  /b, -b, --bytes          print size in bytes"));
     _putts(_T("  /h, -h, --human-readable print sizes in human readable format (e.g., 0K 234M 2G)"));
+    _putts(_T("  /L, -L, --dereference    follow all junctions and symbolic links"));
     _putts(_T("  /s, -s, --summarize      display only a total for each argument"));
+    _putts(_T("  /x, -x, --one-file-system"));
+    _putts(_T("                           skip directories on different volumes"));
+    _putts(_T("      --by-age[=AGES]      show bytes last modified within each age range,"));
+    _putts(_T("                           on every line and as a table after each total;"));
+    _putts(_T("                           AGES is a list such as 90d,1y,3y (default 1y,3y,5y)"));
+    _putts(_T("                           with d for days, w for weeks and y for years"));
+    _putts(_T("      --by-extension       after each total, show the file name extensions"));
+    _putts(_T("                           using the most space and the most files"));
+    _putts(_T("      --by-owner           after each total, show the files and bytes of"));
+    _putts(_T("                           each owner"));
+    _putts(_T("      --checkpoint=FILE    save how far the scan has got to FILE every minute,"));
+    _putts(_T("                           and what it has printed to FILE.out, so that it"));
+    _putts(_T("                           can be carried on with --resume if it is stopped;"));
+    _putts(_T("                           both are removed when the scan finishes"));
+    _putts(_T("      --checkpoint-interval=DURATION"));
+    _putts(_T("                           save a checkpoint every DURATION instead"));
+    _putts(_T("      --deadline=DURATION  stop reading directories after DURATION, such as"));
+    _putts(_T("                           90, 30s, 5m or 1h30m, and print what is known;"));
+    _putts(_T("                           incomplete totals are marked >="));
+    _putts(_T("      --estimate[=SECONDS] estimate the total of each FILE by random sampling"));
+    _putts(_T("                           for up to SECONDS (default 10), with the 95%"));
+    _putts(_T("                           margin of error"));
+    _putts(_T("      --exclude=PATTERN    skip files and directories whose name matches PATTERN"));
+    _putts(_T("      --exclude-from=FILE  skip names matching any pattern in FILE"));
+    _putts(_T("      --files-from=FILE    summarize the files named in FILE, one per line,"));
+    _putts(_T("                           instead of FILE arguments; - reads standard input"));
+    _putts(_T("      --files0-from=FILE   like --files-from with names ended by NUL characters"));
+    _putts(_T("      --histogram          after each total, show how many files and bytes"));
+    _putts(_T("                           fall in each power of two size class"));
+    _putts(_T("      --include=PATTERN    count only files whose name matches PATTERN"));
+    _putts(_T("      --inodes             count files, directories and links instead of"));
+    _putts(_T("                           adding up sizes, using only the directory"));
+    _putts(_T("                           listings, so that no file is opened"));
+    _putts(_T("      --max-errors=N       display only the first N errors, count the rest"));
+    _putts(_T("      --merge              print what a single run would have, from the"));
+    _putts(_T("                           partial result files of every shard given as FILEs;"));
+    _putts(_T("                           the options are those the shards were given"));
+    _putts(_T("      --order=ORDER        physical looks up files and directories in the"));
+    _putts(_T("                           order they are stored on an NTFS volume, which"));
+    _putts(_T("                           saves seeking on a hard disk; the default is"));
+    _putts(_T("                           listing; output is in the same order either way"));
+    _putts(_T("      --partial=FILE       where --shard writes its partial result"));
+    _putts(_T("      --pipe=NAME          named pipe for --serve and --query (default du)"));
+    _putts(_T("      --prefetch[=K]       read up to K directories (default 16) ahead of the"));
+    _putts(_T("                           scan on another thread, so that they are in the"));
+    _putts(_T("                           cache when the scan gets to them; 0 turns it off"));
+    _putts(_T("      --progress           report progress on stderr while scanning"));
+    _putts(_T("      --quiet-errors       do not display errors, only a summary at the end"));
+    _putts(_T("      --query=QUERY        ask a running du --serve about each FILE, where"));
+    _putts(_T("                           QUERY is total, children, or top[:N] for the N"));
+    _putts(_T("                           largest directories (default 10)"));
+    _putts(_T("      --resume=FILE        carry on from the checkpoint in FILE, given the same"));
+    _putts(_T("                           options and FILEs in the same directory, with the"));
+    _putts(_T("                           same output as if the scan had not been stopped"));
+    _putts(_T("      --serve              read each FILE once, keep the totals up to date as"));
+    _putts(_T("                           files change, and answer --query until stopped"));
+    _putts(_T("      --shard=I/N          scan only the part of each FILE that falls to shard"));
+    _putts(_T("                           I of N, so that N runs with the same options and"));
+    _putts(_T("                           FILEs, on one machine or several, share the scan;"));
+    _putts(_T("                           nothing is printed until --merge"));
+    _putts(_T("      --split-depth=D      with --shard, read the directories less than D"));
+    _putts(_T("                           levels below each FILE in every shard, and share"));
+    _putts(_T("                           out what is in them (default 1)"));
+    _putts(_T("      --stats              when done, show on stderr how many directories"));
+    _putts(_T("                           were read and how many had been read ahead"));
+    _putts(_T("      --threads=N          summarize up to N FILEs at a time (default one"));
+    _putts(_T("                           per processor); output stays in FILE order"));
+    _putts(_T("      --time               show the newest modification time in each tree"));
     _putts(_T("  /?, -?, --help           display this help and exit"));
     _putts(_T("  /v, -v, --version        output version information and exit"));
     _putts(_T(""));
+    _putts(_T("PATTERN may contain *, ? and [...] and is matched against the name"));
+    _putts(_T("of each entry, ignoring case. Excluded directories are not read."));
+    _putts(_T(""));
+    _putts(_T("FILE may contain *, ? and [...] wildcards, and ** matches any number"));
+    _putts(_T("of directories, as in du -s src\\**\\*.obj"));
+    _putts(_T("A FILE inside another FILE is read only once, as part of the outer one."));
+    _putts(_T(""));
+    _putts(_T("Junctions, mount points and directory symbolic links below the FILE"));
+    _putts(_T("arguments are not followed unless -L is given. With -L, a directory"));
+    _putts(_T("that was already counted is not counted again, which breaks loops."));
+    _putts(_T(""));
     _putts(_T("Example: du -s *"));
     _putts(_T(""));
     _putts(_T("Report bugs at https://github.com/gungwald/du"));
@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <string.h>     /* memset */
+#include "histogram.h"
+#include "format.h"
+#include "output.h"
+
+#define BUCKET_LABEL_CAPACITY 16
+
+static int getBucket(int64_t size);
+static const wchar_t *formatBucketBound(int bucket, wchar_t *buffer, size_t capacity);
+
+void initHistogram(struct Histogram *histogram)
+{
+    memset(histogram, 0, sizeof(struct Histogram));
+}
+
+static int getBucket(int64_t size)
+{
+    int bucket;
+
+    if (size <= 0) {
+        bucket = 0;
+    } else {
+#ifdef __GNUC__
+        bucket = 64 - __builtin_clzll((unsigned long long) size);
+#else
+        for (bucket = 0; size != 0; size >>= 1) {
+            bucket++;
+        }
+#endif
+    }
+    return bucket < HISTOGRAM_BUCKET_COUNT ? bucket : HISTOGRAM_BUCKET_COUNT - 1;
+}
+
+void addToHistogram(struct Histogram *histogram, int64_t size)
+{
+    int bucket;
+
+    bucket = getBucket(size);
+    histogram->fileCounts[bucket]++;
+    histogram->byteTotals[bucket] += size;
+}
+
+void mergeHistogram(struct Histogram *total, const struct Histogram *part)
+{
+    int i;
+
+    for (i = 0; i < HISTOGRAM_BUCKET_COUNT; i++) {
+        total->fileCounts[i] += part->fileCounts[i];
+        total->byteTotals[i] += part->byteTotals[i];
+    }
+}
+
+/* The smallest size in the bucket, in binary units such as 512, 4K or 2G. */
+static const wchar_t *formatBucketBound(int bucket, wchar_t *buffer, size_t capacity)
+{
+    const wchar_t *units = L" KMGTPE";
+    int shift;
+
+    if (bucket == 0) {
+        _snwprintf(buffer, capacity, L"0");
+    } else {
+        shift = bucket - 1;
+        if (shift / 10 == 0) {
+            _snwprintf(buffer, capacity, L"%d", 1 << shift);
+        } else {
+            _snwprintf(buffer, capacity, L"%d%lc", 1 << (shift % 10), units[shift / 10]);
+        }
+    }
+    buffer[capacity - 1] = L'\0';
+    return buffer;
+}
+
+void printHistogram(const struct Histogram *histogram, const wchar_t *path)
+{
+    wchar_t lowText[BUCKET_LABEL_CAPACITY];
+    wchar_t highText[BUCKET_LABEL_CAPACITY];
+    wchar_t sizeText[SIZE_TEXT_CAPACITY];
+    uint64_t totalFiles = 0;
+    int64_t totalBytes = 0;
+    int first = -1;
+    int last = -1;
+    int i;
+
+    for (i = 0; i < HISTOGRAM_BUCKET_COUNT; i++) {
+        if (histogram->fileCounts[i] > 0) {
+            if (first < 0) {
+                first = i;
+            }
+            last = i;
+            totalFiles += histogram->fileCounts[i];
+            totalBytes += histogram->byteTotals[i];
+        }
+    }
+    writeOutput(L"File sizes in %ls:\n", path);
+    writeOutput(L"  %-17ls %12ls %6ls %12ls %6ls\n", L"Size", L"Files", L"%", L"Total", L"%");
+    for (i = first; i >= 0 && i <= last; i++) {
+        formatBucketBound(i, lowText, BUCKET_LABEL_CAPACITY);
+        if (i == 0) {
+            writeOutput(L"  %-17ls", lowText);
+        } else {
+            formatBucketBound(i + 1, highText, BUCKET_LABEL_CAPACITY);
+            writeOutput(L"  %6ls to < %-6ls", lowText, highText);
+        }
+        formatFileSize(histogram->byteTotals[i], sizeText, SIZE_TEXT_CAPACITY);
+        writeOutput(L" %12llu %5.1f%% %12ls %5.1f%%\n",
+                (unsigned long long) histogram->fileCounts[i],
+                100.0 * histogram->fileCounts[i] / totalFiles,
+                sizeText,
+                totalBytes > 0 ? 100.0 * histogram->byteTotals[i] / totalBytes : 0.0);
+    }
+    fflush(stdout);
+}
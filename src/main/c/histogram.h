@@ -0,0 +1,21 @@
+#ifndef HISTOGRAM_H_YHNUJM
+#define HISTOGRAM_H_YHNUJM
+
+#include <stdint.h>
+#include <wchar.h>
+
+/* Bucket 0 holds empty files and bucket i holds sizes from 2^(i-1) up to
+   2^i - 1, which covers every 64 bit size. */
+#define HISTOGRAM_BUCKET_COUNT 64
+
+struct Histogram {
+    uint64_t fileCounts[HISTOGRAM_BUCKET_COUNT];
+    int64_t byteTotals[HISTOGRAM_BUCKET_COUNT];
+};
+
+extern void initHistogram(struct Histogram *histogram);
+extern void addToHistogram(struct Histogram *histogram, int64_t size);
+extern void mergeHistogram(struct Histogram *total, const struct Histogram *part);
+extern void printHistogram(const struct Histogram *histogram, const wchar_t *path);
+
+#endif
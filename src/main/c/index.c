@@ -0,0 +1,1054 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>     /* memcpy, memmove */
+#include <errno.h>
+#include <windows.h>
+#include <gc.h>
+#include "index.h"
+#include "filename.h"
+#include "string.h"
+#include "error.h"
+#include "args.h"
+
+#define INITIAL_NODE_CAPACITY 1024
+#define INITIAL_CHILDREN_CAPACITY 1024
+#define INITIAL_NAMES_CAPACITY 16384
+/* Must be a power of 2 so that the hash can be masked. */
+#define INITIAL_NAME_SLOT_CAPACITY 1024
+/* NTFS allows 255 UTF-16 units in a name, which is at most 765 bytes of UTF-8. */
+#define NAME_CAPACITY 256
+#define INITIAL_FILL_STACK_CAPACITY 64
+/* Removed entries and moved runs of children are only dropped once there
+   are at least this many of them, and they are half of what is held. */
+#define MIN_COMPACTION_WASTE 4096
+#define UTF8_NAME_CAPACITY (NAME_CAPACITY * 3)
+
+/* Flags kept in the high bits of childCounts. A grown directory has had
+   its children moved to a run with room for a power of 2 of them. */
+#define DIRECTORY_FLAG 0x80000000UL
+#define GROWN_FLAG 0x40000000UL
+#define CHILD_COUNT_MASK 0x3FFFFFFFUL
+
+struct UsageIndex {
+    wchar_t *rootPath;
+    /* One element per entry, indexed by IndexNode. Entry 0 is the root. */
+    uint32_t *parents;
+    uint32_t *nameOffsets;      /* Into names */
+    int64_t *sizes;             /* Total of the whole subtree */
+    uint32_t *childStarts;      /* Into children */
+    uint32_t *childCounts;      /* With DIRECTORY_FLAG and GROWN_FLAG */
+    size_t nodeCount;
+    size_t nodeCapacity;
+    /* The children of each directory are a run in this array, sorted by
+       name ignoring case. */
+    IndexNode *children;
+    size_t childrenLength;
+    size_t childrenCapacity;
+    /* Each distinct name once, as UTF-8 with a terminator. */
+    char *names;
+    size_t namesLength;
+    size_t namesCapacity;
+    uint32_t *nameSlots;        /* Open addressing, name offset + 1, 0 when empty */
+    size_t nameSlotCapacity;
+    size_t nameCount;
+    /* Left behind by updates, until the index is compacted. */
+    size_t orphanedNodes;
+    size_t orphanedChildren;
+    CRITICAL_SECTION lock;
+};
+
+/* A directory being filled in. Its subdirectories still to be read are
+   among the nodes from nextChild to endChild. */
+struct FillFrame {
+    IndexNode directory;
+    size_t pathLength;          /* Its path is the start of the one being read */
+    IndexNode nextChild;
+    IndexNode endChild;
+};
+
+/* For sorting the children of a directory. */
+struct NamedNode {
+    IndexNode node;
+    wchar_t *name;
+};
+
+static void *growArray(void *array, size_t capacity, size_t elementSize);
+static void ensureNodeCapacity(UsageIndex *index, size_t extra);
+static void ensureChildrenCapacity(UsageIndex *index, size_t extra);
+static unsigned long hashUtf8(const char *name, size_t length);
+static uint32_t internUtf8(UsageIndex *index, const char *name, size_t length);
+static uint32_t internName(UsageIndex *index, const wchar_t *name);
+static void growNameSlots(UsageIndex *index);
+static const wchar_t *getNodeName(const UsageIndex *index, IndexNode node, wchar_t *buffer);
+static IndexNode addNode(UsageIndex *index, IndexNode parent, uint32_t nameOffset, int64_t size, bool isDirectory);
+static bool isDirectoryNode(const UsageIndex *index, IndexNode node);
+static size_t getChildCount(const UsageIndex *index, IndexNode node);
+static size_t roundUpToPowerOfTwo(size_t n);
+static void makeRoomForChild(UsageIndex *index, IndexNode parent);
+static int compareNamedNodes(const void *left, const void *right);
+static void sortChildren(UsageIndex *index, IndexNode directory);
+static int compareName(const wchar_t *name, const wchar_t *component, size_t length);
+static size_t findChildPosition(const UsageIndex *index, IndexNode parent, const wchar_t *component, size_t length, bool *found);
+static void insertChild(UsageIndex *index, IndexNode parent, IndexNode child);
+static void removeChild(UsageIndex *index, IndexNode parent, size_t position);
+static void orphanSubtree(UsageIndex *index, IndexNode node);
+static size_t getChildRunLength(const UsageIndex *index, IndexNode node);
+static void addToAncestors(UsageIndex *index, IndexNode node, int64_t delta);
+static void readIndexDirectory(UsageIndex *index, IndexNode directory, const wchar_t *path);
+static void fillIndexDirectory(UsageIndex *index, IndexNode directory, const wchar_t *path);
+static wchar_t *setFillPath(wchar_t *path, size_t *capacity, size_t length, const wchar_t *name);
+static void graftIndex(UsageIndex *index, IndexNode parent, const UsageIndex *subtree);
+static void moveIndexContents(UsageIndex *target, UsageIndex *source);
+static bool needsCompaction(const UsageIndex *index);
+static void compactUsageIndex(UsageIndex *index);
+static size_t getRootLength(const UsageIndex *index);
+static wchar_t *getIndexNodePath(const UsageIndex *index, IndexNode node);
+
+/* The arrays hold no pointers, so the collector does not need to scan them. */
+static void *growArray(void *array, size_t capacity, size_t elementSize)
+{
+    if (array == NULL) {
+        array = GC_MALLOC_ATOMIC(capacity * elementSize);
+    } else {
+        array = GC_REALLOC(array, capacity * elementSize);
+    }
+    if (array == NULL) {
+        writeError(errno, L"Failed to allocate memory for", L"index");
+        exit(EXIT_FAILURE);
+    }
+    return array;
+}
+
+static void ensureNodeCapacity(UsageIndex *index, size_t extra)
+{
+    size_t capacity;
+
+    if (index->nodeCount + extra > index->nodeCapacity) {
+        if (index->nodeCount + extra >= NO_INDEX_NODE) {
+            writeError(ENOMEM, L"Too many entries for", L"index");
+            exit(EXIT_FAILURE);
+        }
+        capacity = index->nodeCapacity == 0 ? INITIAL_NODE_CAPACITY : index->nodeCapacity;
+        /* Half again rather than double, since at 100 million entries the
+           unused tail of a doubled array would be gigabytes. */
+        while (capacity < index->nodeCount + extra) {
+            capacity += capacity / 2;
+        }
+        index->parents = (uint32_t *) growArray(index->parents, capacity, sizeof(uint32_t));
+        index->nameOffsets = (uint32_t *) growArray(index->nameOffsets, capacity, sizeof(uint32_t));
+        index->sizes = (int64_t *) growArray(index->sizes, capacity, sizeof(int64_t));
+        index->childStarts = (uint32_t *) growArray(index->childStarts, capacity, sizeof(uint32_t));
+        index->childCounts = (uint32_t *) growArray(index->childCounts, capacity, sizeof(uint32_t));
+        index->nodeCapacity = capacity;
+    }
+}
+
+static void ensureChildrenCapacity(UsageIndex *index, size_t extra)
+{
+    size_t capacity;
+
+    if (index->childrenLength + extra > index->childrenCapacity) {
+        if (index->childrenLength + extra >= NO_INDEX_NODE) {
+            writeError(ENOMEM, L"Too many entries for", L"index");
+            exit(EXIT_FAILURE);
+        }
+        capacity = index->childrenCapacity == 0 ? INITIAL_CHILDREN_CAPACITY : index->childrenCapacity;
+        while (capacity < index->childrenLength + extra) {
+            capacity += capacity / 2;
+        }
+        index->children = (IndexNode *) growArray(index->children, capacity, sizeof(IndexNode));
+        index->childrenCapacity = capacity;
+    }
+}
+
+/* FNV-1a */
+static unsigned long hashUtf8(const char *name, size_t length)
+{
+    unsigned long hash = 2166136261UL;
+    size_t i;
+
+    for (i = 0; i < length; i++) {
+        hash ^= (unsigned char) name[i];
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+static void growNameSlots(UsageIndex *index)
+{
+    uint32_t *oldSlots;
+    size_t oldCapacity;
+    size_t i;
+    size_t slot;
+    const char *name;
+
+    oldSlots = index->nameSlots;
+    oldCapacity = index->nameSlotCapacity;
+    index->nameSlotCapacity = oldCapacity == 0 ? INITIAL_NAME_SLOT_CAPACITY : oldCapacity * 2;
+    index->nameSlots = (uint32_t *) growArray(NULL, index->nameSlotCapacity, sizeof(uint32_t));
+    memset(index->nameSlots, 0, index->nameSlotCapacity * sizeof(uint32_t));
+    for (i = 0; i < oldCapacity; i++) {
+        if (oldSlots[i] != 0) {
+            name = index->names + oldSlots[i] - 1;
+            slot = hashUtf8(name, strlen(name)) & (index->nameSlotCapacity - 1);
+            while (index->nameSlots[slot] != 0) {
+                slot = (slot + 1) & (index->nameSlotCapacity - 1);
+            }
+            index->nameSlots[slot] = oldSlots[i];
+        }
+    }
+}
+
+/* Returns the offset of the name in the pool, adding it if it is new. */
+static uint32_t internUtf8(UsageIndex *index, const char *name, size_t length)
+{
+    size_t slot;
+    size_t capacity;
+    const char *candidate;
+    uint32_t offset;
+
+    slot = hashUtf8(name, length) & (index->nameSlotCapacity - 1);
+    while (index->nameSlots[slot] != 0) {
+        candidate = index->names + index->nameSlots[slot] - 1;
+        if (strncmp(candidate, name, length) == 0 && candidate[length] == '\0') {
+            return index->nameSlots[slot] - 1;
+        }
+        slot = (slot + 1) & (index->nameSlotCapacity - 1);
+    }
+    if (index->namesLength + length + 1 > index->namesCapacity) {
+        if (index->namesLength + length + 1 >= UINT32_MAX) {
+            writeError(ENOMEM, L"Too many names for", L"index");
+            exit(EXIT_FAILURE);
+        }
+        capacity = index->namesCapacity == 0 ? INITIAL_NAMES_CAPACITY : index->namesCapacity;
+        while (capacity < index->namesLength + length + 1) {
+            capacity *= 2;
+        }
+        index->names = (char *) growArray(index->names, capacity, sizeof(char));
+        index->namesCapacity = capacity;
+    }
+    offset = (uint32_t) index->namesLength;
+    memcpy(index->names + offset, name, length);
+    index->names[offset + length] = '\0';
+    index->namesLength += length + 1;
+    index->nameSlots[slot] = offset + 1;
+    index->nameCount++;
+    /* Keep the table at most half full so that probe sequences stay short. */
+    if (index->nameCount * 2 > index->nameSlotCapacity) {
+        growNameSlots(index);
+    }
+    return offset;
+}
+
+static uint32_t internName(UsageIndex *index, const wchar_t *name)
+{
+    char buffer[UTF8_NAME_CAPACITY];
+    char *utf8;
+    int length;
+
+    length = WideCharToMultiByte(CP_UTF8, 0, name, -1, buffer, UTF8_NAME_CAPACITY, NULL, NULL);
+    if (length > 0) {
+        utf8 = buffer;
+    } else {
+        /* Longer than any NTFS name, such as a root given as a full path. */
+        utf8 = convertToUtf8(name);
+        length = (int) strlen(utf8) + 1;
+    }
+    return internUtf8(index, utf8, (size_t) length - 1);
+}
+
+/* buffer must hold NAME_CAPACITY characters. */
+static const wchar_t *getNodeName(const UsageIndex *index, IndexNode node, wchar_t *buffer)
+{
+    if (MultiByteToWideChar(CP_UTF8, 0, index->names + index->nameOffsets[node], -1, buffer, NAME_CAPACITY) == 0) {
+        buffer[0] = L'\0';
+    }
+    return buffer;
+}
+
+static IndexNode addNode(UsageIndex *index, IndexNode parent, uint32_t nameOffset, int64_t size, bool isDirectory)
+{
+    IndexNode node;
+
+    ensureNodeCapacity(index, 1);
+    node = (IndexNode) index->nodeCount++;
+    index->parents[node] = parent;
+    index->nameOffsets[node] = nameOffset;
+    index->sizes[node] = size;
+    index->childStarts[node] = 0;
+    index->childCounts[node] = isDirectory ? DIRECTORY_FLAG : 0;
+    return node;
+}
+
+static bool isDirectoryNode(const UsageIndex *index, IndexNode node)
+{
+    return (index->childCounts[node] & DIRECTORY_FLAG) != 0;
+}
+
+static size_t getChildCount(const UsageIndex *index, IndexNode node)
+{
+    return index->childCounts[node] & CHILD_COUNT_MASK;
+}
+
+static size_t roundUpToPowerOfTwo(size_t n)
+{
+    size_t power = 1;
+
+    while (power < n) {
+        power *= 2;
+    }
+    return n == 0 ? 0 : power;
+}
+
+/* Makes sure that the run of children of parent has room for one more at
+   its end. A run that ends the array simply grows. Otherwise it is moved
+   to the end with room for a power of 2 of children, and the space it
+   leaves is not used again until the index is compacted. */
+static void makeRoomForChild(UsageIndex *index, IndexNode parent)
+{
+    size_t count;
+    size_t start;
+    size_t capacity;
+    bool isGrown;
+
+    count = getChildCount(index, parent);
+    start = index->childStarts[parent];
+    isGrown = (index->childCounts[parent] & GROWN_FLAG) != 0;
+    if (count == 0 && !isGrown) {
+        start = index->childrenLength;
+        index->childStarts[parent] = (uint32_t) start;
+    }
+    if (isGrown && count < roundUpToPowerOfTwo(count)) {
+        return;
+    }
+    if (!isGrown && start + count == index->childrenLength) {
+        ensureChildrenCapacity(index, 1);
+        index->childrenLength++;
+        return;
+    }
+    capacity = roundUpToPowerOfTwo(count + 1);
+    if (isGrown && start + count == index->childrenLength) {
+        ensureChildrenCapacity(index, capacity - count);
+        index->childrenLength = start + capacity;
+        return;
+    }
+    ensureChildrenCapacity(index, capacity);
+    index->orphanedChildren += getChildRunLength(index, parent);
+    memcpy(index->children + index->childrenLength, index->children + start, count * sizeof(IndexNode));
+    index->childStarts[parent] = (uint32_t) index->childrenLength;
+    index->childrenLength += capacity;
+    index->childCounts[parent] |= GROWN_FLAG;
+}
+
+UsageIndex *initUsageIndex(const wchar_t *rootPath)
+{
+    UsageIndex *index;
+
+    if ((index = (UsageIndex *) GC_MALLOC(sizeof(UsageIndex))) == NULL) {
+        writeError(errno, L"Failed to allocate memory for index of", rootPath);
+        exit(EXIT_FAILURE);
+    }
+    index->rootPath = createStringCopy(rootPath);
+    index->parents = NULL;
+    index->nameOffsets = NULL;
+    index->sizes = NULL;
+    index->childStarts = NULL;
+    index->childCounts = NULL;
+    index->nodeCount = 0;
+    index->nodeCapacity = 0;
+    index->children = NULL;
+    index->childrenLength = 0;
+    index->childrenCapacity = 0;
+    index->names = NULL;
+    index->namesLength = 0;
+    index->namesCapacity = 0;
+    index->nameSlots = NULL;
+    index->nameSlotCapacity = 0;
+    index->nameCount = 0;
+    index->orphanedNodes = 0;
+    index->orphanedChildren = 0;
+    InitializeCriticalSection(&index->lock);
+    growNameSlots(index);
+    addNode(index, NO_INDEX_NODE, internName(index, getSimpleName(rootPath)), 0, true);
+    return index;
+}
+
+IndexNode getIndexRoot(const UsageIndex *index)
+{
+    return 0;
+}
+
+/* For building a directory: children are added in any order, then
+   finishIndexDirectory is called once everything below the directory has
+   been added. */
+IndexNode appendIndexChild(UsageIndex *index, IndexNode parent, const wchar_t *name, int64_t size, bool isDirectory)
+{
+    IndexNode child;
+
+    child = addNode(index, parent, internName(index, name), size, isDirectory);
+    makeRoomForChild(index, parent);
+    index->children[index->childStarts[parent] + getChildCount(index, parent)] = child;
+    index->childCounts[parent]++;
+    return child;
+}
+
+static int compareNamedNodes(const void *left, const void *right)
+{
+    return _wcsicmp(((const struct NamedNode *) left)->name, ((const struct NamedNode *) right)->name);
+}
+
+static void sortChildren(UsageIndex *index, IndexNode directory)
+{
+    struct NamedNode *named;
+    wchar_t buffer[NAME_CAPACITY];
+    IndexNode *run;
+    size_t count;
+    size_t i;
+
+    count = getChildCount(index, directory);
+    run = index->children + index->childStarts[directory];
+    if ((named = (struct NamedNode *) GC_MALLOC(count * sizeof(struct NamedNode))) == NULL) {
+        writeError(errno, L"Failed to allocate memory for", L"index");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < count; i++) {
+        named[i].node = run[i];
+        named[i].name = createStringCopy(getNodeName(index, run[i], buffer));
+    }
+    qsort(named, count, sizeof(struct NamedNode), compareNamedNodes);
+    for (i = 0; i < count; i++) {
+        run[i] = named[i].node;
+    }
+}
+
+/* Sorts the children unless they came in order already, and sets the
+   total of the directory. */
+void finishIndexDirectory(UsageIndex *index, IndexNode directory)
+{
+    wchar_t previous[NAME_CAPACITY];
+    wchar_t current[NAME_CAPACITY];
+    const IndexNode *run;
+    size_t count;
+    size_t i;
+    int64_t total = 0;
+    bool isSorted = true;
+
+    count = getChildCount(index, directory);
+    run = index->children + index->childStarts[directory];
+    for (i = 0; i < count; i++) {
+        total += index->sizes[run[i]];
+        if (i > 0 && isSorted) {
+            getNodeName(index, run[i - 1], previous);
+            isSorted = _wcsicmp(previous, getNodeName(index, run[i], current)) <= 0;
+        }
+    }
+    if (!isSorted) {
+        sortChildren(index, directory);
+    }
+    index->sizes[directory] = total;
+}
+
+size_t getUsageIndexEntryCount(const UsageIndex *index)
+{
+    return index->nodeCount;
+}
+
+size_t getUsageIndexMemoryUse(const UsageIndex *index)
+{
+    return sizeof(UsageIndex)
+        + index->nodeCapacity * (3 * sizeof(uint32_t) + sizeof(int64_t) + sizeof(uint32_t))
+        + index->childrenCapacity * sizeof(IndexNode)
+        + index->namesCapacity
+        + index->nameSlotCapacity * sizeof(uint32_t);
+}
+
+/* Orders like _wcsicmp, comparing name with the first length characters
+   of component. */
+static int compareName(const wchar_t *name, const wchar_t *component, size_t length)
+{
+    int result;
+
+    result = _wcsnicmp(name, component, length);
+    if (result == 0 && name[length] != L'\0') {
+        result = 1;
+    }
+    return result;
+}
+
+/* Binary search. Returns where the child is, or where it would go. */
+static size_t findChildPosition(const UsageIndex *index, IndexNode parent, const wchar_t *component, size_t length, bool *found)
+{
+    wchar_t buffer[NAME_CAPACITY];
+    const IndexNode *run;
+    size_t low = 0;
+    size_t high;
+    size_t middle;
+    int result;
+
+    run = index->children + index->childStarts[parent];
+    high = getChildCount(index, parent);
+    *found = false;
+    while (low < high) {
+        middle = low + (high - low) / 2;
+        result = compareName(getNodeName(index, run[middle], buffer), component, length);
+        if (result == 0) {
+            *found = true;
+            return middle;
+        } else if (result < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+static void insertChild(UsageIndex *index, IndexNode parent, IndexNode child)
+{
+    wchar_t buffer[NAME_CAPACITY];
+    IndexNode *run;
+    size_t position;
+    size_t count;
+    bool found;
+
+    getNodeName(index, child, buffer);
+    position = findChildPosition(index, parent, buffer, wcslen(buffer), &found);
+    makeRoomForChild(index, parent);
+    run = index->children + index->childStarts[parent];
+    count = getChildCount(index, parent);
+    memmove(run + position + 1, run + position, (count - position) * sizeof(IndexNode));
+    run[position] = child;
+    index->childCounts[parent]++;
+    index->parents[child] = parent;
+}
+
+/* The removed child and the entries below it stay in the arrays, counted
+   as orphaned, until the index is compacted. */
+static void removeChild(UsageIndex *index, IndexNode parent, size_t position)
+{
+    IndexNode *run;
+    size_t count;
+
+    run = index->children + index->childStarts[parent];
+    count = getChildCount(index, parent);
+    orphanSubtree(index, run[position]);
+    memmove(run + position, run + position + 1, (count - position - 1) * sizeof(IndexNode));
+    index->childCounts[parent]--;
+}
+
+static void orphanSubtree(UsageIndex *index, IndexNode node)
+{
+    IndexNode *stack;
+    size_t stackLength = 0;
+    size_t stackCapacity = INITIAL_FILL_STACK_CAPACITY;
+    size_t childCount;
+    size_t i;
+    const IndexNode *run;
+
+    stack = (IndexNode *) growArray(NULL, stackCapacity, sizeof(IndexNode));
+    stack[stackLength++] = node;
+    while (stackLength > 0) {
+        node = stack[--stackLength];
+        index->orphanedNodes++;
+        index->orphanedChildren += getChildRunLength(index, node);
+        run = index->children + index->childStarts[node];
+        childCount = getChildCount(index, node);
+        if (stackLength + childCount > stackCapacity) {
+            while (stackLength + childCount > stackCapacity) {
+                stackCapacity *= 2;
+            }
+            stack = (IndexNode *) growArray(stack, stackCapacity, sizeof(IndexNode));
+        }
+        for (i = 0; i < childCount; i++) {
+            stack[stackLength++] = run[i];
+        }
+    }
+}
+
+/* How much of the children array the run of node takes up. */
+static size_t getChildRunLength(const UsageIndex *index, IndexNode node)
+{
+    size_t count;
+
+    count = getChildCount(index, node);
+    return (index->childCounts[node] & GROWN_FLAG) != 0 ? roundUpToPowerOfTwo(count) : count;
+}
+
+static void addToAncestors(UsageIndex *index, IndexNode node, int64_t delta)
+{
+    for (; node != NO_INDEX_NODE; node = index->parents[node]) {
+        index->sizes[node] += delta;
+    }
+}
+
+/* All of the entries of a directory are added before any subdirectory is
+   read, so that each run of children is built at the end of the array. */
+static void readIndexDirectory(UsageIndex *index, IndexNode directory, const wchar_t *path)
+{
+    struct ListingOptions listing;
+    DirectoryReader *reader;
+    struct FileEntry *batch;
+    size_t batchSize;
+    size_t i;
+
+    chooseListingOptions(&listing);
+    if ((reader = openDirectory(path, &listing)) != NULL) {
+        while ((batch = readDirectory(reader, &batchSize)) != NULL) {
+            for (i = 0; i < batchSize; i++) {
+                /* Links to directories are kept as empty entries and are
+                   not followed, as in a scan without -L. */
+                appendIndexChild(index, directory, getSimpleName(batch[i].path),
+                                 batch[i].type == FILETYPE_FILE
+                                     ? getEntrySize(&batch[i], chooseTallySize(), listing.dereference) : 0,
+                                 batch[i].type == FILETYPE_DIRECTORY);
+            }
+        }
+        closeDirectory(reader);
+    }
+}
+
+/* Walks the tree with an explicit stack, so that a deep tree cannot run
+   out of native stack. The children of a directory are the nodes added
+   while it was read, so the names they were given are all that is needed
+   to find its subdirectories again. */
+static void fillIndexDirectory(UsageIndex *index, IndexNode directory, const wchar_t *path)
+{
+    struct FillFrame *frames = NULL;
+    struct FillFrame *frame;
+    size_t frameCount = 0;
+    size_t frameCapacity = 0;
+    wchar_t *directoryPath;
+    size_t pathLength;
+    size_t pathCapacity = 0;
+    wchar_t buffer[NAME_CAPACITY];
+    IndexNode child;
+
+    /* One path that grows on the way down and is cut on the way up. */
+    directoryPath = setFillPath(NULL, &pathCapacity, 0, path);
+    pathLength = wcslen(path);
+    for (;;) {
+        if (frameCount == frameCapacity) {
+            frameCapacity = frameCapacity == 0 ? INITIAL_FILL_STACK_CAPACITY : frameCapacity * 2;
+            if ((frames = (struct FillFrame *) GC_REALLOC(frames, frameCapacity * sizeof(struct FillFrame))) == NULL) {
+                writeError(errno, L"Failed to allocate memory for", L"index");
+                exit(EXIT_FAILURE);
+            }
+        }
+        frame = &frames[frameCount++];
+        frame->directory = directory;
+        frame->pathLength = pathLength;
+        frame->nextChild = (IndexNode) index->nodeCount;
+        readIndexDirectory(index, directory, directoryPath);
+        frame->endChild = (IndexNode) index->nodeCount;
+
+        /* Finish directories until one has a subdirectory left to read. */
+        for (;;) {
+            frame = &frames[frameCount - 1];
+            while (frame->nextChild < frame->endChild && !isDirectoryNode(index, frame->nextChild)) {
+                frame->nextChild++;
+            }
+            if (frame->nextChild < frame->endChild) {
+                break;
+            }
+            finishIndexDirectory(index, frame->directory);
+            if (--frameCount == 0) {
+                return;
+            }
+        }
+        child = frame->nextChild++;
+        directoryPath = setFillPath(directoryPath, &pathCapacity, frame->pathLength, L"\\");
+        directoryPath = setFillPath(directoryPath, &pathCapacity, frame->pathLength + 1, getNodeName(index, child, buffer));
+        pathLength = wcslen(directoryPath);
+        directory = child;
+    }
+}
+
+/* Puts name after the first length characters of path, growing it if
+   need be, and returns where path now is. */
+static wchar_t *setFillPath(wchar_t *path, size_t *capacity, size_t length, const wchar_t *name)
+{
+    size_t nameLength;
+
+    nameLength = wcslen(name);
+    if (length + nameLength + 1 > *capacity) {
+        *capacity = (length + nameLength + 1) * 2;
+        if ((path = (wchar_t *) GC_REALLOC(path, *capacity * sizeof(wchar_t))) == NULL) {
+            writeError(errno, L"Failed to allocate memory for", name);
+            exit(EXIT_FAILURE);
+        }
+    }
+    wmemcpy(path + length, name, nameLength + 1);
+    return path;
+}
+
+UsageIndex *buildUsageIndex(const wchar_t *rootPath)
+{
+    UsageIndex *index;
+    struct FileEntry entry;
+
+    index = initUsageIndex(rootPath);
+    if (getFileEntry(index->rootPath, &entry)) {
+        if (entry.type == FILETYPE_DIRECTORY) {
+            fillIndexDirectory(index, getIndexRoot(index), index->rootPath);
+        } else {
+            index->childCounts[getIndexRoot(index)] = 0;
+            if (entry.type == FILETYPE_FILE) {
+                index->sizes[getIndexRoot(index)] = getEntrySize(&entry, chooseTallySize(), dereference);
+            }
+        }
+    }
+    return index;
+}
+
+/* Copies a separately built subtree in as a child of parent. */
+static void graftIndex(UsageIndex *index, IndexNode parent, const UsageIndex *subtree)
+{
+    IndexNode base;
+    IndexNode node;
+    size_t count;
+    size_t start;
+    size_t i;
+    size_t j;
+
+    base = (IndexNode) index->nodeCount;
+    ensureNodeCapacity(index, subtree->nodeCount);
+    for (i = 0; i < subtree->nodeCount; i++) {
+        node = base + (IndexNode) i;
+        index->parents[node] = i == 0 ? parent : base + subtree->parents[i];
+        index->nameOffsets[node] = internUtf8(index, subtree->names + subtree->nameOffsets[i],
+                                              strlen(subtree->names + subtree->nameOffsets[i]));
+        index->sizes[node] = subtree->sizes[i];
+        count = getChildCount(subtree, (IndexNode) i);
+        index->childCounts[node] = (uint32_t) count | (subtree->childCounts[i] & DIRECTORY_FLAG);
+        index->childStarts[node] = 0;
+        if (count > 0) {
+            ensureChildrenCapacity(index, count);
+            start = index->childrenLength;
+            for (j = 0; j < count; j++) {
+                index->children[start + j] = base + subtree->children[subtree->childStarts[i] + j];
+            }
+            index->childStarts[node] = (uint32_t) start;
+            index->childrenLength += count;
+        }
+    }
+    index->nodeCount += subtree->nodeCount;
+    insertChild(index, parent, base);
+    addToAncestors(index, parent, index->sizes[base]);
+}
+
+/* Everything but the root path and the lock. */
+static void moveIndexContents(UsageIndex *target, UsageIndex *source)
+{
+    target->parents = source->parents;
+    target->nameOffsets = source->nameOffsets;
+    target->sizes = source->sizes;
+    target->childStarts = source->childStarts;
+    target->childCounts = source->childCounts;
+    target->nodeCount = source->nodeCount;
+    target->nodeCapacity = source->nodeCapacity;
+    target->children = source->children;
+    target->childrenLength = source->childrenLength;
+    target->childrenCapacity = source->childrenCapacity;
+    target->names = source->names;
+    target->namesLength = source->namesLength;
+    target->namesCapacity = source->namesCapacity;
+    target->nameSlots = source->nameSlots;
+    target->nameSlotCapacity = source->nameSlotCapacity;
+    target->nameCount = source->nameCount;
+    target->orphanedNodes = source->orphanedNodes;
+    target->orphanedChildren = source->orphanedChildren;
+}
+
+/* Compacting is a pass over the whole index, so it waits until what
+   updates have left behind is half of what is held, which keeps its
+   cost in proportion to the updates. */
+static bool needsCompaction(const UsageIndex *index)
+{
+    return (index->orphanedNodes >= MIN_COMPACTION_WASTE && index->orphanedNodes * 2 > index->nodeCount)
+        || (index->orphanedChildren >= MIN_COMPACTION_WASTE && index->orphanedChildren * 2 > index->childrenLength);
+}
+
+/* Copies what is still reachable from the root into new arrays, a level
+   at a time so that each run of children is built whole, and with only
+   the names still in use. Must be called with the index locked. */
+static void compactUsageIndex(UsageIndex *index)
+{
+    UsageIndex *compacted;
+    IndexNode *sources;             /* The node each new node was copied from */
+    IndexNode node;
+    IndexNode source;
+    IndexNode child;
+    const IndexNode *run;
+    const char *name;
+    size_t count;
+    size_t start;
+    size_t i;
+
+    compacted = initUsageIndex(index->rootPath);
+    sources = (IndexNode *) growArray(NULL, index->nodeCount, sizeof(IndexNode));
+    sources[0] = getIndexRoot(index);
+    compacted->sizes[0] = index->sizes[0];
+    compacted->childCounts[0] = index->childCounts[0] & DIRECTORY_FLAG;
+    for (node = 0; node < compacted->nodeCount; node++) {
+        source = sources[node];
+        count = getChildCount(index, source);
+        if (count == 0) {
+            continue;
+        }
+        run = index->children + index->childStarts[source];
+        ensureChildrenCapacity(compacted, count);
+        start = compacted->childrenLength;
+        for (i = 0; i < count; i++) {
+            name = index->names + index->nameOffsets[run[i]];
+            child = addNode(compacted, node, internUtf8(compacted, name, strlen(name)), index->sizes[run[i]],
+                            isDirectoryNode(index, run[i]));
+            sources[child] = run[i];
+            compacted->children[start + i] = child;
+        }
+        compacted->childStarts[node] = (uint32_t) start;
+        compacted->childCounts[node] |= (uint32_t) count;
+        compacted->childrenLength += count;
+    }
+    moveIndexContents(index, compacted);
+    DeleteCriticalSection(&compacted->lock);
+}
+
+/* Without any trailing backslash, as in C: for C:\ */
+static size_t getRootLength(const UsageIndex *index)
+{
+    size_t length;
+
+    length = wcslen(index->rootPath);
+    while (length > 0 && index->rootPath[length - 1] == L'\\') {
+        length--;
+    }
+    return length;
+}
+
+const wchar_t *getUsageIndexRoot(const UsageIndex *index)
+{
+    return index->rootPath;
+}
+
+void lockUsageIndex(UsageIndex *index)
+{
+    EnterCriticalSection(&index->lock);
+}
+
+void unlockUsageIndex(UsageIndex *index)
+{
+    LeaveCriticalSection(&index->lock);
+}
+
+/* path must be the root or below it, with backslashes. Returns
+   NO_INDEX_NODE if there is no such entry. */
+IndexNode findIndexNode(const UsageIndex *index, const wchar_t *path)
+{
+    IndexNode node;
+    const wchar_t *component;
+    const wchar_t *end;
+    size_t rootLength;
+    size_t position;
+    bool found = true;
+
+    rootLength = getRootLength(index);
+    if (_wcsnicmp(path, index->rootPath, rootLength) != 0
+            || (path[rootLength] != L'\0' && path[rootLength] != L'\\')) {
+        return NO_INDEX_NODE;
+    }
+    node = getIndexRoot(index);
+    component = path + rootLength;
+    while (found && *component != L'\0') {
+        while (*component == L'\\') {
+            component++;
+        }
+        if (*component == L'\0') {
+            break;
+        }
+        for (end = component; *end != L'\0' && *end != L'\\'; end++)
+            ;
+        position = findChildPosition(index, node, component, end - component, &found);
+        if (found) {
+            node = index->children[index->childStarts[node] + position];
+            component = end;
+        }
+    }
+    return found ? node : NO_INDEX_NODE;
+}
+
+int64_t getIndexNodeSize(const UsageIndex *index, IndexNode node)
+{
+    return index->sizes[node];
+}
+
+static wchar_t *getIndexNodePath(const UsageIndex *index, IndexNode node)
+{
+    wchar_t buffer[NAME_CAPACITY];
+    wchar_t *path;
+    IndexNode ancestor;
+    size_t length;
+    size_t nameLength;
+
+    if (node == getIndexRoot(index)) {
+        return createStringCopy(index->rootPath);
+    }
+    length = getRootLength(index);
+    for (ancestor = node; ancestor != getIndexRoot(index); ancestor = index->parents[ancestor]) {
+        length += 1 + wcslen(getNodeName(index, ancestor, buffer));
+    }
+    if ((path = (wchar_t *) GC_MALLOC_ATOMIC((length + 1) * sizeof(wchar_t))) == NULL) {
+        writeError(errno, L"Failed to allocate memory for path in", index->rootPath);
+        exit(EXIT_FAILURE);
+    }
+    path[length] = L'\0';
+    for (ancestor = node; ancestor != getIndexRoot(index); ancestor = index->parents[ancestor]) {
+        nameLength = wcslen(getNodeName(index, ancestor, buffer));
+        length -= nameLength;
+        wmemcpy(path + length, buffer, nameLength);
+        path[--length] = L'\\';
+    }
+    wmemcpy(path, index->rootPath, length);
+    return path;
+}
+
+void forEachIndexChild(const UsageIndex *index, IndexNode node, IndexNodeHandler handler, void *context)
+{
+    const IndexNode *run;
+    size_t count;
+    size_t i;
+
+    run = index->children + index->childStarts[node];
+    count = getChildCount(index, node);
+    for (i = 0; i < count; i++) {
+        handler(getIndexNodePath(index, run[i]), index->sizes[run[i]], context);
+    }
+}
+
+/* The count largest directories at or below node, largest first. The
+   walk keeps its own stack, because trees can be very deep. */
+void forEachLargestDirectory(const UsageIndex *index, IndexNode node, size_t count, IndexNodeHandler handler, void *context)
+{
+    IndexNode *largest;
+    IndexNode *stack;
+    size_t stackLength = 0;
+    size_t stackCapacity = INITIAL_CHILDREN_CAPACITY;
+    size_t found = 0;
+    size_t childCount;
+    size_t i;
+    const IndexNode *run;
+
+    if (count == 0 || !isDirectoryNode(index, node)) {
+        return;
+    }
+    largest = (IndexNode *) growArray(NULL, count, sizeof(IndexNode));
+    stack = (IndexNode *) growArray(NULL, stackCapacity, sizeof(IndexNode));
+    stack[stackLength++] = node;
+    while (stackLength > 0) {
+        node = stack[--stackLength];
+        if (found < count || index->sizes[node] > index->sizes[largest[found - 1]]) {
+            i = found < count ? found++ : found - 1;
+            for (; i > 0 && index->sizes[largest[i - 1]] < index->sizes[node]; i--) {
+                largest[i] = largest[i - 1];
+            }
+            largest[i] = node;
+        }
+        run = index->children + index->childStarts[node];
+        childCount = getChildCount(index, node);
+        for (i = 0; i < childCount; i++) {
+            if (isDirectoryNode(index, run[i])) {
+                if (stackLength == stackCapacity) {
+                    stackCapacity *= 2;
+                    stack = (IndexNode *) growArray(stack, stackCapacity, sizeof(IndexNode));
+                }
+                stack[stackLength++] = run[i];
+            }
+        }
+    }
+    for (i = 0; i < found; i++) {
+        handler(getIndexNodePath(index, largest[i]), index->sizes[largest[i]], context);
+    }
+}
+
+/* Brings one entry up to date after a change notification for path, by
+   looking at what is there now. A file that is already known has its
+   size changed where it is, and a new file or link is added as one
+   entry. Only a new directory is read in full, into an index of its own
+   outside of the lock, and then copied in. A change to a directory that
+   is already known needs nothing, because the changes inside it have
+   notifications of their own. */
+void updateUsageIndex(UsageIndex *index, const wchar_t *path)
+{
+    struct ListingOptions listing;
+    struct FileEntry entry;
+    UsageIndex *replacement = NULL;
+    IndexNode parent;
+    IndexNode existing;
+    IndexNode child;
+    wchar_t *parentPath;
+    const wchar_t *name;
+    size_t position;
+    int64_t size = 0;
+    bool exists;
+    bool isDirectory;
+    bool isKnownDirectory;
+    bool found;
+
+    name = getSimpleName(path);
+    parentPath = createStringCopy(path);
+    parentPath[name - path > 0 ? name - path - 1 : 0] = L'\0';
+    chooseListingOptions(&listing);
+    exists = getFileEntryIfExists(path, &entry) && !isExcludedEntry(&entry, &listing);
+    isDirectory = exists && entry.type == FILETYPE_DIRECTORY;
+    if (isDirectory) {
+        lockUsageIndex(index);
+        existing = findIndexNode(index, path);
+        isKnownDirectory = existing != NO_INDEX_NODE && isDirectoryNode(index, existing);
+        unlockUsageIndex(index);
+        if (isKnownDirectory) {
+            return;
+        }
+        replacement = buildUsageIndex(path);
+    } else if (exists && entry.type == FILETYPE_FILE) {
+        /* Links to directories are kept as empty entries. */
+        size = getEntrySize(&entry, chooseTallySize(), listing.dereference);
+    }
+
+    lockUsageIndex(index);
+    parent = findIndexNode(index, parentPath);
+    if (parent != NO_INDEX_NODE && isDirectoryNode(index, parent)) {
+        position = findChildPosition(index, parent, name, wcslen(name), &found);
+        child = found ? index->children[index->childStarts[parent] + position] : NO_INDEX_NODE;
+        if (found && exists && !isDirectory && !isDirectoryNode(index, child)) {
+            addToAncestors(index, child, size - index->sizes[child]);
+        } else {
+            if (found) {
+                addToAncestors(index, parent, -index->sizes[child]);
+                removeChild(index, parent, position);
+            }
+            if (replacement != NULL) {
+                graftIndex(index, parent, replacement);
+            } else if (exists) {
+                child = addNode(index, parent, internName(index, name), size, false);
+                insertChild(index, parent, child);
+                addToAncestors(index, parent, size);
+            }
+        }
+        if (needsCompaction(index)) {
+            compactUsageIndex(index);
+        }
+    }
+    unlockUsageIndex(index);
+}
+
+/* For when change notifications were lost and the index cannot be
+   trusted. */
+void rebuildUsageIndex(UsageIndex *index)
+{
+    UsageIndex *rebuilt;
+
+    rebuilt = buildUsageIndex(index->rootPath);
+    lockUsageIndex(index);
+    moveIndexContents(index, rebuilt);
+    unlockUsageIndex(index);
+    DeleteCriticalSection(&rebuilt->lock);
+}
@@ -0,0 +1,44 @@
+#ifndef INDEX_H_WSXEDC
+#define INDEX_H_WSXEDC
+
+#include <stdbool.h>
+#include <stddef.h>     /* size_t */
+#include <stdint.h>
+#include <wchar.h>
+
+/* The tree below one root held in memory with the total of every
+   directory, so that it can be queried without reading the disk. It is
+   kept current with updateUsageIndex. Callers lock the index around
+   lookups; the update functions lock it themselves.
+
+   Entries are numbered and their fields are kept in parallel arrays
+   without pointers, and each distinct name is stored once as UTF-8, so
+   that an entry costs around 30 bytes. */
+typedef
+    struct UsageIndex /* as */
+    UsageIndex;
+
+typedef uint32_t IndexNode;
+
+#define NO_INDEX_NODE UINT32_MAX
+
+typedef void (*IndexNodeHandler)(const wchar_t *path, int64_t size, void *context);
+
+extern UsageIndex *initUsageIndex(const wchar_t *rootPath);
+extern UsageIndex *buildUsageIndex(const wchar_t *rootPath);
+extern IndexNode getIndexRoot(const UsageIndex *index);
+extern IndexNode appendIndexChild(UsageIndex *index, IndexNode parent, const wchar_t *name, int64_t size, bool isDirectory);
+extern void finishIndexDirectory(UsageIndex *index, IndexNode directory);
+extern size_t getUsageIndexEntryCount(const UsageIndex *index);
+extern size_t getUsageIndexMemoryUse(const UsageIndex *index);
+extern const wchar_t *getUsageIndexRoot(const UsageIndex *index);
+extern void lockUsageIndex(UsageIndex *index);
+extern void unlockUsageIndex(UsageIndex *index);
+extern IndexNode findIndexNode(const UsageIndex *index, const wchar_t *path);
+extern int64_t getIndexNodeSize(const UsageIndex *index, IndexNode node);
+extern void forEachIndexChild(const UsageIndex *index, IndexNode node, IndexNodeHandler handler, void *context);
+extern void forEachLargestDirectory(const UsageIndex *index, IndexNode node, size_t count, IndexNodeHandler handler, void *context);
+extern void updateUsageIndex(UsageIndex *index, const wchar_t *path);
+extern void rebuildUsageIndex(UsageIndex *index);
+
+#endif
@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <windows.h>
+#include <gc.h>
+#include "output.h"
+#include "progress.h"
+#include "error.h"
+
+#define INITIAL_OUTPUT_CAPACITY 4096
+
+struct OutputBuffer {
+    wchar_t *text;
+    size_t length;
+    size_t capacity;
+    bool isDirect;              /* Once written, the rest goes straight through */
+    CRITICAL_SECTION lock;
+};
+
+static DWORD outputSlot = TLS_OUT_OF_INDEXES;
+static FILE *outputCopy = NULL;
+
+static void writeOutputArguments(OutputBuffer *buffer, const wchar_t *format, va_list args);
+static void writeStandardOutput(const wchar_t *format, va_list args);
+static void copyOutput(const wchar_t *text);
+static void appendOutput(OutputBuffer *buffer, const wchar_t *format, va_list args);
+
+/* Must be called before any thread is given a buffer. */
+void initOutput()
+{
+    if ((outputSlot = TlsAlloc()) == TLS_OUT_OF_INDEXES) {
+        writeLastError(GetLastError(), L"Failed to allocate thread local storage for", L"output");
+        exit(EXIT_FAILURE);
+    }
+}
+
+OutputBuffer *initOutputBuffer()
+{
+    OutputBuffer *buffer;
+
+    if ((buffer = (OutputBuffer *) GC_MALLOC(sizeof(OutputBuffer))) == NULL) {
+        writeError(errno, L"Failed to allocate memory for", L"output buffer");
+        exit(EXIT_FAILURE);
+    }
+    buffer->text = NULL;
+    buffer->length = 0;
+    buffer->capacity = 0;
+    buffer->isDirect = false;
+    InitializeCriticalSection(&buffer->lock);
+    return buffer;
+}
+
+/* NULL sends the thread's output straight to standard output again. The
+   caller must keep its own reference to the buffer, because the collector
+   does not look in thread local storage. */
+void setThreadOutput(OutputBuffer *buffer)
+{
+    TlsSetValue(outputSlot, buffer);
+}
+
+OutputBuffer *getThreadOutput()
+{
+    return outputSlot == TLS_OUT_OF_INDEXES ? NULL : (OutputBuffer *) TlsGetValue(outputSlot);
+}
+
+/* Everything written to standard output from then on is also written to
+   the file, as the wide characters themselves, so that it can be written
+   again by a later run. NULL stops the copying. */
+void setOutputCopy(FILE *file)
+{
+    outputCopy = file;
+}
+
+/* Never NULL. Only meaningful once nothing more is being written. */
+const wchar_t *getOutputText(const OutputBuffer *buffer)
+{
+    return buffer->length == 0 ? L"" : buffer->text;
+}
+
+void writeOutput(const wchar_t *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    writeOutputArguments(getThreadOutput(), format, args);
+    va_end(args);
+}
+
+/* Like writeOutput, for a buffer other than the thread's own. */
+void writeOutputTo(OutputBuffer *buffer, const wchar_t *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    writeOutputArguments(buffer, format, args);
+    va_end(args);
+}
+
+static void writeOutputArguments(OutputBuffer *buffer, const wchar_t *format, va_list args)
+{
+    if (buffer == NULL) {
+        writeStandardOutput(format, args);
+    } else {
+        EnterCriticalSection(&buffer->lock);
+        if (buffer->isDirect) {
+            writeStandardOutput(format, args);
+        } else {
+            appendOutput(buffer, format, args);
+        }
+        LeaveCriticalSection(&buffer->lock);
+    }
+}
+
+/* With a copy to keep, the text is formatted once for both. */
+static void writeStandardOutput(const wchar_t *format, va_list args)
+{
+    va_list argsCopy;
+    wchar_t *text;
+    int length;
+
+    if (outputCopy == NULL) {
+        vwprintf(format, args);
+        return;
+    }
+    va_copy(argsCopy, args);
+    length = _vscwprintf(format, argsCopy);
+    va_end(argsCopy);
+    if (length < 0) {
+        return;
+    }
+    if ((text = (wchar_t *) GC_MALLOC_ATOMIC(((size_t) length + 1) * sizeof(wchar_t))) == NULL) {
+        writeError(errno, L"Failed to allocate memory for", L"output");
+        exit(EXIT_FAILURE);
+    }
+    _vsnwprintf(text, (size_t) length + 1, format, args);
+    text[length] = L'\0';
+    fputws(text, stdout);
+    copyOutput(text);
+}
+
+static void copyOutput(const wchar_t *text)
+{
+    if (outputCopy != NULL) {
+        fwrite(text, sizeof(wchar_t), wcslen(text), outputCopy);
+    }
+}
+
+static void appendOutput(OutputBuffer *buffer, const wchar_t *format, va_list args)
+{
+    va_list argsCopy;
+    size_t needed;
+    size_t capacity;
+    int length;
+
+    va_copy(argsCopy, args);
+    length = _vscwprintf(format, argsCopy);
+    va_end(argsCopy);
+    if (length < 0) {
+        return;
+    }
+    needed = buffer->length + (size_t) length + 1;
+    if (needed > buffer->capacity) {
+        capacity = buffer->capacity == 0 ? INITIAL_OUTPUT_CAPACITY : buffer->capacity;
+        while (capacity < needed) {
+            capacity *= 2;
+        }
+        if (buffer->text == NULL) {
+            buffer->text = (wchar_t *) GC_MALLOC_ATOMIC(capacity * sizeof(wchar_t));
+        } else {
+            buffer->text = (wchar_t *) GC_REALLOC(buffer->text, capacity * sizeof(wchar_t));
+        }
+        if (buffer->text == NULL) {
+            writeError(errno, L"Failed to allocate memory for", L"output buffer");
+            exit(EXIT_FAILURE);
+        }
+        buffer->capacity = capacity;
+    }
+    _vsnwprintf(buffer->text + buffer->length, (size_t) length + 1, format, args);
+    buffer->length += (size_t) length;
+    buffer->text[buffer->length] = L'\0';
+}
+
+/* Writes everything collected so far to standard output, and from then
+   on whatever the thread prints goes straight there. Used when every
+   output before this one has been written, so that a long scan at the
+   head of the line shows its lines as they come. */
+void writeOutputBuffer(OutputBuffer *buffer)
+{
+    EnterCriticalSection(&buffer->lock);
+    if (buffer->length > 0) {
+        clearProgressLine();
+        fputws(buffer->text, stdout);
+        fflush(stdout);
+        copyOutput(buffer->text);
+        buffer->length = 0;
+    }
+    buffer->isDirect = true;
+    LeaveCriticalSection(&buffer->lock);
+}
@@ -0,0 +1,24 @@
+#ifndef OUTPUT_H_MKOLPN
+#define OUTPUT_H_MKOLPN
+
+#include <stdio.h>
+#include <wchar.h>
+
+/* Normal output goes to standard output, except on a thread that has been
+   given a buffer, where it is kept until the buffer is written. This lets
+   arguments be scanned at the same time and still be printed in order. */
+typedef
+    struct OutputBuffer /* as */
+    OutputBuffer;
+
+extern void initOutput();
+extern OutputBuffer *initOutputBuffer();
+extern void setThreadOutput(OutputBuffer *buffer);
+extern OutputBuffer *getThreadOutput();
+extern const wchar_t *getOutputText(const OutputBuffer *buffer);
+extern void writeOutput(const wchar_t *format, ...);
+extern void writeOutputTo(OutputBuffer *buffer, const wchar_t *format, ...);
+extern void writeOutputBuffer(OutputBuffer *buffer);
+extern void setOutputCopy(FILE *file);
+
+#endif
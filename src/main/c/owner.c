@@ -0,0 +1,353 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>     /* memcpy, memset */
+#include <errno.h>
+#include <windows.h>
+#include <sddl.h>       /* ConvertSidToStringSid */
+#include <gc.h>
+#include "owner.h"
+#include "format.h"
+#include "error.h"
+#include "string.h"
+#include "output.h"
+
+/* Must be a power of 2 so that the hash can be masked. */
+#define INITIAL_OWNER_CAPACITY 64
+#define INITIAL_OWNER_TABLE_CAPACITY 16
+/* Big enough for a descriptor holding only an owner. */
+#define SECURITY_DESCRIPTOR_CAPACITY 256
+#define ACCOUNT_NAME_CAPACITY 256
+#define UNKNOWN_OWNER_NAME L"(unknown)"
+
+struct CachedOwner {
+    PSID sid;                   /* NULL for an empty slot */
+    size_t length;
+    unsigned long hash;
+    size_t owner;
+};
+
+/* Maps each SID to an owner number and each number to an account name, so
+   that every distinct owner is looked up once however many files it owns.
+   Shared by all scans. */
+static struct {
+    struct CachedOwner *slots;
+    size_t capacity;
+    size_t count;
+    const wchar_t **names;      /* Indexed by owner number */
+    size_t nameCapacity;
+    CRITICAL_SECTION lock;
+} cache;
+
+struct OwnerUsage {
+    int64_t bytes;
+    uint64_t files;
+};
+
+/* One line of the printed table. */
+struct OwnerRow {
+    size_t owner;
+    struct OwnerUsage usage;
+};
+
+struct OwnerTable {
+    struct OwnerUsage *owners;  /* Indexed by owner number */
+    size_t capacity;
+};
+
+static unsigned long hashSid(PSID sid, size_t length);
+static struct CachedOwner *findCachedOwner(PSID sid, size_t length, unsigned long hash);
+static void growOwnerCache();
+static size_t addCachedOwner(PSID sid, size_t length, unsigned long hash, const wchar_t *name);
+static size_t lookUpOwner(PSID sid);
+static const wchar_t *resolveAccountName(PSID sid);
+static void ensureOwnerTableCapacity(OwnerTable *table, size_t owner);
+static int compareByBytes(const void *left, const void *right);
+
+void initOwnerCache()
+{
+    InitializeCriticalSection(&cache.lock);
+    cache.capacity = 0;
+    cache.count = 0;
+    cache.slots = NULL;
+    cache.nameCapacity = INITIAL_OWNER_TABLE_CAPACITY;
+    if ((cache.names = (const wchar_t **) GC_MALLOC(cache.nameCapacity * sizeof(const wchar_t *))) == NULL) {
+        writeError(errno, L"Failed to allocate memory for", L"owner cache");
+        exit(EXIT_FAILURE);
+    }
+    cache.names[UNKNOWN_OWNER] = UNKNOWN_OWNER_NAME;
+    growOwnerCache();
+}
+
+/* Only the owner is asked for, which is usually small enough for the stack
+   buffer, so one call per file is enough. */
+size_t getFileOwner(const wchar_t *path)
+{
+    char stackBuffer[SECURITY_DESCRIPTOR_CAPACITY];
+    PSECURITY_DESCRIPTOR descriptor;
+    DWORD needed = 0;
+    PSID sid;
+    BOOL isDefaulted;
+    DWORD lastError;
+
+    descriptor = (PSECURITY_DESCRIPTOR) stackBuffer;
+    if (!GetFileSecurity(path, OWNER_SECURITY_INFORMATION, descriptor, sizeof(stackBuffer), &needed)) {
+        lastError = GetLastError();
+        if (lastError != ERROR_INSUFFICIENT_BUFFER) {
+            writeLastError(lastError, L"Failed to get owner of", path);
+            return UNKNOWN_OWNER;
+        }
+        if ((descriptor = (PSECURITY_DESCRIPTOR) GC_MALLOC_ATOMIC(needed)) == NULL) {
+            writeError(errno, L"Failed to allocate memory for owner of", path);
+            exit(EXIT_FAILURE);
+        }
+        if (!GetFileSecurity(path, OWNER_SECURITY_INFORMATION, descriptor, needed, &needed)) {
+            writeLastError(GetLastError(), L"Failed to get owner of", path);
+            return UNKNOWN_OWNER;
+        }
+    }
+    if (!GetSecurityDescriptorOwner(descriptor, &sid, &isDefaulted) || sid == NULL) {
+        return UNKNOWN_OWNER;
+    }
+    return lookUpOwner(sid);
+}
+
+const wchar_t *getOwnerName(size_t owner)
+{
+    const wchar_t *name;
+
+    EnterCriticalSection(&cache.lock);
+    name = cache.names[owner];
+    LeaveCriticalSection(&cache.lock);
+    return name;
+}
+
+/* FNV-1a over the bytes of the SID. */
+static unsigned long hashSid(PSID sid, size_t length)
+{
+    const unsigned char *bytes = (const unsigned char *) sid;
+    unsigned long hash = 2166136261UL;
+    size_t i;
+
+    for (i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+/* Must be called with the lock held. Returns the slot for the SID or the
+   empty slot where it belongs. */
+static struct CachedOwner *findCachedOwner(PSID sid, size_t length, unsigned long hash)
+{
+    struct CachedOwner *slot;
+    size_t i;
+
+    i = hash & (cache.capacity - 1);
+    for (;;) {
+        slot = &cache.slots[i];
+        if (slot->sid == NULL
+                || (slot->hash == hash && slot->length == length && memcmp(slot->sid, sid, length) == 0)) {
+            return slot;
+        }
+        i = (i + 1) & (cache.capacity - 1);
+    }
+}
+
+/* Must be called with the lock held. */
+static void growOwnerCache()
+{
+    struct CachedOwner *oldSlots;
+    size_t oldCapacity;
+    size_t i;
+
+    oldSlots = cache.slots;
+    oldCapacity = cache.capacity;
+    cache.capacity = oldCapacity == 0 ? INITIAL_OWNER_CAPACITY : oldCapacity * 2;
+    if ((cache.slots = (struct CachedOwner *) GC_MALLOC(cache.capacity * sizeof(struct CachedOwner))) == NULL) {
+        writeError(errno, L"Failed to allocate memory for", L"owner cache");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < oldCapacity; i++) {
+        if (oldSlots[i].sid != NULL) {
+            *findCachedOwner(oldSlots[i].sid, oldSlots[i].length, oldSlots[i].hash) = oldSlots[i];
+        }
+    }
+}
+
+/* Must be called with the lock held, after checking that the SID is not
+   in the cache yet. */
+static size_t addCachedOwner(PSID sid, size_t length, unsigned long hash, const wchar_t *name)
+{
+    struct CachedOwner *slot;
+    PSID copy;
+
+    if ((cache.count + 1) * 2 > cache.capacity) {
+        growOwnerCache();
+    }
+    if (cache.count + 2 > cache.nameCapacity) {
+        cache.nameCapacity *= 2;
+        cache.names = (const wchar_t **) GC_REALLOC((void *) cache.names, cache.nameCapacity * sizeof(const wchar_t *));
+        if (cache.names == NULL) {
+            writeError(errno, L"Failed to allocate memory for", L"owner cache");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if ((copy = (PSID) GC_MALLOC_ATOMIC(length)) == NULL) {
+        writeError(errno, L"Failed to allocate memory for owner", name);
+        exit(EXIT_FAILURE);
+    }
+    memcpy(copy, sid, length);
+    slot = findCachedOwner(sid, length, hash);
+    slot->sid = copy;
+    slot->length = length;
+    slot->hash = hash;
+    slot->owner = ++cache.count;
+    cache.names[slot->owner] = name;
+    return slot->owner;
+}
+
+/* The account name is resolved without holding the lock, because it can
+   mean asking a domain controller. Two threads that meet a new owner at
+   the same time may both resolve it, but only one number is handed out. */
+static size_t lookUpOwner(PSID sid)
+{
+    struct CachedOwner *slot;
+    const wchar_t *name;
+    unsigned long hash;
+    size_t length;
+    size_t owner;
+
+    length = GetLengthSid(sid);
+    hash = hashSid(sid, length);
+    EnterCriticalSection(&cache.lock);
+    slot = findCachedOwner(sid, length, hash);
+    owner = slot->sid == NULL ? UNKNOWN_OWNER : slot->owner;
+    LeaveCriticalSection(&cache.lock);
+    if (owner == UNKNOWN_OWNER) {
+        name = resolveAccountName(sid);
+        EnterCriticalSection(&cache.lock);
+        slot = findCachedOwner(sid, length, hash);
+        owner = slot->sid == NULL ? addCachedOwner(sid, length, hash, name) : slot->owner;
+        LeaveCriticalSection(&cache.lock);
+    }
+    return owner;
+}
+
+/* DOMAIN\name, or the SID in S-1-5-... form for accounts that no longer
+   exist or cannot be looked up. */
+static const wchar_t *resolveAccountName(PSID sid)
+{
+    wchar_t account[ACCOUNT_NAME_CAPACITY];
+    wchar_t domain[ACCOUNT_NAME_CAPACITY];
+    DWORD accountLength = ACCOUNT_NAME_CAPACITY;
+    DWORD domainLength = ACCOUNT_NAME_CAPACITY;
+    SID_NAME_USE use;
+    wchar_t *sidText;
+    const wchar_t *name;
+
+    if (LookupAccountSid(NULL, sid, account, &accountLength, domain, &domainLength, &use)) {
+        name = domainLength > 0 ? concat3(domain, L"\\", account) : createStringCopy(account);
+    } else if (ConvertSidToStringSid(sid, &sidText)) {
+        name = createStringCopy(sidText);
+        LocalFree(sidText);
+    } else {
+        name = UNKNOWN_OWNER_NAME;
+    }
+    return name;
+}
+
+OwnerTable *initOwnerTable()
+{
+    OwnerTable *table;
+
+    if ((table = (OwnerTable *) GC_MALLOC(sizeof(OwnerTable))) == NULL) {
+        writeError(errno, L"Failed to allocate memory for", L"owner table");
+        exit(EXIT_FAILURE);
+    }
+    table->capacity = 0;
+    table->owners = NULL;
+    return table;
+}
+
+static void ensureOwnerTableCapacity(OwnerTable *table, size_t owner)
+{
+    size_t capacity;
+
+    if (owner >= table->capacity) {
+        capacity = table->capacity == 0 ? INITIAL_OWNER_TABLE_CAPACITY : table->capacity;
+        while (owner >= capacity) {
+            capacity *= 2;
+        }
+        table->owners = (struct OwnerUsage *) GC_REALLOC(table->owners, capacity * sizeof(struct OwnerUsage));
+        if (table->owners == NULL) {
+            writeError(errno, L"Failed to allocate memory for", L"owner table");
+            exit(EXIT_FAILURE);
+        }
+        memset(table->owners + table->capacity, 0, (capacity - table->capacity) * sizeof(struct OwnerUsage));
+        table->capacity = capacity;
+    }
+}
+
+void addToOwnerTable(OwnerTable *table, size_t owner, int64_t size)
+{
+    ensureOwnerTableCapacity(table, owner);
+    table->owners[owner].bytes += size;
+    table->owners[owner].files++;
+}
+
+void mergeOwnerTable(OwnerTable *total, const OwnerTable *part)
+{
+    size_t i;
+
+    if (part->capacity > 0) {
+        ensureOwnerTableCapacity(total, part->capacity - 1);
+    }
+    for (i = 0; i < part->capacity; i++) {
+        total->owners[i].bytes += part->owners[i].bytes;
+        total->owners[i].files += part->owners[i].files;
+    }
+}
+
+static int compareByBytes(const void *left, const void *right)
+{
+    const struct OwnerRow *a = (const struct OwnerRow *) left;
+    const struct OwnerRow *b = (const struct OwnerRow *) right;
+
+    if (a->usage.bytes != b->usage.bytes) {
+        return a->usage.bytes > b->usage.bytes ? -1 : 1;
+    }
+    return a->owner < b->owner ? -1 : 1;
+}
+
+/* Every owner with at least one file, largest first. */
+void printOwnerTable(const OwnerTable *table, const wchar_t *path)
+{
+    wchar_t sizeText[SIZE_TEXT_CAPACITY];
+    struct OwnerRow *rows;
+    size_t count = 0;
+    int64_t totalBytes = 0;
+    size_t i;
+
+    if ((rows = (struct OwnerRow *) GC_MALLOC_ATOMIC((table->capacity + 1) * sizeof(struct OwnerRow))) == NULL) {
+        writeError(errno, L"Failed to allocate memory for", L"owner table");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < table->capacity; i++) {
+        if (table->owners[i].files > 0) {
+            rows[count].owner = i;
+            rows[count].usage = table->owners[i];
+            totalBytes += table->owners[i].bytes;
+            count++;
+        }
+    }
+    qsort(rows, count, sizeof(struct OwnerRow), compareByBytes);
+    writeOutput(L"Owners in %ls:\n", path);
+    writeOutput(L"  %-32ls %12ls %12ls %6ls\n", L"Owner", L"Files", L"Total", L"%");
+    for (i = 0; i < count; i++) {
+        formatFileSize(rows[i].usage.bytes, sizeText, SIZE_TEXT_CAPACITY);
+        writeOutput(L"  %-32ls %12llu %12ls %5.1f%%\n", getOwnerName(rows[i].owner),
+                (unsigned long long) rows[i].usage.files, sizeText,
+                totalBytes > 0 ? 100.0 * rows[i].usage.bytes / totalBytes : 0.0);
+    }
+    fflush(stdout);
+}
@@ -0,0 +1,25 @@
+#ifndef OWNER_H_UJMIKO
+#define OWNER_H_UJMIKO
+
+#include <stddef.h>     /* size_t */
+#include <stdint.h>
+#include <wchar.h>
+
+/* Owners are numbered in the order they are first seen. Number 0 stands
+   for files whose owner could not be read. */
+#define UNKNOWN_OWNER 0
+
+/* Bytes and number of files per owner. */
+typedef
+    struct OwnerTable /* as */
+    OwnerTable;
+
+extern void initOwnerCache();
+extern size_t getFileOwner(const wchar_t *path);
+extern const wchar_t *getOwnerName(size_t owner);
+extern OwnerTable *initOwnerTable();
+extern void addToOwnerTable(OwnerTable *table, size_t owner, int64_t size);
+extern void mergeOwnerTable(OwnerTable *total, const OwnerTable *part);
+extern void printOwnerTable(const OwnerTable *table, const wchar_t *path);
+
+#endif
@@ -0,0 +1,426 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>     /* uint32_t */
+#include <string.h>     /* memcpy, memset */
+#include <wctype.h>     /* towlower, towupper */
+#include <errno.h>
+#include <gc.h>
+#include "pattern.h"
+#include "string.h"
+#include "error.h"
+
+#define INITIAL_LITERAL_CAPACITY 64
+#define INITIAL_TOKEN_CAPACITY 64
+#define PATTERN_LINE_CAPACITY 4096
+/* Sets with up to 4096 automaton states are matched without allocating. */
+#define STACK_STATE_WORDS 128
+#define BITS_PER_WORD 32
+#define UTF8_BOM "\xEF\xBB\xBF"
+
+enum TokenType {
+    TOKEN_CHAR, TOKEN_ANY, TOKEN_STAR, TOKEN_CLASS, TOKEN_ACCEPT
+};
+
+struct CharRange {
+    wchar_t first;
+    wchar_t last;
+};
+
+/* One state of the automaton. Each glob is a sequence of tokens ending in
+   TOKEN_ACCEPT, and all of the globs in a set are stored back to back. */
+struct Token {
+    enum TokenType type;
+    wchar_t c;                  /* TOKEN_CHAR, already lower case */
+    bool negated;               /* TOKEN_CLASS */
+    size_t rangeCount;          /* TOKEN_CLASS */
+    struct CharRange *ranges;   /* TOKEN_CLASS */
+};
+
+struct PatternSet {
+    const wchar_t **literals;   /* Open addressing hash table of lower case names */
+    size_t literalCapacity;
+    size_t literalCount;
+    struct Token *tokens;
+    size_t tokenCount;
+    size_t tokenCapacity;
+    uint32_t *startStates;
+    size_t stateWords;
+};
+
+static bool hasWildcard(const wchar_t *pattern);
+static unsigned long hashName(const wchar_t *name);
+static void addLiteral(PatternSet *set, const wchar_t *name);
+static bool containsLiteral(const PatternSet *set, const wchar_t *name);
+static void addGlob(PatternSet *set, const wchar_t *pattern);
+static struct Token *appendToken(PatternSet *set, enum TokenType type);
+static const wchar_t *parseCharClass(struct Token *token, const wchar_t *start);
+static bool matchesCharClass(const struct Token *token, wchar_t c);
+static void addState(const PatternSet *set, uint32_t *states, size_t state);
+static bool runAutomaton(const PatternSet *set, const wchar_t *name);
+
+PatternSet *initPatternSet()
+{
+    PatternSet *set;
+
+    if ((set = (PatternSet *) GC_MALLOC(sizeof(PatternSet))) == NULL) {
+        writeError(errno, L"Failed to allocate memory for", L"pattern set");
+        exit(EXIT_FAILURE);
+    }
+    set->literals = NULL;
+    set->literalCapacity = 0;
+    set->literalCount = 0;
+    set->tokens = NULL;
+    set->tokenCount = 0;
+    set->tokenCapacity = 0;
+    set->startStates = NULL;
+    set->stateWords = 0;
+    return set;
+}
+
+static bool hasWildcard(const wchar_t *pattern)
+{
+    return wcspbrk(pattern, L"*?[") != NULL;
+}
+
+void addPattern(PatternSet *set, const wchar_t *pattern)
+{
+    if (*pattern != L'\0') {
+        if (hasWildcard(pattern)) {
+            addGlob(set, pattern);
+        } else {
+            addLiteral(set, toLowerCase(pattern));
+        }
+    }
+}
+
+/* Reads one pattern per line from a UTF-8 text file. Empty lines are ignored. */
+void addPatternsFromFile(PatternSet *set, const wchar_t *fileName)
+{
+    FILE *patternFile;
+    char line[PATTERN_LINE_CAPACITY];
+    char *start;
+    size_t length;
+    bool isFirstLine = true;
+    bool isContinuation = false;
+
+    if ((patternFile = _wfopen(fileName, L"rb")) == NULL) {
+        writeError(errno, L"Failed to open pattern file", fileName);
+        exit(EXIT_FAILURE);
+    }
+    while (fgets(line, PATTERN_LINE_CAPACITY, patternFile) != NULL) {
+        start = line;
+        if (isFirstLine && strncmp(start, UTF8_BOM, strlen(UTF8_BOM)) == 0) {
+            start += strlen(UTF8_BOM);
+        }
+        isFirstLine = false;
+        length = strlen(start);
+        if (isContinuation) {
+            /* The rest of an overlong line, which could never match a name anyway. */
+            isContinuation = length > 0 && start[length - 1] != '\n';
+            continue;
+        }
+        isContinuation = length > 0 && start[length - 1] != '\n' && !feof(patternFile);
+        while (length > 0 && (start[length - 1] == '\n' || start[length - 1] == '\r')) {
+            start[--length] = '\0';
+        }
+        if (!isContinuation && length > 0) {
+            addPattern(set, convertFromUtf8(start));
+        }
+    }
+    if (ferror(patternFile)) {
+        writeError(errno, L"Failed to read pattern file", fileName);
+        exit(EXIT_FAILURE);
+    }
+    fclose(patternFile);
+}
+
+/* FNV-1a over the lower case form so that lookups need no copy of the name. */
+static unsigned long hashName(const wchar_t *name)
+{
+    unsigned long hash = 2166136261UL;
+
+    for (; *name != L'\0'; name++) {
+        hash ^= (unsigned long) towlower(*name);
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+static void addLiteral(PatternSet *set, const wchar_t *name)
+{
+    const wchar_t **oldLiterals;
+    size_t oldCapacity;
+    size_t i;
+
+    if (containsLiteral(set, name)) {
+        return;
+    }
+    /* Keep the table at most half full so that probe sequences stay short. */
+    if ((set->literalCount + 1) * 2 > set->literalCapacity) {
+        oldLiterals = set->literals;
+        oldCapacity = set->literalCapacity;
+        set->literalCapacity = oldCapacity == 0 ? INITIAL_LITERAL_CAPACITY : oldCapacity * 2;
+        set->literals = (const wchar_t **) GC_MALLOC(set->literalCapacity * sizeof(wchar_t *));
+        if (set->literals == NULL) {
+            writeError(errno, L"Failed to allocate memory for pattern", name);
+            exit(EXIT_FAILURE);
+        }
+        set->literalCount = 0;
+        for (i = 0; i < oldCapacity; i++) {
+            if (oldLiterals[i] != NULL) {
+                addLiteral(set, oldLiterals[i]);
+            }
+        }
+    }
+    i = hashName(name) & (set->literalCapacity - 1);
+    while (set->literals[i] != NULL) {
+        i = (i + 1) & (set->literalCapacity - 1);
+    }
+    set->literals[i] = name;
+    set->literalCount++;
+}
+
+static bool containsLiteral(const PatternSet *set, const wchar_t *name)
+{
+    size_t i;
+    bool found = false;
+
+    if (set->literalCount > 0) {
+        i = hashName(name) & (set->literalCapacity - 1);
+        while (!found && set->literals[i] != NULL) {
+            found = _wcsicmp(set->literals[i], name) == 0;
+            i = (i + 1) & (set->literalCapacity - 1);
+        }
+    }
+    return found;
+}
+
+static struct Token *appendToken(PatternSet *set, enum TokenType type)
+{
+    struct Token *token;
+
+    if (set->tokenCount == set->tokenCapacity) {
+        set->tokenCapacity = set->tokenCapacity == 0 ? INITIAL_TOKEN_CAPACITY : set->tokenCapacity * 2;
+        set->tokens = (struct Token *) GC_REALLOC(set->tokens, set->tokenCapacity * sizeof(struct Token));
+        if (set->tokens == NULL) {
+            writeError(errno, L"Failed to allocate memory for", L"pattern tokens");
+            exit(EXIT_FAILURE);
+        }
+    }
+    token = &set->tokens[set->tokenCount++];
+    token->type = type;
+    token->c = L'\0';
+    token->negated = false;
+    token->rangeCount = 0;
+    token->ranges = NULL;
+    return token;
+}
+
+static void addGlob(PatternSet *set, const wchar_t *pattern)
+{
+    const wchar_t *p;
+    const wchar_t *classEnd;
+    struct Token *token;
+
+    for (p = pattern; *p != L'\0'; p++) {
+        if (*p == L'*') {
+            /* Consecutive stars match the same thing as one star. */
+            if (p == pattern || p[-1] != L'*') {
+                appendToken(set, TOKEN_STAR);
+            }
+        } else if (*p == L'?') {
+            appendToken(set, TOKEN_ANY);
+        } else if (*p == L'[' && (classEnd = parseCharClass(NULL, p)) != NULL) {
+            token = appendToken(set, TOKEN_CLASS);
+            parseCharClass(token, p);
+            p = classEnd;
+        } else {
+            token = appendToken(set, TOKEN_CHAR);
+            token->c = towlower(*p);
+        }
+    }
+    appendToken(set, TOKEN_ACCEPT);
+}
+
+/* Parses [abc], [a-z] and [!abc] or [^abc] starting at the opening bracket.
+   Returns a pointer to the closing bracket, or NULL if there is none, in
+   which case the bracket is an ordinary character. When token is NULL only
+   the end of the class is found. */
+static const wchar_t *parseCharClass(struct Token *token, const wchar_t *start)
+{
+    const wchar_t *p;
+    const wchar_t *first;
+    size_t rangeCount = 0;
+
+    p = start + 1;
+    if (*p == L'!' || *p == L'^') {
+        if (token != NULL) {
+            token->negated = true;
+        }
+        p++;
+    }
+    first = p;
+    if (token != NULL) {
+        /* There cannot be more ranges than characters between the brackets. */
+        token->ranges = (struct CharRange *) GC_MALLOC_ATOMIC(wcslen(first) * sizeof(struct CharRange) + 1);
+        if (token->ranges == NULL) {
+            writeError(errno, L"Failed to allocate memory for pattern", start);
+            exit(EXIT_FAILURE);
+        }
+    }
+    /* A closing bracket right after the opening one is taken literally. */
+    while (*p != L'\0' && (*p != L']' || p == first)) {
+        if (token != NULL) {
+            token->ranges[rangeCount].first = *p;
+            token->ranges[rangeCount].last = *p;
+            if (p[1] == L'-' && p[2] != L'\0' && p[2] != L']') {
+                token->ranges[rangeCount].last = p[2];
+                p += 2;
+            }
+            rangeCount++;
+        }
+        p++;
+    }
+    if (token != NULL) {
+        token->rangeCount = rangeCount;
+    }
+    return *p == L']' ? p : NULL;
+}
+
+static bool matchesCharClass(const struct Token *token, wchar_t c)
+{
+    wchar_t lower, upper;
+    size_t i;
+    bool matches = false;
+
+    lower = towlower(c);
+    upper = towupper(c);
+    for (i = 0; i < token->rangeCount && !matches; i++) {
+        matches = (lower >= token->ranges[i].first && lower <= token->ranges[i].last)
+               || (upper >= token->ranges[i].first && upper <= token->ranges[i].last);
+    }
+    return matches != token->negated;
+}
+
+/* Must be called after all patterns are added and before any matching. */
+void compilePatternSet(PatternSet *set)
+{
+    size_t i;
+    bool isStart = true;
+
+    set->stateWords = (set->tokenCount + BITS_PER_WORD - 1) / BITS_PER_WORD;
+    if (set->stateWords > 0) {
+        set->startStates = (uint32_t *) GC_MALLOC_ATOMIC(set->stateWords * sizeof(uint32_t));
+        if (set->startStates == NULL) {
+            writeError(errno, L"Failed to allocate memory for", L"pattern automaton");
+            exit(EXIT_FAILURE);
+        }
+        memset(set->startStates, 0, set->stateWords * sizeof(uint32_t));
+        for (i = 0; i < set->tokenCount; i++) {
+            if (isStart) {
+                addState(set, set->startStates, i);
+            }
+            isStart = set->tokens[i].type == TOKEN_ACCEPT;
+        }
+    }
+}
+
+bool isPatternSetEmpty(const PatternSet *set)
+{
+    return set == NULL || (set->literalCount == 0 && set->tokenCount == 0);
+}
+
+bool matchesPatternSet(const PatternSet *set, const wchar_t *name)
+{
+    return containsLiteral(set, name) || (set->tokenCount > 0 && runAutomaton(set, name));
+}
+
+/* Activates a state. A star can match nothing, so the state after it is
+   activated too. */
+static void addState(const PatternSet *set, uint32_t *states, size_t state)
+{
+    while (set->tokens[state].type == TOKEN_STAR) {
+        states[state / BITS_PER_WORD] |= 1UL << (state % BITS_PER_WORD);
+        state++;
+    }
+    states[state / BITS_PER_WORD] |= 1UL << (state % BITS_PER_WORD);
+}
+
+/* Simulates all of the globs at once, one character at a time, keeping the
+   set of active states in a bit set. There is no backtracking, so the cost
+   is linear in the length of the name. */
+static bool runAutomaton(const PatternSet *set, const wchar_t *name)
+{
+    uint32_t stackStates[2][STACK_STATE_WORDS];
+    uint32_t *current;
+    uint32_t *next;
+    uint32_t *swap;
+    uint32_t bits;
+    size_t word, state, stateBytes;
+    const struct Token *token;
+    wchar_t c;
+    bool isActive = true;
+    bool matched = false;
+
+    stateBytes = set->stateWords * sizeof(uint32_t);
+    if (set->stateWords <= STACK_STATE_WORDS) {
+        current = stackStates[0];
+        next = stackStates[1];
+    } else {
+        current = (uint32_t *) GC_MALLOC_ATOMIC(stateBytes);
+        next = (uint32_t *) GC_MALLOC_ATOMIC(stateBytes);
+        if (current == NULL || next == NULL) {
+            writeError(errno, L"Failed to allocate memory for matching", name);
+            exit(EXIT_FAILURE);
+        }
+    }
+    memcpy(current, set->startStates, stateBytes);
+    for (; *name != L'\0' && isActive; name++) {
+        c = towlower(*name);
+        memset(next, 0, stateBytes);
+        isActive = false;
+        for (word = 0; word < set->stateWords; word++) {
+            for (bits = current[word], state = word * BITS_PER_WORD; bits != 0; bits >>= 1, state++) {
+                if ((bits & 1) == 0) {
+                    continue;
+                }
+                token = &set->tokens[state];
+                switch (token->type) {
+                case TOKEN_CHAR:
+                    if (token->c == c) {
+                        addState(set, next, state + 1);
+                        isActive = true;
+                    }
+                    break;
+                case TOKEN_ANY:
+                    addState(set, next, state + 1);
+                    isActive = true;
+                    break;
+                case TOKEN_STAR:
+                    addState(set, next, state);
+                    isActive = true;
+                    break;
+                case TOKEN_CLASS:
+                    if (matchesCharClass(token, *name)) {
+                        addState(set, next, state + 1);
+                        isActive = true;
+                    }
+                    break;
+                case TOKEN_ACCEPT:
+                    break;
+                }
+            }
+        }
+        swap = current;
+        current = next;
+        next = swap;
+    }
+    if (isActive) {
+        for (word = 0; word < set->stateWords && !matched; word++) {
+            for (bits = current[word], state = word * BITS_PER_WORD; bits != 0 && !matched; bits >>= 1, state++) {
+                matched = (bits & 1) != 0 && set->tokens[state].type == TOKEN_ACCEPT;
+            }
+        }
+    }
+    return matched;
+}
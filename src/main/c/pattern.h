@@ -0,0 +1,22 @@
+#ifndef PATTERN_H_QWERTY
+#define PATTERN_H_QWERTY
+
+#include <stdbool.h>
+#include <wchar.h>
+
+/* A set of wildcard patterns compiled together so that a name can be tested
+   against all of them in a single pass. Plain names go into a hash table and
+   patterns containing *, ? or [...] are combined into one automaton. Matching
+   is case insensitive, like the Windows file system. */
+typedef
+    struct PatternSet /* as */
+    PatternSet;
+
+extern PatternSet *initPatternSet();
+extern void addPattern(PatternSet *set, const wchar_t *pattern);
+extern void addPatternsFromFile(PatternSet *set, const wchar_t *fileName);
+extern void compilePatternSet(PatternSet *set);
+extern bool isPatternSetEmpty(const PatternSet *set);
+extern bool matchesPatternSet(const PatternSet *set, const wchar_t *name);
+
+#endif
@@ -0,0 +1,171 @@
+#include <stdlib.h>
+#include <errno.h>
+#include <windows.h>
+#include <gc.h>
+#include "pool.h"
+#include "output.h"
+#include "error.h"
+
+/* Items that may be queued, running or waiting to be written, for each
+   thread. A slow item holds up the writing of those after it, and this
+   bounds how much finished output can pile up behind it. */
+#define ITEMS_PER_THREAD 4
+
+struct PoolItem {
+    void *item;
+    OutputBuffer *output;
+    bool isDone;
+};
+
+/* The items are a ring in which, in order, come the ones written, the ones
+   running or finished but not yet written, and the ones queued. */
+struct WorkerPool {
+    PoolTask task;
+    HANDLE *threads;
+    unsigned long threadCount;
+    struct PoolItem *items;
+    size_t capacity;
+    size_t submitted;
+    size_t taken;
+    size_t written;
+    CRITICAL_SECTION lock;
+    HANDLE workAvailable;       /* Counts queued items, plus one per thread at the end */
+    HANDLE slotAvailable;       /* Counts free places in the ring */
+};
+
+static DWORD WINAPI runWorker(LPVOID parameter);
+static void writeFinishedItems(WorkerPool *pool);
+static void releaseHeadOutput(WorkerPool *pool);
+
+unsigned long getDefaultThreadCount()
+{
+    SYSTEM_INFO info;
+
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? info.dwNumberOfProcessors : 1;
+}
+
+WorkerPool *startWorkerPool(PoolTask task, unsigned long threadCount)
+{
+    WorkerPool *pool;
+    unsigned long i;
+
+    pool = (WorkerPool *) GC_MALLOC(sizeof(WorkerPool));
+    if (pool != NULL) {
+        pool->threads = (HANDLE *) GC_MALLOC_ATOMIC(threadCount * sizeof(HANDLE));
+        pool->items = (struct PoolItem *) GC_MALLOC(threadCount * ITEMS_PER_THREAD * sizeof(struct PoolItem));
+    }
+    if (pool == NULL || pool->threads == NULL || pool->items == NULL) {
+        writeError(errno, L"Failed to allocate memory for", L"worker pool");
+        exit(EXIT_FAILURE);
+    }
+    pool->task = task;
+    pool->threadCount = threadCount;
+    pool->capacity = threadCount * ITEMS_PER_THREAD;
+    pool->submitted = 0;
+    pool->taken = 0;
+    pool->written = 0;
+    InitializeCriticalSection(&pool->lock);
+    pool->workAvailable = CreateSemaphore(NULL, 0, (LONG) (pool->capacity + threadCount), NULL);
+    pool->slotAvailable = CreateSemaphore(NULL, (LONG) pool->capacity, (LONG) pool->capacity, NULL);
+    if (pool->workAvailable == NULL || pool->slotAvailable == NULL) {
+        writeLastError(GetLastError(), L"Failed to create semaphore for", L"worker pool");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < threadCount; i++) {
+        if ((pool->threads[i] = CreateThread(NULL, 0, runWorker, pool, 0, NULL)) == NULL) {
+            writeLastError(GetLastError(), L"Failed to start thread for", L"worker pool");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return pool;
+}
+
+/* Waits while the ring is full, so that items can be submitted as fast as
+   they are read without holding all of them in memory. */
+void submitToWorkerPool(WorkerPool *pool, void *item)
+{
+    struct PoolItem *poolItem;
+
+    WaitForSingleObject(pool->slotAvailable, INFINITE);
+    EnterCriticalSection(&pool->lock);
+    poolItem = &pool->items[pool->submitted % pool->capacity];
+    poolItem->item = item;
+    poolItem->output = initOutputBuffer();
+    poolItem->isDone = false;
+    pool->submitted++;
+    releaseHeadOutput(pool);
+    LeaveCriticalSection(&pool->lock);
+    ReleaseSemaphore(pool->workAvailable, 1, NULL);
+}
+
+/* Returns once every item has run and its output has been written. */
+void finishWorkerPool(WorkerPool *pool)
+{
+    unsigned long i;
+
+    ReleaseSemaphore(pool->workAvailable, (LONG) pool->threadCount, NULL);
+    for (i = 0; i < pool->threadCount; i++) {
+        WaitForSingleObject(pool->threads[i], INFINITE);
+        CloseHandle(pool->threads[i]);
+    }
+    CloseHandle(pool->workAvailable);
+    CloseHandle(pool->slotAvailable);
+}
+
+/* A thread stops when it is woken and finds nothing queued, which only
+   happens once finishWorkerPool has added the extra count for each thread. */
+static DWORD WINAPI runWorker(LPVOID parameter)
+{
+    WorkerPool *pool = (WorkerPool *) parameter;
+    struct PoolItem *poolItem;
+
+    for (;;) {
+        WaitForSingleObject(pool->workAvailable, INFINITE);
+        EnterCriticalSection(&pool->lock);
+        if (pool->taken == pool->submitted) {
+            LeaveCriticalSection(&pool->lock);
+            break;
+        }
+        poolItem = &pool->items[pool->taken % pool->capacity];
+        pool->taken++;
+        LeaveCriticalSection(&pool->lock);
+
+        setThreadOutput(poolItem->output);
+        pool->task(poolItem->item);
+        setThreadOutput(NULL);
+
+        EnterCriticalSection(&pool->lock);
+        poolItem->isDone = true;
+        writeFinishedItems(pool);
+        LeaveCriticalSection(&pool->lock);
+    }
+    return 0;
+}
+
+/* Must be called with the lock held. Writes the finished items that have
+   no unfinished item before them. */
+static void writeFinishedItems(WorkerPool *pool)
+{
+    struct PoolItem *poolItem;
+
+    while (pool->written < pool->taken
+            && (poolItem = &pool->items[pool->written % pool->capacity])->isDone) {
+        writeOutputBuffer(poolItem->output);
+        poolItem->item = NULL;
+        poolItem->output = NULL;
+        poolItem->isDone = false;
+        pool->written++;
+        ReleaseSemaphore(pool->slotAvailable, 1, NULL);
+    }
+    releaseHeadOutput(pool);
+}
+
+/* Must be called with the lock held. The first item not yet written has
+   nothing before it to wait for, so its output need not be held back. */
+static void releaseHeadOutput(WorkerPool *pool)
+{
+    if (pool->written < pool->submitted) {
+        writeOutputBuffer(pool->items[pool->written % pool->capacity].output);
+    }
+}
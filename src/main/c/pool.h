@@ -0,0 +1,18 @@
+#ifndef POOL_H_QAZWSX
+#define POOL_H_QAZWSX
+
+/* A fixed number of threads that run a task on each submitted item. What
+   a task prints is held back and written in the order the items were
+   submitted, as if they had been run one after another. */
+typedef
+    struct WorkerPool /* as */
+    WorkerPool;
+
+typedef void (*PoolTask)(void *item);
+
+extern unsigned long getDefaultThreadCount();
+extern WorkerPool *startWorkerPool(PoolTask task, unsigned long threadCount);
+extern void submitToWorkerPool(WorkerPool *pool, void *item);
+extern void finishWorkerPool(WorkerPool *pool);
+
+#endif
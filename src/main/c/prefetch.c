@@ -0,0 +1,271 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <windows.h>
+#include <gc.h>
+#include "prefetch.h"
+#include "filename.h"
+#include "deadline.h"
+#include "error.h"
+#include "du.h"
+
+enum SlotState {
+    SLOT_FREE,
+    SLOT_QUEUED,
+    SLOT_READING,
+    SLOT_DONE
+};
+
+/* A directory named by the scan. The path is the scan's own string, so
+   a claim finds it by address. */
+struct Slot {
+    const wchar_t *path;
+    enum SlotState state;
+    bool isClaimed;             /* The scan got there while it was being read */
+    unsigned long long order;   /* When it was named; newer ones come sooner */
+};
+
+/* Written under the lock while the thread runs. Without it only the
+   directories are counted, for --stats. */
+struct PrefetchStats {
+    LONG64 directoriesRead;
+    LONG64 hits;
+    LONG64 late;
+    LONG64 readAhead;
+    LONG64 wasted;
+};
+
+static bool isPrefetchEnabled = false;
+static bool isStopping = false;
+static struct Slot *slots = NULL;
+static unsigned long slotCount = 0;
+static unsigned long long nextOrder = 0;
+static struct PrefetchStats stats = { 0, 0, 0, 0, 0 };
+static HANDLE prefetchThread = NULL;
+static HANDLE workAvailable = NULL;     /* Counts named directories, plus one to stop */
+static CRITICAL_SECTION lock;
+
+static DWORD WINAPI runPrefetch(LPVOID parameter);
+static struct Slot *findSlot(const wchar_t *path);
+static struct Slot *findNewestQueuedSlot();
+static struct Slot *takeSlot();
+static void readAhead(const wchar_t *path);
+
+void startPrefetch(unsigned long depth, Deadline *deadline)
+{
+    if ((slots = (struct Slot *) GC_MALLOC(depth * sizeof(struct Slot))) == NULL) {
+        writeError(errno, L"Failed to allocate memory for", L"directory prefetch");
+        exit(EXIT_FAILURE);
+    }
+    slotCount = depth;
+    InitializeCriticalSection(&lock);
+    if ((workAvailable = CreateSemaphore(NULL, 0, MAXLONG, NULL)) == NULL) {
+        writeLastError(GetLastError(), L"Failed to create semaphore for", L"directory prefetch");
+        return;
+    }
+    if ((prefetchThread = CreateThread(NULL, 0, runPrefetch, deadline, 0, NULL)) == NULL) {
+        writeLastError(GetLastError(), L"Failed to start thread for", L"directory prefetch");
+        return;
+    }
+    isPrefetchEnabled = true;
+}
+
+/* Directories that were read ahead and never claimed count as wasted. */
+void stopPrefetch()
+{
+    unsigned long i;
+
+    if (isPrefetchEnabled) {
+        EnterCriticalSection(&lock);
+        isStopping = true;
+        LeaveCriticalSection(&lock);
+        ReleaseSemaphore(workAvailable, 1, NULL);
+        WaitForSingleObject(prefetchThread, INFINITE);
+        CloseHandle(prefetchThread);
+        CloseHandle(workAvailable);
+        isPrefetchEnabled = false;
+        for (i = 0; i < slotCount; i++) {
+            if (slots[i].state == SLOT_DONE) {
+                stats.wasted++;
+            }
+        }
+    }
+}
+
+/* 0 when there is no reading ahead. */
+unsigned long getPrefetchDepth()
+{
+    return isPrefetchEnabled ? slotCount : 0;
+}
+
+/* The newest directories are read first, because the scan goes depth
+   first: what it named last it will get to soonest. When every slot is
+   taken the one named longest ago gives way. */
+void prefetchDirectory(const wchar_t *path)
+{
+    struct Slot *slot;
+
+    if (!isPrefetchEnabled) {
+        return;
+    }
+    EnterCriticalSection(&lock);
+    if ((slot = takeSlot()) != NULL) {
+        slot->path = path;
+        slot->state = SLOT_QUEUED;
+        slot->isClaimed = false;
+        slot->order = nextOrder++;
+    }
+    LeaveCriticalSection(&lock);
+    if (slot != NULL) {
+        ReleaseSemaphore(workAvailable, 1, NULL);
+    }
+}
+
+/* Counts a hit if the directory has been read ahead. One that is still
+   being read is late, and one still waiting is not read ahead at all,
+   because the scan is about to read it anyway. */
+void claimPrefetchedDirectory(const wchar_t *path)
+{
+    struct Slot *slot;
+
+    if (!isPrefetchEnabled) {
+        InterlockedIncrement64(&stats.directoriesRead);
+        return;
+    }
+    EnterCriticalSection(&lock);
+    stats.directoriesRead++;
+    if ((slot = findSlot(path)) != NULL) {
+        switch (slot->state) {
+        case SLOT_DONE:
+            stats.hits++;
+            slot->state = SLOT_FREE;
+            break;
+        case SLOT_READING:
+            stats.late++;
+            slot->isClaimed = true;
+            break;
+        default:
+            slot->state = SLOT_FREE;
+            break;
+        }
+    }
+    LeaveCriticalSection(&lock);
+}
+
+/* For --stats, on stderr once the scan is done. */
+void writeScanStats()
+{
+    double hitRate;
+
+    if (slotCount == 0) {
+        fwprintf(stderr, L"%ls: stats: %lld directories read, no prefetch\n",
+                 programName, (long long) stats.directoriesRead);
+        return;
+    }
+    hitRate = stats.directoriesRead > 0 ? 100.0 * stats.hits / stats.directoriesRead : 0.0;
+    fwprintf(stderr, L"%ls: stats: %lld directories read, prefetch hit rate %.1f%% (%lld hits, %lld late), %lld read ahead, %lld wasted\n",
+             programName, (long long) stats.directoriesRead, hitRate, (long long) stats.hits,
+             (long long) stats.late, (long long) stats.readAhead, (long long) stats.wasted);
+}
+
+/* Waits for a directory to be named, since the wait for the disk is what
+   this thread is for. Nothing is read after the deadline, which is the
+   parameter. */
+static DWORD WINAPI runPrefetch(LPVOID parameter)
+{
+    Deadline *deadline = (Deadline *) parameter;
+    struct Slot *slot = NULL;
+    const wchar_t *path = NULL;
+
+    for (;;) {
+        WaitForSingleObject(workAvailable, INFINITE);
+        EnterCriticalSection(&lock);
+        if (isStopping) {
+            LeaveCriticalSection(&lock);
+            break;
+        }
+        /* Nothing is found when the scan got to the directory first. */
+        slot = isPastDeadline(deadline) ? NULL : findNewestQueuedSlot();
+        if (slot != NULL) {
+            slot->state = SLOT_READING;
+            path = slot->path;
+        }
+        LeaveCriticalSection(&lock);
+        if (slot == NULL) {
+            continue;
+        }
+        readAhead(path);
+        EnterCriticalSection(&lock);
+        stats.readAhead++;
+        slot->state = slot->isClaimed ? SLOT_FREE : SLOT_DONE;
+        LeaveCriticalSection(&lock);
+    }
+    return 0;
+}
+
+static struct Slot *findSlot(const wchar_t *path)
+{
+    unsigned long i;
+
+    for (i = 0; i < slotCount; i++) {
+        if (slots[i].state != SLOT_FREE && slots[i].path == path) {
+            return &slots[i];
+        }
+    }
+    return NULL;
+}
+
+static struct Slot *findNewestQueuedSlot()
+{
+    struct Slot *newest = NULL;
+    unsigned long i;
+
+    for (i = 0; i < slotCount; i++) {
+        if (slots[i].state == SLOT_QUEUED && (newest == NULL || slots[i].order > newest->order)) {
+            newest = &slots[i];
+        }
+    }
+    return newest;
+}
+
+/* A free slot, or else the oldest one not being read. Returns NULL when
+   the only slot is being read. */
+static struct Slot *takeSlot()
+{
+    struct Slot *oldest = NULL;
+    unsigned long i;
+
+    for (i = 0; i < slotCount; i++) {
+        if (slots[i].state == SLOT_FREE) {
+            return &slots[i];
+        }
+        if (slots[i].state != SLOT_READING && (oldest == NULL || slots[i].order < oldest->order)) {
+            oldest = &slots[i];
+        }
+    }
+    if (oldest != NULL && oldest->state == SLOT_DONE) {
+        stats.wasted++;
+    }
+    return oldest;
+}
+
+/* Lists the directory and throws the names away. Errors are left for the
+   scan to report when it reads the directory itself. */
+static void readAhead(const wchar_t *path)
+{
+    WIN32_FIND_DATA findData;
+    HANDLE findHandle;
+    wchar_t *search;
+
+    search = buildPath(path, L"*");
+    findHandle = FindFirstFileEx(search, FindExInfoBasic, &findData,
+                                 FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+    if (findHandle == INVALID_HANDLE_VALUE && GetLastError() == ERROR_INVALID_PARAMETER) {
+        findHandle = FindFirstFile(search, &findData);
+    }
+    if (findHandle != INVALID_HANDLE_VALUE) {
+        while (FindNextFile(findHandle, &findData)) {
+        }
+        FindClose(findHandle);
+    }
+}
@@ -0,0 +1,22 @@
+#ifndef PREFETCH_H_YHNUJM
+#define PREFETCH_H_YHNUJM
+
+#include <wchar.h>
+#include "deadline.h"
+
+#define DEFAULT_PREFETCH_DEPTH 16
+
+/* A thread that reads directories ahead of the scan, so that their
+   listings are already in the cache when the scan gets to them. The scan
+   names the directories it will visit soon with prefetchDirectory and
+   says when it reads one with claimPrefetchedDirectory. Up to depth
+   directories are held ahead at a time, and none after the deadline,
+   which may be NULL. */
+extern void startPrefetch(unsigned long depth, Deadline *deadline);
+extern void stopPrefetch();
+extern unsigned long getPrefetchDepth();
+extern void prefetchDirectory(const wchar_t *path);
+extern void claimPrefetchedDirectory(const wchar_t *path);
+extern void writeScanStats();
+
+#endif
@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <windows.h>
+#include <gc.h>
+#include "progress.h"
+#include "error.h"
+#include "du.h"
+
+#define CONSOLE_REDRAW_MILLISECONDS 250
+#define LOG_LINE_MILLISECONDS 10000
+#define DEFAULT_CONSOLE_WIDTH 80
+#define PROGRESS_LINE_CAPACITY 512
+#define PROGRESS_SIZE_CAPACITY 32
+
+/* Written by the scanning code and only read by the reporter thread, so
+   a stale value now and then is harmless. */
+static volatile LONG64 entryCount = 0;
+static volatile LONG64 byteCount = 0;
+static const wchar_t *volatile currentPath = NULL;
+
+static bool isProgressEnabled = false;
+static bool isInteractive = false;
+static bool isLineShown = false;
+static HANDLE reporterThread = NULL;
+static HANDLE stopEvent = NULL;
+static CRITICAL_SECTION consoleLock;
+static bool isConsoleLockReady = false;     /* Stays set after stopProgress */
+
+static DWORD WINAPI reportProgress(LPVOID parameter);
+static void writeProgressLine(LONG64 entriesPerSecond);
+static void eraseProgressLine();
+static const wchar_t *formatProgressSize(LONG64 size, wchar_t *buffer, size_t capacity);
+static int getConsoleWidth();
+
+void startProgress()
+{
+    DWORD consoleMode;
+
+    isInteractive = GetConsoleMode(GetStdHandle(STD_ERROR_HANDLE), &consoleMode) != FALSE;
+    InitializeCriticalSection(&consoleLock);
+    isConsoleLockReady = true;
+    if ((stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL)) == NULL) {
+        writeLastError(GetLastError(), L"Failed to create event for", L"progress reporter");
+        return;
+    }
+    reporterThread = CreateThread(NULL, 0, reportProgress, NULL, 0, NULL);
+    if (reporterThread == NULL) {
+        writeLastError(GetLastError(), L"Failed to start thread for", L"progress reporter");
+        return;
+    }
+    isProgressEnabled = true;
+}
+
+void stopProgress()
+{
+    if (isProgressEnabled) {
+        SetEvent(stopEvent);
+        WaitForSingleObject(reporterThread, INFINITE);
+        CloseHandle(reporterThread);
+        CloseHandle(stopEvent);
+        isProgressEnabled = false;
+        clearProgressLine();
+    }
+}
+
+void countProgressEntry(int64_t size)
+{
+    if (isProgressEnabled) {
+        InterlockedIncrement64(&entryCount);
+        InterlockedExchangeAdd64(&byteCount, size);
+    }
+}
+
+void countProgressEntries(int64_t count, int64_t size)
+{
+    if (isProgressEnabled) {
+        InterlockedExchangeAdd64(&entryCount, count);
+        InterlockedExchangeAdd64(&byteCount, size);
+    }
+}
+
+void setProgressPath(const wchar_t *path)
+{
+    if (isProgressEnabled) {
+        currentPath = path;
+    }
+}
+
+/* Called before normal output goes to the console, so that the output
+   does not end up mixed into the status line. The reporter draws it again
+   at its next turn. */
+void clearProgressLine()
+{
+    if (isConsoleLockReady) {
+        EnterCriticalSection(&consoleLock);
+        eraseProgressLine();
+        LeaveCriticalSection(&consoleLock);
+    }
+}
+
+/* For error and warning lines, which go to the same console as the status
+   line and would otherwise be written onto the end of it. */
+void writeOverProgressLine(const wchar_t *text)
+{
+    if (isConsoleLockReady) {
+        EnterCriticalSection(&consoleLock);
+        eraseProgressLine();
+        fputws(text, stderr);
+        LeaveCriticalSection(&consoleLock);
+    } else {
+        fputws(text, stderr);
+    }
+}
+
+/* Must be called with consoleLock held. */
+static void eraseProgressLine()
+{
+    if (isInteractive && isLineShown) {
+        fwprintf(stderr, L"\r%*ls\r", getConsoleWidth() - 1, L"");
+        fflush(stderr);
+        isLineShown = false;
+    }
+}
+
+static DWORD WINAPI reportProgress(LPVOID parameter)
+{
+    DWORD interval;
+    LONG64 previousEntries = 0;
+    LONG64 entries;
+
+    interval = isInteractive ? CONSOLE_REDRAW_MILLISECONDS : LOG_LINE_MILLISECONDS;
+    while (WaitForSingleObject(stopEvent, interval) == WAIT_TIMEOUT) {
+        entries = entryCount;
+        writeProgressLine((entries - previousEntries) * 1000 / interval);
+        previousEntries = entries;
+    }
+    return 0;
+}
+
+/* On a console one line is redrawn in place; otherwise each report is a
+   line of its own, which suits log files. */
+static void writeProgressLine(LONG64 entriesPerSecond)
+{
+    wchar_t line[PROGRESS_LINE_CAPACITY];
+    wchar_t sizeText[PROGRESS_SIZE_CAPACITY];
+    const wchar_t *path;
+    size_t pathLength;
+    int lineWidth;
+    int width;
+    int length;
+
+    path = currentPath;
+    if (path == NULL) {
+        path = L"";
+    }
+    length = _snwprintf(line, PROGRESS_LINE_CAPACITY, L"%lld entries, %ls, %lld entries/s, %lu errors: ",
+                    (long long) entryCount, formatProgressSize(byteCount, sizeText, PROGRESS_SIZE_CAPACITY),
+                    (long long) entriesPerSecond, getErrorCount());
+    if (length < 0) {
+        return;
+    }
+    EnterCriticalSection(&consoleLock);
+    if (isInteractive) {
+        /* The line must stay short of the last column, or it wraps and \r
+           no longer takes it back to its start. Keep the end of the path,
+           which is the part that changes. */
+        lineWidth = getConsoleWidth() - 1;
+        width = lineWidth - length;
+        pathLength = wcslen(path);
+        if (width > 3 && pathLength > (size_t) width) {
+            fwprintf(stderr, L"\r%ls...%ls", line, path + pathLength - (width - 3));
+        } else if (width > 3) {
+            fwprintf(stderr, L"\r%ls%-*ls", line, width, path);
+        } else {
+            if (lineWidth > 0 && length > lineWidth) {
+                line[lineWidth] = L'\0';
+            }
+            fwprintf(stderr, L"\r%ls", line);
+        }
+        isLineShown = true;
+    } else {
+        fwprintf(stderr, L"%ls: progress: %ls%ls\n", programName, line, path);
+    }
+    fflush(stderr);
+    LeaveCriticalSection(&consoleLock);
+}
+
+static const wchar_t *formatProgressSize(LONG64 size, wchar_t *buffer, size_t capacity)
+{
+    const wchar_t *units[] = { L"B", L"KB", L"MB", L"GB", L"TB", L"PB" };
+    double value;
+    int unit = 0;
+
+    value = (double) size;
+    while (value >= 1024.0 && unit < 5) {
+        value /= 1024.0;
+        unit++;
+    }
+    _snwprintf(buffer, capacity, L"%.1f %ls", value, units[unit]);
+    buffer[capacity - 1] = L'\0';
+    return buffer;
+}
+
+static int getConsoleWidth()
+{
+    CONSOLE_SCREEN_BUFFER_INFO info;
+    int width = DEFAULT_CONSOLE_WIDTH;
+
+    if (GetConsoleScreenBufferInfo(GetStdHandle(STD_ERROR_HANDLE), &info)) {
+        width = info.srWindow.Right - info.srWindow.Left + 1;
+    }
+    return width;
+}
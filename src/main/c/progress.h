@@ -0,0 +1,17 @@
+#ifndef PROGRESS_H_RFVTGB
+#define PROGRESS_H_RFVTGB
+
+#include <stdint.h>     /* int64_t */
+#include <wchar.h>
+
+/* A thread that reports how far the scan has got on stderr. The counting
+   functions cost next to nothing when it is not running. */
+extern void startProgress();
+extern void stopProgress();
+extern void countProgressEntry(int64_t size);
+extern void countProgressEntries(int64_t count, int64_t size);
+extern void setProgressPath(const wchar_t *path);
+extern void clearProgressLine();
+extern void writeOverProgressLine(const wchar_t *text);
+
+#endif
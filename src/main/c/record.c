@@ -0,0 +1,108 @@
+#include <stdlib.h>
+#include <string.h>
+#include <io.h>         /* _get_osfhandle */
+#include <windows.h>
+#include <gc.h>
+#include "record.h"
+#include "string.h"
+
+/* No text du writes is anywhere near this long, so a longer one means
+   the file is damaged. */
+#define MAX_RECORD_TEXT_LENGTH (1024 * 1024)
+
+/* Seven bits at a time, lowest first, with the top bit of each byte
+   saying that more follow. */
+void writeRecordNumber(FILE *file, uint64_t number)
+{
+    while (number >= 0x80) {
+        putc((int) (number & 0x7F) | 0x80, file);
+        number >>= 7;
+    }
+    putc((int) number, file);
+}
+
+void writeRecordText(FILE *file, const wchar_t *text)
+{
+    char *utf8;
+    size_t length;
+
+    utf8 = convertToUtf8(text);
+    length = strlen(utf8);
+    writeRecordNumber(file, length);
+    fwrite(utf8, 1, length, file);
+}
+
+/* Every age bucket is written, since those that are not used take a
+   byte each. */
+void writeRecordUsage(FILE *file, const struct Usage *usage)
+{
+    int i;
+
+    writeRecordNumber(file, (uint64_t) usage->size);
+    writeRecordNumber(file, usage->isLowerBound ? 1 : 0);
+    for (i = 0; i < AGE_BUCKET_COUNT; i++) {
+        writeRecordNumber(file, (uint64_t) usage->ageBytes[i]);
+    }
+    writeRecordNumber(file, usage->newestTime);
+}
+
+bool readRecordNumber(FILE *file, uint64_t *number)
+{
+    int c;
+    int shift = 0;
+
+    *number = 0;
+    do {
+        if ((c = getc(file)) == EOF || shift > 63) {
+            return false;
+        }
+        *number |= (uint64_t) (c & 0x7F) << shift;
+        shift += 7;
+    } while (c & 0x80);
+    return true;
+}
+
+wchar_t *readRecordText(FILE *file)
+{
+    uint64_t length;
+    char *utf8;
+
+    if (!readRecordNumber(file, &length) || length > MAX_RECORD_TEXT_LENGTH) {
+        return NULL;
+    }
+    if ((utf8 = (char *) GC_MALLOC_ATOMIC((size_t) length + 1)) == NULL) {
+        return NULL;
+    }
+    if (fread(utf8, 1, (size_t) length, file) != length) {
+        return NULL;
+    }
+    utf8[length] = '\0';
+    return convertFromUtf8(utf8);
+}
+
+bool readRecordUsage(FILE *file, struct Usage *usage)
+{
+    uint64_t number;
+    int i;
+
+    if (!readRecordNumber(file, &number)) {
+        return false;
+    }
+    usage->size = (int64_t) number;
+    if (!readRecordNumber(file, &number)) {
+        return false;
+    }
+    usage->isLowerBound = number != 0;
+    for (i = 0; i < AGE_BUCKET_COUNT; i++) {
+        if (!readRecordNumber(file, &number)) {
+            return false;
+        }
+        usage->ageBytes[i] = (int64_t) number;
+    }
+    return readRecordNumber(file, &usage->newestTime);
+}
+
+bool flushRecordFile(FILE *file)
+{
+    return fflush(file) == 0 && FlushFileBuffers((HANDLE) _get_osfhandle(_fileno(file)));
+}
@@ -0,0 +1,25 @@
+#ifndef RECORD_H_TGBYHN
+#define RECORD_H_TGBYHN
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <wchar.h>
+#include "usage.h"
+
+/* The fields of the files du writes for itself to read back, such as
+   checkpoints. Numbers take a byte for each 7 bits they need, and text is
+   kept as UTF-8, so that a file holding millions of entries stays small.
+   Write errors are left for the caller to find with ferror. A read that
+   fails, because the file is cut short or damaged, returns false or NULL. */
+extern void writeRecordNumber(FILE *file, uint64_t number);
+extern void writeRecordText(FILE *file, const wchar_t *text);
+extern void writeRecordUsage(FILE *file, const struct Usage *usage);
+extern bool readRecordNumber(FILE *file, uint64_t *number);
+extern wchar_t *readRecordText(FILE *file);
+extern bool readRecordUsage(FILE *file, struct Usage *usage);
+/* Returns false if what was written to the file could not be put on the
+   disk, where it has to be before the file is said to be written. */
+extern bool flushRecordFile(FILE *file);
+
+#endif
@@ -22,7 +22,9 @@ void addElementToRegistryUserPath(const _TCHAR *element)
 
     environmentKey = openRegistryKey(HKEY_CURRENT_USER, REGISTRY_ENVIRONMENT_KEY_NAME);
     path = getRegistryStringData(environmentKey, REGISTRY_USER_PATH_VALUE_NAME);
-    absElement = getAbsolutePath(element);
+    if ((absElement = getAbsolutePath(element)) == NULL) {
+        exit(EXIT_FAILURE);
+    }
     updatedPath = addElementToPath(path, absElement);
     if (updatedPath == path) {
         _tprintf(_T("Directory %ls already exists in user Path in the registry.\n"), absElement);
@@ -0,0 +1,120 @@
+#include <stdlib.h>
+#include <errno.h>
+#include <wctype.h>     /* towlower */
+#include <windows.h>
+#include <gc.h>
+#include "roots.h"
+#include "filename.h"
+#include "string.h"
+#include "error.h"
+
+static wchar_t *getRootFullPath(const wchar_t *path);
+static int compareRoots(const void *left, const void *right);
+static size_t getContainedOffset(const wchar_t *outer, const wchar_t *inner);
+
+/* Returns the paths as roots in the same order, each one linked to the
+   outermost other root that contains it, so that a directory given twice,
+   or given along with a directory above it, can be read only once. An
+   exact duplicate counts as contained in its first occurrence. */
+struct Root **initRoots(List *paths, size_t *count)
+{
+    struct Root **roots;
+    struct Root **sorted;
+    struct Root *outermost = NULL;
+    List *node;
+    size_t offset;
+    size_t i;
+
+    *count = getListSize(paths);
+    roots = (struct Root **) GC_MALLOC(*count * sizeof(struct Root *));
+    sorted = (struct Root **) GC_MALLOC(*count * sizeof(struct Root *));
+    if (roots == NULL || sorted == NULL) {
+        writeError(errno, L"Failed to allocate memory for", L"arguments");
+        exit(EXIT_FAILURE);
+    }
+    for (node = paths, i = 0; !isListEmpty(node); node = skipListItem(node), i++) {
+        if ((roots[i] = (struct Root *) GC_MALLOC(sizeof(struct Root))) == NULL) {
+            writeError(errno, L"Failed to allocate memory for", L"arguments");
+            exit(EXIT_FAILURE);
+        }
+        roots[i]->path = (const wchar_t *) getListItem(node);
+        roots[i]->fullPath = getRootFullPath(roots[i]->path);
+        roots[i]->position = i;
+        roots[i]->enclosing = NULL;
+        roots[i]->scanPath = roots[i]->path;
+        sorted[i] = roots[i];
+    }
+
+    /* In this order everything inside a root comes right after it. */
+    qsort(sorted, *count, sizeof(struct Root *), compareRoots);
+    for (i = 0; i < *count; i++) {
+        if (outermost != NULL && (offset = getContainedOffset(outermost->fullPath, sorted[i]->fullPath)) > 0) {
+            sorted[i]->enclosing = outermost;
+            if (sorted[i]->fullPath[offset] == L'\0') {
+                sorted[i]->scanPath = outermost->path;
+            } else {
+                sorted[i]->scanPath = buildPath(outermost->path, sorted[i]->fullPath + offset);
+            }
+        } else {
+            outermost = sorted[i];
+        }
+    }
+    return roots;
+}
+
+/* Without the trailing backslash, except for the root of a volume. */
+static wchar_t *getRootFullPath(const wchar_t *path)
+{
+    wchar_t *fullPath;
+    size_t length;
+
+    if ((fullPath = getAbsolutePath(path)) == NULL) {
+        /* The scan will report the path as it was given. */
+        fullPath = createStringCopy(path);
+    }
+    length = wcslen(fullPath);
+    while (length > 1 && fullPath[length - 1] == L'\\' && fullPath[length - 2] != L':' && fullPath[length - 2] != L'\\') {
+        fullPath[--length] = L'\0';
+    }
+    return fullPath;
+}
+
+/* Ignoring case, with the backslash sorting before every other character,
+   then in argument order. */
+static int compareRoots(const void *left, const void *right)
+{
+    const struct Root *leftRoot = *(const struct Root **) left;
+    const struct Root *rightRoot = *(const struct Root **) right;
+    const wchar_t *l = leftRoot->fullPath;
+    const wchar_t *r = rightRoot->fullPath;
+    wint_t lc;
+    wint_t rc;
+
+    for (;; l++, r++) {
+        lc = *l == L'\\' ? 1 : towlower(*l);
+        rc = *r == L'\\' ? 1 : towlower(*r);
+        if (lc != rc) {
+            return lc < rc ? -1 : 1;
+        }
+        if (lc == L'\0') {
+            break;
+        }
+    }
+    return leftRoot->position < rightRoot->position ? -1 : leftRoot->position > rightRoot->position;
+}
+
+/* If inner is outer or lies inside it, returns where the part of inner
+   below outer starts, and otherwise 0. */
+static size_t getContainedOffset(const wchar_t *outer, const wchar_t *inner)
+{
+    size_t length;
+
+    length = wcslen(outer);
+    if (length == 0 || _wcsnicmp(outer, inner, length) != 0) {
+        return 0;
+    }
+    if (inner[length] == L'\0' || outer[length - 1] == L'\\') {
+        return length;
+    }
+    return inner[length] == L'\\' ? length + 1 : 0;
+}
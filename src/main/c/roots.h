@@ -0,0 +1,19 @@
+#ifndef ROOTS_H_TGBYHN
+#define ROOTS_H_TGBYHN
+
+#include <stddef.h>
+#include <wchar.h>
+#include "list.h"
+
+/* An argument to summarize, after wildcards have been expanded. */
+struct Root {
+    const wchar_t *path;        /* As given */
+    const wchar_t *fullPath;
+    size_t position;            /* Place in the argument order */
+    struct Root *enclosing;     /* The outermost argument that contains this one, or NULL */
+    const wchar_t *scanPath;    /* This one's path as the scan of enclosing meets it */
+};
+
+extern struct Root **initRoots(List *paths, size_t *count);
+
+#endif
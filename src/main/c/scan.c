@@ -0,0 +1,744 @@
+#include <stdlib.h>
+#include <string.h>     /* memcpy */
+#include <windows.h>
+#include <gc.h>
+#include "scan.h"
+#include "deadline.h"
+#include "progress.h"
+#include "prefetch.h"
+#include "record.h"
+#include "string.h"
+
+#define INITIAL_STACK_CAPACITY 64
+#define INITIAL_PATH_CAPACITY 256
+
+/* A directory whose entries are being visited. Those still to be visited
+   run from nextEntry to the top of the entry stack. Its path is the start
+   of the path buffer, and what it has counted so far is kept as its
+   parts, its age buckets apart, so that a deep tree costs little. */
+struct Frame {
+    size_t pathLength;
+    size_t firstEntry;              /* Where its entries start on the entry stack */
+    size_t nextEntry;
+    int64_t size;
+    uint64_t newestTime;
+    void *cookie;
+    enum FileType type;
+    bool isTopLevel;
+    bool isLowerBound;
+};
+
+struct ScanContext {
+    struct ScanOptions options;
+    struct ScanCallbacks callbacks;
+    struct ErrorHandler errorHandler;
+    struct ListingOptions listing;  /* From the options */
+    FileTally fileTally;
+    volatile LONG isCancelled;      /* Stays set once cancelScan is called */
+    bool isFailed;                  /* For the tree being scanned */
+    unsigned long rootVolume;
+    struct Frame *frames;           /* The directories being read, outermost first */
+    size_t frameCount;
+    size_t frameCapacity;
+    int64_t *frameAgeBytes;         /* AGE_BUCKET_COUNT for each frame, only by age */
+    wchar_t *path;                  /* Of the directory or entry being visited */
+    size_t pathLength;
+    size_t pathCapacity;
+    struct FileEntry *entries;      /* Entries of those directories not yet visited, each */
+                                    /* path what follows the path of its directory */
+    size_t entryCount;
+    size_t entryCapacity;
+    struct Usage total;             /* Of the whole tree, once it is done */
+};
+
+static struct Breakdowns noBreakdowns = { NULL, NULL, NULL };
+
+static bool loadFrames(ScanContext *scan, FILE *file);
+static void saveEntry(const struct FileEntry *entry, FILE *file);
+static bool loadEntry(struct FileEntry *entry, FILE *file);
+static const struct ErrorHandler *enterScan(ScanContext *scan);
+static void walkTree(ScanContext *scan);
+static enum ScanResult leaveScan(ScanContext *scan, const struct ErrorHandler *outerHandler, struct Usage *total);
+static void visitEntry(ScanContext *scan, const struct FileEntry *fileEntry, bool isTopLevel);
+static bool enterDirectory(ScanContext *scan, const struct ScanEntry *directory);
+static void nameDirectoriesAhead(const ScanContext *scan, const struct Frame *frame);
+static void leaveDirectory(ScanContext *scan);
+static void finishEntry(ScanContext *scan, const struct ScanEntry *entry, EntryCallback callback);
+static void abandonDirectories(ScanContext *scan);
+static bool isStopped(const ScanContext *scan);
+static struct Frame *pushFrame(ScanContext *scan);
+static bool pushEntry(ScanContext *scan, const struct FileEntry *entry, const wchar_t *name);
+static bool setPath(ScanContext *scan, size_t length, const wchar_t *name);
+static void startFrameUsage(ScanContext *scan, struct Frame *frame, const struct Usage *usage);
+static void addFrameUsage(ScanContext *scan, struct Frame *frame, const struct Usage *usage);
+static void getFrameUsage(const ScanContext *scan, const struct Frame *frame, struct Usage *usage);
+static bool shouldDescend(ScanContext *scan, const struct FileEntry *fileEntry, bool isTopLevel);
+
+/* Returns NULL if there is not enough memory. */
+ScanContext *initScanContext(const struct ScanOptions *options, const struct ScanCallbacks *callbacks)
+{
+    ScanContext *scan;
+    bool hasBreakdowns;
+
+    if ((scan = (ScanContext *) GC_MALLOC(sizeof(ScanContext))) == NULL) {
+        return NULL;
+    }
+    scan->options = *options;
+    scan->callbacks = *callbacks;
+    if (scan->options.dereference && scan->options.visited == NULL) {
+        scan->options.visited = initVisitedSet();
+    }
+    hasBreakdowns = scan->options.breakdowns != NULL || scan->options.byAge;
+    if (scan->options.breakdowns == NULL) {
+        scan->options.breakdowns = &noBreakdowns;
+    }
+    scan->listing.isPhysicalOrder = options->isPhysicalOrder;
+    scan->listing.needsAllocatedSizes = options->size == TALLY_ALLOCATED_SIZE;
+    scan->listing.dereference = options->dereference;
+    scan->listing.excludes = options->excludes;
+    scan->listing.includes = options->includes;
+    scan->listing.deadline = options->deadline;
+    scan->fileTally = getFileTally(scan->options.size, hasBreakdowns, scan->options.byAge);
+    scan->errorHandler.callback = callbacks->error;
+    scan->errorHandler.context = callbacks->context;
+    scan->errorHandler.programName = options->programName;
+    scan->isCancelled = FALSE;
+    scan->frames = NULL;
+    scan->frameCapacity = 0;
+    scan->frameAgeBytes = NULL;
+    scan->path = NULL;
+    scan->pathLength = 0;
+    scan->pathCapacity = 0;
+    scan->entries = NULL;
+    scan->entryCapacity = 0;
+    return scan;
+}
+
+/* Walks the tree with an explicit stack instead of recursion, so that
+   however deep the tree is the native stack does not grow. Entries are
+   visited in the same order a recursive walk would visit them. total is
+   a lower bound unless the scan is complete. */
+enum ScanResult scanTree(ScanContext *scan, const wchar_t *path, struct Usage *total)
+{
+    const struct ErrorHandler *outerHandler;
+    struct FileEntry entry;
+
+    outerHandler = enterScan(scan);
+    scan->rootVolume = 0;
+    scan->frameCount = 0;
+    scan->entryCount = 0;
+    if (scan->isCancelled) {
+        /* Nothing is looked at. */
+    } else if (!getFileEntry(path, &entry)) {
+        scan->isFailed = true;
+    } else if (setPath(scan, 0, entry.path)) {
+        entry.path = scan->path;
+        visitEntry(scan, &entry, true);
+        walkTree(scan);
+    }
+    return leaveScan(scan, outerHandler, total);
+}
+
+/* Carries on from where the scan was when its state was saved, with the
+   state loaded by loadScanState. Only the entries still to be visited are
+   looked at, so what the directories hold now may not be what they held
+   when the scan started. */
+enum ScanResult resumeScan(ScanContext *scan, struct Usage *total)
+{
+    const struct ErrorHandler *outerHandler;
+
+    outerHandler = enterScan(scan);
+    if (!scan->isCancelled) {
+        walkTree(scan);
+    }
+    return leaveScan(scan, outerHandler, total);
+}
+
+/* May be called from any thread. The scan stops at the next entry, and
+   the directories it is in are not reported. */
+void cancelScan(ScanContext *scan)
+{
+    InterlockedExchange(&scan->isCancelled, TRUE);
+}
+
+/* Everything the scan has counted is either in a frame or still to be
+   visited on the entry stack. Each frame is written with the entries of
+   it that are left, and each path as what follows the path of the frame
+   before it, as the scan keeps them, which keeps the file small however
+   deep the tree is. The cookies of the frames are not saved. Returns
+   false if it could not all be written, or there is not enough memory. */
+bool saveScanState(const ScanContext *scan, FILE *file)
+{
+    const struct Frame *frame;
+    struct Usage usage;
+    wchar_t *path = NULL;
+    wchar_t next;
+    size_t outerLength = 0;
+    size_t end;
+    size_t i;
+    size_t j;
+
+    /* A copy, to cut at the end of each frame's path. */
+    if (scan->frameCount > 0 && (path = joinText(scan->path, L"")) == NULL) {
+        return false;
+    }
+    writeRecordNumber(file, scan->rootVolume);
+    writeRecordNumber(file, scan->frameCount);
+    for (i = 0; i < scan->frameCount; i++) {
+        frame = &scan->frames[i];
+        end = i + 1 < scan->frameCount ? scan->frames[i + 1].firstEntry : scan->entryCount;
+        next = path[frame->pathLength];
+        path[frame->pathLength] = L'\0';
+        writeRecordText(file, path + outerLength);
+        path[frame->pathLength] = next;
+        writeRecordNumber(file, frame->type);
+        getFrameUsage(scan, frame, &usage);
+        writeRecordUsage(file, &usage);
+        writeRecordNumber(file, end - frame->nextEntry);
+        for (j = frame->nextEntry; j < end; j++) {
+            saveEntry(&scan->entries[j], file);
+        }
+        outerLength = frame->pathLength;
+    }
+    return !ferror(file);
+}
+
+/* Replaces the state of the scan with one written by saveScanState.
+   Returns false, leaving nothing to resume, if the file is cut short or
+   damaged, or there is not enough memory. */
+bool loadScanState(ScanContext *scan, FILE *file)
+{
+    if (!loadFrames(scan, file)) {
+        scan->frameCount = 0;
+        scan->entryCount = 0;
+        return false;
+    }
+    return true;
+}
+
+static bool loadFrames(ScanContext *scan, FILE *file)
+{
+    struct Frame *frame;
+    struct FileEntry entry;
+    struct Usage usage;
+    const wchar_t *part;
+    uint64_t rootVolume;
+    uint64_t frameCount;
+    uint64_t entryCount;
+    uint64_t type;
+    uint64_t i;
+    uint64_t j;
+
+    scan->frameCount = 0;
+    scan->entryCount = 0;
+    scan->pathLength = 0;
+    if (!readRecordNumber(file, &rootVolume) || !readRecordNumber(file, &frameCount)) {
+        return false;
+    }
+    scan->rootVolume = (unsigned long) rootVolume;
+    for (i = 0; i < frameCount; i++) {
+        if ((part = readRecordText(file)) == NULL
+                || !readRecordNumber(file, &type) || type > FILETYPE_UNKNOWN
+                || (frame = pushFrame(scan)) == NULL
+                || !setPath(scan, scan->pathLength, part)) {
+            return false;
+        }
+        frame->pathLength = scan->pathLength;
+        frame->type = (enum FileType) type;
+        frame->isTopLevel = i == 0;
+        frame->cookie = NULL;
+        frame->firstEntry = scan->entryCount;
+        frame->nextEntry = scan->entryCount;
+        if (!readRecordUsage(file, &usage) || !readRecordNumber(file, &entryCount)) {
+            return false;
+        }
+        startFrameUsage(scan, frame, &usage);
+        for (j = 0; j < entryCount; j++) {
+            if (!loadEntry(&entry, file) || !pushEntry(scan, &entry, entry.path)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/* Installs the error handler of the scan on this thread and returns the
+   one it replaces. */
+static const struct ErrorHandler *enterScan(ScanContext *scan)
+{
+    const struct ErrorHandler *outerHandler;
+
+    outerHandler = getThreadErrorHandler();
+    if (scan->errorHandler.callback != NULL || scan->errorHandler.programName != NULL) {
+        setThreadErrorHandler(&scan->errorHandler);
+    }
+    scan->isFailed = false;
+    initUsage(&scan->total);
+    return outerHandler;
+}
+
+/* Visits what is on the stacks until they are empty or the scan stops.
+   Between two entries everything counted is in a frame, so that is
+   where the state can be saved. */
+static void walkTree(ScanContext *scan)
+{
+    struct FileEntry entry;
+    struct Frame *frame;
+    ULONGLONG interval;
+    ULONGLONG nextCheckpoint;
+
+    interval = (ULONGLONG) scan->options.checkpointSeconds * 1000;
+    nextCheckpoint = GetTickCount64() + interval;
+    while (scan->frameCount > 0 && !isStopped(scan)) {
+        if (scan->callbacks.checkpoint != NULL && GetTickCount64() >= nextCheckpoint) {
+            scan->callbacks.checkpoint(scan->callbacks.context, scan);
+            nextCheckpoint = GetTickCount64() + interval;
+            if (isStopped(scan)) {
+                /* Cancelled by the callback, so the state it saved is
+                   where the scan ends. */
+                break;
+            }
+        }
+        frame = &scan->frames[scan->frameCount - 1];
+        if (frame->nextEntry < scan->entryCount) {
+            /* Copied, because visiting it can move the array. */
+            entry = scan->entries[frame->nextEntry++];
+            if (setPath(scan, frame->pathLength, entry.path)) {
+                entry.path = scan->path;
+                visitEntry(scan, &entry, false);
+            }
+        } else {
+            leaveDirectory(scan);
+        }
+    }
+    abandonDirectories(scan);
+}
+
+static enum ScanResult leaveScan(ScanContext *scan, const struct ErrorHandler *outerHandler, struct Usage *total)
+{
+    enum ScanResult result;
+
+    setThreadErrorHandler(outerHandler);
+    *total = scan->total;
+    if (scan->isFailed) {
+        result = SCAN_FAILED;
+    } else if (scan->isCancelled) {
+        result = SCAN_CANCELLED;
+    } else {
+        result = SCAN_COMPLETE;
+    }
+    return result;
+}
+
+/* The allocated size may be SIZE_NOT_ASKED or UNKNOWN_SIZE, which are
+   moved up to be written as numbers that are not negative. */
+static void saveEntry(const struct FileEntry *entry, FILE *file)
+{
+    writeRecordText(file, entry->path);
+    writeRecordNumber(file, entry->type);
+    writeRecordNumber(file, (uint64_t) entry->size);
+    writeRecordNumber(file, (uint64_t) (entry->allocatedSize - UNKNOWN_SIZE));
+    writeRecordNumber(file, entry->lastWriteTime);
+    writeRecordNumber(file, entry->id.volumeSerialNumber);
+    writeRecordNumber(file, entry->id.fileIndex);
+}
+
+static bool loadEntry(struct FileEntry *entry, FILE *file)
+{
+    uint64_t number;
+
+    if ((entry->path = readRecordText(file)) == NULL) {
+        return false;
+    }
+    if (!readRecordNumber(file, &number) || number > FILETYPE_UNKNOWN) {
+        return false;
+    }
+    entry->type = (enum FileType) number;
+    if (!readRecordNumber(file, &number)) {
+        return false;
+    }
+    entry->size = (int64_t) number;
+    if (!readRecordNumber(file, &number)) {
+        return false;
+    }
+    entry->allocatedSize = (int64_t) number + UNKNOWN_SIZE;
+    if (!readRecordNumber(file, &entry->lastWriteTime) || !readRecordNumber(file, &number)) {
+        return false;
+    }
+    entry->id.volumeSerialNumber = (unsigned long) number;
+    return readRecordNumber(file, &entry->id.fileIndex);
+}
+
+/* After the deadline no more directories are read and no more files are
+   opened. Whatever was not looked at makes the totals above it lower bounds.
+   A directory that is read is only entered here; it is finished by
+   leaveDirectory once everything below it has been visited. */
+static void visitEntry(ScanContext *scan, const struct FileEntry *fileEntry, bool isTopLevel)
+{
+    struct ScanEntry done;
+
+    if (!isTopLevel && scan->callbacks.select != NULL && scan->frameCount <= scan->options.selectDepth
+            && !scan->callbacks.select(scan->callbacks.context, fileEntry, (unsigned long) scan->frameCount)) {
+        return;
+    }
+    done.path = fileEntry->path;
+    done.type = fileEntry->type;
+    done.isTopLevel = isTopLevel;
+    done.isRead = true;
+    done.cookie = NULL;
+    initUsage(&done.usage);
+    if (scan->callbacks.startEntry != NULL) {
+        done.cookie = scan->callbacks.startEntry(scan->callbacks.context, fileEntry, isTopLevel);
+    }
+    if (fileEntry->type == FILETYPE_FILE) {
+        /* A batch of one. */
+        scan->fileTally(&done.usage, fileEntry, 1, scan->options.breakdowns, &scan->listing);
+        finishEntry(scan, &done, scan->callbacks.entryDone);
+        return;
+    }
+    done.usage.newestTime = fileEntry->lastWriteTime;
+    if (scan->options.size == TALLY_COUNT_ONLY) {
+        /* Links and unread directories are counted too. */
+        done.usage.size = 1;
+    }
+    if (!shouldDescend(scan, fileEntry, isTopLevel)) {
+        /* A link that is not followed takes no space of its own. */
+        done.isRead = false;
+        finishEntry(scan, &done, scan->callbacks.entryDone);
+    } else if (isPastDeadline(scan->options.deadline)) {
+        countUnscannedDirectory(scan->options.deadline);
+        done.usage.isLowerBound = true;
+        finishEntry(scan, &done, scan->callbacks.directoryDone);
+    } else if (!enterDirectory(scan, &done)) {
+        done.usage.isLowerBound = true;
+        finishEntry(scan, &done, scan->callbacks.directoryDone);
+    }
+}
+
+/* Pushes a frame for the directory and reads it. Unless they are reported
+   one by one, files are added up by the file tally as they are read.
+   Only what has to be descended into or reported in order is kept, on
+   the entry stack, until the directory has been read to the end. Returns
+   false if there is no memory for the frame. The directory's path is the
+   one in the path buffer. */
+static bool enterDirectory(ScanContext *scan, const struct ScanEntry *directory)
+{
+    struct Frame *frame;
+    DirectoryReader *reader;
+    struct FileEntry *batch;
+    struct Usage tallied;
+    size_t batchSize;
+    size_t i;
+    bool isTallied;
+
+    if ((frame = pushFrame(scan)) == NULL) {
+        return false;
+    }
+    setProgressPath(directory->path);
+    countProgressEntry(0);
+    frame->pathLength = scan->pathLength;
+    frame->type = directory->type;
+    frame->isTopLevel = directory->isTopLevel;
+    frame->cookie = directory->cookie;
+    startFrameUsage(scan, frame, &directory->usage);
+    frame->firstEntry = scan->entryCount;
+    frame->nextEntry = scan->entryCount;
+    /* Files that select has to be asked about are visited one by one. */
+    isTallied = !scan->options.visitsFiles
+            && (scan->callbacks.select == NULL || scan->frameCount > scan->options.selectDepth);
+    claimPrefetchedDirectory(directory->path);
+    if ((reader = openDirectory(directory->path, &scan->listing)) == NULL) {
+        /* Counted as unknown, like a file that cannot be opened. */
+        frame->isLowerBound = true;
+    } else {
+        while (!isStopped(scan) && (batch = readDirectory(reader, &batchSize)) != NULL) {
+            if (isTallied) {
+                /* The frame does not move while a directory is read. */
+                initUsage(&tallied);
+                scan->fileTally(&tallied, batch, batchSize, scan->options.breakdowns, &scan->listing);
+                addFrameUsage(scan, frame, &tallied);
+            }
+            for (i = 0; i < batchSize; i++) {
+                if ((!isTallied || batch[i].type != FILETYPE_FILE)
+                        && !pushEntry(scan, &batch[i], batch[i].path + frame->pathLength)) {
+                    break;
+                }
+            }
+        }
+        if (!isDirectoryComplete(reader)) {
+            /* The listing was abandoned when the deadline passed. */
+            countUnscannedDirectory(scan->options.deadline);
+            frame->isLowerBound = true;
+        }
+        if (hasDirectoryFailed(reader)) {
+            frame->isLowerBound = true;
+        }
+        closeDirectory(reader);
+    }
+    if (scan->options.isPhysicalOrder) {
+        prefetchDirectories(directory->path, &scan->entries[frame->firstEntry], scan->entryCount - frame->firstEntry,
+                scan->options.deadline);
+    }
+    if (getPrefetchDepth() > 0) {
+        nameDirectoriesAhead(scan, frame);
+    }
+    return true;
+}
+
+/* Names the subdirectories to be read ahead, the first to be visited last
+   so that it is read first. The very first is left out, because the scan
+   goes into it straight away and would only race the reading ahead. */
+static void nameDirectoriesAhead(const ScanContext *scan, const struct Frame *frame)
+{
+    size_t first = scan->entryCount;
+    size_t end;
+    wchar_t *path;
+    unsigned long depth;
+    unsigned long count = 0;
+
+    depth = getPrefetchDepth();
+    for (end = frame->firstEntry; end < scan->entryCount && count <= depth; end++) {
+        if (scan->entries[end].type == FILETYPE_DIRECTORY) {
+            if (count == 0) {
+                first = end;
+            }
+            count++;
+        }
+    }
+    while (end > first + 1) {
+        end--;
+        /* The reader ahead keeps the path, so it gets a copy of its own. */
+        if (scan->entries[end].type == FILETYPE_DIRECTORY
+                && (path = joinText(scan->path, scan->entries[end].path)) != NULL) {
+            prefetchDirectory(path);
+        }
+    }
+}
+
+/* Called when every entry of the directory on top of the stack has been
+   visited. */
+static void leaveDirectory(ScanContext *scan)
+{
+    const struct Frame *frame;
+    struct ScanEntry done;
+
+    frame = &scan->frames[scan->frameCount - 1];
+    scan->path[frame->pathLength] = L'\0';
+    scan->pathLength = frame->pathLength;
+    done.path = scan->path;
+    done.type = frame->type;
+    done.isTopLevel = frame->isTopLevel;
+    done.isRead = true;
+    done.cookie = frame->cookie;
+    getFrameUsage(scan, frame, &done.usage);
+    scan->entryCount = frame->firstEntry;
+    scan->frameCount--;
+    finishEntry(scan, &done, scan->callbacks.directoryDone);
+}
+
+/* Reports an entry that is done and adds its usage to the directory it
+   is in, or makes it the total if it is the top. */
+static void finishEntry(ScanContext *scan, const struct ScanEntry *entry, EntryCallback callback)
+{
+    if (callback != NULL) {
+        callback(scan->callbacks.context, entry);
+    }
+    if (scan->frameCount > 0) {
+        addFrameUsage(scan, &scan->frames[scan->frameCount - 1], &entry->usage);
+    } else {
+        scan->total = entry->usage;
+    }
+}
+
+/* Once the scan is stopped, what was found in the directories still on
+   the stack goes into the total, which is then only a lower bound. */
+static void abandonDirectories(ScanContext *scan)
+{
+    struct Usage usage;
+
+    while (scan->frameCount > 0) {
+        getFrameUsage(scan, &scan->frames[--scan->frameCount], &usage);
+        usage.isLowerBound = true;
+        if (scan->frameCount > 0) {
+            addFrameUsage(scan, &scan->frames[scan->frameCount - 1], &usage);
+        } else {
+            scan->total = usage;
+        }
+    }
+}
+
+static bool isStopped(const ScanContext *scan)
+{
+    return scan->isCancelled || scan->isFailed;
+}
+
+/* Running out of memory for the stacks ends the scan, not the process. */
+static struct Frame *pushFrame(ScanContext *scan)
+{
+    struct Frame *frames;
+    int64_t *ageBytes;
+    size_t capacity;
+
+    if (scan->frameCount == scan->frameCapacity) {
+        capacity = scan->frameCapacity == 0 ? INITIAL_STACK_CAPACITY : scan->frameCapacity * 2;
+        if ((frames = (struct Frame *) GC_REALLOC(scan->frames, capacity * sizeof(struct Frame))) == NULL) {
+            writeLastError(ERROR_NOT_ENOUGH_MEMORY, L"Failed to allocate memory for", L"directory stack");
+            scan->isFailed = true;
+            return NULL;
+        }
+        scan->frames = frames;
+        if (scan->options.byAge) {
+            ageBytes = (int64_t *) GC_REALLOC(scan->frameAgeBytes, capacity * AGE_BUCKET_COUNT * sizeof(int64_t));
+            if (ageBytes == NULL) {
+                writeLastError(ERROR_NOT_ENOUGH_MEMORY, L"Failed to allocate memory for", L"directory stack");
+                scan->isFailed = true;
+                return NULL;
+            }
+            scan->frameAgeBytes = ageBytes;
+        }
+        scan->frameCapacity = capacity;
+    }
+    return &scan->frames[scan->frameCount++];
+}
+
+/* Only name, what follows the path of the directory, is kept, and it is
+   copied, because the entry is from a batch that will be reused. */
+static bool pushEntry(ScanContext *scan, const struct FileEntry *entry, const wchar_t *name)
+{
+    struct FileEntry *entries;
+    size_t capacity;
+    wchar_t *path;
+
+    if (scan->entryCount == scan->entryCapacity) {
+        capacity = scan->entryCapacity == 0 ? INITIAL_STACK_CAPACITY : scan->entryCapacity * 2;
+        if ((entries = (struct FileEntry *) GC_REALLOC(scan->entries, capacity * sizeof(struct FileEntry))) == NULL) {
+            writeLastError(ERROR_NOT_ENOUGH_MEMORY, L"Failed to allocate memory for the entry stack at", entry->path);
+            scan->isFailed = true;
+            return false;
+        }
+        scan->entries = entries;
+        scan->entryCapacity = capacity;
+    }
+    if ((path = (wchar_t *) GC_MALLOC_ATOMIC((wcslen(name) + 1) * sizeof(wchar_t))) == NULL) {
+        writeLastError(ERROR_NOT_ENOUGH_MEMORY, L"Failed to allocate memory for", entry->path);
+        scan->isFailed = true;
+        return false;
+    }
+    wcscpy(path, name);
+    scan->entries[scan->entryCount] = *entry;
+    scan->entries[scan->entryCount].path = path;
+    scan->entryCount++;
+    return true;
+}
+
+/* Puts name at length in the path buffer, which holds the path of the
+   directory it follows up to there. The last character of the buffer is
+   never written over, so that the progress reporter, which reads the
+   path from another thread, always finds its end. */
+static bool setPath(ScanContext *scan, size_t length, const wchar_t *name)
+{
+    wchar_t *path;
+    size_t nameLength;
+    size_t capacity;
+
+    nameLength = wcslen(name);
+    if (length + nameLength + 2 > scan->pathCapacity) {
+        capacity = scan->pathCapacity == 0 ? INITIAL_PATH_CAPACITY : scan->pathCapacity;
+        while (length + nameLength + 2 > capacity) {
+            capacity *= 2;
+        }
+        if ((path = (wchar_t *) GC_MALLOC_ATOMIC(capacity * sizeof(wchar_t))) == NULL) {
+            writeLastError(ERROR_NOT_ENOUGH_MEMORY, L"Failed to allocate memory for", name);
+            scan->isFailed = true;
+            return false;
+        }
+        /* The old buffer is left as it is for whoever still reads it. */
+        wmemset(path, L'\0', capacity);
+        if (length > 0) {
+            wmemcpy(path, scan->path, length);
+        }
+        scan->path = path;
+        scan->pathCapacity = capacity;
+    }
+    wmemcpy(scan->path + length, name, nameLength + 1);
+    scan->pathLength = length + nameLength;
+    return true;
+}
+
+static void startFrameUsage(ScanContext *scan, struct Frame *frame, const struct Usage *usage)
+{
+    frame->size = usage->size;
+    frame->newestTime = usage->newestTime;
+    frame->isLowerBound = usage->isLowerBound;
+    if (scan->options.byAge) {
+        memcpy(&scan->frameAgeBytes[(frame - scan->frames) * AGE_BUCKET_COUNT], usage->ageBytes, sizeof(usage->ageBytes));
+    }
+}
+
+/* Like addUsage, for what the frame has counted so far. */
+static void addFrameUsage(ScanContext *scan, struct Frame *frame, const struct Usage *usage)
+{
+    int64_t *ageBytes;
+    int i;
+
+    frame->size += usage->size;
+    frame->isLowerBound = frame->isLowerBound || usage->isLowerBound;
+    if (usage->newestTime > frame->newestTime) {
+        frame->newestTime = usage->newestTime;
+    }
+    if (scan->options.byAge) {
+        ageBytes = &scan->frameAgeBytes[(frame - scan->frames) * AGE_BUCKET_COUNT];
+        for (i = 0; i < AGE_BUCKET_COUNT; i++) {
+            ageBytes[i] += usage->ageBytes[i];
+        }
+    }
+}
+
+static void getFrameUsage(const ScanContext *scan, const struct Frame *frame, struct Usage *usage)
+{
+    initUsage(usage);
+    usage->size = frame->size;
+    usage->newestTime = frame->newestTime;
+    usage->isLowerBound = frame->isLowerBound;
+    if (scan->options.byAge) {
+        memcpy(usage->ageBytes, &scan->frameAgeBytes[(frame - scan->frames) * AGE_BUCKET_COUNT], sizeof(usage->ageBytes));
+    }
+}
+
+/* Decides whether a directory gets read, according to -L and -x. Reparse
+   points are only followed with -L, and then every directory is recorded
+   by its file ID so that one reached again through a link is skipped.
+   A directory listed with --order=physical already has its ID, which
+   for a link would be that of the link rather than of its target. */
+static bool shouldDescend(ScanContext *scan, const struct FileEntry *fileEntry, bool isTopLevel)
+{
+    const wchar_t *path = fileEntry->path;
+    enum FileType type = fileEntry->type;
+    struct FileId id;
+    bool descend;
+
+    if (type == FILETYPE_LINK && !isTopLevel && !scan->options.dereference) {
+        descend = false;
+    } else if (!scan->options.dereference) {
+        /* Without following links there is no way to reach a directory twice. */
+        descend = true;
+    } else if (type == FILETYPE_DIRECTORY && fileEntry->id.fileIndex != 0) {
+        id = fileEntry->id;
+        descend = markVisited(scan->options.visited, &id);
+    } else if (!getFileId(path, &id)) {
+        descend = true;
+    } else if (isTopLevel) {
+        scan->rootVolume = id.volumeSerialNumber;
+        descend = markVisited(scan->options.visited, &id);
+    } else if (scan->options.oneFileSystem && id.volumeSerialNumber != scan->rootVolume) {
+        descend = false;
+    } else if (!markVisited(scan->options.visited, &id)) {
+        if (type == FILETYPE_LINK) {
+            writeWarning(L"Not following link to a directory that was already counted", path);
+        }
+        descend = false;
+    } else {
+        descend = true;
+    }
+    return descend;
+}
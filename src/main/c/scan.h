@@ -0,0 +1,111 @@
+#ifndef SCAN_H_ZAQXSW
+#define SCAN_H_ZAQXSW
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <wchar.h>
+#include "filename.h"
+#include "usage.h"
+#include "tally.h"
+#include "visited.h"
+#include "error.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Scans a tree and reports what it finds through callbacks, for du and
+   for programs that want the totals without running du and reading its
+   output. Errors go to the error callback and the scan carries on past
+   them: an entry that cannot be read counts as nothing, and the totals
+   above it are marked as lower bounds. A failure it cannot get past, such
+   as running out of memory for its stacks, ends that scan alone. Scans
+   with different contexts may run at the same time on different threads.
+
+   Still set for the whole process, because they are shared with
+   --estimate and --serve, are the boundaries of the age buckets
+   (initAgeBuckets), the progress line and reading ahead (--prefetch).
+   Running out of memory for the tables of the breakdowns or for the
+   directories -L has visited still ends the process.
+
+   Memory comes from the Boehm collector. The program has to call GC_INIT
+   before the first scan, and be compiled with GC_THREADS, as the library
+   is, so that gc.h makes CreateThread tell the collector about the
+   threads scans run on. Nothing else has to be set up first. */
+typedef
+    struct ScanContext /* as */
+    ScanContext;
+
+enum ScanResult {
+    SCAN_COMPLETE,
+    SCAN_CANCELLED,
+    SCAN_FAILED
+};
+
+struct ScanOptions {
+    enum TallySize size;            /* Listed size (-b), allocated size, or a count (--inodes) */
+    bool byAge;                     /* Fill in the age buckets of each usage (--by-age) */
+    bool dereference;               /* -L */
+    bool oneFileSystem;             /* -x */
+    bool isPhysicalOrder;           /* --order=physical */
+    const PatternSet *excludes;     /* --exclude, NULL for none */
+    const PatternSet *includes;     /* --include, NULL for all files */
+    Deadline *deadline;             /* --deadline, NULL for none */
+    bool visitsFiles;               /* Report each file, not only directories */
+    VisitedSet *visited;            /* With -L, shared by scans that must not count a directory twice; NULL for a set of its own */
+    struct Breakdowns *breakdowns;  /* Tables every file is added to, NULL for none */
+    unsigned long checkpointSeconds; /* How often the checkpoint callback is called */
+    unsigned long selectDepth;      /* How deep the select callback is asked about entries */
+    const wchar_t *programName;     /* What errors are printed after without an error callback, NULL for "du" */
+};
+
+/* An entry that is done, with everything below it. */
+struct ScanEntry {
+    const wchar_t *path;
+    enum FileType type;
+    struct Usage usage;
+    bool isTopLevel;
+    bool isRead;                    /* False for a link or directory that was not gone into */
+    void *cookie;                   /* What startEntry returned for it */
+};
+
+typedef void *(*StartEntryCallback)(void *context, const struct FileEntry *entry, bool isTopLevel);
+typedef void (*EntryCallback)(void *context, const struct ScanEntry *entry);
+typedef void (*CheckpointCallback)(void *context, ScanContext *scan);
+typedef bool (*SelectCallback)(void *context, const struct FileEntry *entry, unsigned long depth);
+
+/* Each callback may be NULL. startEntry is called for every entry that
+   is reported, before anything below it, and may change the tables the
+   breakdowns point to. Without visitsFiles, files are only added to the
+   directory they are in. A NULL error callback leaves errors to be
+   reported the way du reports them. A context that is cancelled stays
+   cancelled, and every scan with it stops straight away. checkpoint is
+   called every checkpointSeconds at a point where saveScanState may be
+   called, so that the scan can later be resumed in another process with
+   loadScanState and resumeScan, given the same options. The directories
+   that -L has visited are not saved. select is asked about each entry
+   down to selectDepth below the top, files too, before startEntry, and
+   an entry it turns down is neither counted nor reported. The path of an
+   entry is only good until the callback it is given to returns. */
+struct ScanCallbacks {
+    StartEntryCallback startEntry;
+    EntryCallback entryDone;        /* Files, links, and directories that were not gone into */
+    EntryCallback directoryDone;    /* Directories gone into, or cut off by the deadline */
+    ErrorCallback error;
+    void *context;                  /* Passed to each callback */
+    CheckpointCallback checkpoint;
+    SelectCallback select;
+};
+
+extern ScanContext *initScanContext(const struct ScanOptions *options, const struct ScanCallbacks *callbacks);
+extern enum ScanResult scanTree(ScanContext *scan, const wchar_t *path, struct Usage *total);
+extern enum ScanResult resumeScan(ScanContext *scan, struct Usage *total);
+extern void cancelScan(ScanContext *scan);
+extern bool saveScanState(const ScanContext *scan, FILE *file);
+extern bool loadScanState(ScanContext *scan, FILE *file);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,378 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <windows.h>
+#include <gc.h>
+#include "serve.h"
+#include "index.h"
+#include "watch.h"
+#include "filename.h"
+#include "format.h"
+#include "string.h"
+#include "error.h"
+#include "args.h"
+#include "du.h"
+
+#define PIPE_PREFIX L"\\\\.\\pipe\\"
+#define PIPE_BUFFER_SIZE 65536
+/* A query is a kind, a count and a path of at most 32767 characters. */
+#define REQUEST_CAPACITY 33000
+#define RESPONSE_LINE_CAPACITY 64
+#define INITIAL_REPLY_CAPACITY 4096
+#define RESPONSE_OK L"OK"
+#define RESPONSE_ERROR L"ERROR"
+
+/* The protocol is UTF-16 text. The client sends one line,
+
+       KIND<TAB>COUNT<TAB>PATH<LF>
+
+   where KIND is total, children or top, and the server answers with a
+   line that is OK or ERROR followed by a message, then for each result a
+   line with the size in bytes, a tab and the path, and closes the pipe. */
+
+/* The answer to a query, put together while the index is locked and
+   sent once it is not, so that a client that does not read what it is
+   sent cannot hold up the watcher and the other clients. */
+struct Reply {
+    wchar_t *text;
+    size_t length;
+    size_t capacity;
+};
+
+static UsageIndex **indexes;
+static size_t indexCount;
+
+static wchar_t *getPipePath();
+static DWORD WINAPI serveClient(LPVOID parameter);
+static bool readRequest(HANDLE pipe, wchar_t *request, size_t capacity);
+static void answerRequest(HANDLE pipe, wchar_t *request);
+static void makeReply(struct Reply *reply, UsageIndex *index, const wchar_t *kind, unsigned long count,
+        const wchar_t *path);
+static UsageIndex *findIndex(const wchar_t *path);
+static void addResult(const wchar_t *path, int64_t size, void *context);
+static void addText(struct Reply *reply, const wchar_t *text);
+static void writeText(HANDLE pipe, const wchar_t *text);
+static bool sendQuery(const wchar_t *path);
+static void printResult(wchar_t *line);
+
+static wchar_t *getPipePath()
+{
+    return concat(PIPE_PREFIX, pipeName != NULL ? pipeName : DEFAULT_PIPE_NAME);
+}
+
+/* Reads every root into an index, starts watching each of them, and then
+   answers queries until the process is ended. */
+int serveUsage(List *roots)
+{
+    List *node;
+    HANDLE pipe;
+    HANDLE thread;
+    wchar_t *pipePath;
+    wchar_t *path;
+    size_t i;
+
+    indexCount = getListSize(roots);
+    if ((indexes = (UsageIndex **) GC_MALLOC(indexCount * sizeof(UsageIndex *))) == NULL) {
+        writeError(errno, L"Failed to allocate memory for", L"indexes");
+        exit(EXIT_FAILURE);
+    }
+    for (node = roots, i = 0; !isListEmpty(node); node = skipListItem(node), i++) {
+        if ((path = getAbsolutePath((const wchar_t *) getListItem(node))) == NULL) {
+            exit(EXIT_FAILURE);
+        }
+        indexes[i] = buildUsageIndex(path);
+        startWatching(indexes[i]);
+    }
+    pipePath = getPipePath();
+    fwprintf(stderr, L"%ls: serving %lu roots on %ls\n", programName, (unsigned long) indexCount, pipePath);
+    for (;;) {
+        pipe = CreateNamedPipe(pipePath, PIPE_ACCESS_DUPLEX,
+                    PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+                    PIPE_UNLIMITED_INSTANCES, PIPE_BUFFER_SIZE, PIPE_BUFFER_SIZE, 0, NULL);
+        if (pipe == INVALID_HANDLE_VALUE) {
+            writeLastError(GetLastError(), L"Failed to create named pipe", pipePath);
+            return EXIT_FAILURE;
+        }
+        if (!ConnectNamedPipe(pipe, NULL) && GetLastError() != ERROR_PIPE_CONNECTED) {
+            writeLastError(GetLastError(), L"Failed to accept a client on", pipePath);
+            CloseHandle(pipe);
+            continue;
+        }
+        /* A thread per client, so that a slow client does not hold up the others. */
+        if ((thread = CreateThread(NULL, 0, serveClient, pipe, 0, NULL)) == NULL) {
+            writeLastError(GetLastError(), L"Failed to start thread for a client on", pipePath);
+            CloseHandle(pipe);
+        } else {
+            CloseHandle(thread);
+        }
+    }
+}
+
+static DWORD WINAPI serveClient(LPVOID parameter)
+{
+    HANDLE pipe = (HANDLE) parameter;
+    wchar_t *request;
+
+    if ((request = (wchar_t *) GC_MALLOC_ATOMIC(REQUEST_CAPACITY * sizeof(wchar_t))) == NULL) {
+        writeError(errno, L"Failed to allocate memory for", L"request");
+        exit(EXIT_FAILURE);
+    }
+    if (readRequest(pipe, request, REQUEST_CAPACITY)) {
+        answerRequest(pipe, request);
+    }
+    FlushFileBuffers(pipe);
+    DisconnectNamedPipe(pipe);
+    CloseHandle(pipe);
+    return 0;
+}
+
+/* Reads up to the line feed, which is replaced by the terminator. The
+   client sends nothing more until it has its answer, so whatever has
+   arrived is taken at once, and only what is new is looked through. */
+static bool readRequest(HANDLE pipe, wchar_t *request, size_t capacity)
+{
+    DWORD bytesRead;
+    size_t byteCount = 0;
+    size_t byteCapacity;
+    size_t length;
+    size_t i = 0;
+
+    byteCapacity = (capacity - 1) * sizeof(wchar_t);
+    while (byteCount < byteCapacity) {
+        if (!ReadFile(pipe, (BYTE *) request + byteCount, (DWORD) (byteCapacity - byteCount), &bytesRead, NULL)
+                || bytesRead == 0) {
+            return false;
+        }
+        byteCount += bytesRead;
+        length = byteCount / sizeof(wchar_t);
+        for (; i < length; i++) {
+            if (request[i] == L'\n') {
+                request[i] = L'\0';
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static void answerRequest(HANDLE pipe, wchar_t *request)
+{
+    wchar_t *kind;
+    wchar_t *countText;
+    wchar_t *path;
+    wchar_t *end;
+    unsigned long count;
+    UsageIndex *index;
+    struct Reply reply;
+
+    kind = request;
+    if ((countText = wcschr(kind, L'\t')) == NULL || (path = wcschr(countText + 1, L'\t')) == NULL) {
+        writeText(pipe, RESPONSE_ERROR L" malformed request\n");
+        return;
+    }
+    *countText++ = L'\0';
+    *path++ = L'\0';
+    count = wcstoul(countText, &end, 10);
+    if ((index = findIndex(path)) == NULL) {
+        writeText(pipe, RESPONSE_ERROR L" not below any served root\n");
+        return;
+    }
+    reply.text = NULL;
+    reply.length = 0;
+    reply.capacity = 0;
+    lockUsageIndex(index);
+    makeReply(&reply, index, kind, count, path);
+    unlockUsageIndex(index);
+    writeText(pipe, reply.text);
+}
+
+/* Must be called with the index locked. */
+static void makeReply(struct Reply *reply, UsageIndex *index, const wchar_t *kind, unsigned long count,
+        const wchar_t *path)
+{
+    IndexNode node;
+
+    if ((node = findIndexNode(index, path)) == NO_INDEX_NODE) {
+        addText(reply, RESPONSE_ERROR L" no such file or directory in the index\n");
+    } else if (wcscmp(kind, L"total") == 0) {
+        addText(reply, RESPONSE_OK L"\n");
+        addResult(path, getIndexNodeSize(index, node), reply);
+    } else if (wcscmp(kind, L"children") == 0) {
+        addText(reply, RESPONSE_OK L"\n");
+        forEachIndexChild(index, node, addResult, reply);
+    } else if (wcscmp(kind, L"top") == 0) {
+        addText(reply, RESPONSE_OK L"\n");
+        forEachLargestDirectory(index, node, count, addResult, reply);
+    } else {
+        addText(reply, RESPONSE_ERROR L" unknown query\n");
+    }
+}
+
+/* The root with the longest match, in case one root is inside another. */
+static UsageIndex *findIndex(const wchar_t *path)
+{
+    UsageIndex *best = NULL;
+    size_t bestLength = 0;
+    size_t length;
+    size_t i;
+
+    for (i = 0; i < indexCount; i++) {
+        lockUsageIndex(indexes[i]);
+        if (findIndexNode(indexes[i], path) != NO_INDEX_NODE) {
+            length = wcslen(getUsageIndexRoot(indexes[i]));
+            if (best == NULL || length > bestLength) {
+                best = indexes[i];
+                bestLength = length;
+            }
+        }
+        unlockUsageIndex(indexes[i]);
+    }
+    return best;
+}
+
+static void addResult(const wchar_t *path, int64_t size, void *context)
+{
+    wchar_t sizeText[RESPONSE_LINE_CAPACITY];
+
+    _snwprintf(sizeText, RESPONSE_LINE_CAPACITY, L"%lld\t", (long long) size);
+    sizeText[RESPONSE_LINE_CAPACITY - 1] = L'\0';
+    addText((struct Reply *) context, sizeText);
+    addText((struct Reply *) context, path);
+    addText((struct Reply *) context, L"\n");
+}
+
+static void addText(struct Reply *reply, const wchar_t *text)
+{
+    size_t length;
+    size_t capacity;
+
+    length = wcslen(text);
+    if (reply->length + length + 1 > reply->capacity) {
+        capacity = reply->capacity == 0 ? INITIAL_REPLY_CAPACITY : reply->capacity;
+        while (reply->length + length + 1 > capacity) {
+            capacity *= 2;
+        }
+        if ((reply->text = (wchar_t *) GC_REALLOC(reply->text, capacity * sizeof(wchar_t))) == NULL) {
+            writeError(errno, L"Failed to allocate memory for", L"answer");
+            exit(EXIT_FAILURE);
+        }
+        reply->capacity = capacity;
+    }
+    wmemcpy(reply->text + reply->length, text, length + 1);
+    reply->length += length;
+}
+
+/* A client that went away is not an error worth reporting. */
+static void writeText(HANDLE pipe, const wchar_t *text)
+{
+    DWORD bytesWritten;
+
+    WriteFile(pipe, text, (DWORD) (wcslen(text) * sizeof(wchar_t)), &bytesWritten, NULL);
+}
+
+/* Client side. Sends the query in --query for each path and prints the
+   results like the normal output. */
+int queryUsage(List *paths)
+{
+    List *node;
+    wchar_t *path;
+    int exitCode = EXIT_SUCCESS;
+
+    if (isListEmpty(paths)) {
+        if ((path = getAbsolutePath(L".")) == NULL) {
+            return EXIT_FAILURE;
+        }
+        appendListItem(&paths, path);
+    }
+    for (node = paths; !isListEmpty(node); node = skipListItem(node)) {
+        path = getAbsolutePath((const wchar_t *) getListItem(node));
+        if (path == NULL || !sendQuery(path)) {
+            exitCode = EXIT_FAILURE;
+        }
+    }
+    return exitCode;
+}
+
+static bool sendQuery(const wchar_t *path)
+{
+    HANDLE pipe;
+    wchar_t *pipePath;
+    wchar_t *request;
+    wchar_t countText[RESPONSE_LINE_CAPACITY];
+    wchar_t *response;
+    wchar_t *line;
+    wchar_t *end;
+    size_t capacity = PIPE_BUFFER_SIZE;
+    size_t length = 0;
+    DWORD bytesRead;
+    bool succeeded;
+
+    pipePath = getPipePath();
+    pipe = CreateFile(pipePath, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+    if (pipe == INVALID_HANDLE_VALUE && GetLastError() == ERROR_PIPE_BUSY && WaitNamedPipe(pipePath, NMPWAIT_USE_DEFAULT_WAIT)) {
+        pipe = CreateFile(pipePath, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+    }
+    if (pipe == INVALID_HANDLE_VALUE) {
+        writeLastError(GetLastError(), L"Failed to connect to du --serve on", pipePath);
+        return false;
+    }
+    _snwprintf(countText, RESPONSE_LINE_CAPACITY, L"\t%lu\t", queryCount);
+    countText[RESPONSE_LINE_CAPACITY - 1] = L'\0';
+    request = concat4(queryKind, countText, path, L"\n");
+    writeText(pipe, request);
+
+    /* Read everything up to the end of the pipe. */
+    if ((response = (wchar_t *) GC_MALLOC_ATOMIC(capacity)) == NULL) {
+        writeError(errno, L"Failed to allocate memory for the answer for", path);
+        exit(EXIT_FAILURE);
+    }
+    while (ReadFile(pipe, (BYTE *) response + length, (DWORD) (capacity - length - sizeof(wchar_t)), &bytesRead, NULL)
+            && bytesRead > 0) {
+        length += bytesRead;
+        if (capacity - length < PIPE_BUFFER_SIZE / 2) {
+            capacity *= 2;
+            if ((response = (wchar_t *) GC_REALLOC(response, capacity)) == NULL) {
+                writeError(errno, L"Failed to allocate memory for the answer for", path);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    CloseHandle(pipe);
+    response[length / sizeof(wchar_t)] = L'\0';
+
+    line = response;
+    if ((end = wcschr(line, L'\n')) != NULL) {
+        *end = L'\0';
+    }
+    succeeded = wcscmp(line, RESPONSE_OK) == 0;
+    if (!succeeded) {
+        fwprintf(stderr, L"%ls: %ls: %ls\n", programName, path,
+                startsWith(line, RESPONSE_ERROR L" ") ? line + wcslen(RESPONSE_ERROR L" ") : L"no answer from server");
+    }
+    while (succeeded && end != NULL) {
+        line = end + 1;
+        if ((end = wcschr(line, L'\n')) != NULL) {
+            *end = L'\0';
+            printResult(line);
+        }
+    }
+    fflush(stdout);
+    return succeeded;
+}
+
+static void printResult(wchar_t *line)
+{
+    wchar_t sizeText[SIZE_TEXT_CAPACITY];
+    wchar_t *path;
+
+    if ((path = wcschr(line, L'\t')) == NULL) {
+        return;
+    }
+    *path++ = L'\0';
+    formatFileSize(_wcstoi64(line, NULL, 10), sizeText, SIZE_TEXT_CAPACITY);
+    if (humanReadable) {
+        wprintf(L"%ls\t%ls\n", sizeText, path);
+    } else {
+        wprintf(L"%-7ls %ls\n", sizeText, path);
+    }
+}
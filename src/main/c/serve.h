@@ -0,0 +1,12 @@
+#ifndef SERVE_H_YGVUHB
+#define SERVE_H_YGVUHB
+
+#include "list.h"
+
+#define DEFAULT_PIPE_NAME L"du"
+#define DEFAULT_TOP_COUNT 10
+
+extern int serveUsage(List *roots);
+extern int queryUsage(List *paths);
+
+#endif
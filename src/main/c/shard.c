@@ -0,0 +1,746 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <windows.h>
+#include <gc.h>
+#include "shard.h"
+#include "record.h"
+#include "args.h"
+#include "error.h"
+#include "string.h"
+#include "du.h"
+
+#define PARTIAL_MAGIC "du partial 1\n"
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+#define SETTING_COUNT 7            /* Before the age boundaries */
+
+/* A partial result file holds PARTIAL_MAGIC, the fingerprint, the shard
+   it is, the options that decide how the lines look, and then for each
+   argument the entries the shard reported, in the order it reported
+   them. Each path is kept as what follows the path of the shared
+   directory it is in. The number of errors comes last. */
+enum PartialRecord {
+    RECORD_ARGUMENT = 1,    /* Its path */
+    RECORD_ARGUMENT_DONE,   /* Its ScanResult */
+    RECORD_SHARED,          /* A directory every shard reads, or the argument */
+    RECORD_SHARED_DONE,     /* Its entry and its usage without its entries */
+    RECORD_ENTRY,           /* In a subtree of this shard */
+    RECORD_SUBTREE_DONE,    /* The entry that heads a subtree of this shard */
+    RECORD_ELSEWHERE,       /* The path of a subtree of another shard */
+    RECORD_END              /* The number of errors */
+};
+
+/* Which callback an entry went to. */
+enum EntryKind {
+    KIND_ENTRY,
+    KIND_DIRECTORY
+};
+
+/* A shared directory being scanned, and what has been added to it by the
+   entries in it that this shard reported. */
+struct SharedDirectory {
+    size_t pathLength;
+    struct Usage entries;
+};
+
+struct ShardMerge {
+    FILE **files;                   /* In shard order */
+    const wchar_t **paths;
+    unsigned long count;
+    uint64_t *kinds;                /* The record each file is at */
+    struct Usage *usages;           /* Of a shared directory in each file */
+    struct Usage *ownUsages;
+    int64_t *bodies;                /* Where the entries start in each file */
+    bool isChecked;                 /* The files have been read through once */
+    unsigned long failedCount;      /* Shards that had errors */
+};
+
+static const wchar_t *resultPath;
+static FILE *resultFile;
+static wchar_t *fingerprint;
+static unsigned long thisShard;    /* From 0 */
+static unsigned long shardTotal;
+static unsigned long sharedDepth;   /* --split-depth */
+static size_t argumentLength;
+static struct SharedDirectory *sharedDirectories = NULL;
+static size_t sharedCount;
+static size_t sharedCapacity = 0;
+static bool isInSubtree;
+static char sharedCookie;
+static char subtreeCookie;
+
+static wchar_t *makeFingerprint(int argc, const wchar_t *argv[]);
+static bool isShardOption(const wchar_t *argument);
+static void writeSettings(FILE *file);
+static bool readSettings(FILE *file);
+static uint64_t hashPath(const wchar_t *path);
+static bool isShared(const struct FileEntry *entry, bool isTopLevel, size_t depth);
+static bool selectShardEntry(void *context, const struct FileEntry *entry, unsigned long depth);
+static void *startShardEntry(void *context, const struct FileEntry *entry, bool isTopLevel);
+static void finishShardEntry(void *context, const struct ScanEntry *entry);
+static void finishShardDirectory(void *context, const struct ScanEntry *entry);
+static void recordEntry(const struct ScanEntry *entry, enum EntryKind kind);
+static void writeEntry(const struct ScanEntry *entry, enum EntryKind kind);
+static size_t getSharedPathLength();
+static void readHeader(ShardMerge *merge, const wchar_t *path, wchar_t **firstFingerprint);
+static void checkMerge(ShardMerge *merge);
+static uint64_t mergeEntries(ShardMerge *merge, const struct ScanCallbacks *callbacks, const wchar_t *sharedPath,
+        struct Usage *sum);
+static void mergeShared(ShardMerge *merge, const struct ScanCallbacks *callbacks, const wchar_t *path,
+        bool isTopLevel, struct Usage *usage);
+static void mergeSubtree(ShardMerge *merge, const struct ScanCallbacks *callbacks, const wchar_t *sharedPath,
+        struct Usage *usage);
+static void readEntry(ShardMerge *merge, unsigned long shard, const wchar_t *sharedPath,
+        struct ScanEntry *entry, enum EntryKind *kind);
+static void reportEntry(const struct ScanCallbacks *callbacks, const struct ScanEntry *entry, enum EntryKind kind);
+static void readKinds(ShardMerge *merge);
+static void checkSameKind(const ShardMerge *merge, const wchar_t *location);
+static uint64_t readNumber(ShardMerge *merge, unsigned long shard);
+static wchar_t *readText(ShardMerge *merge, unsigned long shard);
+static wchar_t *readSameText(ShardMerge *merge, unsigned long skipped, const wchar_t *location);
+static void partialDamaged(const wchar_t *path);
+static void partsDoNotFit(const wchar_t *location);
+
+/* index counts from 0. */
+void startShard(const wchar_t *path, unsigned long index, unsigned long count, unsigned long depth,
+        int argc, const wchar_t *argv[])
+{
+    resultPath = path;
+    thisShard = index;
+    shardTotal = count;
+    sharedDepth = depth;
+    fingerprint = makeFingerprint(argc, argv);
+    if ((resultFile = _wfopen(path, L"wb")) == NULL) {
+        writeError(errno, L"Failed to create", path);
+        exit(EXIT_FAILURE);
+    }
+    fwrite(PARTIAL_MAGIC, 1, strlen(PARTIAL_MAGIC), resultFile);
+    writeRecordText(resultFile, fingerprint);
+    writeRecordNumber(resultFile, thisShard);
+    writeRecordNumber(resultFile, shardTotal);
+    writeSettings(resultFile);
+}
+
+/* The shards of one scan differ only in --shard and --partial. */
+static wchar_t *makeFingerprint(int argc, const wchar_t *argv[])
+{
+    wchar_t *text = L"";
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (!isShardOption(argv[i])) {
+            text = concat3(text, L"\n", argv[i]);
+        } else if (wcschr(argv[i], L'=') == NULL) {
+            /* Its value is the next argument. */
+            i++;
+        }
+    }
+    return text;
+}
+
+static bool isShardOption(const wchar_t *argument)
+{
+    return startsWith(argument, L"--shard") || startsWith(argument, L"--partial");
+}
+
+static void writeSettings(FILE *file)
+{
+    size_t i;
+
+    writeRecordNumber(file, displayRegularFilesAlso);
+    writeRecordNumber(file, summarize);
+    writeRecordNumber(file, displayBytes);
+    writeRecordNumber(file, humanReadable);
+    writeRecordNumber(file, countInodes);
+    writeRecordNumber(file, showTime);
+    writeRecordNumber(file, ageBoundaryCount);
+    for (i = 0; i < ageBoundaryCount; i++) {
+        writeRecordNumber(file, ageBoundaries[i]);
+    }
+}
+
+static bool readSettings(FILE *file)
+{
+    uint64_t numbers[SETTING_COUNT];
+    uint64_t boundary;
+    size_t i;
+
+    for (i = 0; i < SETTING_COUNT; i++) {
+        if (!readRecordNumber(file, &numbers[i])) {
+            return false;
+        }
+    }
+    displayRegularFilesAlso = numbers[0] != 0;
+    summarize = numbers[1] != 0;
+    displayBytes = numbers[2] != 0;
+    humanReadable = numbers[3] != 0;
+    countInodes = numbers[4] != 0;
+    showTime = numbers[5] != 0;
+    if (numbers[6] > MAX_AGE_BOUNDARIES) {
+        return false;
+    }
+    ageBoundaryCount = (size_t) numbers[6];
+    for (i = 0; i < ageBoundaryCount; i++) {
+        if (!readRecordNumber(file, &boundary)) {
+            return false;
+        }
+        ageBoundaries[i] = (unsigned long) boundary;
+    }
+    return true;
+}
+
+/* Scans the argument with only the subtrees of this shard counted, and
+   writes what it reports to the partial result file. */
+void scanShard(const wchar_t *path, const struct ScanOptions *options)
+{
+    struct ScanOptions shardOptions;
+    struct ScanCallbacks callbacks;
+    ScanContext *scan;
+    struct Usage total;
+    enum ScanResult result;
+
+    shardOptions = *options;
+    shardOptions.selectDepth = sharedDepth;
+    callbacks.startEntry = startShardEntry;
+    callbacks.entryDone = finishShardEntry;
+    callbacks.directoryDone = finishShardDirectory;
+    callbacks.error = NULL;
+    callbacks.context = NULL;
+    callbacks.checkpoint = NULL;
+    callbacks.select = selectShardEntry;
+    if ((scan = initScanContext(&shardOptions, &callbacks)) == NULL) {
+        writeError(errno, L"Failed to allocate memory for scan of", path);
+        exit(EXIT_FAILURE);
+    }
+    argumentLength = wcslen(path);
+    sharedCount = 0;
+    isInSubtree = false;
+    writeRecordNumber(resultFile, RECORD_ARGUMENT);
+    writeRecordText(resultFile, path);
+    result = scanTree(scan, path, &total);
+    writeRecordNumber(resultFile, RECORD_ARGUMENT_DONE);
+    writeRecordNumber(resultFile, result);
+}
+
+/* Returns false, having reported why, if the partial result file is not
+   all on the disk, which --merge would refuse. */
+bool finishShard()
+{
+    bool isWritten;
+
+    writeRecordNumber(resultFile, RECORD_END);
+    writeRecordNumber(resultFile, getErrorCount());
+    isWritten = flushRecordFile(resultFile) && !ferror(resultFile);
+    if (fclose(resultFile) != 0) {
+        isWritten = false;
+    }
+    if (!isWritten) {
+        writeError(errno, L"Failed to write", resultPath);
+    }
+    return isWritten;
+}
+
+/* FNV-1a over each UTF-16 code unit, low byte first, so that every shard
+   and every compiler gets the same number. */
+static uint64_t hashPath(const wchar_t *path)
+{
+    uint64_t hash = FNV_OFFSET_BASIS;
+
+    for (; *path != L'\0'; path++) {
+        hash = (hash ^ (*path & 0xFF)) * FNV_PRIME;
+        hash = (hash ^ ((*path >> 8) & 0xFF)) * FNV_PRIME;
+    }
+    return hash;
+}
+
+/* The argument and the directories above the split depth are read by
+   every shard. */
+static bool isShared(const struct FileEntry *entry, bool isTopLevel, size_t depth)
+{
+    return isTopLevel || (entry->type == FILETYPE_DIRECTORY && depth < sharedDepth);
+}
+
+/* A subtree of another shard is skipped, and only its path is written, so
+   that the merge can tell the files are of the same tree. */
+static bool selectShardEntry(void *context, const struct FileEntry *entry, unsigned long depth)
+{
+    if (isShared(entry, false, depth) || hashPath(entry->path + argumentLength) % shardTotal == thisShard) {
+        return true;
+    }
+    writeRecordNumber(resultFile, RECORD_ELSEWHERE);
+    writeRecordText(resultFile, entry->path + getSharedPathLength());
+    return false;
+}
+
+/* Every entry below the split depth is in a subtree, and the cookie of
+   the entry that heads a subtree tells when it is done. */
+static void *startShardEntry(void *context, const struct FileEntry *entry, bool isTopLevel)
+{
+    struct SharedDirectory *shared;
+
+    if (isInSubtree) {
+        return NULL;
+    }
+    if (!isShared(entry, isTopLevel, sharedCount)) {
+        isInSubtree = true;
+        return &subtreeCookie;
+    }
+    if (sharedCount == sharedCapacity) {
+        sharedCapacity = sharedCapacity == 0 ? 8 : sharedCapacity * 2;
+        sharedDirectories = (struct SharedDirectory *) GC_REALLOC(sharedDirectories,
+                sharedCapacity * sizeof(struct SharedDirectory));
+        if (sharedDirectories == NULL) {
+            writeError(errno, L"Failed to allocate memory for", entry->path);
+            exit(EXIT_FAILURE);
+        }
+    }
+    writeRecordNumber(resultFile, RECORD_SHARED);
+    writeRecordText(resultFile, entry->path + getSharedPathLength());
+    shared = &sharedDirectories[sharedCount++];
+    shared->pathLength = wcslen(entry->path);
+    initUsage(&shared->entries);
+    return &sharedCookie;
+}
+
+static void finishShardEntry(void *context, const struct ScanEntry *entry)
+{
+    recordEntry(entry, KIND_ENTRY);
+}
+
+static void finishShardDirectory(void *context, const struct ScanEntry *entry)
+{
+    recordEntry(entry, KIND_DIRECTORY);
+}
+
+/* What a shared directory holds of its own, without its entries, is the
+   same in every shard, so the merge can add its merged entries to it. */
+static void recordEntry(const struct ScanEntry *entry, enum EntryKind kind)
+{
+    struct SharedDirectory *shared;
+    struct Usage own;
+    int i;
+
+    if (entry->cookie == &sharedCookie) {
+        shared = &sharedDirectories[--sharedCount];
+        own = entry->usage;
+        own.size -= shared->entries.size;
+        for (i = 0; i < AGE_BUCKET_COUNT; i++) {
+            own.ageBytes[i] -= shared->entries.ageBytes[i];
+        }
+        writeRecordNumber(resultFile, RECORD_SHARED_DONE);
+        writeRecordNumber(resultFile, kind);
+        writeRecordNumber(resultFile, entry->type);
+        writeRecordNumber(resultFile, entry->isRead);
+        writeRecordUsage(resultFile, &entry->usage);
+        writeRecordUsage(resultFile, &own);
+    } else if (entry->cookie == &subtreeCookie) {
+        writeRecordNumber(resultFile, RECORD_SUBTREE_DONE);
+        writeEntry(entry, kind);
+        isInSubtree = false;
+    } else {
+        writeRecordNumber(resultFile, RECORD_ENTRY);
+        writeEntry(entry, kind);
+        return;
+    }
+    if (sharedCount > 0) {
+        addUsage(&sharedDirectories[sharedCount - 1].entries, &entry->usage);
+    }
+}
+
+static void writeEntry(const struct ScanEntry *entry, enum EntryKind kind)
+{
+    writeRecordNumber(resultFile, kind);
+    writeRecordText(resultFile, entry->path + getSharedPathLength());
+    writeRecordNumber(resultFile, entry->type);
+    writeRecordNumber(resultFile, entry->isRead);
+    writeRecordUsage(resultFile, &entry->usage);
+}
+
+/* Of the shared directory the scan is in, 0 before the argument. */
+static size_t getSharedPathLength()
+{
+    return sharedCount > 0 ? sharedDirectories[sharedCount - 1].pathLength : 0;
+}
+
+/* Opens the partial result file of every shard, and makes sure that there
+   is one for each and that they are of the same scan. */
+ShardMerge *openShardMerge(List *paths)
+{
+    ShardMerge *merge;
+    wchar_t *firstFingerprint = NULL;
+    List *node;
+    unsigned long i;
+
+    if ((merge = (ShardMerge *) GC_MALLOC(sizeof(ShardMerge))) == NULL) {
+        writeError(errno, L"Failed to allocate memory for", L"merge");
+        exit(EXIT_FAILURE);
+    }
+    merge->count = (unsigned long) getListSize(paths);
+    merge->files = (FILE **) GC_MALLOC(merge->count * sizeof(FILE *));
+    merge->paths = (const wchar_t **) GC_MALLOC(merge->count * sizeof(const wchar_t *));
+    merge->kinds = (uint64_t *) GC_MALLOC_ATOMIC(merge->count * sizeof(uint64_t));
+    merge->usages = (struct Usage *) GC_MALLOC_ATOMIC(merge->count * sizeof(struct Usage));
+    merge->ownUsages = (struct Usage *) GC_MALLOC_ATOMIC(merge->count * sizeof(struct Usage));
+    merge->bodies = (int64_t *) GC_MALLOC_ATOMIC(merge->count * sizeof(int64_t));
+    if (merge->files == NULL || merge->paths == NULL || merge->kinds == NULL
+            || merge->usages == NULL || merge->ownUsages == NULL || merge->bodies == NULL) {
+        writeError(errno, L"Failed to allocate memory for", L"merge");
+        exit(EXIT_FAILURE);
+    }
+    merge->isChecked = false;
+    for (i = 0; i < merge->count; i++) {
+        merge->files[i] = NULL;
+    }
+    for (node = paths; !isListEmpty(node); node = skipListItem(node)) {
+        readHeader(merge, (const wchar_t *) getListItem(node), &firstFingerprint);
+    }
+    checkMerge(merge);
+    return merge;
+}
+
+/* Puts the file in the place of its shard. The first file decides how
+   the lines look. */
+static void readHeader(ShardMerge *merge, const wchar_t *path, wchar_t **firstFingerprint)
+{
+    FILE *file;
+    char magic[sizeof(PARTIAL_MAGIC) - 1];
+    wchar_t *savedFingerprint;
+    uint64_t index;
+    uint64_t count;
+
+    if ((file = _wfopen(path, L"rb")) == NULL) {
+        writeError(errno, L"Failed to open", path);
+        exit(EXIT_FAILURE);
+    }
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic)
+            || memcmp(magic, PARTIAL_MAGIC, sizeof(magic)) != 0
+            || (savedFingerprint = readRecordText(file)) == NULL
+            || !readRecordNumber(file, &index)
+            || !readRecordNumber(file, &count)
+            || index >= count
+            || !readSettings(file)) {
+        partialDamaged(path);
+    }
+    if (*firstFingerprint == NULL) {
+        *firstFingerprint = savedFingerprint;
+    } else if (wcscmp(savedFingerprint, *firstFingerprint) != 0) {
+        fwprintf(stderr, L"%ls: ERROR with arguments: %ls was written by a shard with other options or FILEs than the first partial result file\n",
+                programName, path);
+        exit(EXIT_FAILURE);
+    }
+    if (count != merge->count) {
+        fwprintf(stderr, L"%ls: ERROR with arguments: %ls is one of %llu shards, so --merge needs %llu partial result files\n",
+                programName, path, (unsigned long long) count, (unsigned long long) count);
+        exit(EXIT_FAILURE);
+    }
+    if (merge->files[index] != NULL) {
+        fwprintf(stderr, L"%ls: ERROR with arguments: %ls and %ls are both of shard %llu\n",
+                programName, merge->paths[index], path, (unsigned long long) index + 1);
+        exit(EXIT_FAILURE);
+    }
+    if ((merge->bodies[index] = _ftelli64(file)) < 0) {
+        writeError(errno, L"Failed to read", path);
+        exit(EXIT_FAILURE);
+    }
+    merge->files[index] = file;
+    merge->paths[index] = path;
+}
+
+/* Reads the files through once before anything is printed, so that files
+   that do not fit together print nothing. */
+static void checkMerge(ShardMerge *merge)
+{
+    struct ScanCallbacks callbacks;
+    const wchar_t *path;
+    struct Usage total;
+    enum ScanResult result;
+    unsigned long i;
+
+    callbacks.entryDone = NULL;
+    callbacks.directoryDone = NULL;
+    callbacks.context = NULL;
+    while (mergeNextArgument(merge, &callbacks, &path, &total, &result)) {
+        /* Only checking */
+    }
+    for (i = 0; i < merge->count; i++) {
+        if (_fseeki64(merge->files[i], merge->bodies[i], SEEK_SET) != 0) {
+            writeError(errno, L"Failed to read", merge->paths[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    merge->isChecked = true;
+}
+
+/* Reads the next argument from every file, and reports its entries to the
+   callbacks in the order a single scan would have. Returns false once
+   there are no more. */
+bool mergeNextArgument(ShardMerge *merge, const struct ScanCallbacks *callbacks,
+        const wchar_t **path, struct Usage *total, enum ScanResult *result)
+{
+    uint64_t shardResult;
+    unsigned long i;
+
+    readKinds(merge);
+    checkSameKind(merge, L"");
+    if (merge->kinds[0] == RECORD_END) {
+        merge->failedCount = 0;
+        for (i = 0; i < merge->count; i++) {
+            if (readNumber(merge, i) > 0) {
+                merge->failedCount++;
+            }
+            if (merge->isChecked) {
+                fclose(merge->files[i]);
+            }
+        }
+        return false;
+    }
+    if (merge->kinds[0] != RECORD_ARGUMENT) {
+        partialDamaged(merge->paths[0]);
+    }
+    *path = readSameText(merge, merge->count, L"");
+    /* The argument is the only entry at the top. */
+    initUsage(total);
+    if (mergeEntries(merge, callbacks, NULL, total) != RECORD_ARGUMENT_DONE) {
+        partsDoNotFit(*path);
+    }
+    /* The worst of them, as the whole scan would have been. */
+    *result = SCAN_COMPLETE;
+    for (i = 0; i < merge->count; i++) {
+        shardResult = readNumber(merge, i);
+        if (shardResult > *result) {
+            *result = (enum ScanResult) shardResult;
+        }
+    }
+    return true;
+}
+
+/* Merges the entries of a shared directory, or the argument itself when
+   sharedPath is NULL, up to the record that ends them in every file,
+   which is returned. What they hold is added to sum. */
+static uint64_t mergeEntries(ShardMerge *merge, const struct ScanCallbacks *callbacks, const wchar_t *sharedPath,
+        struct Usage *sum)
+{
+    wchar_t *suffix;
+    struct Usage usage;
+
+    for (;;) {
+        readKinds(merge);
+        switch (merge->kinds[0]) {
+        case RECORD_SHARED:
+            checkSameKind(merge, sharedPath);
+            suffix = readSameText(merge, merge->count, sharedPath);
+            mergeShared(merge, callbacks, sharedPath == NULL ? suffix : concat(sharedPath, suffix),
+                    sharedPath == NULL, &usage);
+            break;
+        case RECORD_SHARED_DONE:
+        case RECORD_ARGUMENT_DONE:
+            checkSameKind(merge, sharedPath);
+            return merge->kinds[0];
+        default:
+            if (sharedPath == NULL) {
+                partialDamaged(merge->paths[0]);
+            }
+            mergeSubtree(merge, callbacks, sharedPath, &usage);
+            break;
+        }
+        addUsage(sum, &usage);
+    }
+}
+
+/* A shared directory holds what it holds of its own, which every shard
+   counted, and its entries, each of which is merged. Its newest time and
+   whether it is a lower bound are found from its usage in every shard. */
+static void mergeShared(ShardMerge *merge, const struct ScanCallbacks *callbacks, const wchar_t *path,
+        bool isTopLevel, struct Usage *usage)
+{
+    struct ScanEntry entry;
+    struct Usage entries;
+    enum EntryKind kind;
+    unsigned long i;
+    int j;
+
+    initUsage(&entries);
+    if (mergeEntries(merge, callbacks, path, &entries) != RECORD_SHARED_DONE) {
+        partsDoNotFit(path);
+    }
+    kind = (enum EntryKind) readNumber(merge, 0);
+    entry.type = (enum FileType) readNumber(merge, 0);
+    entry.isRead = readNumber(merge, 0) != 0;
+    for (i = 0; i < merge->count; i++) {
+        if (i > 0 && (readNumber(merge, i) != kind || readNumber(merge, i) != entry.type
+                || (readNumber(merge, i) != 0) != entry.isRead)) {
+            partsDoNotFit(path);
+        }
+        if (!readRecordUsage(merge->files[i], &merge->usages[i])
+                || !readRecordUsage(merge->files[i], &merge->ownUsages[i])) {
+            partialDamaged(merge->paths[i]);
+        }
+    }
+    entry.path = path;
+    entry.usage = merge->usages[0];
+    entry.usage.size = merge->ownUsages[0].size + entries.size;
+    for (j = 0; j < AGE_BUCKET_COUNT; j++) {
+        entry.usage.ageBytes[j] = merge->ownUsages[0].ageBytes[j] + entries.ageBytes[j];
+    }
+    for (i = 1; i < merge->count; i++) {
+        if (merge->usages[i].newestTime > entry.usage.newestTime) {
+            entry.usage.newestTime = merge->usages[i].newestTime;
+        }
+        entry.usage.isLowerBound |= merge->usages[i].isLowerBound;
+    }
+    entry.isTopLevel = isTopLevel;
+    entry.cookie = NULL;
+    reportEntry(callbacks, &entry, kind);
+    *usage = entry.usage;
+}
+
+/* Every shard but one has skipped the subtree, and the one that scanned it
+   has its entries in order, ending with the one that heads it. */
+static void mergeSubtree(ShardMerge *merge, const struct ScanCallbacks *callbacks, const wchar_t *sharedPath,
+        struct Usage *usage)
+{
+    struct ScanEntry entry;
+    enum EntryKind kind;
+    wchar_t *elsewherePath;
+    unsigned long owner = merge->count;
+    unsigned long i;
+
+    for (i = 0; i < merge->count; i++) {
+        if (merge->kinds[i] == RECORD_ENTRY || merge->kinds[i] == RECORD_SUBTREE_DONE) {
+            if (owner < merge->count) {
+                partsDoNotFit(sharedPath);
+            }
+            owner = i;
+        } else if (merge->kinds[i] != RECORD_ELSEWHERE) {
+            partsDoNotFit(sharedPath);
+        }
+    }
+    if (owner == merge->count) {
+        partsDoNotFit(sharedPath);
+    }
+    elsewherePath = readSameText(merge, owner, sharedPath);
+    while (merge->kinds[owner] == RECORD_ENTRY) {
+        readEntry(merge, owner, sharedPath, &entry, &kind);
+        reportEntry(callbacks, &entry, kind);
+        merge->kinds[owner] = readNumber(merge, owner);
+    }
+    if (merge->kinds[owner] != RECORD_SUBTREE_DONE) {
+        partialDamaged(merge->paths[owner]);
+    }
+    readEntry(merge, owner, sharedPath, &entry, &kind);
+    if (elsewherePath != NULL && wcscmp(concat(sharedPath, elsewherePath), entry.path) != 0) {
+        partsDoNotFit(entry.path);
+    }
+    reportEntry(callbacks, &entry, kind);
+    *usage = entry.usage;
+}
+
+static void readEntry(ShardMerge *merge, unsigned long shard, const wchar_t *sharedPath,
+        struct ScanEntry *entry, enum EntryKind *kind)
+{
+    *kind = (enum EntryKind) readNumber(merge, shard);
+    entry->path = concat(sharedPath, readText(merge, shard));
+    entry->type = (enum FileType) readNumber(merge, shard);
+    entry->isRead = readNumber(merge, shard) != 0;
+    if (!readRecordUsage(merge->files[shard], &entry->usage)) {
+        partialDamaged(merge->paths[shard]);
+    }
+    entry->isTopLevel = false;
+    entry->cookie = NULL;
+}
+
+static void reportEntry(const struct ScanCallbacks *callbacks, const struct ScanEntry *entry, enum EntryKind kind)
+{
+    EntryCallback callback;
+
+    callback = kind == KIND_DIRECTORY ? callbacks->directoryDone : callbacks->entryDone;
+    if (callback != NULL) {
+        callback(callbacks->context, entry);
+    }
+}
+
+unsigned long getFailedShardCount(const ShardMerge *merge)
+{
+    return merge->failedCount;
+}
+
+/* Reads the kind of the next record of every file. */
+static void readKinds(ShardMerge *merge)
+{
+    unsigned long i;
+
+    for (i = 0; i < merge->count; i++) {
+        merge->kinds[i] = readNumber(merge, i);
+    }
+}
+
+static void checkSameKind(const ShardMerge *merge, const wchar_t *location)
+{
+    unsigned long i;
+
+    for (i = 1; i < merge->count; i++) {
+        if (merge->kinds[i] != merge->kinds[0]) {
+            partsDoNotFit(location);
+        }
+    }
+}
+
+static uint64_t readNumber(ShardMerge *merge, unsigned long shard)
+{
+    uint64_t number;
+
+    if (!readRecordNumber(merge->files[shard], &number)) {
+        partialDamaged(merge->paths[shard]);
+    }
+    return number;
+}
+
+static wchar_t *readText(ShardMerge *merge, unsigned long shard)
+{
+    wchar_t *text;
+
+    if ((text = readRecordText(merge->files[shard])) == NULL) {
+        partialDamaged(merge->paths[shard]);
+    }
+    return text;
+}
+
+/* Reads a path from every file but the skipped one, which has to be the
+   same in each of them. Returns NULL if there is no other file. */
+static wchar_t *readSameText(ShardMerge *merge, unsigned long skipped, const wchar_t *location)
+{
+    wchar_t *first = NULL;
+    wchar_t *text;
+    unsigned long i;
+
+    for (i = 0; i < merge->count; i++) {
+        if (i == skipped) {
+            continue;
+        }
+        text = readText(merge, i);
+        if (first == NULL) {
+            first = text;
+        } else if (wcscmp(text, first) != 0) {
+            partsDoNotFit(location);
+        }
+    }
+    return first;
+}
+
+static void partialDamaged(const wchar_t *path)
+{
+    writeLastError(ERROR_INVALID_DATA, L"Partial result file is damaged or was written by another version of du", path);
+    exit(EXIT_FAILURE);
+}
+
+/* The shards found different entries in a directory they all read, or
+   found an entry in a place where another one was. */
+static void partsDoNotFit(const wchar_t *location)
+{
+    writeLastError(ERROR_INVALID_DATA, L"Partial result files do not fit together, the tree changed between the shards at",
+            location);
+    exit(EXIT_FAILURE);
+}
@@ -0,0 +1,36 @@
+#ifndef SHARD_H_WSXCDE
+#define SHARD_H_WSXCDE
+
+#include <stdbool.h>
+#include <wchar.h>
+#include "list.h"
+#include "scan.h"
+
+#define DEFAULT_SPLIT_DEPTH 1
+
+/* --shard=I/N scans the part of each argument that falls to shard I of N,
+   so that a tree can be scanned by N processes, on one machine or many,
+   and the results put together with --merge. Every shard reads the
+   directories above --split-depth, and each entry at that depth or above
+   them, with everything below it, falls to a single shard by a hash of
+   its path below the argument, which comes out the same wherever the
+   shard runs. Nothing is printed: a shard writes what it finds to a
+   partial result file, and the shards are to be run with the same options
+   and FILEs. --merge reads all N files and prints what a single run would
+   have printed, with the options it was given, which openShardMerge
+   takes from the files. */
+extern void startShard(const wchar_t *path, unsigned long index, unsigned long count, unsigned long depth,
+        int argc, const wchar_t *argv[]);
+extern void scanShard(const wchar_t *path, const struct ScanOptions *options);
+extern bool finishShard();
+
+typedef
+    struct ShardMerge /* as */
+    ShardMerge;
+
+extern ShardMerge *openShardMerge(List *paths);
+extern bool mergeNextArgument(ShardMerge *merge, const struct ScanCallbacks *callbacks,
+        const wchar_t **path, struct Usage *total, enum ScanResult *result);
+extern unsigned long getFailedShardCount(const ShardMerge *merge);
+
+#endif
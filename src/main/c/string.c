@@ -6,11 +6,6 @@
 #include "string.h"
 #include "error.h"
 
-bool isGlob(const wchar_t *s)
-{
-    return wcschr(s, L'*') != NULL || wcschr(s, L'?') != NULL;
-}
-
 wchar_t *concat(const wchar_t *left, const wchar_t *right)
 {
     size_t capacity;
@@ -27,6 +22,21 @@ wchar_t *concat(const wchar_t *left, const wchar_t *right)
     return result;
 }
 
+/* Like concat, but returns NULL rather than ending the process when there
+   is not enough memory. */
+wchar_t *joinText(const wchar_t *left, const wchar_t *right)
+{
+    wchar_t *text;
+    size_t leftLength;
+
+    leftLength = wcslen(left);
+    if ((text = (wchar_t *) GC_MALLOC_ATOMIC((leftLength + wcslen(right) + 1) * sizeof(wchar_t))) != NULL) {
+        wcscpy(text, left);
+        wcscpy(text + leftLength, right);
+    }
+    return text;
+}
+
 wchar_t *concat3(const wchar_t *first,
                  const wchar_t *second,
                  const wchar_t *third)
@@ -102,6 +112,24 @@ char *convertToUtf8(const wchar_t *wstr)
     return utf8;
 }
 
+wchar_t *convertFromUtf8(const char *str)
+{
+    int reqSize; /* in characters */
+    wchar_t *wstr;
+
+    /* Will include string terminator because of -1 argument. */
+    reqSize = MultiByteToWideChar(CP_UTF8, 0, str, -1, NULL, 0);
+    wstr = (wchar_t *) GC_MALLOC(reqSize * sizeof(wchar_t));
+    if (wstr) {
+        /* Includes string terminator because of -1 argument. */
+        MultiByteToWideChar(CP_UTF8, 0, str, -1, wstr, reqSize);
+    } else {
+        _wperror(L"Failed alloc memory for wide string");
+        exit(EXIT_FAILURE);
+    }
+    return wstr;
+}
+
 char **convertAllToUtf8(int argc, const TCHAR *argv[])
 {
     char **utf8StringArray;
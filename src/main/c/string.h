@@ -6,10 +6,12 @@
 #include <wchar.h>
 
 extern wchar_t *concat(const wchar_t *s, const wchar_t *t);
+extern wchar_t *joinText(const wchar_t *left, const wchar_t *right);
 extern wchar_t *concat3(const wchar_t *s, const wchar_t *t,const wchar_t *u);
 extern wchar_t *concat4(const wchar_t *s, const wchar_t *t, const wchar_t *u, const wchar_t *v);
 extern wchar_t *replaceAll(wchar_t *in, wchar_t from, wchar_t to);
 extern char *convertToUtf8(const wchar_t *s);
+extern wchar_t *convertFromUtf8(const char *s);
 extern char **convertAllToUtf8(int count, const wchar_t *strs[]);
 extern bool startsWith(const wchar_t *s, const wchar_t *prefix);
 extern bool endsWith(const wchar_t *s, const wchar_t *suffix);
@@ -0,0 +1,174 @@
+#include "tally.h"
+#include "age.h"
+#include "deadline.h"
+#include "progress.h"
+
+static void tallyListedSizes(struct Usage *usage, const struct FileEntry *entries, size_t count,
+        const struct Breakdowns *breakdowns, const struct ListingOptions *listing);
+static void tallyAllocatedSizes(struct Usage *usage, const struct FileEntry *entries, size_t count,
+        const struct Breakdowns *breakdowns, const struct ListingOptions *listing);
+static void tallyListedSizesWithBreakdowns(struct Usage *usage, const struct FileEntry *entries, size_t count,
+        const struct Breakdowns *breakdowns, const struct ListingOptions *listing);
+static void tallyAllocatedSizesWithBreakdowns(struct Usage *usage, const struct FileEntry *entries, size_t count,
+        const struct Breakdowns *breakdowns, const struct ListingOptions *listing);
+static void tallyListedSizesByAge(struct Usage *usage, const struct FileEntry *entries, size_t count,
+        const struct Breakdowns *breakdowns, const struct ListingOptions *listing);
+static void tallyAllocatedSizesByAge(struct Usage *usage, const struct FileEntry *entries, size_t count,
+        const struct Breakdowns *breakdowns, const struct ListingOptions *listing);
+static void tallyCounts(struct Usage *usage, const struct FileEntry *entries, size_t count,
+        const struct Breakdowns *breakdowns, const struct ListingOptions *listing);
+static void addToBreakdowns(struct Usage *usage, const struct FileEntry *entry, int64_t size,
+        const struct Breakdowns *breakdowns, bool byAge);
+
+/* Counts have no breakdowns, since --inodes cannot be combined with them.
+   The versions by age take the tables too. */
+FileTally getFileTally(enum TallySize size, bool hasBreakdowns, bool byAge)
+{
+    switch (size) {
+    case TALLY_LISTED_SIZE:
+        if (byAge) {
+            return tallyListedSizesByAge;
+        }
+        return hasBreakdowns ? tallyListedSizesWithBreakdowns : tallyListedSizes;
+    case TALLY_ALLOCATED_SIZE:
+        if (byAge) {
+            return tallyAllocatedSizesByAge;
+        }
+        return hasBreakdowns ? tallyAllocatedSizesWithBreakdowns : tallyAllocatedSizes;
+    default:
+        return tallyCounts;
+    }
+}
+
+/* The allocated size needs the file to be opened, unless that was done
+   already; the listed size is there already. A count is one for each
+   entry. A file that could not be opened counts as empty, its error
+   having been reported. */
+int64_t getEntrySize(const struct FileEntry *entry, enum TallySize size, bool dereference)
+{
+    int64_t bytes;
+
+    if (size == TALLY_COUNT_ONLY) {
+        return 1;
+    }
+    bytes = size == TALLY_LISTED_SIZE ? entry->size : getAllocatedEntrySize(entry, dereference);
+    return bytes == UNKNOWN_SIZE ? 0 : bytes;
+}
+
+/* The versions that add sizes are all this one with constant flags,
+   which the compiler folds away. Sizes from the listing cost nothing to
+   get, so the deadline is checked once for the batch; an allocated size
+   may mean opening the file, so then it is checked for each one. */
+static inline void tallyFiles(struct Usage *usage, const struct FileEntry *entries, size_t count,
+        const struct Breakdowns *breakdowns, const struct ListingOptions *listing,
+        bool isSizeListed, bool hasBreakdowns, bool byAge)
+{
+    int64_t fileCount = 0;
+    int64_t bytes = 0;
+    int64_t size;
+    bool isPast;
+    size_t i;
+
+    isPast = isSizeListed && isPastDeadline(listing->deadline);
+    for (i = 0; i < count; i++) {
+        if (entries[i].type != FILETYPE_FILE) {
+            continue;
+        }
+        fileCount++;
+        if (entries[i].lastWriteTime > usage->newestTime) {
+            usage->newestTime = entries[i].lastWriteTime;
+        }
+        if (isSizeListed ? isPast : isPastDeadline(listing->deadline)) {
+            usage->isLowerBound = true;
+            continue;
+        }
+        size = isSizeListed ? entries[i].size : getAllocatedEntrySize(&entries[i], listing->dereference);
+        if (!isSizeListed && size == UNKNOWN_SIZE) {
+            /* Reported already. What is above it is no more than a lower bound. */
+            usage->isLowerBound = true;
+            continue;
+        }
+        bytes += size;
+        if (hasBreakdowns) {
+            addToBreakdowns(usage, &entries[i], size, breakdowns, byAge);
+        }
+    }
+    usage->size += bytes;
+    countProgressEntries(fileCount, bytes);
+}
+
+static void tallyListedSizes(struct Usage *usage, const struct FileEntry *entries, size_t count,
+        const struct Breakdowns *breakdowns, const struct ListingOptions *listing)
+{
+    tallyFiles(usage, entries, count, breakdowns, listing, true, false, false);
+}
+
+static void tallyAllocatedSizes(struct Usage *usage, const struct FileEntry *entries, size_t count,
+        const struct Breakdowns *breakdowns, const struct ListingOptions *listing)
+{
+    tallyFiles(usage, entries, count, breakdowns, listing, false, false, false);
+}
+
+static void tallyListedSizesWithBreakdowns(struct Usage *usage, const struct FileEntry *entries, size_t count,
+        const struct Breakdowns *breakdowns, const struct ListingOptions *listing)
+{
+    tallyFiles(usage, entries, count, breakdowns, listing, true, true, false);
+}
+
+static void tallyAllocatedSizesWithBreakdowns(struct Usage *usage, const struct FileEntry *entries, size_t count,
+        const struct Breakdowns *breakdowns, const struct ListingOptions *listing)
+{
+    tallyFiles(usage, entries, count, breakdowns, listing, false, true, false);
+}
+
+static void tallyListedSizesByAge(struct Usage *usage, const struct FileEntry *entries, size_t count,
+        const struct Breakdowns *breakdowns, const struct ListingOptions *listing)
+{
+    tallyFiles(usage, entries, count, breakdowns, listing, true, true, true);
+}
+
+static void tallyAllocatedSizesByAge(struct Usage *usage, const struct FileEntry *entries, size_t count,
+        const struct Breakdowns *breakdowns, const struct ListingOptions *listing)
+{
+    tallyFiles(usage, entries, count, breakdowns, listing, false, true, true);
+}
+
+/* For --inodes. Counting asks nothing of the file system beyond the
+   listing, so unlike the sizes the counts are not cut short by the
+   deadline; only the directories that are not read are. */
+static void tallyCounts(struct Usage *usage, const struct FileEntry *entries, size_t count,
+        const struct Breakdowns *breakdowns, const struct ListingOptions *listing)
+{
+    int64_t fileCount = 0;
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        if (entries[i].type == FILETYPE_FILE) {
+            fileCount++;
+            if (entries[i].lastWriteTime > usage->newestTime) {
+                usage->newestTime = entries[i].lastWriteTime;
+            }
+        }
+    }
+    usage->size += fileCount;
+    countProgressEntries(fileCount, 0);
+}
+
+/* Only reached with --by-age, --histogram, --by-extension or --by-owner,
+   where the work per file is well beyond a test or two. */
+static void addToBreakdowns(struct Usage *usage, const struct FileEntry *entry, int64_t size,
+        const struct Breakdowns *breakdowns, bool byAge)
+{
+    if (byAge) {
+        usage->ageBytes[getAgeBucket(entry->lastWriteTime)] += size;
+    }
+    if (breakdowns->histogram != NULL) {
+        addToHistogram(breakdowns->histogram, size);
+    }
+    if (breakdowns->extensions != NULL) {
+        addToExtensionTable(breakdowns->extensions, entry->path, size);
+    }
+    if (breakdowns->owners != NULL) {
+        addToOwnerTable(breakdowns->owners, getFileOwner(entry->path), size);
+    }
+}
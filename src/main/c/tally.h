@@ -0,0 +1,41 @@
+#ifndef TALLY_H_WSXCDE
+#define TALLY_H_WSXCDE
+
+#include <stdbool.h>
+#include <stddef.h>     /* size_t */
+#include "filename.h"
+#include "usage.h"
+#include "histogram.h"
+#include "extension.h"
+#include "owner.h"
+
+/* The tables a file is counted in besides its directory's total. Each is
+   NULL unless its option was given. */
+struct Breakdowns {
+    struct Histogram *histogram;
+    ExtensionTable *extensions;
+    OwnerTable *owners;
+};
+
+/* Where the size of a file comes from. With --inodes it is not needed. */
+enum TallySize {
+    TALLY_LISTED_SIZE,
+    TALLY_ALLOCATED_SIZE,
+    TALLY_COUNT_ONLY
+};
+
+/* Adds the plain files in a batch of directory entries to usage, and
+   passes over the rest. This is the loop most of a scan is spent in, when
+   files are not printed one by one, so there is a version of it for each
+   combination of the options it depends on. getFileTally picks one
+   when a scan starts; the loop itself tests none of them. With byAge the
+   age buckets of usage are filled in too, by the boundaries that
+   initAgeBuckets set. The listing options say whether a link to a file
+   is followed for its allocated size and when the deadline is. */
+typedef void (*FileTally)(struct Usage *usage, const struct FileEntry *entries, size_t count,
+        const struct Breakdowns *breakdowns, const struct ListingOptions *listing);
+
+extern FileTally getFileTally(enum TallySize size, bool hasBreakdowns, bool byAge);
+extern int64_t getEntrySize(const struct FileEntry *entry, enum TallySize size, bool dereference);
+
+#endif
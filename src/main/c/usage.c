@@ -0,0 +1,27 @@
+#include "usage.h"
+
+void initUsage(struct Usage *usage)
+{
+    int i;
+
+    usage->size = 0;
+    usage->isLowerBound = false;
+    for (i = 0; i < AGE_BUCKET_COUNT; i++) {
+        usage->ageBytes[i] = 0;
+    }
+    usage->newestTime = 0;
+}
+
+void addUsage(struct Usage *total, const struct Usage *part)
+{
+    int i;
+
+    total->size += part->size;
+    total->isLowerBound = total->isLowerBound || part->isLowerBound;
+    for (i = 0; i < AGE_BUCKET_COUNT; i++) {
+        total->ageBytes[i] += part->ageBytes[i];
+    }
+    if (part->newestTime > total->newestTime) {
+        total->newestTime = part->newestTime;
+    }
+}
@@ -0,0 +1,19 @@
+#ifndef USAGE_H_POIUYT
+#define USAGE_H_POIUYT
+
+#include <stdbool.h>
+#include <stdint.h>     /* int64_t */
+#include "age.h"
+
+/* What is known about the space used by a file or a directory tree. */
+struct Usage {
+    int64_t size;
+    bool isLowerBound;      /* Part of the tree was not scanned */
+    int64_t ageBytes[AGE_BUCKET_COUNT];     /* Only filled in with --by-age */
+    uint64_t newestTime;    /* Latest last write time in the tree */
+};
+
+extern void initUsage(struct Usage *usage);
+extern void addUsage(struct Usage *total, const struct Usage *part);
+
+#endif
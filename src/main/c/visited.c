@@ -0,0 +1,112 @@
+#include <stdlib.h>
+#include <string.h>     /* memset */
+#include <errno.h>
+#include <windows.h>
+#include <gc.h>
+#include "visited.h"
+#include "error.h"
+
+/* Must be a power of 2 so that the hash can be masked. */
+#define INITIAL_VISITED_CAPACITY 1024
+
+struct VisitedSet {
+    struct FileId *ids;
+    bool *used;
+    size_t capacity;
+    size_t count;
+    CRITICAL_SECTION lock;
+};
+
+static size_t hashFileId(const struct FileId *id);
+static void insertFileId(VisitedSet *set, const struct FileId *id);
+static void growVisitedSet(VisitedSet *set);
+
+VisitedSet *initVisitedSet()
+{
+    VisitedSet *set;
+
+    if ((set = (VisitedSet *) GC_MALLOC(sizeof(VisitedSet))) == NULL) {
+        writeError(errno, L"Failed to allocate memory for", L"visited directory set");
+        exit(EXIT_FAILURE);
+    }
+    set->ids = NULL;
+    set->used = NULL;
+    set->capacity = 0;
+    set->count = 0;
+    InitializeCriticalSection(&set->lock);
+    growVisitedSet(set);
+    return set;
+}
+
+static size_t hashFileId(const struct FileId *id)
+{
+    uint64_t hash;
+
+    hash = (id->fileIndex ^ ((uint64_t) id->volumeSerialNumber << 32)) * 0x9E3779B97F4A7C15ULL;
+    return (size_t) (hash >> 32);
+}
+
+/* Must be called with the lock held and with room in the table. */
+static void insertFileId(VisitedSet *set, const struct FileId *id)
+{
+    size_t i;
+
+    i = hashFileId(id) & (set->capacity - 1);
+    while (set->used[i]) {
+        i = (i + 1) & (set->capacity - 1);
+    }
+    set->ids[i] = *id;
+    set->used[i] = true;
+    set->count++;
+}
+
+static void growVisitedSet(VisitedSet *set)
+{
+    struct FileId *oldIds;
+    bool *oldUsed;
+    size_t oldCapacity;
+    size_t i;
+
+    oldIds = set->ids;
+    oldUsed = set->used;
+    oldCapacity = set->capacity;
+    set->capacity = oldCapacity == 0 ? INITIAL_VISITED_CAPACITY : oldCapacity * 2;
+    set->ids = (struct FileId *) GC_MALLOC_ATOMIC(set->capacity * sizeof(struct FileId));
+    set->used = (bool *) GC_MALLOC_ATOMIC(set->capacity * sizeof(bool));
+    if (set->ids == NULL || set->used == NULL) {
+        writeError(errno, L"Failed to allocate memory for", L"visited directory set");
+        exit(EXIT_FAILURE);
+    }
+    memset(set->used, 0, set->capacity * sizeof(bool));
+    set->count = 0;
+    for (i = 0; i < oldCapacity; i++) {
+        if (oldUsed[i]) {
+            insertFileId(set, &oldIds[i]);
+        }
+    }
+}
+
+/* Returns true if the directory had not been visited before. */
+bool markVisited(VisitedSet *set, const struct FileId *id)
+{
+    size_t i;
+    bool isNew = true;
+
+    EnterCriticalSection(&set->lock);
+    i = hashFileId(id) & (set->capacity - 1);
+    while (isNew && set->used[i]) {
+        if (set->ids[i].fileIndex == id->fileIndex && set->ids[i].volumeSerialNumber == id->volumeSerialNumber) {
+            isNew = false;
+        }
+        i = (i + 1) & (set->capacity - 1);
+    }
+    if (isNew) {
+        /* Keep the table at most half full so that probe sequences stay short. */
+        if ((set->count + 1) * 2 > set->capacity) {
+            growVisitedSet(set);
+        }
+        insertFileId(set, id);
+    }
+    LeaveCriticalSection(&set->lock);
+    return isNew;
+}
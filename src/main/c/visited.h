@@ -0,0 +1,17 @@
+#ifndef VISITED_H_WSXEDC
+#define VISITED_H_WSXEDC
+
+#include <stdbool.h>
+#include "filename.h"
+
+/* The set of directories already counted, identified by volume and file
+   index so that a directory reached through a junction or symbolic link is
+   recognized as the same directory. Safe to use from several threads. */
+typedef
+    struct VisitedSet /* as */
+    VisitedSet;
+
+extern VisitedSet *initVisitedSet();
+extern bool markVisited(VisitedSet *set, const struct FileId *id);
+
+#endif
@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <windows.h>
+#include <gc.h>
+#include "watch.h"
+#include "filename.h"
+#include "string.h"
+#include "error.h"
+
+/* ReadDirectoryChangesW cannot return more than 64 KB over the network. */
+#define CHANGE_BUFFER_SIZE 65536
+#define WATCHED_CHANGES (FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME \
+                         | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE)
+
+struct Watch {
+    UsageIndex *index;
+    HANDLE directory;
+};
+
+static DWORD WINAPI watchChanges(LPVOID parameter);
+static void applyChanges(struct Watch *watch, const BYTE *buffer);
+
+/* Keeps the index current from change notifications on a thread of its
+   own. Returns false if the root cannot be watched, in which case the
+   index is only correct as of when it was built. */
+bool startWatching(UsageIndex *index)
+{
+    struct Watch *watch;
+    HANDLE thread;
+
+    if ((watch = (struct Watch *) GC_MALLOC(sizeof(struct Watch))) == NULL) {
+        writeError(errno, L"Failed to allocate memory for watching", getUsageIndexRoot(index));
+        exit(EXIT_FAILURE);
+    }
+    watch->index = index;
+    /* FILE_FLAG_BACKUP_SEMANTICS is required to open a directory. */
+    watch->directory = CreateFile(getUsageIndexRoot(index), FILE_LIST_DIRECTORY,
+                            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                            NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+    if (watch->directory == INVALID_HANDLE_VALUE) {
+        writeLastError(GetLastError(), L"Failed to open directory to watch", getUsageIndexRoot(index));
+        return false;
+    }
+    if ((thread = CreateThread(NULL, 0, watchChanges, watch, 0, NULL)) == NULL) {
+        writeLastError(GetLastError(), L"Failed to start thread to watch", getUsageIndexRoot(index));
+        CloseHandle(watch->directory);
+        return false;
+    }
+    CloseHandle(thread);
+    return true;
+}
+
+static DWORD WINAPI watchChanges(LPVOID parameter)
+{
+    struct Watch *watch = (struct Watch *) parameter;
+    BYTE *buffer;
+    DWORD length;
+
+    /* DWORD aligned, as ReadDirectoryChangesW requires. */
+    if ((buffer = (BYTE *) GC_MALLOC_ATOMIC(CHANGE_BUFFER_SIZE)) == NULL) {
+        writeError(errno, L"Failed to allocate memory for watching", getUsageIndexRoot(watch->index));
+        exit(EXIT_FAILURE);
+    }
+    while (ReadDirectoryChangesW(watch->directory, buffer, CHANGE_BUFFER_SIZE, TRUE,
+                                 WATCHED_CHANGES, &length, NULL, NULL)) {
+        if (length == 0) {
+            /* More changes happened than fit in the buffer, so which ones is unknown. */
+            writeWarning(L"Too many changes at once, reading the whole tree again", getUsageIndexRoot(watch->index));
+            rebuildUsageIndex(watch->index);
+        } else {
+            applyChanges(watch, buffer);
+        }
+    }
+    writeLastError(GetLastError(), L"Stopped watching for changes, totals will no longer be updated for",
+            getUsageIndexRoot(watch->index));
+    CloseHandle(watch->directory);
+    return 0;
+}
+
+/* Every kind of change is handled by looking at what is at the path now,
+   so an added, removed, renamed or modified entry all come to the same. */
+static void applyChanges(struct Watch *watch, const BYTE *buffer)
+{
+    const FILE_NOTIFY_INFORMATION *change;
+    wchar_t *relativePath;
+    size_t nameLength;
+
+    change = (const FILE_NOTIFY_INFORMATION *) buffer;
+    for (;;) {
+        nameLength = change->FileNameLength / sizeof(wchar_t);
+        if ((relativePath = (wchar_t *) GC_MALLOC_ATOMIC((nameLength + 1) * sizeof(wchar_t))) == NULL) {
+            writeError(errno, L"Failed to allocate memory for change in", getUsageIndexRoot(watch->index));
+            exit(EXIT_FAILURE);
+        }
+        wmemcpy(relativePath, change->FileName, nameLength);
+        relativePath[nameLength] = L'\0';
+        updateUsageIndex(watch->index, buildPath(getUsageIndexRoot(watch->index), relativePath));
+        if (change->NextEntryOffset == 0) {
+            break;
+        }
+        change = (const FILE_NOTIFY_INFORMATION *) ((const BYTE *) change + change->NextEntryOffset);
+    }
+}
@@ -0,0 +1,9 @@
+#ifndef WATCH_H_RFVTGB
+#define WATCH_H_RFVTGB
+
+#include <stdbool.h>
+#include "index.h"
+
+extern bool startWatching(UsageIndex *index);
+
+#endif
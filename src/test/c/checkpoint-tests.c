@@ -0,0 +1,391 @@
+/*
+ * Stops a scan at each point where it could be checkpointed in turn, saves
+ * its state, and resumes it from the saved state with another context. What
+ * the stopped scan reported and what the resumed one reported together
+ * have to be what a scan that was never stopped reports, with the same
+ * total.
+ *
+ * Then stops du.exe with --checkpoint part way through a run of many
+ * arguments, and checks that --resume prints what a run that was not
+ * stopped prints, and exits with the same code, and that it is refused
+ * with other arguments.
+ *
+ * Uses the scan library in this process, and runs du.exe from the debug
+ * build for the rest.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <wchar.h>
+#include <windows.h>
+#include "munit.h"
+#include "test-helpers.h"
+#include "../../main/c/scan.h"
+#include "../../main/c/filename.h"
+#include "../../main/c/string.h"
+
+#define LINE_CAPACITY 1024
+#define ARGUMENT_COUNT 40
+#define FILES_PER_ARGUMENT 50
+#define PIPE_CAPACITY 4096
+/* Longer than the checkpoint interval of one second. */
+#define STOP_DELAY_MILLISECONDS 1500
+
+/* What a scan reports, one line per entry, and where it is to be stopped. */
+struct Report {
+    wchar_t *lines;
+    unsigned long checkpointCount;
+    unsigned long stopAt;           /* 0 to run to the end */
+    FILE *state;                    /* Where it is saved when it is stopped */
+    bool isStopped;
+};
+
+static void *setup(const MunitParameter params[], void *user_data)
+{
+    return createTestTree(L"du-checkpoint.");
+}
+
+/* A directory for each argument of a run, each with files of one byte. */
+static void *setupArguments(const MunitParameter params[], void *user_data)
+{
+    wchar_t *top;
+    wchar_t *directory;
+    int i;
+    int j;
+
+    top = makeTestTreeName(L"du-resume.");
+    if (!CreateDirectory(top, NULL)) {
+        fail(L"Failed to create directory", top);
+    }
+    for (i = 0; i < ARGUMENT_COUNT; i++) {
+        directory = buildNumberedPath(top, L"d", i);
+        if (!CreateDirectory(directory, NULL)) {
+            fail(L"Failed to create directory", directory);
+        }
+        for (j = 0; j < FILES_PER_ARGUMENT; j++) {
+            createFile(buildNumberedPath(directory, L"f", j), 1);
+        }
+    }
+    return top;
+}
+
+static wchar_t *getCheckpointPath(const wchar_t *top)
+{
+    return concat(top, L".checkpoint");
+}
+
+static void tearDownArguments(void *fixture)
+{
+    const wchar_t *top = (const wchar_t *) fixture;
+    wchar_t *checkpointPath = getCheckpointPath(top);
+    wchar_t *directory;
+    int i;
+    int j;
+
+    for (i = 0; i < ARGUMENT_COUNT; i++) {
+        directory = buildNumberedPath(top, L"d", i);
+        for (j = 0; j < FILES_PER_ARGUMENT; j++) {
+            DeleteFile(buildNumberedPath(directory, L"f", j));
+        }
+        RemoveDirectory(directory);
+    }
+    RemoveDirectory(top);
+    DeleteFile(checkpointPath);
+    DeleteFile(concat(checkpointPath, L".out"));
+    DeleteFile(concat(checkpointPath, L".tmp"));
+}
+
+/* Every directory of the tree, after one that does not exist, so that
+   there is an error to be counted in the exit code. */
+static wchar_t *buildArguments(const wchar_t *options, const wchar_t *top)
+{
+    wchar_t *arguments;
+    int i;
+
+    arguments = concat4(options, L" \"", buildPath(top, L"missing"), L"\"");
+    for (i = 0; i < ARGUMENT_COUNT; i++) {
+        arguments = concat4(arguments, L" \"", buildNumberedPath(top, L"d", i), L"\"");
+    }
+    return arguments;
+}
+
+static wchar_t *buildCheckpointArguments(const wchar_t *option, const wchar_t *checkpointPath,
+        const wchar_t *arguments)
+{
+    return concat4(L"--checkpoint-interval=1 \"", option, checkpointPath, concat(L"\" ", arguments));
+}
+
+static bool exists(const wchar_t *path)
+{
+    return GetFileAttributes(path) != INVALID_FILE_ATTRIBUTES;
+}
+
+static uint64_t getSize(const wchar_t *path)
+{
+    WIN32_FILE_ATTRIBUTE_DATA data;
+
+    if (!GetFileAttributesEx(path, GetFileExInfoStandard, &data)) {
+        fail(L"Failed to get the size of", path);
+    }
+    return ((uint64_t) data.nFileSizeHigh << 32) | data.nFileSizeLow;
+}
+
+/* Runs du with its output going to a pipe that is not read, so that it
+   waits when the pipe is full. Once a checkpoint is due, a little of the
+   output is read, which lets du finish the argument it was printing and
+   save a checkpoint after it, before the pipe is full again. Then du is
+   killed, as a reboot would stop it. */
+static void stopDu(const wchar_t *arguments)
+{
+    SECURITY_ATTRIBUTES security;
+    STARTUPINFO startup;
+    PROCESS_INFORMATION process;
+    HANDLE readEnd;
+    HANDLE writeEnd;
+    wchar_t *command;
+    char buffer[PIPE_CAPACITY];
+    DWORD count;
+
+    security.nLength = sizeof(security);
+    security.lpSecurityDescriptor = NULL;
+    security.bInheritHandle = TRUE;
+    if (!CreatePipe(&readEnd, &writeEnd, &security, PIPE_CAPACITY)
+            || !SetHandleInformation(readEnd, HANDLE_FLAG_INHERIT, 0)) {
+        fail(L"Failed to create a pipe for", DU_PROGRAM);
+    }
+    memset(&startup, 0, sizeof(startup));
+    startup.cb = sizeof(startup);
+    startup.dwFlags = STARTF_USESTDHANDLES;
+    startup.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+    startup.hStdOutput = writeEnd;
+    startup.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+    command = concat(L"\"" DU_PROGRAM L"\" ", arguments);
+    if (!CreateProcess(NULL, command, NULL, NULL, TRUE, 0, NULL, NULL, &startup, &process)) {
+        fail(L"Failed to run", command);
+    }
+    CloseHandle(writeEnd);
+    Sleep(STOP_DELAY_MILLISECONDS);
+    if (!ReadFile(readEnd, buffer, sizeof(buffer), &count, NULL)) {
+        fail(L"Failed to read the output of", command);
+    }
+    Sleep(STOP_DELAY_MILLISECONDS);
+    /* The tree prints far more than the pipe holds, so du cannot be done. */
+    munit_assert_int(WaitForSingleObject(process.hProcess, 0), ==, WAIT_TIMEOUT);
+    TerminateProcess(process.hProcess, EXIT_FAILURE);
+    WaitForSingleObject(process.hProcess, INFINITE);
+    CloseHandle(process.hProcess);
+    CloseHandle(process.hThread);
+    CloseHandle(readEnd);
+}
+
+/* Stands for output printed after the last checkpoint, which is in
+   FILE.out when a run is stopped. It is longer than all that the run
+   prints, so that none of it can be written over. */
+static void appendOutput(const wchar_t *path, size_t length)
+{
+    FILE *file;
+    size_t i;
+
+    if ((file = _wfopen(path, L"ab")) == NULL) {
+        fail(L"Failed to open", path);
+    }
+    for (i = 0; i < length; i++) {
+        fputwc(L'x', file);
+    }
+    fclose(file);
+}
+
+static void reportEntry(void *context, const struct ScanEntry *entry)
+{
+    struct Report *report = (struct Report *) context;
+    wchar_t line[LINE_CAPACITY];
+
+    _snwprintf(line, LINE_CAPACITY, L"%lld %ls\n", (long long) entry->usage.size, entry->path);
+    report->lines = concat(report->lines, line);
+}
+
+/* Saves the state and stops the scan when it gets to stopAt. */
+static void stopAtCheckpoint(void *context, ScanContext *scan)
+{
+    struct Report *report = (struct Report *) context;
+
+    if (++report->checkpointCount == report->stopAt) {
+        munit_assert_true(saveScanState(scan, report->state));
+        report->isStopped = true;
+        cancelScan(scan);
+    }
+}
+
+static ScanContext *initReportingScan(struct Report *report)
+{
+    struct ScanOptions options;
+    struct ScanCallbacks callbacks;
+    ScanContext *scan;
+
+    options.size = TALLY_LISTED_SIZE;
+    options.byAge = false;
+    options.dereference = false;
+    options.oneFileSystem = false;
+    options.isPhysicalOrder = false;
+    options.excludes = NULL;
+    options.includes = NULL;
+    options.deadline = NULL;
+    options.visitsFiles = true;
+    options.visited = NULL;
+    options.breakdowns = NULL;
+    /* A checkpoint between every two entries. */
+    options.checkpointSeconds = 0;
+    options.selectDepth = 0;
+    options.programName = NULL;
+    callbacks.startEntry = NULL;
+    callbacks.entryDone = reportEntry;
+    callbacks.directoryDone = reportEntry;
+    callbacks.error = NULL;
+    callbacks.context = report;
+    callbacks.checkpoint = stopAtCheckpoint;
+    callbacks.select = NULL;
+    scan = initScanContext(&options, &callbacks);
+    munit_assert_not_null(scan);
+    return scan;
+}
+
+static void initReport(struct Report *report, unsigned long stopAt, FILE *state)
+{
+    report->lines = L"";
+    report->checkpointCount = 0;
+    report->stopAt = stopAt;
+    report->state = state;
+    report->isStopped = false;
+}
+
+static MunitResult testResumeAtEveryCheckpoint(const MunitParameter params[], void *fixture)
+{
+    const wchar_t *top = (const wchar_t *) fixture;
+    struct Report whole;
+    struct Report stopped;
+    struct Report resumed;
+    struct Usage wholeTotal;
+    struct Usage total;
+    ScanContext *scan;
+    FILE *state;
+    unsigned long stopAt;
+
+    initReport(&whole, 0, NULL);
+    munit_assert_int(scanTree(initReportingScan(&whole), top, &wholeTotal), ==, SCAN_COMPLETE);
+    munit_assert_ulong(whole.checkpointCount, >, 1);
+    for (stopAt = 1; stopAt <= whole.checkpointCount; stopAt++) {
+        if ((state = tmpfile()) == NULL) {
+            fail(L"Failed to create a file for the state of", top);
+        }
+        initReport(&stopped, stopAt, state);
+        munit_assert_int(scanTree(initReportingScan(&stopped), top, &total), ==, SCAN_CANCELLED);
+        munit_assert_true(stopped.isStopped);
+        rewind(state);
+        initReport(&resumed, 0, NULL);
+        scan = initReportingScan(&resumed);
+        munit_assert_true(loadScanState(scan, state));
+        fclose(state);
+        munit_assert_int(resumeScan(scan, &total), ==, SCAN_COMPLETE);
+        munit_assert_string_equal(convertToUtf8(concat(stopped.lines, resumed.lines)), convertToUtf8(whole.lines));
+        munit_assert_llong(total.size, ==, wholeTotal.size);
+        munit_assert_false(total.isLowerBound);
+    }
+    return MUNIT_OK;
+}
+
+/* A state that is cut short is not resumed. */
+static MunitResult testDamagedState(const MunitParameter params[], void *fixture)
+{
+    const wchar_t *top = (const wchar_t *) fixture;
+    struct Report stopped;
+    struct Report resumed;
+    struct Usage total;
+    ScanContext *scan;
+    FILE *state;
+    FILE *shortState;
+    long length;
+    long i;
+
+    if ((state = tmpfile()) == NULL || (shortState = tmpfile()) == NULL) {
+        fail(L"Failed to create a file for the state of", top);
+    }
+    initReport(&stopped, 4, state);
+    munit_assert_int(scanTree(initReportingScan(&stopped), top, &total), ==, SCAN_CANCELLED);
+    length = ftell(state);
+    rewind(state);
+    for (i = 0; i < length - 1; i++) {
+        putc(getc(state), shortState);
+    }
+    fclose(state);
+    rewind(shortState);
+    initReport(&resumed, 0, NULL);
+    scan = initReportingScan(&resumed);
+    munit_assert_false(loadScanState(scan, shortState));
+    fclose(shortState);
+    return MUNIT_OK;
+}
+
+/* The run is stopped twice, and the second time it was resumed. */
+static MunitResult testResumeStoppedRun(const MunitParameter params[], void *fixture)
+{
+    const wchar_t *top = (const wchar_t *) fixture;
+    wchar_t *checkpointPath = getCheckpointPath(top);
+    wchar_t *outputPath = concat(checkpointPath, L".out");
+    wchar_t *arguments = buildArguments(L"-a", top);
+    wchar_t *whole;
+    wchar_t *resumed;
+    int exitCode;
+
+    exitCode = runDu(arguments, &whole);
+    munit_assert_int(exitCode, ==, EXIT_FAILURE);
+    stopDu(buildCheckpointArguments(L"--checkpoint=", checkpointPath, arguments));
+    munit_assert_true(exists(checkpointPath));
+    appendOutput(outputPath, wcslen(whole) + 1);
+    stopDu(buildCheckpointArguments(L"--resume=", checkpointPath, arguments));
+    /* What came after the checkpoint was cut off FILE.out. */
+    munit_assert_uint64(getSize(outputPath), <=, wcslen(whole) * sizeof(wchar_t));
+    munit_assert_int(runDu(buildCheckpointArguments(L"--resume=", checkpointPath, arguments), &resumed), ==, exitCode);
+    munit_assert_string_equal(convertToUtf8(resumed), convertToUtf8(whole));
+    munit_assert_false(exists(checkpointPath));
+    munit_assert_false(exists(outputPath));
+    return MUNIT_OK;
+}
+
+/* A run with other options would print something else, so it cannot
+   carry on with the output of this one. */
+static MunitResult testResumeWithOtherArguments(const MunitParameter params[], void *fixture)
+{
+    const wchar_t *top = (const wchar_t *) fixture;
+    wchar_t *checkpointPath = getCheckpointPath(top);
+    wchar_t *resumed;
+
+    stopDu(buildCheckpointArguments(L"--checkpoint=", checkpointPath, buildArguments(L"-a", top)));
+    munit_assert_int(runDu(buildCheckpointArguments(L"--resume=", checkpointPath, buildArguments(L"-a -b", top)), &resumed),
+            ==, EXIT_FAILURE);
+    munit_assert_string_equal(convertToUtf8(resumed), "");
+    munit_assert_true(exists(checkpointPath));
+    return MUNIT_OK;
+}
+
+static MunitTest tests[] = {
+    { "/resumeAtEveryCheckpoint", testResumeAtEveryCheckpoint, setup, removeTestTree, MUNIT_TEST_OPTION_NONE, NULL },
+    { "/damagedState", testDamagedState, setup, removeTestTree, MUNIT_TEST_OPTION_NONE, NULL },
+    { "/resumeStoppedRun", testResumeStoppedRun, setupArguments, tearDownArguments, MUNIT_TEST_OPTION_NONE, NULL },
+    { "/resumeWithOtherArguments", testResumeWithOtherArguments, setupArguments, tearDownArguments, MUNIT_TEST_OPTION_NONE, NULL },
+    { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
+
+static const MunitSuite suite = {
+    "/checkpoint",              /* name */
+    tests,                      /* tests */
+    NULL,                       /* suites */
+    1,                          /* iterations */
+    MUNIT_SUITE_OPTION_NONE     /* options */
+};
+
+int wmain(int argc, const wchar_t *argv[])
+{
+    return runTestSuite(&suite, argc, argv);
+}
@@ -0,0 +1,124 @@
+/*
+ * Scans a tree 10,000 directories deep, which is far deeper than a
+ * recursive walk could go on the default 1 MB stack. Every directory
+ * holds one file of one byte, so the total with -b is the depth.
+ *
+ * Runs du.exe from the debug build for the scan, and builds the usage
+ * index in this process.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <wchar.h>
+#include <windows.h>
+#include "munit.h"
+#include "test-helpers.h"
+#include "../../main/c/filename.h"
+#include "../../main/c/index.h"
+#include "../../main/c/args.h"
+#include "../../main/c/string.h"
+
+#define TREE_DEPTH 10000
+#define PATH_CAPACITY 32768     /* The longest path Windows allows */
+
+/* Returns the extended length path of the top of the tree. */
+static void *setup(const MunitParameter params[], void *user_data)
+{
+    wchar_t *top;
+    wchar_t *path;
+    size_t length;
+    int level;
+
+    top = concat(EXTENDED_LENGTH_PATH_PREFIX, makeTestTreeName(L"du-deep-tree."));
+    if ((path = (wchar_t *) malloc(PATH_CAPACITY * sizeof(wchar_t))) == NULL) {
+        fail(L"Failed to allocate memory for", top);
+    }
+    wcscpy(path, top);
+    for (level = 0; level < TREE_DEPTH; level++) {
+        if (level > 0) {
+            wcscat(path, L"\\d");
+        }
+        if (!CreateDirectory(path, NULL)) {
+            fail(L"Failed to create directory", path);
+        }
+        length = wcslen(path);
+        wcscat(path, L"\\f");
+        createFile(path, 1);
+        path[length] = L'\0';
+    }
+    free(path);
+    return top;
+}
+
+/* Removes the tree from the bottom up. */
+static void tearDown(void *fixture)
+{
+    const wchar_t *top = (const wchar_t *) fixture;
+    wchar_t *path;
+    wchar_t *lastSeparator;
+    size_t length;
+    size_t topLength;
+    int level;
+
+    topLength = wcslen(top);
+    if ((path = (wchar_t *) malloc(PATH_CAPACITY * sizeof(wchar_t))) == NULL) {
+        fail(L"Failed to allocate memory for", top);
+    }
+    wcscpy(path, top);
+    for (level = 1; level < TREE_DEPTH; level++) {
+        wcscat(path, L"\\d");
+    }
+    for (;;) {
+        length = wcslen(path);
+        wcscat(path, L"\\f");
+        DeleteFile(path);
+        path[length] = L'\0';
+        RemoveDirectory(path);
+        if (length == topLength) {
+            break;
+        }
+        lastSeparator = wcsrchr(path, L'\\');
+        *lastSeparator = L'\0';
+    }
+    free(path);
+}
+
+static MunitResult testScanDeepTree(const MunitParameter params[], void *fixture)
+{
+    const wchar_t *top = (const wchar_t *) fixture;
+    wchar_t *output;
+
+    munit_assert_int(runDu(concat3(L"-s -b \"", top, L"\""), &output), ==, EXIT_SUCCESS);
+    munit_assert_llong(wcstoll(output, NULL, 10), ==, TREE_DEPTH);
+    return MUNIT_OK;
+}
+
+static MunitResult testIndexDeepTree(const MunitParameter params[], void *fixture)
+{
+    UsageIndex *index;
+
+    displayBytes = true;
+    index = buildUsageIndex((const wchar_t *) fixture);
+    munit_assert_size(getUsageIndexEntryCount(index), ==, 2 * TREE_DEPTH);
+    munit_assert_llong(getIndexNodeSize(index, getIndexRoot(index)), ==, TREE_DEPTH);
+    return MUNIT_OK;
+}
+
+static MunitTest tests[] = {
+    { "/scanDeepTree", testScanDeepTree, setup, tearDown, MUNIT_TEST_OPTION_NONE, NULL },
+    { "/indexDeepTree", testIndexDeepTree, setup, tearDown, MUNIT_TEST_OPTION_NONE, NULL },
+    { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
+
+static const MunitSuite suite = {
+    "/deepTree",                /* name */
+    tests,                      /* tests */
+    NULL,                       /* suites */
+    1,                          /* iterations */
+    MUNIT_SUITE_OPTION_NONE     /* options */
+};
+
+int wmain(int argc, const wchar_t *argv[])
+{
+    return runTestSuite(&suite, argc, argv);
+}
@@ -0,0 +1,206 @@
+/*
+ * Scans a tree with a directory whose ACL lets no one list it, which the
+ * scan has to count as unknown, carrying on with the rest of the tree and
+ * exiting with 1 as GNU du does, and a file that another process holds
+ * open without sharing, whose size can still be read.
+ *
+ * Runs du.exe from the debug build for the scan.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <wchar.h>
+#include <windows.h>
+#include <gc.h>
+#include "munit.h"
+#include "test-helpers.h"
+#include "../../main/c/filename.h"
+#include "../../main/c/string.h"
+
+#define LINE_CAPACITY 1024
+#define MAX_LINES 16
+#define LOWER_BOUND_MARK L">="
+
+/* The file is held open for as long as the test runs. */
+struct Tree {
+    wchar_t *top;
+    HANDLE lockedFile;
+};
+
+struct Output {
+    wchar_t lines[MAX_LINES][LINE_CAPACITY];
+    int lineCount;
+};
+
+static void createDirectoryWithFile(const wchar_t *path)
+{
+    if (!CreateDirectory(path, NULL)) {
+        fail(L"Failed to create directory", path);
+    }
+    createFile(buildPath(path, L"f"), 1);
+}
+
+/* An empty ACL grants nothing to anyone, and a NULL one everything. The
+   owner can always change it back. */
+static void setAcl(const wchar_t *path, ACL *acl)
+{
+    SECURITY_DESCRIPTOR descriptor;
+
+    if (!InitializeSecurityDescriptor(&descriptor, SECURITY_DESCRIPTOR_REVISION)
+            || !SetSecurityDescriptorDacl(&descriptor, TRUE, acl, FALSE)
+            || !SetFileSecurity(path, DACL_SECURITY_INFORMATION, &descriptor)) {
+        fail(L"Failed to set the ACL of", path);
+    }
+}
+
+static void *setup(const MunitParameter params[], void *user_data)
+{
+    struct Tree *tree;
+    wchar_t *lockedPath;
+    ACL emptyAcl;
+
+    if ((tree = (struct Tree *) GC_MALLOC(sizeof(struct Tree))) == NULL) {
+        fail(L"Failed to allocate memory for", L"the test tree");
+    }
+    tree->top = makeTestTreeName(L"du-denied.");
+    if (!CreateDirectory(tree->top, NULL)) {
+        fail(L"Failed to create directory", tree->top);
+    }
+    createDirectoryWithFile(buildPath(tree->top, L"readable"));
+    createDirectoryWithFile(buildPath(tree->top, L"denied"));
+    createDirectoryWithFile(buildPath(tree->top, L"after"));
+    lockedPath = buildPath(tree->top, L"locked");
+    createFile(lockedPath, 1);
+    tree->lockedFile = CreateFile(lockedPath, GENERIC_READ, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (tree->lockedFile == INVALID_HANDLE_VALUE) {
+        fail(L"Failed to lock", lockedPath);
+    }
+    if (!InitializeAcl(&emptyAcl, sizeof(ACL), ACL_REVISION)) {
+        fail(L"Failed to make an ACL for", tree->top);
+    }
+    setAcl(buildPath(tree->top, L"denied"), &emptyAcl);
+    return tree;
+}
+
+static void removeDirectoryWithFile(const wchar_t *path)
+{
+    DeleteFile(buildPath(path, L"f"));
+    RemoveDirectory(path);
+}
+
+static void tearDown(void *fixture)
+{
+    struct Tree *tree = (struct Tree *) fixture;
+    wchar_t *deniedPath;
+
+    CloseHandle(tree->lockedFile);
+    DeleteFile(buildPath(tree->top, L"locked"));
+    deniedPath = buildPath(tree->top, L"denied");
+    setAcl(deniedPath, NULL);
+    removeDirectoryWithFile(deniedPath);
+    removeDirectoryWithFile(buildPath(tree->top, L"readable"));
+    removeDirectoryWithFile(buildPath(tree->top, L"after"));
+    RemoveDirectory(tree->top);
+}
+
+/* Keeps the lines du prints, without their line breaks. Its errors go to
+   the console. Returns its exit code. */
+static int runDuLines(const wchar_t *options, const wchar_t *top, struct Output *output)
+{
+    FILE *pipe;
+    wchar_t *line;
+
+    pipe = startDu(concat4(options, L" \"", top, L"\""));
+    output->lineCount = 0;
+    while (output->lineCount < MAX_LINES
+            && (line = fgetws(output->lines[output->lineCount], LINE_CAPACITY, pipe)) != NULL) {
+        line[wcscspn(line, L"\r\n")] = L'\0';
+        output->lineCount++;
+    }
+    return _pclose(pipe);
+}
+
+/* Returns the line for the entry whose path ends with the suffix. */
+static const wchar_t *findLine(const struct Output *output, const wchar_t *suffix)
+{
+    int i;
+
+    for (i = 0; i < output->lineCount; i++) {
+        if (endsWith(output->lines[i], suffix)) {
+            return output->lines[i];
+        }
+    }
+    return NULL;
+}
+
+static void assertKnown(const struct Output *output, const wchar_t *suffix)
+{
+    const wchar_t *line;
+
+    line = findLine(output, suffix);
+    munit_assert_not_null(line);
+    munit_assert_false(startsWith(line, LOWER_BOUND_MARK));
+}
+
+static void assertUnknown(const struct Output *output, const wchar_t *suffix)
+{
+    const wchar_t *line;
+
+    line = findLine(output, suffix);
+    munit_assert_not_null(line);
+    munit_assert_true(startsWith(line, LOWER_BOUND_MARK));
+}
+
+/* The allocated size of the locked file needs it to be opened, but only
+   for its attributes, which sharing does not keep from anyone. */
+static MunitResult testAllocatedSizes(const MunitParameter params[], void *fixture)
+{
+    struct Tree *tree = (struct Tree *) fixture;
+    struct Output output;
+
+    munit_assert_int(runDuLines(L"-a", tree->top, &output), ==, EXIT_FAILURE);
+    assertKnown(&output, L"\\readable\\f");
+    assertKnown(&output, L"\\after\\f");
+    assertKnown(&output, L"\\after");
+    assertKnown(&output, L"\\locked");
+    assertUnknown(&output, L"\\denied");
+    munit_assert_int(output.lineCount, >, 0);
+    munit_assert_true(startsWith(output.lines[output.lineCount - 1], LOWER_BOUND_MARK));
+    munit_assert_true(endsWith(output.lines[output.lineCount - 1], tree->top));
+    return MUNIT_OK;
+}
+
+/* With -b the size comes from the listing, so only the directory is
+   unknown. */
+static MunitResult testListedSizes(const MunitParameter params[], void *fixture)
+{
+    struct Tree *tree = (struct Tree *) fixture;
+    struct Output output;
+
+    munit_assert_int(runDuLines(L"-a -b", tree->top, &output), ==, EXIT_FAILURE);
+    assertKnown(&output, L"\\locked");
+    assertKnown(&output, L"\\after\\f");
+    assertUnknown(&output, L"\\denied");
+    munit_assert_int(output.lineCount, >, 0);
+    munit_assert_true(startsWith(output.lines[output.lineCount - 1], LOWER_BOUND_MARK L"3"));
+    return MUNIT_OK;
+}
+
+static MunitTest tests[] = {
+    { "/allocatedSizes", testAllocatedSizes, setup, tearDown, MUNIT_TEST_OPTION_NONE, NULL },
+    { "/listedSizes", testListedSizes, setup, tearDown, MUNIT_TEST_OPTION_NONE, NULL },
+    { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
+
+static const MunitSuite suite = {
+    "/deniedEntries",           /* name */
+    tests,                      /* tests */
+    NULL,                       /* suites */
+    1,                          /* iterations */
+    MUNIT_SUITE_OPTION_NONE     /* options */
+};
+
+int wmain(int argc, const wchar_t *argv[])
+{
+    return runTestSuite(&suite, argc, argv);
+}
@@ -0,0 +1,100 @@
+/*
+ * Builds a synthetic tree in a UsageIndex and reports how much memory
+ * each entry takes and how fast entries are added.
+ *
+ * Usage: index-benchmark [ENTRIES]     (default 10000000)
+ *
+ * The tree has 100 directories with 100 directories each, and the files
+ * are spread evenly over those 10,000 leaf directories. Most file names
+ * repeat from one directory to the next, as they do in real trees, and
+ * one in ten is unique.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <windows.h>
+#include <gc.h>
+#include "../../main/c/index.h"
+#include "../../main/c/error.h"
+
+#define DEFAULT_ENTRY_COUNT 10000000UL
+#define FANOUT 100
+#define NAME_CAPACITY 64
+#define BYTES_PER_MEGABYTE (1024.0 * 1024.0)
+
+static double getSeconds(const LARGE_INTEGER *start, const LARGE_INTEGER *end, const LARGE_INTEGER *frequency)
+{
+    return (double) (end->QuadPart - start->QuadPart) / (double) frequency->QuadPart;
+}
+
+int wmain(int argc, const wchar_t *argv[])
+{
+    UsageIndex *index;
+    IndexNode root;
+    IndexNode top;
+    IndexNode leaf;
+    wchar_t name[NAME_CAPACITY];
+    unsigned long entryCount = DEFAULT_ENTRY_COUNT;
+    unsigned long filesPerLeaf;
+    unsigned long uniqueName = 0;
+    unsigned long i;
+    unsigned long j;
+    unsigned long k;
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+    double seconds;
+    size_t entries;
+    size_t memoryUse;
+
+    GC_INIT();
+    programName = argv[0];
+    if (argc > 1) {
+        entryCount = wcstoul(argv[1], NULL, 10);
+    }
+    filesPerLeaf = entryCount / (FANOUT * FANOUT);
+    if (filesPerLeaf == 0) {
+        filesPerLeaf = 1;
+    }
+
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&start);
+    index = initUsageIndex(L"C:\\synthetic");
+    root = getIndexRoot(index);
+    for (i = 0; i < FANOUT; i++) {
+        _snwprintf(name, NAME_CAPACITY, L"project%03lu", i);
+        appendIndexChild(index, root, name, 0, true);
+    }
+    for (i = 0, top = root + 1; i < FANOUT; i++, top++) {
+        for (j = 0; j < FANOUT; j++) {
+            _snwprintf(name, NAME_CAPACITY, L"module%03lu", j);
+            appendIndexChild(index, top, name, 0, true);
+        }
+        for (j = 0; j < FANOUT; j++) {
+            leaf = (IndexNode) getUsageIndexEntryCount(index) - FANOUT + j;
+            for (k = 0; k < filesPerLeaf; k++) {
+                if (k % 10 == 9) {
+                    _snwprintf(name, NAME_CAPACITY, L"z%08lu.log", uniqueName++);
+                } else {
+                    _snwprintf(name, NAME_CAPACITY, L"file%06lu.dat", k);
+                }
+                appendIndexChild(index, leaf, name, (int64_t) (k * 4096 + 512), false);
+            }
+            finishIndexDirectory(index, leaf);
+        }
+        finishIndexDirectory(index, top);
+    }
+    finishIndexDirectory(index, root);
+    QueryPerformanceCounter(&end);
+
+    seconds = getSeconds(&start, &end, &frequency);
+    entries = getUsageIndexEntryCount(index);
+    memoryUse = getUsageIndexMemoryUse(index);
+    wprintf(L"entries:         %lu\n", (unsigned long) entries);
+    wprintf(L"memory:          %.1f MB\n", memoryUse / BYTES_PER_MEGABYTE);
+    wprintf(L"bytes per entry: %.1f\n", (double) memoryUse / entries);
+    wprintf(L"build time:      %.2f s\n", seconds);
+    wprintf(L"build rate:      %.0f entries/s\n", seconds > 0.0 ? entries / seconds : 0.0);
+    wprintf(L"total size:      %lld bytes\n", (long long) getIndexNodeSize(index, root));
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,150 @@
+/*
+ * Times a scan that visits a tree in directory order against one with
+ * --order=physical, each starting with nothing of the volume cached, so
+ * that the seeks --order=physical saves can be measured.
+ *
+ * Usage: order-benchmark DIRECTORY [RUNS]     (default 3 of each)
+ *
+ * DIRECTORY should be on a volume of its own on a disk that seeks, such
+ * as a VHD image on a hard disk, attached for the purpose. The volume is
+ * dismounted before every run, so that the run that follows mounts it
+ * afresh and reads everything from the disk. That needs administrator
+ * rights. The runs of the two orders take turns, and sizes are allocated
+ * sizes, which is where the order matters.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>     /* memset */
+#include <windows.h>
+#include <winioctl.h>
+#include <gc.h>
+#include "../../main/c/scan.h"
+#include "../../main/c/string.h"
+
+#define DEFAULT_RUN_COUNT 3UL
+#define VOLUME_NAME_CAPACITY 64
+
+static double getSeconds(const LARGE_INTEGER *start, const LARGE_INTEGER *end, const LARGE_INTEGER *frequency)
+{
+    return (double) (end->QuadPart - start->QuadPart) / (double) frequency->QuadPart;
+}
+
+static void fail(const wchar_t *message, const wchar_t *object)
+{
+    fwprintf(stderr, L"%ls: %ls: %ls: error %lu\n", programName, message, object, (unsigned long) GetLastError());
+    exit(EXIT_FAILURE);
+}
+
+/* The name of the volume without its last backslash, which is how the
+   volume itself rather than its root directory is opened. */
+static wchar_t *getVolumeDevice(const wchar_t *path)
+{
+    wchar_t mountPoint[MAX_PATH];
+    wchar_t volumeName[VOLUME_NAME_CAPACITY];
+    size_t length;
+
+    if (!GetVolumePathName(path, mountPoint, MAX_PATH)) {
+        fail(L"Failed to get the volume of", path);
+    }
+    if (!GetVolumeNameForVolumeMountPoint(mountPoint, volumeName, VOLUME_NAME_CAPACITY)) {
+        fail(L"Failed to get the volume name of", mountPoint);
+    }
+    length = wcslen(volumeName);
+    if (length > 0 && volumeName[length - 1] == L'\\') {
+        volumeName[length - 1] = L'\0';
+    }
+    return createStringCopy(volumeName);
+}
+
+/* Makes the file system let go of the volume and all it has cached of
+   it. The next open of a file on it mounts it again. */
+static void dismountVolume(const wchar_t *volume)
+{
+    HANDLE handle;
+    DWORD returned;
+
+    handle = CreateFile(volume, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                        NULL, OPEN_EXISTING, 0, NULL);
+    if (handle == INVALID_HANDLE_VALUE) {
+        fail(L"Failed to open volume", volume);
+    }
+    if (!DeviceIoControl(handle, FSCTL_DISMOUNT_VOLUME, NULL, 0, NULL, 0, &returned, NULL)) {
+        fail(L"Failed to dismount volume", volume);
+    }
+    CloseHandle(handle);
+}
+
+static double timeScan(const wchar_t *path, const wchar_t *volume, bool isPhysical,
+        const LARGE_INTEGER *frequency)
+{
+    ScanContext *scan;
+    struct ScanOptions options;
+    struct ScanCallbacks callbacks;
+    struct Usage total;
+    enum ScanResult result;
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+    double seconds;
+
+    options.size = TALLY_ALLOCATED_SIZE;
+    options.byAge = false;
+    options.dereference = false;
+    options.oneFileSystem = false;
+    options.isPhysicalOrder = isPhysical;
+    options.excludes = NULL;
+    options.includes = NULL;
+    options.deadline = NULL;
+    options.visitsFiles = false;
+    options.visited = NULL;
+    options.breakdowns = NULL;
+    options.checkpointSeconds = 0;
+    options.selectDepth = 0;
+    options.programName = NULL;
+    memset(&callbacks, 0, sizeof(callbacks));
+    dismountVolume(volume);
+    if ((scan = initScanContext(&options, &callbacks)) == NULL) {
+        fail(L"Failed to allocate memory for scan of", path);
+    }
+    QueryPerformanceCounter(&start);
+    result = scanTree(scan, path, &total);
+    QueryPerformanceCounter(&end);
+    seconds = getSeconds(&start, &end, frequency);
+    wprintf(L"%-18ls %8.2f s  (total %lld%ls)\n", isPhysical ? L"physical order" : L"directory order",
+            seconds, (long long) total.size, result == SCAN_COMPLETE ? L"" : L", not complete");
+    return seconds;
+}
+
+int wmain(int argc, const wchar_t *argv[])
+{
+    unsigned long runCount = DEFAULT_RUN_COUNT;
+    const wchar_t *path;
+    wchar_t *volume;
+    LARGE_INTEGER frequency;
+    double directorySeconds = 0.0;
+    double physicalSeconds = 0.0;
+    unsigned long i;
+
+    GC_INIT();
+    programName = argv[0];
+    if (argc < 2) {
+        fwprintf(stderr, L"Usage: %ls DIRECTORY [RUNS]\n", programName);
+        return EXIT_FAILURE;
+    }
+    path = argv[1];
+    if (argc > 2) {
+        runCount = wcstoul(argv[2], NULL, 10);
+    }
+    volume = getVolumeDevice(path);
+    QueryPerformanceFrequency(&frequency);
+    for (i = 0; i < runCount; i++) {
+        directorySeconds += timeScan(path, volume, false, &frequency);
+        physicalSeconds += timeScan(path, volume, true, &frequency);
+    }
+    if (runCount > 0) {
+        wprintf(L"mean: directory order %.2f s, physical order %.2f s (%.0f%% of directory order)\n",
+                directorySeconds / runCount, physicalSeconds / runCount,
+                directorySeconds > 0.0 ? 100.0 * physicalSeconds / directorySeconds : 0.0);
+    }
+    return EXIT_SUCCESS;
+}
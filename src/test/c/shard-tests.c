@@ -0,0 +1,134 @@
+/*
+ * Scans one tree with N shards running at the same time, merges their
+ * partial results, and compares what --merge prints with what a single
+ * run prints, for several options, numbers of shards and split depths.
+ *
+ * Runs du.exe from the debug build for the scans.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <wchar.h>
+#include <windows.h>
+#include "munit.h"
+#include "test-helpers.h"
+#include "../../main/c/string.h"
+
+#define LINE_CAPACITY 1024
+#define MAX_SHARDS 5
+
+static const wchar_t *optionSets[] = {
+    L"",
+    L"-a",
+    L"-s",
+    L"-a -b --time",
+    L"-a --inodes",
+    L"--by-age=1d,30d",
+    NULL
+};
+
+static void *setup(const MunitParameter params[], void *user_data)
+{
+    return createTestTree(L"du-shard.");
+}
+
+static wchar_t *getPartialPath(const wchar_t *top, unsigned long shard)
+{
+    wchar_t suffix[16];
+
+    _snwprintf(suffix, sizeof(suffix) / sizeof(suffix[0]), L".part%lu", shard);
+    return concat(top, suffix);
+}
+
+/* The shards run at the same time, as they would on several machines. */
+static int runShardsAndMerge(const wchar_t *options, const wchar_t *top, unsigned long shardCount,
+        unsigned long splitDepth, wchar_t **text)
+{
+    FILE *shards[MAX_SHARDS];
+    wchar_t arguments[LINE_CAPACITY];
+    wchar_t *partialPaths = L"";
+    wchar_t *shardOutput;
+    unsigned long i;
+    int exitCode;
+
+    for (i = 0; i < shardCount; i++) {
+        _snwprintf(arguments, LINE_CAPACITY, L"%ls --shard=%lu/%lu --split-depth=%lu \"--partial=%ls\" \"%ls\"",
+                options, i + 1, shardCount, splitDepth, getPartialPath(top, i), top);
+        shards[i] = startDu(arguments);
+        partialPaths = concat4(partialPaths, L" \"", getPartialPath(top, i), L"\"");
+    }
+    for (i = 0; i < shardCount; i++) {
+        munit_assert_int(finishDu(shards[i], &shardOutput), ==, EXIT_SUCCESS);
+        munit_assert_string_equal(convertToUtf8(shardOutput), "");
+    }
+    exitCode = finishDu(startDu(concat(L"--merge", partialPaths)), text);
+    for (i = 0; i < shardCount; i++) {
+        DeleteFile(getPartialPath(top, i));
+    }
+    return exitCode;
+}
+
+static MunitResult testMergeIsSingleRun(const MunitParameter params[], void *fixture)
+{
+    const wchar_t *top = (const wchar_t *) fixture;
+    const wchar_t **options;
+    wchar_t arguments[LINE_CAPACITY];
+    wchar_t *single;
+    wchar_t *merged;
+    unsigned long shardCount;
+    unsigned long splitDepth;
+
+    for (options = optionSets; *options != NULL; options++) {
+        _snwprintf(arguments, LINE_CAPACITY, L"%ls \"%ls\"", *options, top);
+        munit_assert_int(finishDu(startDu(arguments), &single), ==, EXIT_SUCCESS);
+        for (shardCount = 1; shardCount <= MAX_SHARDS; shardCount += 2) {
+            for (splitDepth = 1; splitDepth <= 3; splitDepth++) {
+                munit_assert_int(runShardsAndMerge(*options, top, shardCount, splitDepth, &merged), ==, EXIT_SUCCESS);
+                munit_assert_string_equal(convertToUtf8(merged), convertToUtf8(single));
+            }
+        }
+    }
+    return MUNIT_OK;
+}
+
+/* Without the file of every shard there is nothing to print. */
+static MunitResult testMissingShard(const MunitParameter params[], void *fixture)
+{
+    const wchar_t *top = (const wchar_t *) fixture;
+    wchar_t arguments[LINE_CAPACITY];
+    wchar_t *shardOutput;
+    wchar_t *merged;
+    unsigned long i;
+
+    for (i = 0; i < 2; i++) {
+        _snwprintf(arguments, LINE_CAPACITY, L"--shard=%lu/3 \"--partial=%ls\" \"%ls\"",
+                i + 1, getPartialPath(top, i), top);
+        munit_assert_int(finishDu(startDu(arguments), &shardOutput), ==, EXIT_SUCCESS);
+    }
+    _snwprintf(arguments, LINE_CAPACITY, L"--merge \"%ls\" \"%ls\"", getPartialPath(top, 0), getPartialPath(top, 1));
+    munit_assert_int(finishDu(startDu(arguments), &merged), ==, EXIT_FAILURE);
+    munit_assert_string_equal(convertToUtf8(merged), "");
+    for (i = 0; i < 2; i++) {
+        DeleteFile(getPartialPath(top, i));
+    }
+    return MUNIT_OK;
+}
+
+static MunitTest tests[] = {
+    { "/mergeIsSingleRun", testMergeIsSingleRun, setup, removeTestTree, MUNIT_TEST_OPTION_NONE, NULL },
+    { "/missingShard", testMissingShard, setup, removeTestTree, MUNIT_TEST_OPTION_NONE, NULL },
+    { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
+
+static const MunitSuite suite = {
+    "/shard",                   /* name */
+    tests,                      /* tests */
+    NULL,                       /* suites */
+    1,                          /* iterations */
+    MUNIT_SUITE_OPTION_NONE     /* options */
+};
+
+int wmain(int argc, const wchar_t *argv[])
+{
+    return runTestSuite(&suite, argc, argv);
+}
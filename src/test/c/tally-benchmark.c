@@ -0,0 +1,140 @@
+/*
+ * Times each version of the file tally, and each size format, on entries
+ * held in memory, so that only the loops themselves are measured.
+ *
+ * Usage: tally-benchmark [BATCHES]     (default 100000)
+ *
+ * A batch has 128 entries, one in eight of them a directory. Allocated
+ * sizes are filled in beforehand, as --order=physical does, so that no
+ * file is opened. The files were written a month apart, from early 2016
+ * on, so that they fall into every bucket of the default --by-age.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include <gc.h>
+#include "../../main/c/tally.h"
+#include "../../main/c/age.h"
+#include "../../main/c/format.h"
+#include "../../main/c/args.h"
+#include "../../main/c/error.h"
+
+#define DEFAULT_BATCH_COUNT 100000UL
+#define BATCH_SIZE 128
+#define NAME_CAPACITY 64
+#define FORMAT_COUNT 1000000UL
+#define FIRST_WRITE_TIME 131000000000000000ULL
+#define FILE_TIME_UNITS_PER_MONTH (30ULL * 24 * 60 * 60 * 10000000)
+
+static struct FileEntry entries[BATCH_SIZE];
+
+/* The buckets of --by-age with its default boundaries, 1y,3y,5y. */
+static const unsigned long boundaryDays[] = { 365, 3 * 365, 5 * 365 };
+
+static double getSeconds(const LARGE_INTEGER *start, const LARGE_INTEGER *end, const LARGE_INTEGER *frequency)
+{
+    return (double) (end->QuadPart - start->QuadPart) / (double) frequency->QuadPart;
+}
+
+static void fillBatch()
+{
+    wchar_t name[NAME_CAPACITY];
+    int i;
+
+    for (i = 0; i < BATCH_SIZE; i++) {
+        _snwprintf(name, NAME_CAPACITY, i % 8 == 7 ? L"C:\\bench\\dir%03d" : L"C:\\bench\\file%03d.dat", i);
+        entries[i].path = createStringCopy(name);
+        entries[i].type = i % 8 == 7 ? FILETYPE_DIRECTORY : FILETYPE_FILE;
+        entries[i].size = (int64_t) i * 4096 + 512;
+        entries[i].allocatedSize = (int64_t) (i + 1) * 4096;
+        entries[i].lastWriteTime = FIRST_WRITE_TIME + (uint64_t) i * FILE_TIME_UNITS_PER_MONTH;
+        entries[i].id.volumeSerialNumber = 0;
+        entries[i].id.fileIndex = 0;
+    }
+}
+
+static void timeTally(const wchar_t *name, enum TallySize size, bool hasBreakdowns, bool byAge,
+        unsigned long batchCount, const LARGE_INTEGER *frequency)
+{
+    FileTally tally;
+    struct Usage usage;
+    struct Histogram histogram;
+    struct Breakdowns breakdowns;
+    struct ListingOptions listing;
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+    double seconds;
+    unsigned long i;
+
+    initUsage(&usage);
+    initHistogram(&histogram);
+    breakdowns.histogram = hasBreakdowns ? &histogram : NULL;
+    breakdowns.extensions = hasBreakdowns ? initExtensionTable() : NULL;
+    breakdowns.owners = NULL;
+    /* No deadline, and nothing to follow, since no file is opened. */
+    memset(&listing, 0, sizeof(listing));
+    tally = getFileTally(size, hasBreakdowns, byAge);
+    QueryPerformanceCounter(&start);
+    for (i = 0; i < batchCount; i++) {
+        tally(&usage, entries, BATCH_SIZE, &breakdowns, &listing);
+    }
+    QueryPerformanceCounter(&end);
+    seconds = getSeconds(&start, &end, frequency);
+    wprintf(L"%-32ls %8.2f ns/entry  (total %lld)\n", name,
+            seconds * 1e9 / ((double) batchCount * BATCH_SIZE), (long long) usage.size);
+}
+
+static void timeFormat(const wchar_t *name, const LARGE_INTEGER *frequency)
+{
+    wchar_t text[SIZE_TEXT_CAPACITY];
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+    double seconds;
+    unsigned long i;
+
+    QueryPerformanceCounter(&start);
+    for (i = 0; i < FORMAT_COUNT; i++) {
+        formatFileSize((int64_t) i * 7919, text, SIZE_TEXT_CAPACITY);
+    }
+    QueryPerformanceCounter(&end);
+    seconds = getSeconds(&start, &end, frequency);
+    wprintf(L"%-32ls %8.2f ns/size\n", name, seconds * 1e9 / FORMAT_COUNT);
+}
+
+int wmain(int argc, const wchar_t *argv[])
+{
+    unsigned long batchCount = DEFAULT_BATCH_COUNT;
+    LARGE_INTEGER frequency;
+
+    GC_INIT();
+    programName = argv[0];
+    if (argc > 1) {
+        batchCount = wcstoul(argv[1], NULL, 10);
+    }
+    QueryPerformanceFrequency(&frequency);
+    fillBatch();
+    initAgeBuckets(boundaryDays, sizeof(boundaryDays) / sizeof(boundaryDays[0]));
+
+    timeTally(L"counts only", TALLY_COUNT_ONLY, false, false, batchCount, &frequency);
+    timeTally(L"listed sizes", TALLY_LISTED_SIZE, false, false, batchCount, &frequency);
+    timeTally(L"allocated sizes", TALLY_ALLOCATED_SIZE, false, false, batchCount, &frequency);
+    timeTally(L"listed sizes with breakdowns", TALLY_LISTED_SIZE, true, false, batchCount, &frequency);
+    timeTally(L"allocated sizes with breakdowns", TALLY_ALLOCATED_SIZE, true, false, batchCount, &frequency);
+    /* As with --by-age alone, no tables but the age buckets. */
+    timeTally(L"listed sizes by age", TALLY_LISTED_SIZE, false, true, batchCount, &frequency);
+    timeTally(L"allocated sizes by age", TALLY_ALLOCATED_SIZE, false, true, batchCount, &frequency);
+
+    /* Before chooseSizeFormat every size tests -h and -b. */
+    timeFormat(L"format, options tested", &frequency);
+    chooseSizeFormat();
+    timeFormat(L"format, kilobytes", &frequency);
+    displayBytes = true;
+    chooseSizeFormat();
+    timeFormat(L"format, bytes", &frequency);
+    humanReadable = true;
+    chooseSizeFormat();
+    timeFormat(L"format, human readable", &frequency);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <windows.h>
+#include <gc.h>
+#include "munit.h"
+#include "test-helpers.h"
+#include "../../main/c/error.h"
+#include "../../main/c/filename.h"
+#include "../../main/c/string.h"
+
+#define BRANCH_COUNT 3
+#define TREE_DEPTH 3
+#define DATA_CAPACITY 64
+#define LINE_CAPACITY 1024
+
+static void createLevel(const wchar_t *path, int depth);
+static void removeLevel(const wchar_t *path, int depth);
+
+void fail(const wchar_t *message, const wchar_t *path)
+{
+    fwprintf(stderr, L"%ls: %ls: error %lu\n", message, path, (unsigned long) GetLastError());
+    exit(EXIT_FAILURE);
+}
+
+/* Its bytes are all x. */
+void createFile(const wchar_t *path, DWORD size)
+{
+    HANDLE file;
+    DWORD wanted;
+    DWORD written;
+    char data[DATA_CAPACITY];
+
+    memset(data, 'x', sizeof(data));
+    file = CreateFile(path, GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        fail(L"Failed to create file", path);
+    }
+    while (size > 0) {
+        wanted = size < DATA_CAPACITY ? size : DATA_CAPACITY;
+        if (!WriteFile(file, data, wanted, &written, NULL) || written != wanted) {
+            fail(L"Failed to write file", path);
+        }
+        size -= written;
+    }
+    CloseHandle(file);
+}
+
+wchar_t *buildNumberedPath(const wchar_t *directory, const wchar_t *prefix, int number)
+{
+    wchar_t name[16];
+
+    _snwprintf(name, sizeof(name) / sizeof(name[0]), L"%ls%d", prefix, number);
+    return buildPath(directory, name);
+}
+
+/* A path in the temporary directory that nothing has yet. */
+wchar_t *makeTestTreeName(const wchar_t *prefix)
+{
+    wchar_t *temporaryName;
+    wchar_t *name;
+
+    if ((temporaryName = _wtempnam(NULL, prefix)) == NULL) {
+        fail(L"Failed to make a name for the test tree", prefix);
+    }
+    name = createStringCopy(temporaryName);
+    free(temporaryName);
+    return name;
+}
+
+wchar_t *createTestTree(const wchar_t *prefix)
+{
+    wchar_t *top;
+
+    top = makeTestTreeName(prefix);
+    createLevel(top, 0);
+    return top;
+}
+
+void removeTestTree(void *fixture)
+{
+    removeLevel((const wchar_t *) fixture, 0);
+}
+
+/* Each level holds files of different sizes and directories that hold
+   the same again, down to the last level. */
+static void createLevel(const wchar_t *path, int depth)
+{
+    int i;
+
+    if (!CreateDirectory(path, NULL)) {
+        fail(L"Failed to create directory", path);
+    }
+    for (i = 0; i < BRANCH_COUNT; i++) {
+        createFile(buildNumberedPath(path, L"f", i), (DWORD) (depth * BRANCH_COUNT + i + 1));
+        if (depth < TREE_DEPTH - 1) {
+            createLevel(buildNumberedPath(path, L"d", i), depth + 1);
+        }
+    }
+}
+
+static void removeLevel(const wchar_t *path, int depth)
+{
+    int i;
+
+    for (i = 0; i < BRANCH_COUNT; i++) {
+        DeleteFile(buildNumberedPath(path, L"f", i));
+        if (depth < TREE_DEPTH - 1) {
+            removeLevel(buildNumberedPath(path, L"d", i), depth + 1);
+        }
+    }
+    RemoveDirectory(path);
+}
+
+FILE *startDu(const wchar_t *arguments)
+{
+    wchar_t *command;
+    FILE *pipe;
+
+    /* cmd.exe drops the outermost quotes, so the whole command is quoted. */
+    command = concat3(L"\"\"" DU_PROGRAM L"\" ", arguments, L"\"");
+    if ((pipe = _wpopen(command, L"rt")) == NULL) {
+        fail(L"Failed to run", command);
+    }
+    return pipe;
+}
+
+int finishDu(FILE *pipe, wchar_t **text)
+{
+    wchar_t line[LINE_CAPACITY];
+
+    *text = L"";
+    while (fgetws(line, LINE_CAPACITY, pipe) != NULL) {
+        *text = concat(*text, line);
+    }
+    return _pclose(pipe);
+}
+
+int runDu(const wchar_t *arguments, wchar_t **text)
+{
+    return finishDu(startDu(arguments), text);
+}
+
+int runTestSuite(const MunitSuite *suite, int argc, const wchar_t *argv[])
+{
+    GC_INIT();
+    programName = argv[0];
+    return munit_suite_main(suite, NULL, argc, convertAllToUtf8(argc, argv));
+}
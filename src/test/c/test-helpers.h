@@ -0,0 +1,33 @@
+#ifndef TEST_HELPERS_H_EDCRFV
+#define TEST_HELPERS_H_EDCRFV
+
+#include <stdio.h>
+#include <wchar.h>
+#include <windows.h>
+#include "munit.h"
+
+#define DU_PROGRAM L"..\\..\\main\\c\\Debug\\du.exe"
+
+/* What the tests have in common: making trees to scan, running du.exe
+   from the debug build on them, and the wmain of a test program. A
+   helper that fails ends the test program. */
+extern void fail(const wchar_t *message, const wchar_t *path);
+extern void createFile(const wchar_t *path, DWORD size);
+extern wchar_t *buildNumberedPath(const wchar_t *directory, const wchar_t *prefix, int number);
+extern wchar_t *makeTestTreeName(const wchar_t *prefix);
+
+/* A small tree of numbered files and directories, three levels deep,
+   whose files all differ in size. removeTestTree is a munit tear down. */
+extern wchar_t *createTestTree(const wchar_t *prefix);
+extern void removeTestTree(void *fixture);
+
+/* startDu runs du.exe with the arguments, whose paths the caller has to
+   quote, and finishDu keeps all it prints in text and returns its exit
+   code. Its errors go to the console. */
+extern FILE *startDu(const wchar_t *arguments);
+extern int finishDu(FILE *pipe, wchar_t **text);
+extern int runDu(const wchar_t *arguments, wchar_t **text);
+
+extern int runTestSuite(const MunitSuite *suite, int argc, const wchar_t *argv[]);
+
+#endif
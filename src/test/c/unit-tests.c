@@ -5,10 +5,10 @@
 #include "../../main/c/filename.h"
 #include "../../main/c/args.h"
 #include "../../main/c/string.h"
+#include "../../main/c/error.h"
 
 #pragma warning(disable:4996) /* _CRT_SECURE_NO_WARNINGS */
 
-const TCHAR *programName;
 TCHAR *cwd;
 TCHAR *testDirName;
 TCHAR *testFileName1;